@@ -54,6 +54,7 @@ enum config_setup_keyword {
 	KSF_OCSP_URI,
 	KSF_OCSP_TRUSTNAME,
 	KSF_EXPIRE_SHUNT_INTERVAL,
+	KSF_UPDOWN_COPROCESS,
 
 	/*
 	 * By convention, these are global configuration numeric (and
@@ -70,6 +71,8 @@ enum config_setup_keyword {
 	KYN_AUDIT_LOG,
 	KBF_IKE_SOCKET_BUFSIZE,
 	KYN_IKE_SOCKET_ERRQUEUE,
+	KBF_IKE_SOCKET_BATCH,
+	KYN_IKE_SOCKET_SEND_BATCH,
 	KBF_EXPIRE_LIFETIME,
 	KYN_CRL_STRICT,
 	KBF_CRL_CHECKINTERVAL,
@@ -85,9 +88,15 @@ enum config_setup_keyword {
 	KYN_DROP_OPPO_NULL,
 	KBF_KEEP_ALIVE,
 	KBF_NHELPERS,
+	KBF_OFFLOAD_DECRYPT_THRESHOLD,
+	KBF_UPDOWN_CONCURRENCY,
 	KBF_SHUNTLIFETIME,
+	KBF_TRAFFIC_CACHE_TIME,
 	KBF_DDOS_IKE_THRESHOLD,
 	KBF_MAX_HALFOPEN_IKE,
+	KBF_DDOS_PREFIX_TABLE_SIZE,
+	KBF_DDOS_PREFIX_RATE,
+	KBF_DDOS_PREFIX_BURST,
 	KBF_NFLOG_ALL,		/* Enable global nflog device */
 	KBF_DDOS_MODE,		/* set DDOS mode */
 	KBF_SECCOMP,		/* set SECCOMP mode */
@@ -0,0 +1,86 @@
+/* keyed hash for hash tables, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef HASH_BYTES_H
+#define HASH_BYTES_H
+
+#include <stdint.h>		/* for uint8_t */
+#include <stddef.h>		/* for size_t */
+
+#include "shunk.h"		/* for THING_AS_SHUNK() */
+
+/*
+ * Hash values used to select a hash table bucket.
+ *
+ * The hash is keyed (SipHash-1-3, 8 bytes per step) so that a peer
+ * choosing, for instance, IKE SPIs can't predict which bucket they
+ * land in.  The key must be set, using init_hash_key(), before the
+ * first value is hashed and then left alone (changing it would
+ * scramble every table).  Until then the key is all zeros.
+ *
+ * Hashes can be chained by passing the result of one call in as the
+ * HASH of the next; start with zero_hash.
+ */
+
+typedef struct { unsigned hash; } hash_t;
+extern const hash_t zero_hash;
+
+struct hash_key {
+	uint8_t bytes[16];
+};
+
+void init_hash_key(const struct hash_key *key);
+
+hash_t hash_bytes(const void *ptr, size_t len, hash_t hash);
+
+#define hash_hunk(HUNK, HASH)						\
+	({								\
+		typeof(HUNK) h_ = HUNK; /* evaluate once */		\
+		hash_bytes(h_.ptr, h_.len, HASH);			\
+	})
+#define hash_thing(THING, HASH)						\
+	({								\
+		shunk_t h_ = THING_AS_SHUNK(THING); /* evaluate once */	\
+		hash_bytes(h_.ptr, h_.len, HASH);			\
+	})
+
+/*
+ * Unkeyed hash for values that pluto assigns itself, such as serial
+ * numbers and PIDs.  A peer can't choose these so there's nothing to
+ * defend against, and they are hashed on every state lookup; this
+ * costs about half of hash_bytes().
+ */
+
+hash_t hash_unkeyed_bytes(const void *ptr, size_t len, hash_t hash);
+
+#define hash_unkeyed_thing(THING, HASH)					\
+	({								\
+		shunk_t h_ = THING_AS_SHUNK(THING); /* evaluate once */	\
+		hash_unkeyed_bytes(h_.ptr, h_.len, HASH);		\
+	})
+
+/*
+ * Keyed MAC (SipHash-2-4, 128-bit output) of a short message, for
+ * instance an IKEv2 cookie.
+ *
+ * Unlike hash_bytes(), the caller supplies the key and the result
+ * doesn't depend on the host's byte order.
+ */
+
+struct mac_128 {
+	uint8_t bytes[16];
+};
+
+struct mac_128 mac_bytes(const struct hash_key *key, const void *ptr, size_t len);
+
+#endif
@@ -61,6 +61,9 @@
 # define STRFTIME_LIKE(n) __attribute__ ((format(strftime, n, 0)))
 #endif
 
+/* when the caller's constant arguments are expected to fold the body */
+#define ALWAYS_INLINE inline __attribute__ ((always_inline))
+
 /*
  * A macro to iterate over a list-like structure.
  */
@@ -192,7 +192,12 @@ enum global_timer {
 	EVENT_RESET_LOG_LIMITER,	/* set rate limited log message count back to 0 */
 #define RESET_LOG_LIMITER_FREQUENCY	deltatime(secs_per_hour)
 
-#define GLOBAL_TIMER_ROOF (EVENT_RESET_LOG_LIMITER+1)
+	EVENT_REHASH_HASH_TABLES,	/* drain buckets of resized hash tables */
+	EVENT_FLUSH_UDP_SEND_QUEUES,	/* send datagrams queued by this event */
+	EVENT_STATE_EVENT_WHEEL,	/* run due state events */
+	EVENT_TRAFFIC_PROBE_SWEEP,	/* drop traffic dump shared by probes */
+
+#define GLOBAL_TIMER_ROOF (EVENT_TRAFFIC_PROBE_SWEEP+1)
 };
 
 /*
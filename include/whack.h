@@ -111,6 +111,7 @@ enum whack_command {
 	WHACK_DOWN_CHILD,
 	/**/
 	WHACK_DDOS,
+	WHACK_DDOSSTATUS,
 	WHACK_LIST,
 	WHACK_CHECKPUBKEYS,
 	/**/
@@ -124,6 +125,8 @@ enum whack_command {
 	/**/
 	WHACK_LISTEN,
 	WHACK_UNLISTEN,
+	/**/
+	WHACK_BULK_ADD,
 };
 
 /*
@@ -527,6 +530,32 @@ int whack_send_msg(struct whack_message *msg, const char *ctlsocket,
 		   int usernamelen, int xauthpasslen,
 		   struct logger *logger);
 
+/*
+ * Bulk add: load many connections using a single session.
+ *
+ * The session starts with a header message (.whack_command ==
+ * WHACK_BULK_ADD) padded out to sizeof(struct whack_message).  It is
+ * followed by a stream of records, each being a uint32_t length (in
+ * native byte order) and then that many bytes of a packed WHACK_ADD
+ * message.  A zero length terminates the stream.
+ *
+ * Pluto validates each record and adds the connections, with
+ * "ipsec add" semantics, in batches.  Only errors, one per failed
+ * connection, and a final summary are sent back.
+ *
+ * Since pluto's replies can arrive while records are still being
+ * sent, whack_bulk_add() drains them as it goes.
+ */
+
+#define WHACK_BULK_BATCH 64
+
+struct whack_bulk;
+
+struct whack_bulk *whack_bulk_open(const char *ctlsocket, struct logger *logger);
+int whack_bulk_add(struct whack_bulk *bulk, struct whack_message *msg,
+		   struct logger *logger);
+int whack_bulk_close(struct whack_bulk **bulk, struct logger *logger);
+
 extern bool lsw_alias_cmp(const char *name, const char *aliases);
 
 extern unsigned whack_magic(void);
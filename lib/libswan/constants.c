@@ -2414,6 +2414,10 @@ static const char *global_timer_name[] = {
 	S(EVENT_CHECK_CRLS),
 	S(EVENT_FREE_ROOT_CERTS),
 	S(EVENT_RESET_LOG_LIMITER),
+	S(EVENT_REHASH_HASH_TABLES),
+	S(EVENT_FLUSH_UDP_SEND_QUEUES),
+	S(EVENT_STATE_EVENT_WHEEL),
+	S(EVENT_TRAFFIC_PROBE_SWEEP),
 #undef S
 };
 const struct enum_names global_timer_names = {
@@ -0,0 +1,167 @@
+/* keyed hash for hash tables, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <string.h>		/* for memcpy() */
+
+#include "hash_bytes.h"
+
+const hash_t zero_hash = { 0 };
+
+/*
+ * SipHash-1-3 (one compression round per 8-byte word, three
+ * finalization rounds); see "SipHash: a fast short-input PRF",
+ * Aumasson and Bernstein.
+ *
+ * Words are loaded in host byte order; the result only needs to be
+ * consistent within a single pluto.
+ */
+
+static uint64_t k0, k1;
+
+void init_hash_key(const struct hash_key *key)
+{
+	memcpy(&k0, key->bytes + 0, sizeof(k0));
+	memcpy(&k1, key->bytes + 8, sizeof(k1));
+}
+
+#define ROTL(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+
+#define SIPROUND(V0, V1, V2, V3)					\
+	{								\
+		V0 += V1; V1 = ROTL(V1, 13); V1 ^= V0; V0 = ROTL(V0, 32); \
+		V2 += V3; V3 = ROTL(V3, 16); V3 ^= V2;			\
+		V0 += V3; V3 = ROTL(V3, 21); V3 ^= V0;			\
+		V2 += V1; V1 = ROTL(V1, 17); V1 ^= V2; V2 = ROTL(V2, 32); \
+	}
+
+hash_t hash_bytes(const void *ptr, size_t len, hash_t hash)
+{
+	uint64_t v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+	/* chain in the previous hash */
+	uint64_t v1 = k1 ^ UINT64_C(0x646f72616e646f6d) ^ hash.hash;
+	uint64_t v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = k1 ^ UINT64_C(0x7465646279746573);
+
+	const uint8_t *bytes = ptr;
+	const uint8_t *end = bytes + (len & ~(size_t)7);
+	for (; bytes < end; bytes += 8) {
+		uint64_t m;
+		memcpy(&m, bytes, sizeof(m));
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	/* the last 0..7 bytes, and the length */
+	uint64_t b = ((uint64_t)len) << 56;
+	switch (len & 7) {
+	case 7: b |= ((uint64_t)bytes[6]) << 48; /* fall through */
+	case 6: b |= ((uint64_t)bytes[5]) << 40; /* fall through */
+	case 5: b |= ((uint64_t)bytes[4]) << 32; /* fall through */
+	case 4: b |= ((uint64_t)bytes[3]) << 24; /* fall through */
+	case 3: b |= ((uint64_t)bytes[2]) << 16; /* fall through */
+	case 2: b |= ((uint64_t)bytes[1]) << 8; /* fall through */
+	case 1: b |= ((uint64_t)bytes[0]); break;
+	case 0: break;
+	}
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+
+	uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+	return (hash_t) { (unsigned)(h ^ (h >> 32)), };
+}
+
+/*
+ * 251 is a prime close to 256 (so like <<8).
+ */
+
+hash_t hash_unkeyed_bytes(const void *ptr, size_t len, hash_t hash)
+{
+	const uint8_t *bytes = ptr;
+	for (unsigned j = 0; j < len; j++) {
+		hash.hash = hash.hash * 251 + bytes[j];
+	}
+	return hash;
+}
+
+/*
+ * SipHash-2-4 with 128-bit output; words are loaded little-endian
+ * so that the reference test vectors apply.
+ */
+
+static uint64_t load_le64(const uint8_t *bytes)
+{
+	uint64_t w = 0;
+	for (int i = 7; i >= 0; i--) {
+		w = (w << 8) | bytes[i];
+	}
+	return w;
+}
+
+static void store_le64(uint8_t *bytes, uint64_t w)
+{
+	for (unsigned i = 0; i < 8; i++) {
+		bytes[i] = w >> (i * 8);
+	}
+}
+
+struct mac_128 mac_bytes(const struct hash_key *key, const void *ptr, size_t len)
+{
+	uint64_t mk0 = load_le64(key->bytes + 0);
+	uint64_t mk1 = load_le64(key->bytes + 8);
+	uint64_t v0 = mk0 ^ UINT64_C(0x736f6d6570736575);
+	uint64_t v1 = mk1 ^ UINT64_C(0x646f72616e646f6d) ^ 0xee;
+	uint64_t v2 = mk0 ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = mk1 ^ UINT64_C(0x7465646279746573);
+
+	const uint8_t *bytes = ptr;
+	const uint8_t *end = bytes + (len & ~(size_t)7);
+	for (; bytes < end; bytes += 8) {
+		uint64_t m = load_le64(bytes);
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	/* the last 0..7 bytes, and the length */
+	uint64_t b = ((uint64_t)len) << 56;
+	for (unsigned i = 0; i < (len & 7); i++) {
+		b |= ((uint64_t)bytes[i]) << (i * 8);
+	}
+	v3 ^= b;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	struct mac_128 mac;
+	v2 ^= 0xee;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	store_le64(mac.bytes + 0, v0 ^ v1 ^ v2 ^ v3);
+	v1 ^= 0xdd;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	store_le64(mac.bytes + 8, v0 ^ v1 ^ v2 ^ v3);
+	return mac;
+}
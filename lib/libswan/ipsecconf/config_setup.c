@@ -91,10 +91,14 @@ const struct config_setup *config_setup_singleton(void)
 		 */
 
 		update_setup_option(KBF_NHELPERS, -1);
+		update_setup_option(KBF_OFFLOAD_DECRYPT_THRESHOLD, 0); /* disabled */
 
 		update_setup_option(KBF_DDOS_MODE, DDOS_AUTO);
 		update_setup_option(KBF_DDOS_IKE_THRESHOLD, DEFAULT_IKE_SA_DDOS_THRESHOLD);
 		update_setup_option(KBF_MAX_HALFOPEN_IKE, DEFAULT_MAXIMUM_HALFOPEN_IKE_SA);
+		update_setup_option(KBF_DDOS_PREFIX_TABLE_SIZE, 4096);
+		update_setup_option(KBF_DDOS_PREFIX_RATE, 0); /* disabled */
+		update_setup_option(KBF_DDOS_PREFIX_BURST, 100);
 
 		update_setup_option(KBF_IKEv1_POLICY, GLOBAL_IKEv1_DROP);
 		update_setup_option(KBF_OCSP_CACHE_SIZE, OCSP_DEFAULT_CACHE_SIZE);
@@ -134,11 +138,14 @@ const struct config_setup *config_setup_singleton(void)
 
 		update_setup_deltatime(KSF_EXPIRE_SHUNT_INTERVAL, deltatime(DEFAULT_EXPIRE_SHUNT_INTERVAL_SECONDS));
 		update_setup_deltatime(KBF_SHUNTLIFETIME, deltatime(DEFAULT_SHUNT_LIFETIME_SECONDS));
+		update_setup_deltatime(KBF_TRAFFIC_CACHE_TIME, deltatime(0));
 
 		update_setup_option(KBF_GLOBAL_REDIRECT, GLOBAL_REDIRECT_NO);
 
 		update_setup_yn(KYN_IKE_SOCKET_ERRQUEUE, YN_YES);
 		update_setup_option(KBF_IKE_SOCKET_BUFSIZE, 0); /*redundant*/
+		update_setup_option(KBF_IKE_SOCKET_BATCH, 32);
+		update_setup_yn(KYN_IKE_SOCKET_SEND_BATCH, YN_YES);
 
 		update_setup_yn(KYN_LISTEN_UDP, YN_YES);
 		update_setup_yn(KYN_LISTEN_TCP, YN_NO);
@@ -432,6 +439,7 @@ static const struct keyword_def config_setup_keyword[] = {
   K("statsbin",  kt_string,  KSF_STATSBIN),
   K("uniqueids",  kt_sparse_name,  KYN_UNIQUEIDS, .sparse_names = &yn_option_names),
   K("shuntlifetime",  kt_seconds,  KBF_SHUNTLIFETIME),
+  K("traffic-cache-time",  kt_seconds,  KBF_TRAFFIC_CACHE_TIME),
 
   K("global-redirect", kt_sparse_name, KBF_GLOBAL_REDIRECT, .sparse_names = &global_redirect_names),
   K("global-redirect-to", kt_string, KSF_GLOBAL_REDIRECT_TO),
@@ -457,9 +465,14 @@ static const struct keyword_def config_setup_keyword[] = {
   K("ddos-mode",  kt_sparse_name,  KBF_DDOS_MODE, .sparse_names = &ddos_mode_names),
   K("ddos-ike-threshold",  kt_unsigned,  KBF_DDOS_IKE_THRESHOLD),
   K("max-halfopen-ike",  kt_unsigned,  KBF_MAX_HALFOPEN_IKE),
+  K("ddos-prefix-table-size",  kt_unsigned,  KBF_DDOS_PREFIX_TABLE_SIZE),
+  K("ddos-prefix-rate",  kt_unsigned,  KBF_DDOS_PREFIX_RATE),
+  K("ddos-prefix-burst",  kt_unsigned,  KBF_DDOS_PREFIX_BURST),
 
   K("ike-socket-bufsize",  kt_unsigned,  KBF_IKE_SOCKET_BUFSIZE),
   K("ike-socket-errqueue",  kt_sparse_name,  KYN_IKE_SOCKET_ERRQUEUE, .sparse_names = &yn_option_names),
+  K("ike-socket-batch",  kt_unsigned,  KBF_IKE_SOCKET_BATCH),
+  K("ike-socket-send-batch",  kt_sparse_name,  KYN_IKE_SOCKET_SEND_BATCH, .sparse_names = &yn_option_names),
 #ifdef XFRM_LIFETIME_DEFAULT
   K("expire-lifetime",  kt_seconds,  KBF_EXPIRE_LIFETIME),
 #endif
@@ -473,6 +486,9 @@ static const struct keyword_def config_setup_keyword[] = {
   K("listen",  kt_string,  KSF_LISTEN),
   K("protostack",  kt_string,  KSF_PROTOSTACK,  NULL),
   K("nhelpers",  kt_unsigned,  KBF_NHELPERS),
+  K("offload-decrypt-threshold",  kt_unsigned,  KBF_OFFLOAD_DECRYPT_THRESHOLD),
+  K("updown-concurrency",  kt_unsigned,  KBF_UPDOWN_CONCURRENCY),
+  K("updown-coprocess",  kt_string,  KSF_UPDOWN_COPROCESS),
   K("drop-oppo-null",  kt_sparse_name,  KYN_DROP_OPPO_NULL, .sparse_names = &yn_option_names),
   K("expire-shunt-interval", kt_seconds, KSF_EXPIRE_SHUNT_INTERVAL),
 
@@ -28,10 +28,13 @@
 #include <errno.h>
 #include <stdlib.h>		/* for exit() */
 #include <sys/un.h>		/* struct sockaddr_un;! */
+#include <sys/socket.h>		/* for send() recv() */
+#include <poll.h>
 
 #include "whack.h"
 #include "lsw_socket.h"
 #include "lswlog.h"
+#include "lswalloc.h"
 
 static int whack_get_value(char *buf, size_t bufsize)
 {
@@ -101,156 +104,189 @@ static void whack_send_reply(int sock, const char *buf, ssize_t len, struct logg
 	}
 }
 
-static int whack_read_reply(int sock,
-			    char xauthusername[MAX_XAUTH_USERNAME_LEN],
-			    char xauthpass[XAUTH_MAX_PASS_LENGTH],
-			    int usernamelen,
-			    int xauthpasslen,
-			    struct logger *logger)
-{
+/*
+ * Pluto's reply: a stream of NNN-prefixed lines.
+ */
+
+struct whack_reply {
 	char buf[4097]; /* arbitrary limit on log line length */
-	char *be = buf;
-	int exit_status = 0;
+	char *be;
+	int exit_status;
+	/* for xauth prompts */
+	char *xauthusername;
+	char *xauthpass;
+	int usernamelen;
+	int xauthpasslen;
+};
 
-	for (;; ) {
-		char *ls = buf;
-		ssize_t rl = read(sock, be, (buf + sizeof(buf) - 1) - be);
+/*
+ * Read what is available and then process each complete line.
+ *
+ * Returns the number of bytes read, 0 on EOF, or -1 when the read
+ * should be retried (for instance, MSG_DONTWAIT and nothing to read).
+ */
 
-		if (rl < 0) {
-			int e = errno;
-			llog_error(logger, e, "read() failed");
-			exit(RC_WHACK_PROBLEM);
+static ssize_t whack_recv_reply(int sock, struct whack_reply *r, int flags,
+				struct logger *logger)
+{
+	char *ls = r->buf;
+	ssize_t rl = recv(sock, r->be, (r->buf + sizeof(r->buf) - 1) - r->be, flags);
+
+	if (rl < 0) {
+		int e = errno;
+		if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR) {
+			return -1;
 		}
+		llog_error(logger, e, "read() failed");
+		exit(RC_WHACK_PROBLEM);
+	}
 
-		if (rl == 0) {
-			if (be != buf) {
-				llog_error(logger, 0, "last line from pluto too long or unterminated");
-			}
-			break;
+	if (rl == 0) {
+		if (r->be != r->buf) {
+			llog_error(logger, 0, "last line from pluto too long or unterminated");
 		}
+		return 0;
+	}
 
-		be += rl;
-		*be = '\0';
+	r->be += rl;
+	*r->be = '\0';
 
-		for (;; ) {
-			char *le = strchr(ls, '\n');
+	for (;; ) {
+		char *le = strchr(ls, '\n');
 
-			if (le == NULL) {
-				/* move last, partial line to start of buffer */
-				memmove(buf, ls, be - ls);
-				be -= ls - buf;
-				break;
-			}
-			le++;	/* include NL in line */
+		if (le == NULL) {
+			/* move last, partial line to start of buffer */
+			memmove(r->buf, ls, r->be - ls);
+			r->be -= ls - r->buf;
+			break;
+		}
+		le++;	/* include NL in line */
+
+		/*
+		 * figure out prefix number and how it should
+		 * affect our exit status and printing
+		 */
+		char *lpe = NULL; /* line-prefix-end */
+		unsigned long s = strtoul(ls, &lpe, 10);
+		if (lpe == ls || *lpe != ' ') {
+			/* includes embedded NL, see above */
+			llog_error(logger, 0, "log line missing NNN prefix: %*s",
+				   (int)(le - ls), ls);
+			exit(RC_WHACK_PROBLEM);
+		}
 
-			/*
-			 * figure out prefix number and how it should
-			 * affect our exit status and printing
-			 */
-			char *lpe = NULL; /* line-prefix-end */
-			unsigned long s = strtoul(ls, &lpe, 10);
-			if (lpe == ls || *lpe != ' ') {
-				/* includes embedded NL, see above */
-				llog_error(logger, 0, "log line missing NNN prefix: %*s",
-					   (int)(le - ls), ls);
-				exit(RC_WHACK_PROBLEM);
-			}
+		ls = lpe + 1; /* skip NNN_ */
+
+		if (write(STDOUT_FILENO, ls, le - ls) == -1) {
+			int e = errno;
+			llog_errno(RC_LOG, logger, e, "write() failed, and ignored");
+		}
 
-			ls = lpe + 1; /* skip NNN_ */
+		/*
+		 * figure out prefix number and how it should affect
+		 * our exit status
+		 */
 
-			if (write(STDOUT_FILENO, ls, le - ls) == -1) {
-				int e = errno;
-				llog_errno(RC_LOG, logger, e, "write() failed, and ignored");
-			}
+		switch (s) {
 
+		case RC_LOG:
 			/*
-			 * figure out prefix number and how it should affect
-			 * our exit status
+			 * Ignore; these logs are
+			 * informational only.
 			 */
+			break;
 
-			switch (s) {
-
-			case RC_LOG:
+		case RC_ENTERSECRET:
+			if (r->xauthpass == NULL) {
+				llog_error(logger, 0, "unexpected request for xauth password");
+				exit(RC_WHACK_PROBLEM);
+			}
+			if (r->xauthpasslen == 0) {
+				r->xauthpasslen =
+					whack_get_secret(r->xauthpass,
+							 XAUTH_MAX_PASS_LENGTH);
+			}
+			if (r->xauthpasslen > XAUTH_MAX_PASS_LENGTH) {
 				/*
-				 * Ignore; these logs are
-				 * informational only.
+				 * for input >= 128,
+				 * xauthpasslen would be 129
 				 */
-				break;
-
-			case RC_ENTERSECRET:
-				if (xauthpass == NULL) {
-					llog_error(logger, 0, "unexpected request for xauth password");
-					exit(RC_WHACK_PROBLEM);
-				}
-				if (xauthpasslen == 0) {
-					xauthpasslen =
-						whack_get_secret(xauthpass,
-								 XAUTH_MAX_PASS_LENGTH);
-				}
-				if (xauthpasslen > XAUTH_MAX_PASS_LENGTH) {
-					/*
-					 * for input >= 128,
-					 * xauthpasslen would be 129
-					 */
-					xauthpasslen =
-						XAUTH_MAX_PASS_LENGTH;
-					llog_error(logger, 0,
-						   "xauth password cannot be >= %d chars",
-						   XAUTH_MAX_PASS_LENGTH);
-				}
-				whack_send_reply(sock, xauthpass, xauthpasslen, logger);
-				break;
-
-			case RC_USERPROMPT:
-				if (xauthusername == NULL) {
-					llog_error(logger, 0, "unexpected request for xauth username");
-					exit(RC_WHACK_PROBLEM);
-				}
-				if (usernamelen == 0) {
-					usernamelen = whack_get_value(xauthusername,
-								      MAX_XAUTH_USERNAME_LEN);
-				}
-				if (usernamelen > MAX_XAUTH_USERNAME_LEN) {
-					/*
-					 * for input >= 128,
-					 * useramelen would be 129
-					 */
-					usernamelen = MAX_XAUTH_USERNAME_LEN;
-					llog_error(logger, 0,
-						   "username cannot be >= %d chars",
-						   MAX_XAUTH_USERNAME_LEN);
-				}
-				whack_send_reply(sock, xauthusername, usernamelen, logger);
-
-				break;
+				r->xauthpasslen =
+					XAUTH_MAX_PASS_LENGTH;
+				llog_error(logger, 0,
+					   "xauth password cannot be >= %d chars",
+					   XAUTH_MAX_PASS_LENGTH);
+			}
+			whack_send_reply(sock, r->xauthpass, r->xauthpasslen, logger);
+			break;
 
-			default:
+		case RC_USERPROMPT:
+			if (r->xauthusername == NULL) {
+				llog_error(logger, 0, "unexpected request for xauth username");
+				exit(RC_WHACK_PROBLEM);
+			}
+			if (r->usernamelen == 0) {
+				r->usernamelen = whack_get_value(r->xauthusername,
+								 MAX_XAUTH_USERNAME_LEN);
+			}
+			if (r->usernamelen > MAX_XAUTH_USERNAME_LEN) {
 				/*
-				 * Only RC_ codes between
-				 * RC_EXIT_FLOOR (RC_DUPNAME) and
-				 * RC_EXIT_ROOF are errors.
-				 *
-				 * The exit status is sticky so that
-				 * incidental logs don't clear or
-				 * change it.
+				 * for input >= 128,
+				 * useramelen would be 129
 				 */
-				if (exit_status == 0 && s >= RC_EXIT_FLOOR && s < RC_EXIT_ROOF) {
-					exit_status = s;
-				}
-				break;
+				r->usernamelen = MAX_XAUTH_USERNAME_LEN;
+				llog_error(logger, 0,
+					   "username cannot be >= %d chars",
+					   MAX_XAUTH_USERNAME_LEN);
 			}
+			whack_send_reply(sock, r->xauthusername, r->usernamelen, logger);
+
+			break;
 
-			ls = le;
+		default:
+			/*
+			 * Only RC_ codes between
+			 * RC_EXIT_FLOOR (RC_DUPNAME) and
+			 * RC_EXIT_ROOF are errors.
+			 *
+			 * The exit status is sticky so that
+			 * incidental logs don't clear or
+			 * change it.
+			 */
+			if (r->exit_status == 0 && s >= RC_EXIT_FLOOR && s < RC_EXIT_ROOF) {
+				r->exit_status = s;
+			}
+			break;
 		}
+
+		ls = le;
 	}
-	return exit_status;
+
+	return rl;
 }
 
-int whack_send_msg(struct whack_message *msg, const char *ctlsocket,
-		   char xauthusername[MAX_XAUTH_USERNAME_LEN],
-		   char xauthpass[XAUTH_MAX_PASS_LENGTH],
-		   int usernamelen, int xauthpasslen,
-		   struct logger *logger)
+static int whack_read_reply(int sock,
+			    char xauthusername[MAX_XAUTH_USERNAME_LEN],
+			    char xauthpass[XAUTH_MAX_PASS_LENGTH],
+			    int usernamelen,
+			    int xauthpasslen,
+			    struct logger *logger)
+{
+	struct whack_reply r = {
+		.xauthusername = xauthusername,
+		.xauthpass = xauthpass,
+		.usernamelen = usernamelen,
+		.xauthpasslen = xauthpasslen,
+	};
+	r.be = r.buf;
+
+	while (whack_recv_reply(sock, &r, 0, logger) != 0) {
+		continue;
+	}
+	return r.exit_status;
+}
+
+static int whack_connect(const char *ctlsocket, struct logger *logger)
 {
 	struct sockaddr_un ctl_addr = {
 		.sun_family = AF_UNIX,
@@ -264,23 +300,6 @@ int whack_send_msg(struct whack_message *msg, const char *ctlsocket,
 
 	fill_and_terminate(ctl_addr.sun_path, ctlsocket, sizeof(ctl_addr.sun_path));
 
-	/*  Pack strings */
-
-	struct whackpacker wp = {
-		.msg = msg,
-		.str_next = (unsigned char *)msg->string,
-		.str_roof = (unsigned char *)&msg->string[sizeof(msg->string)],
-	};
-
-	err_t ugh = pack_whack_msg(&wp, logger);
-
-	if (ugh != NULL) {
-		llog_error(logger, 0, "send_wack_msg(): can't pack strings: %s", ugh);
-		return -1;
-	}
-
-	ssize_t len = wp.str_next - (unsigned char *)msg;
-
 	/* Connect to pluto ctl */
 
 	if (access(ctl_addr.sun_path, R_OK | W_OK) < 0) {
@@ -316,6 +335,34 @@ int whack_send_msg(struct whack_message *msg, const char *ctlsocket,
 		exit(RC_WHACK_PROBLEM);
 	}
 
+	return sock;
+}
+
+int whack_send_msg(struct whack_message *msg, const char *ctlsocket,
+		   char xauthusername[MAX_XAUTH_USERNAME_LEN],
+		   char xauthpass[XAUTH_MAX_PASS_LENGTH],
+		   int usernamelen, int xauthpasslen,
+		   struct logger *logger)
+{
+	/*  Pack strings */
+
+	struct whackpacker wp = {
+		.msg = msg,
+		.str_next = (unsigned char *)msg->string,
+		.str_roof = (unsigned char *)&msg->string[sizeof(msg->string)],
+	};
+
+	err_t ugh = pack_whack_msg(&wp, logger);
+
+	if (ugh != NULL) {
+		llog_error(logger, 0, "send_wack_msg(): can't pack strings: %s", ugh);
+		return -1;
+	}
+
+	ssize_t len = wp.str_next - (unsigned char *)msg;
+
+	int sock = whack_connect(ctlsocket, logger);
+
 	/* Send message */
 
 	if (write(sock, msg, len) != len) {
@@ -330,3 +377,139 @@ int whack_send_msg(struct whack_message *msg, const char *ctlsocket,
 
 	return ret;
 }
+
+/*
+ * Bulk add; see whack.h.
+ */
+
+struct whack_bulk {
+	int sock;
+	struct whack_reply reply;
+	/* records waiting to be sent */
+	size_t len;
+	uint8_t buf[64 * 1024];
+};
+
+/*
+ * Send everything buffered.
+ *
+ * Pluto replies (with errors) while it is still reading records, and
+ * blocks when the socket fills; so drain the reply while waiting for
+ * space.
+ */
+
+static void whack_bulk_flush(struct whack_bulk *bulk, struct logger *logger)
+{
+	size_t sent = 0;
+	while (sent < bulk->len) {
+		struct pollfd pfd = {
+			.fd = bulk->sock,
+			.events = POLLIN | POLLOUT,
+		};
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			llog_error(logger, errno, "poll(pluto_ctl) failed");
+			exit(RC_WHACK_PROBLEM);
+		}
+
+		if (pfd.revents & (POLLIN | POLLHUP)) {
+			if (whack_recv_reply(bulk->sock, &bulk->reply, MSG_DONTWAIT, logger) == 0) {
+				llog_error(logger, 0, "pluto closed the bulk session early");
+				exit(bulk->reply.exit_status != 0 ? bulk->reply.exit_status :
+				     RC_WHACK_PROBLEM);
+			}
+		}
+
+		if (pfd.revents & (POLLOUT | POLLERR)) {
+			ssize_t n = send(bulk->sock, bulk->buf + sent, bulk->len - sent,
+					 MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n < 0) {
+				int e = errno;
+				if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR) {
+					continue;
+				}
+				llog_error(logger, e, "write(pluto_ctl) failed");
+				exit(RC_WHACK_PROBLEM);
+			}
+			sent += n;
+		}
+	}
+	bulk->len = 0;
+}
+
+static void whack_bulk_append(struct whack_bulk *bulk, const void *bytes, size_t len,
+			      struct logger *logger)
+{
+	if (bulk->len + len > sizeof(bulk->buf)) {
+		whack_bulk_flush(bulk, logger);
+	}
+	memcpy(bulk->buf + bulk->len, bytes, len);
+	bulk->len += len;
+}
+
+struct whack_bulk *whack_bulk_open(const char *ctlsocket, struct logger *logger)
+{
+	struct whack_message msg = {
+		.whack_from = WHACK_FROM_ADDCONN,
+		.whack_command = WHACK_BULK_ADD,
+	};
+
+	struct whackpacker wp = {
+		.msg = &msg,
+	};
+
+	err_t ugh = pack_whack_msg(&wp, logger);
+	if (ugh != NULL) {
+		llog_error(logger, 0, "whack_bulk_open(): can't pack strings: %s", ugh);
+		return NULL;
+	}
+
+	struct whack_bulk *bulk = alloc_thing(struct whack_bulk, "whack bulk");
+	bulk->sock = whack_connect(ctlsocket, logger);
+	bulk->reply.be = bulk->reply.buf;
+
+	/* the header is always sent in full */
+	whack_bulk_append(bulk, &msg, sizeof(msg), logger);
+	return bulk;
+}
+
+int whack_bulk_add(struct whack_bulk *bulk, struct whack_message *msg,
+		   struct logger *logger)
+{
+	struct whackpacker wp = {
+		.msg = msg,
+	};
+
+	err_t ugh = pack_whack_msg(&wp, logger);
+	if (ugh != NULL) {
+		llog_error(logger, 0, "whack_bulk_add(): can't pack strings: %s", ugh);
+		return -1;
+	}
+
+	uint32_t len = wp.str_next - (unsigned char *)msg;
+	whack_bulk_append(bulk, &len, sizeof(len), logger);
+	whack_bulk_append(bulk, msg, len, logger);
+	return 0;
+}
+
+int whack_bulk_close(struct whack_bulk **bulkp, struct logger *logger)
+{
+	struct whack_bulk *bulk = (*bulkp);
+	(*bulkp) = NULL;
+
+	uint32_t end = 0;
+	whack_bulk_append(bulk, &end, sizeof(end), logger);
+	whack_bulk_flush(bulk, logger);
+
+	/* read the remaining reply */
+	while (whack_recv_reply(bulk->sock, &bulk->reply, 0, logger) != 0) {
+		continue;
+	}
+	close(bulk->sock);
+
+	int ret = bulk->reply.exit_status;
+	pfree(bulk);
+	return ret;
+}
@@ -544,6 +544,12 @@ int main(int argc, char *argv[])
 		if (verbose > 0)
 			printf("  Step #1: Loading auto=add, auto=keep, auto=route, auto=up and auto=start connections\n");
 
+		/*
+		 * All the connections are sent using a single bulk
+		 * session; pluto replies with any errors and a
+		 * summary.
+		 */
+		struct whack_bulk *bulk = NULL;
 		struct starter_conn *conn = NULL;
 		TAILQ_FOREACH(conn, &cfg->conns, link) {
 			enum autostart autostart = conn->values[KNCF_AUTO].option;
@@ -569,7 +575,18 @@ int main(int argc, char *argv[])
 				printf("    %s\n", conn->name);
 			}
 
-			starter_whack_add_conn(ctlsocket, conn, logger);
+			if (bulk == NULL) {
+				bulk = whack_bulk_open(ctlsocket, logger);
+				if (bulk == NULL) {
+					/* already logged */
+					exit(RC_WHACK_PROBLEM);
+				}
+			}
+			starter_whack_bulk_add_conn(bulk, conn, logger);
+		}
+
+		if (bulk != NULL) {
+			whack_bulk_close(&bulk, logger);
 		}
 
 		/*
@@ -13,6 +13,8 @@
  * for more details.
  */
 
+#include <ctype.h>		/* for tolower() */
+
 #include "connection_db.h"
 #include "spd_db.h"
 #include "connections.h"
@@ -22,6 +24,7 @@
 #include "virtual_ip.h"		/* for virtual_ip_addref() */
 #include "orient.h"
 #include "iface.h"
+#include "whack.h"		/* for lsw_alias_cmp() */
 
 /*
  * A table hashed by serialno.
@@ -29,7 +32,7 @@
 
 static hash_t hash_connection_serialno(const co_serial_t *serialno)
 {
-	return hash_thing(*serialno, zero_hash);
+	return hash_unkeyed_thing(*serialno, zero_hash);
 }
 
 HASH_TABLE(connection, serialno, .serialno, STATE_TABLE_SIZE);
@@ -78,6 +81,7 @@ void replace_connection_that_id(struct connection *c, const struct id *src)
 	free_id_content(dst);
 	*dst = clone_id(src, "replaing connection id");
 	connection_db_rehash_that_id(c);
+	connection_db_rehash_responder(c);
 }
 
 /*
@@ -87,7 +91,7 @@ void replace_connection_that_id(struct connection *c, const struct id *src)
 static hash_t hash_connection_clonedfrom(struct connection *const *cpp)
 {
 	so_serial_t serial = (*cpp == NULL ? 0 : (*cpp)->serialno);
-	return hash_thing(serial, zero_hash);
+	return hash_unkeyed_thing(serial, zero_hash);
 }
 
 HASH_TABLE(connection, clonedfrom, .clonedfrom, STATE_TABLE_SIZE);
@@ -132,6 +136,137 @@ HASH_TABLE(connection, host_pair, , STATE_TABLE_SIZE);
 
 REHASH_DB_ENTRY(connection, host_pair, );
 
+/*
+ * Responder hash table.
+ *
+ * The host-pair <local>,%any bucket holds every template on LOCAL;
+ * when refining on IKE_AUTH only those with the right remote .auth
+ * and a remote ID that could possibly match are of interest.
+ *
+ * The remote ID is reduced to a pattern: %any and %fromcert accept
+ * any ID so share the ID_NONE pattern; DN (which allows wildcards
+ * and RDN re-ordering) and ID_NULL are hashed by kind; and the
+ * remaining kinds are hashed by kind and value, the value
+ * normalized the way id_eq() compares it.
+ */
+
+static bool remote_id_pattern_is_wild(const struct id *id)
+{
+	return (id->kind == ID_NONE || id->kind == ID_FROMCERT);
+}
+
+static bool remote_id_pattern_has_value(const struct id *id)
+{
+	switch (id->kind) {
+	case ID_IPV4_ADDR:
+	case ID_IPV6_ADDR:
+	case ID_FQDN:
+	case ID_USER_FQDN:
+	case ID_KEY_ID:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static hash_t hash_remote_id_pattern(const struct id *id, hash_t hash)
+{
+	if (remote_id_pattern_is_wild(id)) {
+		enum ike_id_type kind = ID_NONE;
+		return hash_thing(kind, hash);
+	}
+
+	hash = hash_thing(id->kind, hash);
+	if (!remote_id_pattern_has_value(id)) {
+		return hash;
+	}
+
+	switch (id->kind) {
+	case ID_IPV4_ADDR:
+	case ID_IPV6_ADDR:
+		return hash_hunk(address_as_shunk(&id->ip_addr), hash);
+	case ID_FQDN:
+	case ID_USER_FQDN:
+	{
+		/* case and trailing dots are ignored */
+		size_t len = id->name.len;
+		while (len > 0 && ((const uint8_t *)id->name.ptr)[len - 1] == '.') {
+			len--;
+		}
+		for (size_t i = 0; i < len; i++) {
+			uint8_t lc = tolower(((const uint8_t *)id->name.ptr)[i]);
+			hash = hash_thing(lc, hash);
+		}
+		return hash;
+	}
+	default:
+		return hash_hunk(id->name, hash);
+	}
+}
+
+static bool remote_id_pattern_matches(const struct id *pattern,
+				      const struct id *remote_id)
+{
+	if (remote_id_pattern_is_wild(remote_id)) {
+		return remote_id_pattern_is_wild(pattern);
+	}
+	if (pattern->kind != remote_id->kind) {
+		return false;
+	}
+	if (!remote_id_pattern_has_value(remote_id)) {
+		return true;
+	}
+	return id_eq(pattern, remote_id);
+}
+
+static hash_t hash_responder(const ip_address *local,
+			     enum ike_version ike_version,
+			     enum keyword_auth auth,
+			     const struct id *remote_id)
+{
+	hash_t hash = hash_host_pair(local, &unset_address);
+	hash = hash_thing(ike_version, hash);
+	hash = hash_thing(auth, hash);
+	return hash_remote_id_pattern(remote_id, hash);
+}
+
+static hash_t hash_connection_responder(const struct connection *c)
+{
+	/* same local as the host-pair hash */
+	const ip_address *local = (oriented(c) ? &c->local->host.addr : &unset_address);
+	return hash_responder(local, c->config->ike_version,
+			      c->remote->host.config->auth,
+			      &c->remote->host.id);
+}
+
+HASH_TABLE(connection, responder, , STATE_TABLE_SIZE);
+
+REHASH_DB_ENTRY(connection, responder, );
+
+/*
+ * Name and base-name hash tables.  Neither changes once the
+ * connection has been allocated.
+ */
+
+static hash_t hash_name(const char *name)
+{
+	return hash_hunk(shunk1(name), zero_hash);
+}
+
+static hash_t hash_connection_name(char *const *name)
+{
+	return hash_name(*name);
+}
+
+HASH_TABLE(connection, name, .name, STATE_TABLE_SIZE);
+
+static hash_t hash_connection_base_name(char *const *base_name)
+{
+	return hash_name(*base_name);
+}
+
+HASH_TABLE(connection, base_name, .base_name, STATE_TABLE_SIZE);
+
 /*
  * Maintain the contents of the hash tables.
  */
@@ -140,7 +275,98 @@ HASH_DB(connection,
 	&connection_clonedfrom_hash_table,
 	&connection_serialno_hash_table,
 	&connection_that_id_hash_table,
-	&connection_host_pair_hash_table);
+	&connection_host_pair_hash_table,
+	&connection_responder_hash_table,
+	&connection_name_hash_table,
+	&connection_base_name_hash_table);
+
+/*
+ * Alias hash table.
+ *
+ * A connection's connalias= is a list of words so a connection can't
+ * be threaded onto the table directly; instead each root connection
+ * gets an array of connection_alias entries, one per distinct word,
+ * terminated by a NULL .name.
+ */
+
+struct connection_alias {
+	char *name;
+	struct connection *connection;
+	struct {
+		struct list_entry list;
+		struct list_entry name;
+	} connection_alias_db_entries;
+};
+
+static size_t jam_connection_alias(struct jambuf *buf, const struct connection_alias *a)
+{
+	size_t s = 0;
+	s += jam(buf, "%s->", a->name);
+	s += jam_connection(buf, a->connection);
+	return s;
+}
+
+static hash_t hash_connection_alias_name(char *const *name)
+{
+	return hash_name(*name);
+}
+
+HASH_TABLE(connection_alias, name, .name, STATE_TABLE_SIZE);
+
+HASH_DB(connection_alias,
+	&connection_alias_name_hash_table);
+
+void connection_db_add_aliases(struct connection *c)
+{
+	PASSERT(c->logger, c->aliases == NULL);
+	const char *connalias = c->config->connalias;
+	if (c->root_config == NULL || connalias == NULL) {
+		return;
+	}
+
+	/* over allocate; one per word, plus terminator */
+	unsigned nr_words = 0;
+	for (const char *s = connalias + strspn(connalias, " \t"); *s != '\0';
+	     s += strcspn(s, " \t"), s += strspn(s, " \t")) {
+		nr_words++;
+	}
+	c->aliases = alloc_things(struct connection_alias, nr_words + 1, "connection aliases");
+
+	struct connection_alias *a = c->aliases;
+	for (const char *s = connalias + strspn(connalias, " \t"); *s != '\0';
+	     s += strcspn(s, " \t"), s += strspn(s, " \t")) {
+		char *name = clone_hunk_as_string(shunk2(s, strcspn(s, " \t")), "connection alias");
+		bool duplicate = false;
+		for (struct connection_alias *d = c->aliases; d < a; d++) {
+			if (streq(d->name, name)) {
+				duplicate = true;
+				break;
+			}
+		}
+		if (duplicate) {
+			pfree(name);
+			continue;
+		}
+		a->name = name;
+		a->connection = c;
+		connection_alias_db_init_connection_alias(a);
+		connection_alias_db_add(a);
+		a++;
+	}
+}
+
+void connection_db_del_aliases(struct connection *c)
+{
+	if (c->aliases == NULL) {
+		return;
+	}
+	for (struct connection_alias *a = c->aliases; a->name != NULL; a++) {
+		connection_alias_db_del(a);
+		pfree(a->name);
+	}
+	pfree(c->aliases);
+	c->aliases = NULL;
+}
 
 /*
  * See also {new2old,old2new}_state()
@@ -176,10 +402,65 @@ static struct list_head *connection_filter_head(struct connection_filter *filter
 		return hash_table_bucket(&connection_host_pair_hash_table, hash);
 	}
 
+	if (filter->responder.local != NULL) {
+		passert(filter->responder.remote_id != NULL);
+		address_buf lb;
+		id_buf idb;
+		name_buf ab;
+		vdbg("FOR_EACH_CONNECTION[local=%s,auth=%s,remote_id=%s].... in "PRI_WHERE,
+		     str_address(filter->responder.local, &lb),
+		     str_enum_short(&keyword_auth_names, filter->responder.auth, &ab),
+		     str_id(filter->responder.remote_id, &idb),
+		     pri_where(filter->search.where));
+		hash_t hash = hash_responder(filter->responder.local,
+					     filter->ike_version,
+					     filter->responder.auth,
+					     filter->responder.remote_id);
+		return hash_table_bucket(&connection_responder_hash_table, hash);
+	}
+
+	if (filter->name != NULL) {
+		vdbg("FOR_EACH_CONNECTION[name=%s].... in "PRI_WHERE,
+		     filter->name, pri_where(filter->search.where));
+		hash_t hash = hash_name(filter->name);
+		return hash_table_bucket(&connection_name_hash_table, hash);
+	}
+
+	if (filter->base_name != NULL) {
+		vdbg("FOR_EACH_CONNECTION[base_name=%s].... in "PRI_WHERE,
+		     filter->base_name, pri_where(filter->search.where));
+		hash_t hash = hash_name(filter->base_name);
+		return hash_table_bucket(&connection_base_name_hash_table, hash);
+	}
+
+	if (filter->alias_root != NULL) {
+		vdbg("FOR_EACH_CONNECTION[alias_root=%s].... in "PRI_WHERE,
+		     filter->alias_root, pri_where(filter->search.where));
+		hash_t hash = hash_name(filter->alias_root);
+		return hash_table_bucket(&connection_alias_name_hash_table, hash);
+	}
+
 	vdbg("FOR_EACH_CONNECTION_.... in "PRI_WHERE, pri_where(filter->search.where));
 	return &connection_db_list_head;
 }
 
+/*
+ * Entries on the alias table point at the connection_alias, not the
+ * connection.  Since a connection has at most one entry per alias,
+ * matching the alias's name stops the connection being returned
+ * twice.
+ */
+
+static struct connection *connection_filter_entry(const struct connection_filter *filter,
+						  struct list_entry *entry)
+{
+	if (entry->info == &connection_alias_name_hash_info) {
+		struct connection_alias *a = entry->data;
+		return (streq(a->name, filter->alias_root) ? a->connection : NULL);
+	}
+	return entry->data;
+}
+
 static bool matches_connection_filter(struct connection *c,
 				      struct connection_filter *filter)
 {
@@ -260,6 +541,32 @@ static bool matches_connection_filter(struct connection *c,
 			PEXPECT_WHERE(c->logger, filter->search.where, is_template(c));
 		}
 	}
+	if (filter->responder.local != NULL) {
+		passert(filter->responder.remote_id != NULL);
+		if (is_group(c)) {
+			return false;
+		}
+		if (never_negotiate(c)) {
+			return false;
+		}
+		if (!oriented(c)) {
+			return false;
+		}
+		if (!address_eq_address(c->local->host.addr, *filter->responder.local)) {
+			return false;
+		}
+		if (address_is_specified(c->remote->host.addr)) {
+			return false;
+		}
+		if (c->remote->host.config->auth != filter->responder.auth) {
+			return false;
+		}
+		if (!remote_id_pattern_matches(&c->remote->host.id,
+					       filter->responder.remote_id)) {
+			return false;
+		}
+		PEXPECT_WHERE(c->logger, filter->search.where, is_template(c));
+	}
 
 	return true; /* sure */
 }
@@ -300,6 +607,7 @@ bool next_connection(struct connection_filter *filter)
 #endif
 			vexpect_where(filter->search.where, filter->host_pair.local == NULL);
 			vexpect_where(filter->search.where, filter->host_pair.remote == NULL);
+			vexpect_where(filter->search.where, filter->responder.local == NULL);
 			vexpect_where(filter->search.where, filter->this_id_eq == NULL);
 			vexpect_where(filter->search.where, filter->that_id_eq == NULL);
 		}
@@ -316,8 +624,9 @@ bool next_connection(struct connection_filter *filter)
 	for (struct list_entry *entry = filter->internal;
 	     entry->data != NULL /* head has DATA == NULL */;
 	     entry = entry->next[filter->search.order]) {
-		struct connection *c = (struct connection *) entry->data;
-		if (matches_connection_filter(c, filter)) {
+		filter->visited++;
+		struct connection *c = connection_filter_entry(filter, entry);
+		if (c != NULL && matches_connection_filter(c, filter)) {
 			/* save connection; but step off current entry */
 			filter->internal = entry->next[filter->search.order];
 			filter->count++;
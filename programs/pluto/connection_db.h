@@ -30,4 +30,21 @@ void connection_db_check_connection(struct connection *c, struct logger *logger,
 void connection_db_add(struct connection *c);
 void connection_db_del(struct connection *c);
 
+/*
+ * Root connections are also indexed by each word of their
+ * connalias=.
+ */
+
+struct connection_alias;
+
+void connection_alias_db_init(struct logger *logger);
+void connection_alias_db_check(struct logger *logger);
+
+void connection_alias_db_init_connection_alias(struct connection_alias *a);
+void connection_alias_db_add(struct connection_alias *a);
+void connection_alias_db_del(struct connection_alias *a);
+
+void connection_db_add_aliases(struct connection *c);
+void connection_db_del_aliases(struct connection *c);
+
 #endif
@@ -577,6 +577,7 @@ static void discard_connection(struct connection **cp, bool connection_valid, wh
 	remove_from_group(c);
 
 	if (connection_valid) {
+		connection_db_del_aliases(c);
 		connection_db_del(c);
 	}
 	discard_connection_spds(c);
@@ -5232,6 +5233,7 @@ static diag_t extract_connection(const struct whack_message *wm,
 	 * the database first.
 	 */
 	connection_db_add(c);
+	connection_db_add_aliases(c);
 
 	/*
 	 * Force orientation (currently kind of unoriented?).
@@ -5664,6 +5666,9 @@ const char *str_connection_policies(const struct connection *c, policy_buf *buf)
  * See also find_outgoing_opportunistic_template().
  */
 
+/* largest (src - 1) + (dst - 1) below */
+#define PACKET_SCORE_MAX (6 + 4)
+
 struct connection *find_connection_for_packet(const ip_packet packet,
 					      shunk_t sec_label,
 					      const struct logger *logger)
@@ -5678,15 +5683,27 @@ struct connection *find_connection_for_packet(const ip_packet packet,
 	struct connection *best_connection = NULL;
 	connection_priority_t best_priority = BOTTOM_PRIORITY;
 
-	struct connection_filter cq = {
-		.search = {
-			.order = NEW2OLD,
-			.verbose.logger = logger,
-			.where = HERE,
-		},
-	};
-	while (next_connection(&cq)) {
-		struct connection *c = cq.c;
+	/*
+	 * Only a connection with an SPD (kernel policy) covering the
+	 * packet's destination could have triggered the acquire.
+	 * Visit those best first.
+	 */
+	struct verbose verbose = { .logger = logger, .level = 1, };
+	struct connection **candidates = connections_by_remote_endpoint(packet_dst, verbose);
+	for (struct connection **cp = candidates; cp != NULL && *cp != NULL; cp++) {
+		struct connection *c = *cp;
+
+		/*
+		 * Candidates are ordered by connection_priority() so,
+		 * once even the best selector score can't reach the
+		 * best so far, nothing further can.
+		 */
+		if (best_connection != NULL &&
+		    (connection_priority(c) << 3) + PACKET_SCORE_MAX < best_priority) {
+			ldbg(logger, "    stopping at %s; remaining candidates can't best %s priority %"PRIu32,
+			     c->name, best_connection->name, best_priority);
+			break;
+		}
 
 		if (!oriented(c)) {
 			ldbg(logger, "    skipping %s; not oriented",
@@ -5841,8 +5858,11 @@ struct connection *find_connection_for_packet(const ip_packet packet,
 			 (src - 1/*2-bits, strip 1 added above*/) +
 			 (dst - 1/*2-bits, strip 1 added above*/));
 
+		/* on a tie, the newest connection wins */
 		if (best_connection != NULL &&
-		    priority <= best_priority) {
+		    (priority < best_priority ||
+		     (priority == best_priority &&
+		      c->serialno < best_connection->serialno))) {
 			ldbg(logger,
 			     "    skipping %s priority %"PRIu32"; doesn't best %s priority %"PRIu32,
 			     c->name,
@@ -5870,6 +5890,7 @@ struct connection *find_connection_for_packet(const ip_packet packet,
 		best_connection = c;
 		best_priority = priority;
 	}
+	pfreeany(candidates);
 
 	if (best_connection == NULL) {
 		ldbg(logger, "  concluding with empty; no match");
@@ -6153,6 +6174,7 @@ void update_end_selector_where(struct connection *c, enum end lr,
 				     str_selector(&old_client, &cb));
 		}
 		c->child.spds.list->end[lr].client = new_selector;
+		spd_db_rehash_remote_client(c->child.spds.list);
 	}
 
 	/*
@@ -720,6 +720,7 @@ struct spd {
 	struct {
 		struct list_entry list;
 		struct list_entry remote_client;
+		struct list_entry remote_prefix;
 	} spd_db_entries;
 };
 
@@ -900,7 +901,12 @@ struct connection {
 		struct list_entry that_id;
 		struct list_entry clonedfrom;
 		struct list_entry host_pair;
+		struct list_entry responder;
+		struct list_entry name;
+		struct list_entry base_name;
 	} connection_db_entries;
+	/* one per .config->connalias word; see connection_db.c */
+	struct connection_alias *aliases;
 
 	struct pending *pending;
 
@@ -1042,6 +1048,19 @@ struct connection_filter {
 		const ip_address *const local;
 		const ip_address *const remote;
 	} host_pair;
+	/*
+	 * responder: the host-pair local=LOCAL,remote=&unset
+	 * connections (i.e., oriented templates) narrowed to those
+	 * with the remote .auth AUTH and a remote ID that could match
+	 * REMOTE_ID.  REMOTE_ID with kind ID_NONE selects the
+	 * templates that accept any ID (%any and %fromcert).
+	 * Requires .ike_version.
+	 */
+	const struct {
+		const ip_address *const local;
+		const enum keyword_auth auth;
+		const struct id *const remote_id;
+	} responder;
 
 	/*
 	 * Current result (can be safely deleted).
@@ -1055,6 +1074,8 @@ struct connection_filter {
 	struct connection **connections; /* refcounted connections; used by all_connections() */
 	/* internal: total matches so far */
 	unsigned count;
+	/* internal: total entries examined so far */
+	unsigned visited;
 
 	/*
 	 * Required fields.
@@ -1129,6 +1150,7 @@ bool next_spd(struct spd_filter *srf);
 void replace_connection_that_id(struct connection *c, const struct id *new_id);
 void connection_db_rehash_that_id(struct connection *c);
 void connection_db_rehash_host_pair(struct connection *c);
+void connection_db_rehash_responder(struct connection *c);
 
 void spd_db_rehash_remote_client(struct spd *sr);
 
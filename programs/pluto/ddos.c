@@ -36,10 +36,18 @@
 #include "show.h"
 #include "state.h"		/* for total_halfopen_ike() */
 #include "whack_shutdown.h"	/* for whack_shutdown() and exiting_pluto; */
+#include "hash_table.h"
+#include "ip_subnet.h"
+#include "ip_info.h"
+#include "monotime.h"
+#include "pluto_stats.h"
 
 static enum ddos_mode pluto_ddos_mode; /* set below */
 static unsigned int pluto_max_halfopen_ike; /* set below */
 static unsigned int pluto_ddos_ike_threshold; /* set below */
+static unsigned int pluto_ddos_prefix_table_size; /* set below */
+static unsigned int pluto_ddos_prefix_rate; /* set below; 0 disables */
+static unsigned int pluto_ddos_prefix_burst; /* set below */
 
 void set_ddos_mode(enum ddos_mode mode, struct logger *logger)
 {
@@ -90,9 +98,211 @@ err_t drop_new_exchanges(struct logger *logger)
 	return false;
 }
 
-void init_ddos(const struct config_setup *oco, struct logger *logger UNUSED)
+/*
+ * Per-source-prefix admission control for new IKE exchanges.
+ *
+ * Each source prefix (/24 for IPv4, /64 for IPv6) gets a token
+ * bucket that refills at ddos-prefix-rate tokens per second up to
+ * ddos-prefix-burst.  Each new exchange takes a token; once the
+ * bucket is empty the prefix must return cookies and, once it is
+ * ddos-prefix-burst tokens in debt, its requests are dropped.  So a
+ * single abusive network can't force cookies on, or use up the
+ * half-open IKE SAs of, everyone else.
+ *
+ * The table holds at most ddos-prefix-table-size prefixes; when full
+ * the least recently used prefix is evicted (the DB list is kept in
+ * LRU order).
+ */
+
+#define DDOS_PREFIX_IPV4_BITS 24
+#define DDOS_PREFIX_IPV6_BITS 64
+#define MILLITOKENS 1000
+
+struct ddos_prefix {
+	ip_subnet prefix;
+	intmax_t millitokens;		/* can go negative */
+	monotime_t refilled;
+	monotime_t first_seen;
+	unsigned long nr[DDOS_VERDICT_ROOF];
+	struct {
+		struct list_entry list;	/* LRU order */
+		struct list_entry prefix;
+	} ddos_prefix_db_entries;
+};
+
+static size_t jam_ddos_prefix(struct jambuf *buf, const struct ddos_prefix *p)
+{
+	return jam_subnet(buf, &p->prefix);
+}
+
+static hash_t hash_ddos_prefix_prefix(const ip_subnet *prefix)
+{
+	return hash_thing(prefix->bytes, zero_hash);
+}
+
+HASH_TABLE(ddos_prefix, prefix, .prefix, 251);
+
+static void ddos_prefix_db_init(struct logger *logger);
+static void ddos_prefix_db_check(struct logger *logger) UNUSED;
+static void ddos_prefix_db_init_ddos_prefix(struct ddos_prefix *);
+static void ddos_prefix_db_add(struct ddos_prefix *);
+static void ddos_prefix_db_del(struct ddos_prefix *);
+
+HASH_DB(ddos_prefix, &ddos_prefix_prefix_hash_table);
+
+static unsigned nr_ddos_prefixes;
+
+static ip_subnet ddos_prefix_from_address(const ip_address address)
+{
+	const struct ip_info *afi = address_info(address);
+	unsigned bits = (afi == &ipv4_info ? DDOS_PREFIX_IPV4_BITS :
+			 DDOS_PREFIX_IPV6_BITS);
+	return subnet_from_raw(HERE, afi,
+			       ip_bytes_blit(afi, address.bytes,
+					     &keep_routing_prefix,
+					     &clear_host_identifier,
+					     bits),
+			       bits);
+}
+
+static struct ddos_prefix *ddos_prefix_by_prefix(const ip_subnet *prefix)
+{
+	hash_t hash = hash_ddos_prefix_prefix(prefix);
+	struct list_head *bucket = hash_table_bucket(&ddos_prefix_prefix_hash_table, hash);
+	struct ddos_prefix *p;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(p, bucket) {
+		if (subnet_eq_subnet(p->prefix, *prefix)) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static void free_ddos_prefix(struct ddos_prefix **p)
+{
+	ddos_prefix_db_del(*p);
+	nr_ddos_prefixes--;
+	pfree(*p);
+	*p = NULL;
+}
+
+bool ddos_prefix_rate_limited(void)
+{
+	return (pluto_ddos_prefix_rate > 0 &&
+		pluto_ddos_prefix_table_size > 0);
+}
+
+enum ddos_verdict ddos_admit_new_exchange(const ip_address *sender,
+					  struct logger *logger)
+{
+	if (!ddos_prefix_rate_limited()) {
+		return DDOS_ACCEPT;
+	}
+
+	monotime_t now = mononow();
+	ip_subnet prefix = ddos_prefix_from_address(*sender);
+	struct ddos_prefix *p = ddos_prefix_by_prefix(&prefix);
+	if (p == NULL) {
+		if (nr_ddos_prefixes >= pluto_ddos_prefix_table_size) {
+			/* evict the least recently used */
+			struct ddos_prefix *lru = NULL;
+			FOR_EACH_LIST_ENTRY_OLD2NEW(lru, &ddos_prefix_db_list_head) {
+				break;
+			}
+			pstats_ddos_prefix_evictions++;
+			free_ddos_prefix(&lru);
+		}
+		p = alloc_thing(struct ddos_prefix, "ddos prefix");
+		p->prefix = prefix;
+		p->millitokens = (intmax_t)pluto_ddos_prefix_burst * MILLITOKENS;
+		p->refilled = p->first_seen = now;
+		ddos_prefix_db_init_ddos_prefix(p);
+		ddos_prefix_db_add(p);
+		nr_ddos_prefixes++;
+	} else {
+		/* most recently used */
+		remove_list_entry(&p->ddos_prefix_db_entries.list);
+		insert_list_entry(&ddos_prefix_db_list_head,
+				  &p->ddos_prefix_db_entries.list);
+	}
+
+	/* refill; rate is tokens/second aka millitokens/millisecond */
+	intmax_t ms = milliseconds_from_deltatime(monotime_diff(now, p->refilled));
+	if (ms > 0) {
+		intmax_t burst = (intmax_t)pluto_ddos_prefix_burst * MILLITOKENS;
+		p->millitokens = min(p->millitokens + ms * pluto_ddos_prefix_rate, burst);
+		p->refilled = now;
+	}
+
+	enum ddos_verdict verdict;
+	if (p->millitokens >= MILLITOKENS) {
+		verdict = DDOS_ACCEPT;
+		p->millitokens -= MILLITOKENS;
+	} else if (p->millitokens > -(intmax_t)pluto_ddos_prefix_burst * MILLITOKENS) {
+		verdict = DDOS_COOKIE;
+		p->millitokens -= MILLITOKENS;
+	} else {
+		verdict = DDOS_DROP;
+	}
+	p->nr[verdict]++;
+	pstats_ddos_prefix[verdict]++;
+
+	if (verdict != DDOS_ACCEPT) {
+		subnet_buf sb;
+		ldbg(logger, "DDOS: prefix %s is over its rate limit, %s",
+		     str_subnet(&p->prefix, &sb),
+		     (verdict == DDOS_COOKIE ? "requiring cookies" : "dropping"));
+	}
+	return verdict;
+}
+
+void whack_ddosstatus(const struct whack_message *wm UNUSED, struct show *s)
+{
+	name_buf nb;
+	show(s, "ddos-mode=%s, ddos-ike-threshold=%u, max-halfopen-ike=%u, half-open=%lu, cookies %s",
+	     str_sparse_short(&ddos_mode_names, pluto_ddos_mode, &nb),
+	     pluto_ddos_ike_threshold, pluto_max_halfopen_ike,
+	     total_halfopen_ike(),
+	     (require_ddos_cookies() ? "required" : "not required"));
+	show(s, "ddos-prefix-rate=%u, ddos-prefix-burst=%u, ddos-prefix-table-size=%u, prefixes=%u",
+	     pluto_ddos_prefix_rate, pluto_ddos_prefix_burst,
+	     pluto_ddos_prefix_table_size, nr_ddos_prefixes);
+
+	monotime_t now = mononow();
+	const struct ddos_prefix *p;
+	/* most recently used first */
+	FOR_EACH_LIST_ENTRY_NEW2OLD(p, &ddos_prefix_db_list_head) {
+		SHOW_JAMBUF(s, buf) {
+			jam_subnet(buf, &p->prefix);
+			jam(buf, ": tokens=%jd", p->millitokens / MILLITOKENS);
+			jam(buf, ", accepted=%lu", p->nr[DDOS_ACCEPT]);
+			jam(buf, ", cookies=%lu", p->nr[DDOS_COOKIE]);
+			jam(buf, ", dropped=%lu", p->nr[DDOS_DROP]);
+			jam_string(buf, ", idle=");
+			jam_deltatime(buf, monotime_diff(now, p->refilled));
+			jam_string(buf, "s, age=");
+			jam_deltatime(buf, monotime_diff(now, p->first_seen));
+			jam_string(buf, "s");
+		}
+	}
+}
+
+void free_ddos(struct logger *logger)
+{
+	struct ddos_prefix *p;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(p, &ddos_prefix_db_list_head) {
+		free_ddos_prefix(&p);
+	}
+	ldbg(logger, "DDOS: freed prefix table");
+}
+
+void init_ddos(const struct config_setup *oco, struct logger *logger)
 {
 	pluto_ddos_mode = config_setup_option(oco, KBF_DDOS_MODE);
 	pluto_ddos_ike_threshold = config_setup_option(oco, KBF_DDOS_IKE_THRESHOLD);
 	pluto_max_halfopen_ike = config_setup_option(oco, KBF_MAX_HALFOPEN_IKE);
+	pluto_ddos_prefix_table_size = config_setup_option(oco, KBF_DDOS_PREFIX_TABLE_SIZE);
+	pluto_ddos_prefix_rate = config_setup_option(oco, KBF_DDOS_PREFIX_RATE);
+	pluto_ddos_prefix_burst = config_setup_option(oco, KBF_DDOS_PREFIX_BURST);
+	ddos_prefix_db_init(logger);
 }
@@ -31,6 +31,8 @@ struct logger;
 struct jambuf;
 struct config_setup;
 
+#include "ip_address.h"
+
 extern void set_ddos_mode(enum ddos_mode mode, struct logger *logger);
 
 void whack_ddos(const struct whack_message *wm, struct show *s);
@@ -41,7 +43,25 @@ void show_ddos(struct show *s);
 bool require_ddos_cookies(void);
 err_t drop_new_exchanges(struct logger *logger);
 
+/*
+ * Per-source-prefix rate limit on new exchanges; consulted before
+ * the message is parsed.
+ */
+
+enum ddos_verdict {
+	DDOS_ACCEPT,	/* within the prefix's rate */
+	DDOS_COOKIE,	/* over the rate, demand a cookie */
+	DDOS_DROP,	/* well over the rate */
+#define DDOS_VERDICT_ROOF (DDOS_DROP+1)
+};
+
+bool ddos_prefix_rate_limited(void);
+enum ddos_verdict ddos_admit_new_exchange(const ip_address *sender,
+					  struct logger *logger);
+void whack_ddosstatus(const struct whack_message *wm, struct show *s);
+
 void init_ddos(const struct config_setup *oco, struct logger *logger);
+void free_ddos(struct logger *logger);
 
 #endif
 
@@ -272,14 +272,9 @@ void process_md(struct msg_digest *md)
  * input packet buffer, an auto.
  */
 
-void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
+static void process_iface_read_packet(struct iface_endpoint **ifpp,
+				      struct logger *logger)
 {
-	struct iface_endpoint *ifp = ifp_arg;
-	ifp_arg = NULL; /* can no longer be trusted */
-
-	/* on the same page^D^D^D fd? */
-	pexpect(ifp->fd == fd);
-
 	threadtime_t md_start = threadtime_start();
 
 	/*
@@ -292,7 +287,7 @@ void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
 	 * instance when there's a non-recoverable error IFP may be
 	 * zapped.
 	 */
-	struct msg_digest *md = ifp->io->read_packet(&ifp, logger);
+	struct msg_digest *md = (*ifpp)->io->read_packet(ifpp, logger);
 
 	if (md != NULL) {
 
@@ -328,6 +323,25 @@ void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
 			"%s() reading and processing packet", __func__);
 }
 
+void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
+{
+	struct iface_endpoint *ifp = ifp_arg;
+	ifp_arg = NULL; /* can no longer be trusted */
+
+	/* on the same page^D^D^D fd? */
+	pexpect(ifp->fd == fd);
+
+	/*
+	 * Keep going while there are packets that have already been
+	 * read (for instance, a batch of UDP datagrams).
+	 */
+	do {
+		process_iface_read_packet(&ifp, logger);
+	} while (ifp != NULL &&
+		 ifp->io->pending_packet != NULL &&
+		 ifp->io->pending_packet(ifp));
+}
+
 static void handle_md_event(const char *story UNUSED, struct state *st, void *context)
 {
 	pexpect(st == NULL);
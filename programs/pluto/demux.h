@@ -32,10 +32,11 @@
 #include "refcnt.h"
 #include "where.h"
 #include "crypt_mac.h"
+#include "lswlog.h"		/* for struct logger */
 
 struct state;   /* forward declaration of tag */
 struct iface_endpoint;
-struct logger;
+struct show;
 
 /*
  * Used by UDP and TCP to inject packets.
@@ -161,6 +162,9 @@ struct msg_digest {
 						 * message */
 	struct state *v1_st;			/* (v1) current state object */
 	struct logger *logger;			/* logger for this MD */
+	struct logger md_logger;		/* .logger points here */
+	unsigned md_pool;			/* size class; see msgdigest.c */
+	struct msg_digest *md_pool_next;	/* when on the free list */
 
 	threadtime_t md_inception;		/* when was this started */
 
@@ -249,9 +253,14 @@ struct msg_digest *md_addref_where(struct msg_digest *md, where_t where);
 void md_delref_where(struct msg_digest **mdp, where_t where);
 #define md_delref(MDP) md_delref_where(MDP, HERE)
 
-/* only the buffer */
+/* only the buffer; a clone is marked as a fake (impair) message */
+struct msg_digest *copy_raw_md(struct msg_digest *md, where_t where);
 struct msg_digest *clone_raw_md(struct msg_digest *md, where_t where);
 
+void show_md_pool(struct show *s);
+void clear_md_pool_stats(void);
+void free_md_pool(struct logger *logger);
+
 void schedule_md_event(const char *story, struct msg_digest *md);
 
 void llog_msg_digest(lset_t rc_flags, struct logger *logger,
@@ -14,42 +14,244 @@
  */
 
 #include <stdint.h>
+#include <limits.h>		/* for ULONG_MAX */
 
 #include "defs.h"
 #include "hash_table.h"
 
 #include "log.h"
+#include "rnd.h"		/* for get_rnd_bytes() */
+#include "timer.h"
+#include "show.h"
 
-const hash_t zero_hash = { 0 };
+/*
+ * Grow when the average bucket holds more than MAX_LOAD entries;
+ * shrink (but never below the initial size) when it holds less than
+ * 1/MIN_LOAD.
+ *
+ * Each event-loop pass drains at most REHASH_BATCH entries from each
+ * table being resized.
+ */
 
-void init_hash_table(struct hash_table *table, struct logger *logger)
+#define HASH_TABLE_MAX_LOAD 2
+#define HASH_TABLE_MIN_LOAD 8
+#define HASH_TABLE_REHASH_BATCH 1024
+
+static struct hash_table *hash_tables;	/* all tables, in init order */
+static struct hash_table **hash_tables_tail = &hash_tables;
+static bool hash_table_timer_initialized;
+
+static void init_slots(struct hash_table *table,
+		       struct list_head *slots, unsigned long nr_slots)
 {
-	ldbg(logger, "initialize %s hash table", table->info->name);
-	for (unsigned i = 0; i < table->nr_slots; i++) {
-		struct list_head *slot = &table->slots[i];
+	for (unsigned long i = 0; i < nr_slots; i++) {
+		struct list_head *slot = &slots[i];
 		*slot = (struct list_head) INIT_LIST_HEAD(slot, table->info);
 	}
 }
 
-hash_t hash_bytes(const void *ptr, size_t len, hash_t hash)
+void init_hash_table(struct hash_table *table, struct logger *logger)
 {
-	/*
-	 * 251 is a prime close to 256 (so like <<8).
-	 *
-	 * There's no real rationale for doing this.
-	 */
-	const uint8_t *bytes = ptr;
-	for (unsigned j = 0; j < len; j++) {
-		hash.hash = hash.hash * 251 + bytes[j];
-	}
-	return hash;
+	ldbg(logger, "initialize %s hash table", table->info->name);
+	init_slots(table, table->slots, table->nr_slots);
+	*hash_tables_tail = table;
+	hash_tables_tail = &table->next;
+}
+
+void init_hash_table_key(struct logger *logger)
+{
+	struct hash_key key;
+	get_rnd_bytes(&key, sizeof(key));
+	init_hash_key(&key);
+	ldbg(logger, "hash table key initialized");
 }
 
 struct list_head *hash_table_bucket(struct hash_table *table, hash_t hash)
 {
+	if (table->old.slots != NULL) {
+		unsigned long old = hash.hash % table->old.nr_slots;
+		if (old >= table->old.drained) {
+			return &table->old.slots[old];
+		}
+	}
 	return &table->slots[hash.hash % table->nr_slots];
 }
 
+/*
+ * Move roughly BATCH entries from the OLD buckets into the new
+ * buckets; return true when all are drained.
+ *
+ * A bucket is always moved in full: hash_table_bucket() only looks
+ * in the new buckets once the old bucket is drained, so a partially
+ * moved bucket would hide entries from lookups.
+ *
+ * Entries are moved oldest first so that, in the new bucket, the
+ * relative order of entries with the same hash is preserved.
+ */
+
+static bool drain_hash_table(struct hash_table *table, unsigned long batch)
+{
+	while (table->old.drained < table->old.nr_slots) {
+		if (batch == 0) {
+			return false;
+		}
+		struct list_head *old = &table->old.slots[table->old.drained];
+		void *data;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(data, old) {
+			if (batch > 0) {
+				batch--;
+			}
+			struct list_entry *entry = table->entry(data);
+			hash_t hash = table->hasher(data);
+			remove_list_entry(entry);
+			insert_list_entry(&table->slots[hash.hash % table->nr_slots], entry);
+		}
+		table->old.drained++;
+	}
+
+	ldbg(&global_logger, "%s hash table: resized from %lu to %lu buckets",
+	     table->name, table->old.nr_slots, table->nr_slots);
+	if (table->old.slots != table->initial.slots) {
+		pfree(table->old.slots);
+	}
+	zero(&table->old);
+	return true;
+}
+
+static void resize_hash_table(struct hash_table *table, unsigned long nr_slots)
+{
+	PASSERT(&global_logger, table->old.slots == NULL);
+	ldbg(&global_logger, "%s hash table: resizing from %lu to %lu buckets; %ld entries",
+	     table->name, table->nr_slots, nr_slots, table->nr_entries);
+	table->old.slots = table->slots;
+	table->old.nr_slots = table->nr_slots;
+	table->old.drained = 0;
+	table->slots = (nr_slots == table->initial.nr_slots ? table->initial.slots :
+			alloc_things(struct list_head, nr_slots, table->name));
+	table->nr_slots = nr_slots;
+	init_slots(table, table->slots, table->nr_slots);
+}
+
+/*
+ * Called after every add/del.  Only starts the resize; the buckets
+ * are drained later by the timer.
+ */
+
+static void maybe_resize_hash_table(struct hash_table *table)
+{
+	if (!hash_table_timer_initialized || table->old.slots != NULL) {
+		return;
+	}
+	unsigned long nr_entries = table->nr_entries;
+	if (nr_entries > table->nr_slots * HASH_TABLE_MAX_LOAD) {
+		table->nr_grows++;
+		resize_hash_table(table, table->nr_slots * 2 + 1);
+	} else if (table->nr_slots > table->initial.nr_slots &&
+		   nr_entries < table->nr_slots / HASH_TABLE_MIN_LOAD) {
+		table->nr_shrinks++;
+		resize_hash_table(table, max((table->nr_slots - 1) / 2,
+					     table->initial.nr_slots));
+	} else {
+		return;
+	}
+	schedule_oneshot_timer(EVENT_REHASH_HASH_TABLES, deltatime(0));
+}
+
+static void rehash_hash_tables(struct logger *logger UNUSED)
+{
+	bool again = false;
+	for (struct hash_table *table = hash_tables; table != NULL; table = table->next) {
+		if (table->old.slots == NULL) {
+			continue;
+		}
+		if (drain_hash_table(table, HASH_TABLE_REHASH_BATCH)) {
+			/* perhaps it needs to grow again */
+			maybe_resize_hash_table(table);
+		}
+		again |= (table->old.slots != NULL);
+	}
+	if (again) {
+		schedule_oneshot_timer(EVENT_REHASH_HASH_TABLES, deltatime(0));
+	}
+}
+
+void init_hash_table_timer(struct logger *logger)
+{
+	init_oneshot_timer(EVENT_REHASH_HASH_TABLES, rehash_hash_tables);
+	hash_table_timer_initialized = true;
+	/* catch up with anything added before the event-loop */
+	for (struct hash_table *table = hash_tables; table != NULL; table = table->next) {
+		maybe_resize_hash_table(table);
+	}
+	ldbg(logger, "hash table resizing enabled");
+}
+
+void free_hash_tables(struct logger *logger)
+{
+	hash_table_timer_initialized = false;
+	for (struct hash_table *table = hash_tables; table != NULL; table = table->next) {
+		if (table->old.slots != NULL) {
+			drain_hash_table(table, ULONG_MAX);
+		}
+		if (table->slots != table->initial.slots) {
+			/* what ever is left goes back to the static buckets */
+			resize_hash_table(table, table->initial.nr_slots);
+			drain_hash_table(table, ULONG_MAX);
+		}
+		ldbg(logger, "%s hash table: freed", table->name);
+	}
+}
+
+void show_hash_tables(struct show *s)
+{
+	static const struct {
+		const char *name;
+		unsigned long floor;
+	} lengths[] = {
+		{ "0", 0, },
+		{ "1", 1, },
+		{ "2-3", 2, },
+		{ "4-7", 4, },
+		{ "8-15", 8, },
+		{ "16-31", 16, },
+		{ "32-63", 32, },
+		{ "64+", 64, },
+	};
+	for (struct hash_table *table = hash_tables; table != NULL; table = table->next) {
+		unsigned long histogram[elemsof(lengths)] = {0};
+		for (unsigned long n = 0; n < table->nr_slots + table->old.nr_slots; n++) {
+			if (n >= table->nr_slots &&
+			    n - table->nr_slots < table->old.drained) {
+				/* already drained */
+				continue;
+			}
+			const struct list_head *bucket =
+				(n < table->nr_slots ? &table->slots[n] :
+				 &table->old.slots[n - table->nr_slots]);
+			unsigned long length = 0;
+			const void *data;
+			FOR_EACH_LIST_ENTRY_NEW2OLD(data, bucket) {
+				length++;
+			}
+			unsigned i = elemsof(lengths) - 1;
+			while (length < lengths[i].floor) {
+				i--;
+			}
+			histogram[i]++;
+		}
+		show(s, "current.hash.%s.entries=%ld", table->name, table->nr_entries);
+		show(s, "current.hash.%s.buckets=%lu", table->name, table->nr_slots);
+		show(s, "current.hash.%s.rehashing=%lu", table->name,
+		     table->old.nr_slots - table->old.drained);
+		show(s, "current.hash.%s.grows=%u", table->name, table->nr_grows);
+		show(s, "current.hash.%s.shrinks=%u", table->name, table->nr_shrinks);
+		for (unsigned i = 0; i < elemsof(lengths); i++) {
+			show(s, "current.hash.%s.length.%s=%lu",
+			     table->name, lengths[i].name, histogram[i]);
+		}
+	}
+}
+
 void init_hash_table_entry(struct hash_table *table, void *data)
 {
 	LDBGP_JAMBUF(DBG_TMI, &global_logger, buf) {
@@ -73,6 +275,7 @@ void add_hash_table_entry(struct hash_table *table, void *data)
 		table->info->jam(buf, data);
 		jam(buf, " added to hash table bucket %p", bucket);
 	}
+	maybe_resize_hash_table(table);
 }
 
 void del_hash_table_entry(struct hash_table *table, void *data)
@@ -86,6 +289,7 @@ void del_hash_table_entry(struct hash_table *table, void *data)
 	struct list_entry *entry = table->entry(data);
 	remove_list_entry(entry);
 	table->nr_entries--;
+	maybe_resize_hash_table(table);
 }
 
 /*
@@ -114,8 +318,10 @@ static void check_hash_table_entry(struct hash_table *table, void *data,
 		}
 	}
 	/* ... but plan for the worst */
-	for (unsigned n = 0; n < table->nr_slots; n++) {
-		const struct list_head *table_bucket = &table->slots[n];
+	for (unsigned long n = 0; n < table->nr_slots + table->old.nr_slots; n++) {
+		const struct list_head *table_bucket =
+			(n < table->nr_slots ? &table->slots[n] :
+			 &table->old.slots[n - table->nr_slots]);
 		void *bucket_data;
 		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket_data, table_bucket) {
 			if (data == bucket_data) {
@@ -137,8 +343,10 @@ static void check_hash_table_entry(struct hash_table *table, void *data,
 
 void check_hash_table(struct hash_table *table, struct logger *logger)
 {
-	for (unsigned n = 0; n < table->nr_slots; n++) {
-		const struct list_head *table_bucket = &table->slots[n];
+	for (unsigned long n = 0; n < table->nr_slots + table->old.nr_slots; n++) {
+		const struct list_head *table_bucket =
+			(n < table->nr_slots ? &table->slots[n] :
+			 &table->old.slots[n - table->nr_slots]);
 		void *bucket_data;
 		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket_data, table_bucket) {
 			/* overkill */
@@ -17,23 +17,48 @@
 #define HASH_TABLE_H
 
 #include "list_entry.h"
-#include "shunk.h"		/* has constant ptr */
+#include "hash_bytes.h"		/* for hash_t hash_thing() hash_hunk() */
 #include "where.h"
 
 /*
  * Generic hash table.
  */
 
-typedef struct { unsigned hash; } hash_t;
-extern const hash_t zero_hash;
+struct show;
+
+/*
+ * The table starts out using the statically allocated INITIAL
+ * buckets and then grows (and shrinks back) as NR_ENTRIES changes.
+ *
+ * Resizing is incremental: the current buckets are moved to OLD and
+ * then, from the event-loop, drained a few at a time into the new
+ * buckets.  While this is happening, OLD buckets [0..DRAINED) are
+ * empty and lookups for those go to the new buckets.
+ *
+ * Draining is never done while adding or deleting an entry as a
+ * caller may be part way through walking a bucket.
+ */
 
 struct hash_table {
+	const char *const name;
 	const struct list_info *const info;
 	hash_t (*hasher)(const void *data);
 	struct list_entry *(*entry)(void *data);
-	long nr_entries; /* approx? */
+	long nr_entries;
 	unsigned long nr_slots;
 	struct list_head *slots;
+	const struct {
+		unsigned long nr_slots;
+		struct list_head *slots;
+	} initial;
+	struct {
+		unsigned long nr_slots;
+		struct list_head *slots;
+		unsigned long drained;
+	} old;
+	unsigned nr_grows;
+	unsigned nr_shrinks;
+	struct hash_table *next;	/* all tables */
 };
 
 #define HASH_TABLE(STRUCT, NAME, FIELD, NR_BUCKETS)			\
@@ -56,27 +81,36 @@ struct hash_table {
 	}								\
 									\
 	struct hash_table STRUCT##_##NAME##_hash_table = {		\
+		.name = #STRUCT "." #NAME,				\
 		.hasher = hash_table_hash_##STRUCT##_##NAME,		\
 		.entry = hash_table_entry_##STRUCT##_##NAME,		\
 		.nr_slots = NR_BUCKETS,					\
 		.slots = STRUCT##_##NAME##_buckets,			\
+		.initial = {						\
+			.nr_slots = NR_BUCKETS,				\
+			.slots = STRUCT##_##NAME##_buckets,		\
+		},							\
 		.info = &STRUCT##_##NAME##_hash_info,			\
 	}
 
 void init_hash_table(struct hash_table *table, struct logger *logger);
 void check_hash_table(struct hash_table *table, struct logger *logger);
 
-hash_t hash_bytes(const void *ptr, size_t len, hash_t hash);
-#define hash_hunk(HUNK, HASH)						\
-	({								\
-		typeof(HUNK) h_ = HUNK; /* evaluate once */		\
-		hash_bytes(h_.ptr, h_.len, HASH);			\
-	})
-#define hash_thing(THING, HASH)						\
-	({								\
-		shunk_t h_ = THING_AS_SHUNK(THING); /* evaluate once */	\
-		hash_bytes(h_.ptr, h_.len, HASH);			\
-	})
+/*
+ * Once the event-loop is running, tables can be resized; before then
+ * (and after free_hash_tables()) they stay put.
+ */
+
+void init_hash_table_timer(struct logger *logger);
+void free_hash_tables(struct logger *logger);
+void show_hash_tables(struct show *s);
+
+/*
+ * Seed hash_bytes() with random bytes; needs NSS and must be called
+ * before anything is added to a table.
+ */
+
+void init_hash_table_key(struct logger *logger);
 
 /*
  * Maintain the table.
@@ -35,6 +35,9 @@ struct config_setup;
 
 extern unsigned pluto_ike_socket_bufsize; /* pluto IKE socket buffer */
 extern bool pluto_ike_socket_errqueue; /* Enable MSG_ERRQUEUE on IKE socket */
+extern unsigned pluto_ike_socket_batch; /* UDP datagrams read per wakeup */
+#define MAX_IKE_SOCKET_BATCH 64
+extern bool pluto_ike_socket_send_batch; /* queue UDP sends until the end of the event */
 
 extern const char *pluto_listen;	/* from --listen flag */
 extern bool pluto_listen_udp;
@@ -56,9 +59,12 @@ struct iface_io {
 	const struct ip_protocol *protocol;
 	struct msg_digest *(*read_packet)(struct iface_endpoint **ifp,
 					  struct logger *logger);
+	/* optional; true when read_packet() has more already read */
+	bool (*pending_packet)(const struct iface_endpoint *ifp);
 	ssize_t (*write_packet)(const struct iface_endpoint *ifp,
 				shunk_t packet,
 				const ip_endpoint *remote_endpoint,
+				bool just_a_keepalive,
 				struct logger *logger);
 	void (*cleanup)(struct iface_endpoint *ifp);
 	void (*listen)(struct iface_endpoint *fip, struct logger *logger);
@@ -168,6 +174,7 @@ struct iface_endpoint {
 	/* udp only */
 	struct {
 		struct fd_read_listener *read_listener;
+		struct udp_send_queue *send_queue;
 	} udp;
 	struct {
 		/* tcp port only */
@@ -228,5 +235,6 @@ struct iface_endpoint *alloc_iface_endpoint(int fd,
 
 void init_ifaces(const struct config_setup *oco, struct logger *logger);
 void shutdown_ifaces(struct logger *logger);
+void init_udp_send_queue(struct logger *logger);
 
 #endif
@@ -23,6 +23,10 @@
  * for more details.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* for recvmmsg() sendmmsg() */
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>		/* MSG_ERRQUEUE if defined */
 #include <netinet/udp.h>
@@ -47,6 +51,10 @@
 #include "log_limiter.h"
 #include "ip_info.h"
 #include "ip_sockaddr.h"
+#include "pluto_stats.h"
+#include "ikev2_cookie.h"	/* for v2_rejected_initiator_cookie_from_packet() */
+#include "impair.h"		/* for jacob_two_two */
+#include "timer.h"		/* for schedule_oneshot_timer() */
 
 #ifdef UDP_ENCAP
 static int espinudp_enable_esp_encapsulation(int fd, struct logger *logger)
@@ -98,48 +106,18 @@ static bool check_msg_errqueue(const struct iface_endpoint *ifp,
 			       struct logger *logger);
 #endif
 
-static struct msg_digest * udp_read_packet(struct iface_endpoint **ifpp,
-					   struct logger *logger)
-{
-	struct iface_endpoint *ifp = *ifpp; /*never closed? */
-#ifdef MSG_ERRQUEUE
-	/*
-	 * Even though select(2) says that there is a message, it
-	 * might only be a MSG_ERRQUEUE message.  At least sometimes
-	 * that leads to a hanging recvfrom.  To avoid what appears to
-	 * be a kernel bug, check_msg_errqueue uses poll(2) and tells
-	 * us if there is anything for us to read.
-	 *
-	 * This is early enough that teardown isn't required:
-	 * just return on failure.
-	 */
-	if (pluto_ike_socket_errqueue) {
-		threadtime_t errqueue_start = threadtime_start();
-		bool errqueue_ok = check_msg_errqueue(ifp, POLLIN, __func__,
-						      logger);
-		threadtime_stop(&errqueue_start, SOS_NOBODY,
-				"%s() calling check_incoming_msg_errqueue()", __func__);
-		if (!errqueue_ok) {
-			return false; /* no normal message to read */
-		}
-	}
-#endif
-
-	/*
-	 * COVERITY reports an overflow because FROM.LEN (aka
-	 * sizeof(FROM.SA)) > sizeof(from.sa.sa).  That's the point.
-	 * The FROM.SA union is big enough to hold sockaddr,
-	 * sockaddr_in and sockaddr_in6.
-	 */
-	ip_sockaddr from = {
-		.len = sizeof(from.sa),
-	};
-	uint8_t bigbuffer[MAX_INPUT_UDP_SIZE]; /* ??? this buffer seems *way* too big */
-	ssize_t packet_len = recvfrom(ifp->fd, bigbuffer, sizeof(bigbuffer),
-				      /*flags*/ 0, &from.sa.sa, &from.len);
-	uint8_t *packet_ptr = bigbuffer;
-	int packet_errno = errno; /* save!!! */
+/*
+ * Turn a datagram (or the failure to read one) into a message
+ * digest.
+ */
 
+static struct msg_digest *udp_decode_packet(struct iface_endpoint *ifp,
+					    ip_sockaddr from,
+					    uint8_t *packet_ptr,
+					    ssize_t packet_len,
+					    int packet_errno,
+					    struct logger *logger)
+{
 	/*
 	 * Try to decode the from address.
 	 *
@@ -245,10 +223,186 @@ static struct msg_digest * udp_read_packet(struct iface_endpoint **ifpp,
 		return NULL;
 	}
 
+	/*
+	 * Rate limit IKE_SA_INIT requests and, when under attack,
+	 * check their cookie before going to the expense of a
+	 * message digest.
+	 */
+	if (v2_rejected_initiator_cookie_from_packet(ifp, &sender,
+						     shunk2(packet_ptr, packet_len),
+						     logger)) {
+		return NULL;
+	}
+
 	struct msg_digest *md = alloc_md(ifp, &sender, packet_ptr, packet_len, HERE);
 	return md;
 }
 
+
+/*
+ * Read one datagram per wakeup (ike-socket-batch=1).
+ */
+
+static struct msg_digest *udp_read_one_packet(struct iface_endpoint *ifp,
+					      struct logger *logger)
+{
+#ifdef MSG_ERRQUEUE
+	/*
+	 * Even though select(2) says that there is a message, it
+	 * might only be a MSG_ERRQUEUE message.  At least sometimes
+	 * that leads to a hanging recvfrom.  To avoid what appears to
+	 * be a kernel bug, check_msg_errqueue uses poll(2) and tells
+	 * us if there is anything for us to read.
+	 *
+	 * This is early enough that teardown isn't required:
+	 * just return on failure.
+	 */
+	if (pluto_ike_socket_errqueue) {
+		threadtime_t errqueue_start = threadtime_start();
+		pstats_ike_udp_recv_errqueue++;
+		bool errqueue_ok = check_msg_errqueue(ifp, POLLIN, __func__,
+						      logger);
+		threadtime_stop(&errqueue_start, SOS_NOBODY,
+				"%s() calling check_incoming_msg_errqueue()", __func__);
+		if (!errqueue_ok) {
+			return false; /* no normal message to read */
+		}
+	}
+#endif
+
+	/*
+	 * COVERITY reports an overflow because FROM.LEN (aka
+	 * sizeof(FROM.SA)) > sizeof(from.sa.sa).  That's the point.
+	 * The FROM.SA union is big enough to hold sockaddr,
+	 * sockaddr_in and sockaddr_in6.
+	 */
+	ip_sockaddr from = {
+		.len = sizeof(from.sa),
+	};
+	uint8_t bigbuffer[MAX_INPUT_UDP_SIZE]; /* ??? this buffer seems *way* too big */
+	ssize_t packet_len = recvfrom(ifp->fd, bigbuffer, sizeof(bigbuffer),
+				      /*flags*/ 0, &from.sa.sa, &from.len);
+	int packet_errno = errno; /* save!!! */
+
+	pstats_ike_udp_recv_wakeups++;
+	if (packet_len >= 0) {
+		pstats_ike_udp_recv_datagrams++;
+	}
+
+	return udp_decode_packet(ifp, from, bigbuffer, packet_len,
+				 packet_errno, logger);
+}
+
+/*
+ * Batched receive.
+ *
+ * When woken, read up to pluto_ike_socket_batch datagrams using a
+ * single recvmmsg() and then hand them out, one per call, until
+ * udp_pending_packet() says the batch is drained.
+ *
+ * The buffers are shared by all UDP sockets; that's ok as
+ * process_iface_packet() drains the batch before returning to the
+ * event-loop.
+ *
+ * Since the socket is non-blocking, a wakeup caused by a
+ * MSG_ERRQUEUE message can't hang the read; instead recvmmsg() fails
+ * and only then is the error queue checked.
+ */
+
+static struct {
+	const struct iface_endpoint *ifp;	/* owner of the batch */
+	unsigned nr;			/* datagrams read */
+	unsigned next;			/* next datagram to return */
+	ip_sockaddr from[MAX_IKE_SOCKET_BATCH];
+	struct iovec iov[MAX_IKE_SOCKET_BATCH];
+	struct mmsghdr msg[MAX_IKE_SOCKET_BATCH];
+	uint8_t buffer[MAX_IKE_SOCKET_BATCH][MAX_INPUT_UDP_SIZE];
+} udp_batch;
+
+static bool udp_read_batch(struct iface_endpoint *ifp, struct logger *logger)
+{
+	const unsigned batch = min(pluto_ike_socket_batch, (unsigned)MAX_IKE_SOCKET_BATCH);
+
+	for (unsigned i = 0; i < batch; i++) {
+		udp_batch.from[i] = (ip_sockaddr) {
+			.len = sizeof(udp_batch.from[i].sa),
+		};
+		udp_batch.iov[i] = (struct iovec) {
+			.iov_base = udp_batch.buffer[i],
+			.iov_len = sizeof(udp_batch.buffer[i]),
+		};
+		udp_batch.msg[i] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name = &udp_batch.from[i].sa,
+				.msg_namelen = udp_batch.from[i].len,
+				.msg_iov = &udp_batch.iov[i],
+				.msg_iovlen = 1,
+			},
+		};
+	}
+
+	pstats_ike_udp_recv_wakeups++;
+	int nr = recvmmsg(ifp->fd, udp_batch.msg, batch, MSG_DONTWAIT, NULL);
+	if (nr < 0) {
+		int packet_errno = errno; /* save!!! */
+#ifdef MSG_ERRQUEUE
+		if (pluto_ike_socket_errqueue) {
+			/* this logs any errors */
+			pstats_ike_udp_recv_errqueue++;
+			check_msg_errqueue(ifp, POLLIN, __func__, logger);
+			return false;
+		}
+#endif
+		if (packet_errno == EAGAIN || packet_errno == EWOULDBLOCK) {
+			return false;
+		}
+		/* log the failure */
+		ip_sockaddr from = {
+			.len = sizeof(from.sa),
+		};
+		udp_decode_packet(ifp, from, NULL, -1, packet_errno, logger);
+		return false;
+	}
+
+	pstats_ike_udp_recv_datagrams += nr;
+	if ((unsigned)nr == batch) {
+		pstats_ike_udp_recv_full++;
+	}
+	ldbg(logger, "recvmmsg() on %s read %d of %u datagrams",
+	     ifp->ip_dev->real_device_name, nr, batch);
+
+	udp_batch.ifp = ifp;
+	udp_batch.nr = nr;
+	udp_batch.next = 0;
+	return true;
+}
+
+static bool udp_pending_packet(const struct iface_endpoint *ifp)
+{
+	return (udp_batch.ifp == ifp && udp_batch.next < udp_batch.nr);
+}
+
+static struct msg_digest *udp_read_packet(struct iface_endpoint **ifpp,
+					  struct logger *logger)
+{
+	struct iface_endpoint *ifp = *ifpp; /*never closed? */
+
+	if (pluto_ike_socket_batch <= 1) {
+		return udp_read_one_packet(ifp, logger);
+	}
+
+	if (!udp_pending_packet(ifp) &&
+	    !udp_read_batch(ifp, logger)) {
+		return NULL;
+	}
+
+	unsigned i = udp_batch.next++;
+	udp_batch.from[i].len = udp_batch.msg[i].msg_hdr.msg_namelen;
+	return udp_decode_packet(ifp, udp_batch.from[i],
+				 udp_batch.buffer[i], udp_batch.msg[i].msg_len,
+				 0, logger);
+}
+
 #ifdef USE_XFRM_INTERFACE
 static uint32_t set_mark_out(const struct logger *logger, uint32_t mark, int fd)
 {
@@ -269,10 +423,10 @@ static uint32_t set_mark_out(const struct logger *logger, uint32_t mark, int fd)
 }
 #endif
 
-static ssize_t udp_write_packet(const struct iface_endpoint *ifp,
-				shunk_t packet,
-				const ip_endpoint *remote_endpoint,
-				struct logger *logger /*possibly*/UNUSED)
+static ssize_t udp_send_packet(const struct iface_endpoint *ifp,
+			       shunk_t packet,
+			       const ip_endpoint *remote_endpoint,
+			       struct logger *logger /*possibly*/UNUSED)
 {
 #ifdef MSG_ERRQUEUE
 	if (pluto_ike_socket_errqueue) {
@@ -298,6 +452,272 @@ static ssize_t udp_write_packet(const struct iface_endpoint *ifp,
 	return ret;
 };
 
+/*
+ * Batched send.
+ *
+ * Rather than call sendto() for each datagram, queue the datagram on
+ * the interface and then, once the event that generated it has been
+ * processed, flush all queues using one sendmmsg() per interface.
+ * The flush is triggered by a zero-delay one-shot global timer so
+ * that it runs on the next event-loop iteration.
+ *
+ * When the kernel supports UDP_SEGMENT (GSO), consecutive datagrams
+ * to the same peer with the same size (for instance, all but the
+ * last IKEv2 fragment) are passed down as a single message and split
+ * by the kernel; the last segment can be shorter.
+ *
+ * The queue holds a copy of each datagram so, as far as the caller
+ * is concerned, the datagram has been sent; errors are logged when
+ * the queue is flushed (except for keepalives, which, as in
+ * send_shunks(), fail silently).
+ */
+
+struct udp_send_queue {
+	const struct iface_endpoint *ifp;
+	struct udp_send_queue *next_pending;	/* on udp_send_pending list */
+	bool pending;
+	unsigned nr;
+	struct {
+		ip_endpoint remote_endpoint;	/* for logging */
+		ip_sockaddr remote;
+		chunk_t packet;
+		bool just_a_keepalive;		/* don't log errors */
+	} send[MAX_IKE_SOCKET_BATCH];
+	struct iovec iov[MAX_IKE_SOCKET_BATCH];
+	struct mmsghdr msg[MAX_IKE_SOCKET_BATCH];
+	unsigned first[MAX_IKE_SOCKET_BATCH];	/* msg[i] sends send[first[i]] ... */
+#ifdef UDP_SEGMENT
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} control[MAX_IKE_SOCKET_BATCH];
+#endif
+};
+
+static struct udp_send_queue *udp_send_pending;
+static bool udp_send_queue_initialized;
+
+#ifdef UDP_SEGMENT
+/* UDP_SEGMENT is a per-message option; turned off when not supported */
+static bool udp_send_gso = true;
+/* a GSO message still has to fit in a single (IPv6) UDP datagram */
+#define UDP_GSO_MAX_BYTES (65535 - 40 - 8)
+#endif
+
+static void log_udp_send_error(const struct udp_send_queue *q, unsigned i,
+			       int error, struct logger *logger)
+{
+	if (q->send[i].just_a_keepalive) {
+		return;
+	}
+	endpoint_buf lb;
+	endpoint_buf rb;
+	llog_error(logger, error,
+		   "sendmmsg() on %s from %s to %s using %s failed",
+		   q->ifp->ip_dev->real_device_name,
+		   str_endpoint(&q->ifp->local_endpoint, &lb),
+		   str_endpoint_sensitive(&q->send[i].remote_endpoint, &rb),
+		   q->ifp->io->protocol->name);
+}
+
+/*
+ * Return the number of datagrams, starting at SEND[I], that can be
+ * sent as a single GSO message.
+ */
+
+static unsigned udp_send_segments(const struct udp_send_queue *q, unsigned i)
+{
+#ifdef UDP_SEGMENT
+	if (!udp_send_gso) {
+		return 1;
+	}
+	size_t gso_size = q->send[i].packet.len;
+	size_t total = gso_size;
+	unsigned n = 1;
+	while (i + n < q->nr) {
+		const chunk_t *packet = &q->send[i + n].packet;
+		if (packet->len > gso_size ||
+		    total + packet->len > UDP_GSO_MAX_BYTES ||
+		    q->send[i].remote.len != q->send[i + n].remote.len ||
+		    !memeq(&q->send[i].remote.sa, &q->send[i + n].remote.sa,
+			   q->send[i].remote.len)) {
+			break;
+		}
+		total += packet->len;
+		n++;
+		if (packet->len < gso_size) {
+			/* a short segment must be last */
+			break;
+		}
+	}
+	return n;
+#else
+	return 1;
+#endif
+}
+
+static void flush_udp_send_queue(struct udp_send_queue *q, struct logger *logger)
+{
+	if (q->nr == 0) {
+		return;
+	}
+
+	pstats_ike_udp_send_flushes++;
+
+#ifdef MSG_ERRQUEUE
+	if (pluto_ike_socket_errqueue) {
+		check_msg_errqueue(q->ifp, POLLOUT, __func__, logger);
+	}
+#endif
+
+	/* build the messages */
+	unsigned nr_msgs = 0;
+	for (unsigned i = 0; i < q->nr; ) {
+		unsigned n = udp_send_segments(q, i);
+		for (unsigned j = i; j < i + n; j++) {
+			q->iov[j] = (struct iovec) {
+				.iov_base = q->send[j].packet.ptr,
+				.iov_len = q->send[j].packet.len,
+			};
+		}
+		q->first[nr_msgs] = i;
+		q->msg[nr_msgs] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name = &q->send[i].remote.sa,
+				.msg_namelen = q->send[i].remote.len,
+				.msg_iov = &q->iov[i],
+				.msg_iovlen = n,
+			},
+		};
+#ifdef UDP_SEGMENT
+		if (n > 1) {
+			struct msghdr *hdr = &q->msg[nr_msgs].msg_hdr;
+			hdr->msg_control = q->control[nr_msgs].buf;
+			hdr->msg_controllen = sizeof(q->control[nr_msgs].buf);
+			struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t gso_size = q->send[i].packet.len;
+			memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+			pstats_ike_udp_send_gso += n;
+		}
+#endif
+		nr_msgs++;
+		i += n;
+	}
+
+	ldbg(logger, "sendmmsg() on %s sending %u datagrams using %u messages",
+	     q->ifp->ip_dev->real_device_name, q->nr, nr_msgs);
+
+	/* send them; on failure skip the message */
+	for (unsigned m = 0; m < nr_msgs; ) {
+		pstats_ike_udp_send_calls++;
+		int nr = sendmmsg(q->ifp->fd, &q->msg[m], nr_msgs - m, 0);
+		if (nr > 0) {
+			m += nr;
+			continue;
+		}
+		int error = errno; /* save!!! */
+		unsigned first = q->first[m];
+		unsigned n = q->msg[m].msg_hdr.msg_iovlen;
+#ifdef UDP_SEGMENT
+		if (n > 1 && (error == EIO || error == EINVAL ||
+			      error == ENOPROTOOPT || error == EOPNOTSUPP)) {
+			/*
+			 * The device can't do it (EIO: no checksum
+			 * offload) or the segments are too big for
+			 * the MTU (EINVAL); send each separately.
+			 */
+			if (error != EINVAL) {
+				llog_errno(RC_LOG, logger, error,
+					   "UDP GSO failed on %s, disabling: ",
+					   q->ifp->ip_dev->real_device_name);
+				udp_send_gso = false;
+			}
+			for (unsigned j = first; j < first + n; j++) {
+				pstats_ike_udp_send_calls++;
+				if (sendto(q->ifp->fd, q->send[j].packet.ptr, q->send[j].packet.len, 0,
+					   &q->send[j].remote.sa.sa, q->send[j].remote.len) < 0) {
+					log_udp_send_error(q, j, errno, logger);
+				}
+			}
+			m++;
+			continue;
+		}
+#endif
+		log_udp_send_error(q, first, error, logger);
+		m++;
+	}
+
+	for (unsigned i = 0; i < q->nr; i++) {
+		free_chunk_content(&q->send[i].packet);
+	}
+	q->nr = 0;
+}
+
+static void flush_udp_send_queues(struct logger *logger)
+{
+	struct udp_send_queue *q = udp_send_pending;
+	udp_send_pending = NULL;
+	while (q != NULL) {
+		struct udp_send_queue *next = q->next_pending;
+		q->next_pending = NULL;
+		q->pending = false;
+		flush_udp_send_queue(q, logger);
+		q = next;
+	}
+}
+
+void init_udp_send_queue(struct logger *logger)
+{
+	init_oneshot_timer(EVENT_FLUSH_UDP_SEND_QUEUES, flush_udp_send_queues);
+	udp_send_queue_initialized = true;
+	ldbg(logger, "UDP send queue enabled");
+}
+
+static ssize_t udp_write_packet(const struct iface_endpoint *ifp,
+				shunk_t packet,
+				const ip_endpoint *remote_endpoint,
+				bool just_a_keepalive,
+				struct logger *logger)
+{
+	struct udp_send_queue *q = ifp->udp.send_queue;
+	if (q == NULL ||
+	    !pluto_ike_socket_send_batch ||
+	    !udp_send_queue_initialized ||
+	    remote_endpoint->mark_out > 0 /* needs SO_MARK */ ||
+	    impair.jacob_two_two /* duplicate follows */) {
+		/* keep things in order */
+		if (q != NULL) {
+			flush_udp_send_queue(q, logger);
+		}
+		return udp_send_packet(ifp, packet, remote_endpoint, logger);
+	}
+
+	if (q->nr == elemsof(q->send)) {
+		flush_udp_send_queue(q, logger);
+	}
+
+	unsigned i = q->nr++;
+	q->send[i].remote_endpoint = *remote_endpoint;
+	q->send[i].remote = sockaddr_from_endpoint(*remote_endpoint);
+	q->send[i].packet = clone_hunk(packet, "udp send");
+	q->send[i].just_a_keepalive = just_a_keepalive;
+	pstats_ike_udp_send_queued++;
+
+	if (!q->pending) {
+		if (udp_send_pending == NULL) {
+			schedule_oneshot_timer(EVENT_FLUSH_UDP_SEND_QUEUES, deltatime(0));
+		}
+		q->pending = true;
+		q->next_pending = udp_send_pending;
+		udp_send_pending = q;
+	}
+
+	return packet.len;
+}
+
 static void udp_listen(struct iface_endpoint *ifp,
 		       struct logger *unused_logger UNUSED)
 {
@@ -305,11 +725,34 @@ static void udp_listen(struct iface_endpoint *ifp,
 		attach_fd_read_listener(&ifp->udp.read_listener, ifp->fd,
 					"udp", process_iface_packet, ifp);
 	}
+	if (ifp->udp.send_queue == NULL) {
+		ifp->udp.send_queue = alloc_thing(struct udp_send_queue, "udp send queue");
+		ifp->udp.send_queue->ifp = ifp;
+	}
 }
 
 static void udp_cleanup(struct iface_endpoint *ifp)
 {
 	detach_fd_read_listener(&ifp->udp.read_listener);
+	if (udp_batch.ifp == ifp) {
+		/* discard anything unread */
+		udp_batch.ifp = NULL;
+		udp_batch.nr = udp_batch.next = 0;
+	}
+	struct udp_send_queue *q = ifp->udp.send_queue;
+	if (q != NULL) {
+		/* send anything still queued, then forget the queue */
+		struct logger logger[1] = { global_logger, };
+		flush_udp_send_queue(q, logger);
+		for (struct udp_send_queue **pp = &udp_send_pending; *pp != NULL; pp = &(*pp)->next_pending) {
+			if (*pp == q) {
+				*pp = q->next_pending;
+				break;
+			}
+		}
+		pfree(q);
+		ifp->udp.send_queue = NULL;
+	}
 }
 
 const struct iface_io udp_iface_io = {
@@ -320,6 +763,7 @@ const struct iface_io udp_iface_io = {
 	},
 	.protocol = &ip_protocol_udp,
 	.read_packet = udp_read_packet,
+	.pending_packet = udp_pending_packet,
 	.write_packet = udp_write_packet,
 	.listen = udp_listen,
 #ifdef UDP_ENCAP
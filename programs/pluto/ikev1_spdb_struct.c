@@ -56,6 +56,7 @@
 #include "nat_traversal.h"
 #include "refcnt.h"		/* for ldbg_alloc(&global_logger, )+ldbg_free(&global_logger, ) */
 #include "secrets.h"
+#include "state_db.h"
 
 /** output an attribute (within an SA) */
 /* Note: ikev2_out_attr is a clone, with the same bugs */
@@ -964,6 +965,7 @@ static bool ikev1_out_sa(struct pbs_out *outs,
 							goto fail; /* problem generating CPI */
 
 						ipcomp_cpi_generated = true;
+						state_db_rehash_ipsec_spis(st);
 					}
 					/*
 					 * CPI is stored in network low order end of an
@@ -986,6 +988,7 @@ static bool ikev1_out_sa(struct pbs_out *outs,
 						*spi_ptr = get_ipsec_spi(c, proto, 0,
 									 st->logger);
 						*spi_generated = true;
+						state_db_rehash_ipsec_spis(st);
 					}
 					if (!out_raw((uint8_t *)spi_ptr,
 						     IPSEC_DOI_SPI_SIZE,
@@ -3368,6 +3371,9 @@ v1_notification_t parse_ipsec_sa_body(struct pbs_in *sa_pbs,           /* body o
 		COPY(ipcomp);
 #undef COPY
 
+		/* both echo_proposal() and COPY() update SPIs */
+		state_db_rehash_ipsec_spis(&child->sa);
+
 		return v1N_NOTHING_WRONG;	/* accept this transform! */
 	}
 
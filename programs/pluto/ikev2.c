@@ -1165,6 +1165,15 @@ static void process_packet_with_secured_ike_sa(struct msg_digest *md, struct ike
 	passert(!md->encrypted_payloads.parsed);
 	passert(md->message_payloads.present & (v2P(SK) | v2P(SKF)));
 
+	/*
+	 * When an earlier message is being decrypted by a helper,
+	 * hold this one until it is done.
+	 */
+	if (ike->sa.st_v2_offloaded_decrypt) {
+		hold_v2_message_during_decrypt(ike, md);
+		return;
+	}
+
 	/*
 	 * If the SKEYSEED is missing, compute it now (unless, of
 	 * course, it is already being computed in the background).
@@ -1219,6 +1228,10 @@ static void process_packet_with_secured_ike_sa(struct msg_digest *md, struct ike
 		break;
 	}
 	case v2P(SK):
+		if (offload_v2_decrypt_msg(ike, md)) {
+			/* resumes in helper's callback */
+			return;
+		}
 		if (!ikev2_decrypt_msg(ike, md)) {
 			llog_sa(RC_LOG, ike,
 				"encrypted payload seems to be corrupt; dropping packet");
@@ -68,6 +68,7 @@
 #include "ikev2_notification.h"
 #include "iface.h"
 #include "nat_traversal.h"
+#include "state_db.h"
 
 static bool emit_v2_child_response_payloads(struct ike_sa *ike,
 					    const struct child_sa *child,
@@ -117,6 +118,7 @@ static bool compute_v2_child_ipcomp_cpi(struct child_sa *larval_child)
 		return false;
 	}
 	larval_child->sa.st_ipcomp.inbound.spi = n_ipcomp_cpi;
+	state_db_rehash_ipsec_spis(&larval_child->sa);
 	return true;
 }
 
@@ -140,6 +142,7 @@ static bool compute_v2_child_spi(struct child_sa *larval_child)
 	proto_info->inbound.spi = get_ipsec_spi(cc, protocol,
 						0 /* avoid this # */,
 						larval_child->sa.logger);
+	state_db_rehash_ipsec_spis(&larval_child->sa);
 	return (proto_info->inbound.spi != 0);
 }
 
@@ -620,6 +623,7 @@ v2_notification_t process_childs_v2SA_payload(const char *what,
 			"%s proposed/accepted a proposal we don't actually support!", what);
 		return v2N_NO_PROPOSAL_CHOSEN; /* lie */
 	}
+	state_db_rehash_ipsec_spis(&child->sa);
 
 	/*
 	 * Update/check the PFS.
@@ -916,6 +920,7 @@ v2_notification_t process_v2_child_response_payloads(struct ike_sa *ike, struct
 		child->sa.st_ipcomp.outbound.last_used =
 			realnow();
 		child->sa.st_ipcomp.protocol = &ip_protocol_ipcomp;
+		state_db_rehash_ipsec_spis(&child->sa);
 	}
 
 	ikev2_derive_child_keys(ike, child);
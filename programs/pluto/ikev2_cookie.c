@@ -32,65 +32,366 @@
 #include "rnd.h"
 #include "ikev2_cookie.h"
 #include "demux.h"
-#include "ike_alg_hash.h"	/* for sha2 */
-#include "crypt_hash.h"
+#include "hash_bytes.h"		/* for mac_bytes() */
 #include "ikev2_send.h"
 #include "log.h"
 #include "state.h"
 #include "ikev2.h"
 #include "ikev2_ike_sa_init.h"
 #include "ikev2_notification.h"
+#include "log_limiter.h"
+#include "send.h"
+#include "pluto_stats.h"
+#include "ddos.h"
 
 /*
- * That the cookie size of 32-bytes happens to match
- * SHA2_256_DIGEST_SIZE is just a happy coincidence.
+ * Cookie = <VersionIDofSecret> | Hash(Ni | IPi | SPIi | <secret>)
+ * where <secret> is a randomly generated secret known only to us.
+ *
+ * The hash is a keyed MAC (SipHash-2-4, 128-bit) computed over a
+ * stack buffer; no NSS context is needed.  <secret> is the MAC key.
+ *
+ * The secret is refreshed hourly.  The previous secret is kept, and
+ * the cookie's <VersionIDofSecret> selects which one to use, so that
+ * a cookie handed out just before a refresh is still accepted.
  */
 typedef struct {
-	uint8_t bytes[32];
+	uint8_t version;
+	uint8_t mac[sizeof(struct mac_128)];
 } v2_cookie_t;
 
-static v2_cookie_t v2_cookie_secret;
+static struct hash_key v2_cookie_secret[2]; /* indexed by version & 1 */
+static uint8_t v2_cookie_version;
+static bool v2_cookie_previous_secret_valid;
 
 void refresh_v2_cookie_secret(struct logger *logger)
 {
-	get_rnd_bytes(&v2_cookie_secret, sizeof(v2_cookie_secret));
+	static bool refreshed;
+	v2_cookie_previous_secret_valid = refreshed;
+	refreshed = true;
+	v2_cookie_version++;
+	struct hash_key *secret = &v2_cookie_secret[v2_cookie_version & 1];
+	get_rnd_bytes(secret, sizeof(*secret));
 	if (LDBGP(DBG_CRYPT, logger)) {
-		LDBG_log(logger, "%s:", __func__);
-		LDBG_thing(logger, v2_cookie_secret);
+		LDBG_log(logger, "%s: version %u", __func__, v2_cookie_version);
+		LDBG_thing(logger, *secret);
+	}
+}
+
+static const struct hash_key *v2_cookie_secret_by_version(uint8_t version)
+{
+	if (version == v2_cookie_version) {
+		return &v2_cookie_secret[version & 1];
+	}
+	if (version == (uint8_t)(v2_cookie_version - 1) &&
+	    v2_cookie_previous_secret_valid) {
+		return &v2_cookie_secret[version & 1];
 	}
+	return NULL;
 }
 
 /*
- * Cookie = <VersionIDofSecret> | Hash(Ni | IPi | SPIi | <secret>)
- * where <secret> is a randomly generated secret known only to us
+ * Returns false when VERSION is stale (the peer's cookie is from a
+ * secret that is no longer known).
+ */
+
+static bool compute_v2_cookie(v2_cookie_t *cookie, uint8_t version,
+			      shunk_t Ni, const ip_address *sender,
+			      const ike_spi_t *SPIi)
+{
+	const struct hash_key *secret = v2_cookie_secret_by_version(version);
+	if (secret == NULL) {
+		return false;
+	}
+
+	shunk_t IPi = address_as_shunk(sender);
+	uint8_t buf[IKEv2_MAXIMUM_NONCE_SIZE + sizeof(ip_address) + sizeof(*SPIi)];
+	if (!pexpect(Ni.len <= IKEv2_MAXIMUM_NONCE_SIZE) ||
+	    !pexpect(IPi.len <= sizeof(ip_address))) {
+		return false;
+	}
+	uint8_t *cur = buf;
+	memcpy(cur, Ni.ptr, Ni.len);
+	cur += Ni.len;
+	memcpy(cur, IPi.ptr, IPi.len);
+	cur += IPi.len;
+	memcpy(cur, SPIi, sizeof(*SPIi));
+	cur += sizeof(*SPIi);
+
+	struct mac_128 mac = mac_bytes(secret, buf, cur - buf);
+	cookie->version = version;
+	memcpy(cookie->mac, mac.bytes, sizeof(cookie->mac));
+	return true;
+}
+
+/*
+ * Compute the cookie the peer should have sent: when REMOTE_COOKIE
+ * is non-NULL use the secret it names (falling back to the current
+ * secret if that is unknown).
+ */
+
+static void compute_v2_cookie_for_peer(v2_cookie_t *cookie,
+				       shunk_t remote_cookie,
+				       shunk_t Ni, const ip_address *sender,
+				       const ike_spi_t *SPIi)
+{
+	if (remote_cookie.len == sizeof(v2_cookie_t) &&
+	    compute_v2_cookie(cookie, ((const uint8_t *)remote_cookie.ptr)[0],
+			      Ni, sender, SPIi)) {
+		return;
+	}
+	passert(compute_v2_cookie(cookie, v2_cookie_version, Ni, sender, SPIi));
+}
+
+/*
+ * Fast path, used before a message digest is allocated.
  *
- * Our implementation does not use <VersionIDofSecret> which means
- * once a day and while under DOS attack, we could fail a few cookies
- * until the peer restarts from scratch.
+ * Apply the sender's per-prefix rate limit to new IKE_SA_INIT
+ * requests and then, when cookies are required (globally or for the
+ * prefix), pick out the COOKIE notification (which must be first)
+ * and Ni from the raw request and either answer with a cookie, drop
+ * the message, or let it through to be verified again by
+ * v2_rejected_initiator_cookie().
+ *
+ * Anything that isn't a fresh IKE_SA_INIT request (including a
+ * retransmit for an existing IKE SA) is left to the normal path.
  */
-static bool compute_v2_cookie_from_md(v2_cookie_t *cookie,
-				      struct msg_digest *md,
-				      shunk_t Ni)
+
+struct v2_raw_hdr {
+	ike_spi_t spi_i;
+	ike_spi_t spi_r;
+	uint8_t np;
+	uint8_t version;
+	uint8_t xchg;
+	uint8_t flags;
+	uint8_t msgid[4];
+	uint8_t length[4];
+};
+
+struct v2_raw_notify {
+	uint8_t np;
+	uint8_t critical;
+	uint8_t length[2];
+	uint8_t protoid;
+	uint8_t spisize;
+	uint8_t type[2];
+};
+
+static uint32_t raw_be32(const uint8_t b[4])
 {
-	struct crypt_hash *ctx = crypt_hash_init("IKEv2 COOKIE",
-						 &ike_alg_hash_sha2_256,
-						 md->logger);
+	return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
 
-	crypt_hash_digest_hunk(ctx, "Ni", Ni);
+static uint16_t raw_be16(const uint8_t b[2])
+{
+	return ((uint16_t)b[0] << 8) | b[1];
+}
 
-	ip_address sender = endpoint_address(md->sender);
-	shunk_t IPi = address_as_shunk(&sender);
-	crypt_hash_digest_hunk(ctx, "IPi", IPi);
+static void send_v2N_COOKIE_from_packet(const struct iface_endpoint *ifp,
+					const ip_endpoint *sender,
+					const struct v2_raw_hdr *request,
+					const v2_cookie_t *cookie,
+					struct logger *logger)
+{
+	lset_t rc_flags = log_limiter_rc_flags(logger, UNSECURED_LOG_LIMITER);
+	if (rc_flags != LEMPTY) {
+		LLOG_JAMBUF(rc_flags, logger, buf) {
+			jam_string(buf, "responding to ");
+			jam_enum_short(buf, &ikev2_exchange_names, request->xchg);
+			jam(buf, " request with Message ID %u", raw_be32(request->msgid));
+			jam_string(buf, " with unencrypted notification COOKIE, ");
+			jam_string(buf, "DOS mode is on, initial request must include a COOKIE");
+		}
+	}
 
-	crypt_hash_digest_thing(ctx, "SPIi", md->hdr.isa_ike_initiator_spi);
+	struct {
+		struct v2_raw_hdr hdr;
+		struct v2_raw_notify notify;
+		v2_cookie_t cookie;
+	} response = {
+		.hdr = {
+			.spi_i = request->spi_i,
+			.np = ISAKMP_NEXT_v2N,
+			.version = (IKEv2_MAJOR_VERSION << ISA_MAJ_SHIFT) | IKEv2_MINOR_VERSION,
+			.xchg = request->xchg,
+			.flags = ISAKMP_FLAGS_v2_MSG_R,
+			.length = { 0, 0, 0, sizeof(response), },
+		},
+		.notify = {
+			.np = ISAKMP_NEXT_NONE,
+			.length = { 0, sizeof(response.notify) + sizeof(response.cookie), },
+			.type = { v2N_COOKIE >> 8, v2N_COOKIE & 0xff, },
+		},
+		.cookie = *cookie,
+	};
+	memcpy(response.hdr.msgid, request->msgid, sizeof(response.hdr.msgid));
+
+	if (send_shunk_using_iface(ifp, *sender, "IKEv2 COOKIE fast path",
+				   THING_AS_SHUNK(response), logger)) {
+		pstat(ikev2_sent_notifies_e, v2N_COOKIE);
+	}
+}
 
-	crypt_hash_digest_thing(ctx, "<secret>", v2_cookie_secret);
+/*
+ * Walk the payloads of a raw IKE_SA_INIT request looking for the
+ * COOKIE notification (only when first) and Ni.  Returns NULL, or a
+ * description of why the packet is malformed.
+ */
 
-	/* happy coincidence? */
-	pexpect(sizeof(cookie->bytes) == SHA2_256_DIGEST_SIZE);
-	crypt_hash_final_bytes(&ctx, cookie->bytes, sizeof(cookie->bytes));
+static const char *scan_v2_cookie_payloads(shunk_t packet,
+					   const struct v2_raw_hdr *hdr,
+					   shunk_t *remote_cookie,
+					   bool *cookie_corrupt,
+					   shunk_t *Ni)
+{
+	if (raw_be32(hdr->length) != packet.len) {
+		return "packet with bad length";
+	}
 
-	return true;
+	const uint8_t *ptr = packet.ptr;
+	size_t offset = sizeof(*hdr);
+	unsigned np = hdr->np;
+	bool first = true;
+	while (np != ISAKMP_NEXT_NONE && Ni->ptr == NULL) {
+		struct v2_raw_notify payload; /* generic header is a prefix */
+		if (packet.len - offset < sizeof(struct ikev2_generic)) {
+			return "truncated packet";
+		}
+		memcpy(&payload, ptr + offset, sizeof(struct ikev2_generic));
+		size_t length = raw_be16(payload.length);
+		if (length < sizeof(struct ikev2_generic) ||
+		    length > packet.len - offset) {
+			return "packet with bad payload length";
+		}
+		if (first && np == ISAKMP_NEXT_v2N &&
+		    length >= sizeof(payload)) {
+			memcpy(&payload, ptr + offset, sizeof(payload));
+			if (raw_be16(payload.type) == v2N_COOKIE) {
+				*remote_cookie = shunk2(ptr + offset + sizeof(payload),
+							length - sizeof(payload));
+				*cookie_corrupt = (payload.protoid != 0 ||
+						   payload.spisize != 0 ||
+						   remote_cookie->len != sizeof(v2_cookie_t));
+			}
+		}
+		if (np == ISAKMP_NEXT_v2Ni) {
+			*Ni = shunk2(ptr + offset + sizeof(struct ikev2_generic),
+				     length - sizeof(struct ikev2_generic));
+		}
+		np = payload.np;
+		offset += length;
+		first = false;
+	}
+	return NULL;
+}
+
+bool v2_rejected_initiator_cookie_from_packet(const struct iface_endpoint *ifp,
+					      const ip_endpoint *sender,
+					      shunk_t packet,
+					      struct logger *logger)
+{
+	/*
+	 * Is this a new IKE_SA_INIT (or IKE_SESSION_RESUME)
+	 * request?
+	 */
+	struct v2_raw_hdr hdr;
+	if (packet.len < sizeof(hdr)) {
+		return false;
+	}
+	memcpy(&hdr, packet.ptr, sizeof(hdr));
+	if ((hdr.version >> ISA_MAJ_SHIFT) != IKEv2_MAJOR_VERSION ||
+	    (hdr.xchg != ISAKMP_v2_IKE_SA_INIT &&
+	     hdr.xchg != ISAKMP_v2_IKE_SESSION_RESUME) ||
+	    (hdr.flags & (ISAKMP_FLAGS_v2_IKE_I | ISAKMP_FLAGS_v2_MSG_R)) != ISAKMP_FLAGS_v2_IKE_I ||
+	    raw_be32(hdr.msgid) != 0 ||
+	    !ike_spi_is_zero(&hdr.spi_r) ||
+	    ike_spi_is_zero(&hdr.spi_i)) {
+		return false;
+	}
+
+	ip_address sender_address = endpoint_address(*sender);
+	if (!ddos_prefix_rate_limited() && !require_ddos_cookies()) {
+		return false;
+	}
+
+	/*
+	 * A retransmit, or a request returning a valid cookie, was
+	 * charged a token when first seen; don't charge it again.
+	 */
+	if (find_v2_ike_sa_by_initiator_spi(&hdr.spi_i, SA_RESPONDER) != NULL) {
+		return false;
+	}
+
+	shunk_t remote_cookie = null_shunk;
+	bool cookie_corrupt = false;
+	shunk_t Ni = null_shunk;
+	const char *bad_packet = scan_v2_cookie_payloads(packet, &hdr, &remote_cookie,
+							 &cookie_corrupt, &Ni);
+	bool Ni_ok = (Ni.ptr != NULL &&
+		      Ni.len >= IKEv2_MINIMUM_NONCE_SIZE &&
+		      Ni.len <= IKEv2_MAXIMUM_NONCE_SIZE);
+
+	v2_cookie_t my_cookie;
+	if (bad_packet == NULL && Ni_ok &&
+	    remote_cookie.ptr != NULL && !cookie_corrupt) {
+		compute_v2_cookie_for_peer(&my_cookie, remote_cookie, Ni,
+					   &sender_address, &hdr.spi_i);
+		if (hunk_eq(THING_AS_SHUNK(my_cookie), remote_cookie)) {
+			ldbg(logger, "cookies match; continuing with full parse");
+			return false; /* love the cookie */
+		}
+	}
+
+	bool me_want_cookie;
+	switch (ddos_admit_new_exchange(&sender_address, logger)) {
+	case DDOS_DROP:
+		return true; /* reject cookie */
+	case DDOS_COOKIE:
+		me_want_cookie = true;
+		break;
+	case DDOS_ACCEPT:
+	default:
+		me_want_cookie = require_ddos_cookies();
+		break;
+	}
+	if (!me_want_cookie) {
+		return false;
+	}
+
+	pstats_ike_cookie_fast_path++;
+
+	if (bad_packet != NULL) {
+		ldbg(logger, "DDOS so not responding to %s", bad_packet);
+		return true; /* reject cookie */
+	}
+
+	if (Ni.ptr == NULL) {
+		limited_llog(logger, UNSECURED_LOG_LIMITER,
+			     "DDOS cookie requires Ni paylod - dropping message");
+		return true; /* reject cookie */
+	}
+	if (!Ni_ok) {
+		limited_llog(logger, UNSECURED_LOG_LIMITER,
+			     "DOS cookie failed as Ni payload invalid - dropping message");
+		return true; /* reject cookie */
+	}
+
+	if (remote_cookie.ptr == NULL) {
+		compute_v2_cookie_for_peer(&my_cookie, remote_cookie, Ni,
+					   &sender_address, &hdr.spi_i);
+		send_v2N_COOKIE_from_packet(ifp, sender, &hdr, &my_cookie, logger);
+		return true; /* reject cookie */
+	}
+
+	if (cookie_corrupt) {
+		limited_llog(logger, UNSECURED_LOG_LIMITER,
+			     "DOS cookie notification corrupt, or invalid - dropping message");
+		return true; /* reject cookie */
+	}
+
+	limited_llog(logger, UNSECURED_LOG_LIMITER,
+		     "DOS cookies do not match - dropping message");
+	return true; /* reject cookie */
 }
 
 bool v2_rejected_initiator_cookie(struct msg_digest *md,
@@ -148,11 +449,16 @@ bool v2_rejected_initiator_cookie(struct msg_digest *md,
 		return true; /* reject cookie */
 	}
 
-	/* Most code paths require our cookie, compute it. */
+	/*
+	 * Most code paths require our cookie, compute it.  When the
+	 * peer sent a cookie, use the secret it names.
+	 */
+	shunk_t remote_cookie = (cookie_digest == NULL ? null_shunk :
+				 pbs_in_left(&cookie_digest->pbs));
+	ip_address sender = endpoint_address(md->sender);
 	v2_cookie_t my_cookie;
-	if (!compute_v2_cookie_from_md(&my_cookie, md, Ni)) {
-		return true; /* reject cookie */
-	}
+	compute_v2_cookie_for_peer(&my_cookie, remote_cookie, Ni, &sender,
+				   &md->hdr.isa_ike_initiator_spi);
 	shunk_t local_cookie = shunk2(&my_cookie, sizeof(my_cookie));
 
 	/* No cookie? demand one */
@@ -180,7 +486,6 @@ bool v2_rejected_initiator_cookie(struct msg_digest *md,
 		llog_md(md, "DOS cookie notification corrupt, or invalid - dropping message");
 		return true; /* reject cookie */
 	}
-	shunk_t remote_cookie = pbs_in_left(&cookie_digest->pbs);
 
 	if (LDBGP(DBG_BASE, logger)) {
 		LDBG_log_hunk(logger, "received cookie:", remote_cookie);
@@ -20,7 +20,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "shunk.h"
+#include "ip_endpoint.h"
+
 struct msg_digest;
+struct iface_endpoint;
+struct logger;
 struct ike_sa;
 struct child_sa;
 
@@ -29,6 +34,12 @@ void refresh_v2_cookie_secret(struct logger *logger);
 bool v2_rejected_initiator_cookie(struct msg_digest *md,
 				  bool me_want_cookies);
 
+/* rate limit and, if needed, check cookie before there's a message digest */
+bool v2_rejected_initiator_cookie_from_packet(const struct iface_endpoint *ifp,
+					      const ip_endpoint *sender,
+					      shunk_t packet,
+					      struct logger *logger);
+
 stf_status process_v2_IKE_SA_INIT_response_v2N_COOKIE(struct ike_sa *ike,
 						      struct child_sa *child,
 						      struct msg_digest *md);
@@ -32,6 +32,7 @@
 #include "authby.h"
 #include "instantiate.h"
 #include "verbose.h"
+#include "pluto_stats.h"
 
 static bool match_v2_connection(const struct connection *c,
 				const struct authby remote_authby,
@@ -171,6 +172,9 @@ static struct connection *find_v2_exact_peer_connection(const struct msg_digest
 		}
 	}
 
+	pstats_ike_responder_lookups++;
+	pstats_ike_responder_visited += hpf.visited;
+
 	if (c == NULL) {
 		endpoint_buf b;
 		name_buf xb;
@@ -333,6 +337,9 @@ static struct connection *find_v2_unset_peer_connection(const struct msg_digest
 		/* keep looking */
 	}
 
+	pstats_ike_responder_lookups++;
+	pstats_ike_responder_visited += hpf_unset.visited;
+
 	if (c == NULL) {
 		endpoint_buf b;
 		authby_buf pb;
@@ -68,6 +68,13 @@ static void schedule_liveness(struct child_sa *child, deltatime_t time_since_las
 	 */
 	delay = deltatime_sub(delay, time_since_last_contact);
 	delay = deltatime_max(delay, deltatime(MIN_LIVENESS));
+	/*
+	 * Round up to a whole MIN_LIVENESS boundary so that checks due
+	 * around the same time run, and share kernel lookups,
+	 * together.
+	 */
+	delay = slotted_event_delay(deltatime_add(delay, deltatime(MIN_LIVENESS)),
+				    deltatime(MIN_LIVENESS), deltatime(0));
 	LDBGP_JAMBUF(DBG_BASE, child->sa.logger, buf) {
 		deltatime_buf db;
 		endpoint_buf remote_buf;
@@ -259,10 +266,13 @@ void event_v2_liveness(struct state *st)
 		 child->sa.st_ah.protocol == &ip_protocol_ah ? &child->sa.st_ah :
 		 child->sa.st_ipcomp.protocol == &ip_protocol_ipcomp ? &child->sa.st_ipcomp :
 		 NULL);
+	/* checks in the same slot share the kernel lookups */
+	begin_ipsec_traffic_probe(child->sa.logger);
 	if (get_ipsec_traffic(child, first_ipsec_proto, DIRECTION_INBOUND)) {
 		deltatime_t since =
 			realtime_diff(realnow(), first_ipsec_proto->inbound.last_used);
 		if (recent_last_contact(child, since, "recent IPsec traffic")) {
+			pstats_ike_dpd_skipped++;
 			return;
 		}
 	}
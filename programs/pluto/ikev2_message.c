@@ -49,6 +49,10 @@
 #include "ip_protocol.h"
 #include "ikev2_send.h"
 #include "ikev2_notification.h"
+#include "ikev2.h"		/* for process_protected_v2_message() */
+#include "server_pool.h"
+#include "crypt_symkey.h"
+#include "config_setup.h"
 
 /*
  * Determine the IKE version we will use for the IKE packet
@@ -489,26 +493,62 @@ bool encrypt_v2SK_payload(struct v2SK_payload *sk)
  * the actual starting-variable (a.k.a. IV).
  */
 
-static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
-					  chunk_t text,
-					  shunk_t *plain,
-					  size_t iv_offset)
-{
-	struct logger *logger = ike->sa.logger;
+/*
+ * What is needed to verify and decrypt an incoming message.
+ *
+ * On the main thread this borrows from the IKE SA; a helper gets its
+ * own copy (see struct task below).
+ */
 
-	if (!ike->sa.hidden_variables.st_skeyid_calculated) {
-		endpoint_buf b;
-		llog_pexpect(ike->sa.logger, HERE,
-			     "received encrypted packet from %s but no exponents for state #%lu to decrypt it",
-			     str_endpoint_sensitive(&ike->sa.st_remote_endpoint, &b),
-			     ike->sa.st_serialno);
-		return false;
+struct v2_decrypter {
+	const struct encrypt_desc *encrypt;
+	const struct integ_desc *integ;
+	const struct cipher_context *cipher_context;
+	PK11SymKey *authkey;
+	shunk_t salt;
+};
+
+static struct v2_decrypter v2_decrypter_from_ike(struct ike_sa *ike)
+{
+	struct v2_decrypter d = {
+		.encrypt = ike->sa.st_oakley.ta_encrypt,
+		.integ = ike->sa.st_oakley.ta_integ,
+		.cipher_context = ike->sa.st_ike_decrypt_cipher_context,
+	};
+	switch (ike->sa.st_sa_role) {
+	case SA_INITIATOR:
+		/* need responders key */
+		d.authkey = ike->sa.st_skey_ar_nss;
+		d.salt = HUNK_AS_SHUNK(ike->sa.st_skey_responder_salt);
+		break;
+	case SA_RESPONDER:
+		/* need initiators key */
+		d.authkey = ike->sa.st_skey_ai_nss;
+		d.salt = HUNK_AS_SHUNK(ike->sa.st_skey_initiator_salt);
+		break;
+	default:
+		bad_case(ike->sa.st_sa_role);
 	}
+	return d;
+}
 
-	chunk_t wire_iv = chunk2(text.ptr + iv_offset, ike->sa.st_oakley.ta_encrypt->wire_iv_size);
-	size_t integ_size = (encrypt_desc_is_aead(ike->sa.st_oakley.ta_encrypt)
-			     ? ike->sa.st_oakley.ta_encrypt->aead_tag_size
-			     : ike->sa.st_oakley.ta_integ->integ_output_size);
+/*
+ * Verify and then decrypt TEXT in-place; on success PLAIN points at
+ * the decrypted payloads within TEXT.
+ *
+ * Doesn't touch the IKE SA so can be called from a helper thread.
+ */
+
+static bool verify_and_decrypt_v2_text(const struct v2_decrypter *d,
+				       chunk_t text,
+				       shunk_t *plain,
+				       size_t iv_offset,
+				       struct logger *logger)
+{
+	chunk_t wire_iv = chunk2(text.ptr + iv_offset, d->encrypt->wire_iv_size);
+	size_t integ_size = (encrypt_desc_is_aead(d->encrypt)
+			     ? d->encrypt->aead_tag_size
+			     : d->integ->integ_output_size);
 
 	/*
 	 * check to see if length is plausible:
@@ -519,9 +559,9 @@ static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
 	 */
 	uint8_t *payload_end = text.ptr + text.len;
 	if (payload_end < (wire_iv.ptr + wire_iv.len + 1 + integ_size)) {
-		llog_sa(RC_LOG, ike,
-			  "encrypted payload impossibly short (%tu)",
-			  payload_end - wire_iv.ptr);
+		llog(RC_LOG, logger,
+		     "encrypted payload impossibly short (%tu)",
+		     payload_end - wire_iv.ptr);
 		return false;
 	}
 
@@ -541,37 +581,20 @@ static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
 	 * (originally this was being done between integrity and
 	 * decrypt).
 	 */
-	size_t enc_blocksize = ike->sa.st_oakley.ta_encrypt->enc_blocksize;
-	bool pad_to_blocksize = ike->sa.st_oakley.ta_encrypt->pad_to_blocksize;
+	size_t enc_blocksize = d->encrypt->enc_blocksize;
+	bool pad_to_blocksize = d->encrypt->pad_to_blocksize;
 	if (pad_to_blocksize) {
 		if (enc.len % enc_blocksize != 0) {
-			llog_sa(RC_LOG, ike,
-				  "discarding invalid packet: %zu octet payload length is not a multiple of encryption block-size (%zu)",
-				  enc.len, enc_blocksize);
+			llog(RC_LOG, logger,
+			     "discarding invalid packet: %zu octet payload length is not a multiple of encryption block-size (%zu)",
+			     enc.len, enc_blocksize);
 			return false;
 		}
 	}
 
-	chunk_t salt;
-	PK11SymKey *authkey;
-	switch (ike->sa.st_sa_role) {
-	case SA_INITIATOR:
-		/* need responders key */
-		authkey = ike->sa.st_skey_ar_nss;
-		salt = ike->sa.st_skey_responder_salt;
-		break;
-	case SA_RESPONDER:
-		/* need initiators key */
-		authkey = ike->sa.st_skey_ai_nss;
-		salt = ike->sa.st_skey_initiator_salt;
-		break;
-	default:
-		bad_case(ike->sa.st_sa_role);
-	}
-
 	/* authenticate and decrypt the block. */
 
-	if (encrypt_desc_is_aead(ike->sa.st_oakley.ta_encrypt)) {
+	if (encrypt_desc_is_aead(d->encrypt)) {
 		/*
 		 * Additional Authenticated Data - AAD - size.
 		 * RFC5282 says: The Initialization Vector and Ciphertext
@@ -583,24 +606,24 @@ static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
 
 		/* decrypt */
 		if (LDBGP(DBG_CRYPT, logger)) {
-			LDBG_log_hunk(logger, "salt before authenticated decryption:", salt);
+			LDBG_log_hunk(logger, "salt before authenticated decryption:", d->salt);
 			LDBG_log_hunk(logger, "IV before authenticated decryption:", wire_iv);
 			LDBG_log_hunk(logger, "AAD before authenticated decryption:", aad);
 			LDBG_log_hunk(logger, "integ before authenticated decryption:", integ);
 			LDBG_log_hunk(logger, "payload before decryption:", enc);
 		}
 
-		if (!cipher_context_op_aead(ike->sa.st_ike_decrypt_cipher_context,
+		if (!cipher_context_op_aead(d->cipher_context,
 					    wire_iv, aad,
 					    text_and_tag, enc.len, integ.len,
-					    ike->sa.logger)) {
+					    logger)) {
 			return false;
 		}
 
-		if (DBGP(DBG_CRYPT)) {
-			LDBG_log(ike->sa.logger, "data after authenticated decryption:");
-			LDBG_hunk(ike->sa.logger, enc);
-			LDBG_hunk(ike->sa.logger, integ);
+		if (LDBGP(DBG_CRYPT, logger)) {
+			LDBG_log(logger, "data after authenticated decryption:");
+			LDBG_hunk(logger, enc);
+			LDBG_hunk(logger, integ);
 		}
 
 	} else {
@@ -608,31 +631,31 @@ static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
 		 * check authenticator.  The last INTEG_SIZE bytes are
 		 * the truncated digest.
 		 */
-		struct crypt_prf *ctx = crypt_prf_init_symkey("auth", ike->sa.st_oakley.ta_integ->prf,
-							      "authkey", authkey, ike->sa.logger);
+		struct crypt_prf *ctx = crypt_prf_init_symkey("auth", d->integ->prf,
+							      "authkey", d->authkey, logger);
 		crypt_prf_update_bytes(ctx, "message", auth_start, integ.ptr - auth_start);
-		struct crypt_mac td = crypt_prf_final_mac(&ctx, ike->sa.st_oakley.ta_integ);
+		struct crypt_mac td = crypt_prf_final_mac(&ctx, d->integ);
 
 		if (!hunk_memeq(td, integ.ptr, integ.len)) {
-			llog_sa(RC_LOG, ike, "failed to match authenticator");
+			llog(RC_LOG, logger, "failed to match authenticator");
 			return false;
 		}
 
-		dbg("authenticator matched");
+		ldbg(logger, "authenticator matched");
 
-		if (DBGP(DBG_CRYPT)) {
-			LDBG_log(ike->sa.logger, "payload before decryption:");
-			LDBG_hunk(ike->sa.logger, enc);
+		if (LDBGP(DBG_CRYPT, logger)) {
+			LDBG_log(logger, "payload before decryption:");
+			LDBG_hunk(logger, enc);
 		}
 
 		/* note: no iv is longer than MAX_CBC_BLOCK_SIZE */
-		cipher_context_op_normal(ike->sa.st_ike_decrypt_cipher_context,
+		cipher_context_op_normal(d->cipher_context,
 					 wire_iv, enc, /*ikev1_iv*/NULL,
-					 ike->sa.logger);
+					 logger);
 
-		if (DBGP(DBG_CRYPT)) {
-			LDBG_log(ike->sa.logger, "payload after decryption:");
-			LDBG_hunk(ike->sa.logger, enc);
+		if (LDBGP(DBG_CRYPT, logger)) {
+			LDBG_log(logger, "payload after decryption:");
+			LDBG_hunk(logger, enc);
 		}
 
 	}
@@ -651,22 +674,22 @@ static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
 	 */
 	uint8_t padlen = enc.ptr[enc.len - 1] + 1;
 	if (padlen > enc.len) {
-		llog_sa(RC_LOG, ike,
-			  "discarding invalid packet: padding-length %u (octet 0x%02x) is larger than %zu octet payload length",
-			  padlen, padlen - 1, enc.len);
+		llog(RC_LOG, logger,
+		     "discarding invalid packet: padding-length %u (octet 0x%02x) is larger than %zu octet payload length",
+		     padlen, padlen - 1, enc.len);
 		return false;
 	}
 	if (pad_to_blocksize) {
 		if (padlen > enc_blocksize) {
 			/* probably racoon */
-			dbg("payload contains %zu blocks of extra padding (padding-length: %d (octet 0x%2x), encryption block-size: %zu)",
-			    (padlen - 1) / enc_blocksize,
-			    padlen, padlen - 1, enc_blocksize);
+			ldbg(logger, "payload contains %zu blocks of extra padding (padding-length: %d (octet 0x%2x), encryption block-size: %zu)",
+			     (padlen - 1) / enc_blocksize,
+			     padlen, padlen - 1, enc_blocksize);
 		}
 	} else {
 		if (padlen > 1) {
-			dbg("payload contains %u octets of extra padding (padding-length: %u (octet 0x%2x))",
-			    padlen - 1, padlen, padlen - 1);
+			ldbg(logger, "payload contains %u octets of extra padding (padding-length: %u (octet 0x%2x))",
+			     padlen - 1, padlen, padlen - 1);
 		}
 	}
 
@@ -674,12 +697,30 @@ static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
 	 * Don't check the contents of the pad octets; racoon, for
 	 * instance, sets them to random values.
 	 */
-	dbg("stripping %u octets as pad", padlen);
+	ldbg(logger, "stripping %u octets as pad", padlen);
 	*plain = shunk2(enc.ptr, enc.len - padlen);
 
 	return true;
 }
 
+static bool verify_and_decrypt_v2_message(struct ike_sa *ike,
+					  chunk_t text,
+					  shunk_t *plain,
+					  size_t iv_offset)
+{
+	if (!ike->sa.hidden_variables.st_skeyid_calculated) {
+		endpoint_buf b;
+		llog_pexpect(ike->sa.logger, HERE,
+			     "received encrypted packet from %s but no exponents for state #%lu to decrypt it",
+			     str_endpoint_sensitive(&ike->sa.st_remote_endpoint, &b),
+			     ike->sa.st_serialno);
+		return false;
+	}
+
+	struct v2_decrypter d = v2_decrypter_from_ike(ike);
+	return verify_and_decrypt_v2_text(&d, text, plain, iv_offset, ike->sa.logger);
+}
+
 /*
  * Incoming IKEv2 fragments.
  */
@@ -911,38 +952,31 @@ enum collected_fragment collect_v2_incoming_fragment(struct ike_sa *ike,
 	return (*frags)->count == (*frags)->total ? FRAGMENTS_COMPLETE : FRAGMENTS_MISSING;
 }
 
-bool decrypt_v2_incoming_fragments(struct ike_sa *ike,
-				   struct v2_incoming_fragments **frags)
+/*
+ * Tally up the decrypted fragments, dropping any that were invalid
+ * (.plain is still NULL); return true when all are present.
+ */
+
+static bool settle_v2_incoming_fragments(struct ike_sa *ike,
+					 struct v2_incoming_fragments **frags)
 {
 	for (unsigned i = 1; i <= (*frags)->total; i++) {
 		struct v2_incoming_fragment *frag = &(*frags)->frags[i];
-		if (frag->text.ptr != NULL) {
+		if (frag->text.ptr != NULL && frag->plain.ptr == NULL) {
 			/*
-			 * Point PLAIN at the encrypted fragment and
-			 * then decrypt in-place.  After the
-			 * decryption, PLAIN will have been adjusted
-			 * to just point at the data.
-			 *
 			 * For moment log the individual fragments
 			 * that are invalid (too verbose VS helping
 			 * responder figure out where things go
 			 * wrong).
 			 */
-			if (!verify_and_decrypt_v2_message(ike, frag->text,
-							   &frag->plain,
-							   frag->iv_offset)) {
-				llog_sa(RC_LOG, ike,
-					"saved fragment %u of %u invalid; dropped",
-					i, (*frags)->total);
-				/* release the frag */
-				(*frags)->count--;
-				free_chunk_content(&frag->text);
-				frag->text = empty_chunk;
-				frag->plain = null_shunk;
-				frag->iv_offset = 0;
-			}
-			dbg("saved fragment %u of %u decrypted",
-			    i, (*frags)->total);
+			llog_sa(RC_LOG, ike,
+				"saved fragment %u of %u invalid; dropped",
+				i, (*frags)->total);
+			/* release the frag */
+			(*frags)->count--;
+			free_chunk_content(&frag->text);
+			frag->text = empty_chunk;
+			frag->iv_offset = 0;
 		}
 	}
 
@@ -967,6 +1001,31 @@ bool decrypt_v2_incoming_fragments(struct ike_sa *ike,
 	return true;
 }
 
+bool decrypt_v2_incoming_fragments(struct ike_sa *ike,
+				   struct v2_incoming_fragments **frags)
+{
+	for (unsigned i = 1; i <= (*frags)->total; i++) {
+		struct v2_incoming_fragment *frag = &(*frags)->frags[i];
+		if (frag->text.ptr != NULL) {
+			/*
+			 * Point PLAIN at the encrypted fragment and
+			 * then decrypt in-place.  After the
+			 * decryption, PLAIN will have been adjusted
+			 * to just point at the data.
+			 */
+			frag->plain = null_shunk;
+			if (verify_and_decrypt_v2_message(ike, frag->text,
+							  &frag->plain,
+							  frag->iv_offset)) {
+				dbg("saved fragment %u of %u decrypted",
+				    i, (*frags)->total);
+			}
+		}
+	}
+
+	return settle_v2_incoming_fragments(ike, frags);
+}
+
 struct msg_digest *reassemble_v2_incoming_fragments(struct v2_incoming_fragments **frags)
 {
 	dbg("reassembling incoming fragments");
@@ -1032,7 +1091,8 @@ struct msg_digest *reassemble_v2_incoming_fragments(struct v2_incoming_fragments
  *
  * The bytes to be decryted are roughly .cursor + sizeof(IV) - .roof.
  */
-bool ikev2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md)
+static chunk_t prepare_v2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md,
+				      size_t *iv_offset)
 {
 	struct pbs_in *sk_pbs = &md->chain[ISAKMP_NEXT_v2SK]->pbs;
 	/*
@@ -1050,16 +1110,19 @@ bool ikev2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md)
 	 * Having read the SK header, the .cursor is pointing at the
 	 * IV.  Lets corrupt it!
 	 */
-	size_t iv_offset = sk_pbs->cur - md->packet_pbs.start;
+	(*iv_offset) = sk_pbs->cur - md->packet_pbs.start;
 	if (impair.corrupt_encrypted && !md->fake_clone) {
 		llog(RC_LOG, ike->sa.logger,
 		     "IMPAIR: corrupting incoming encrypted message's SK payload's first byte");
-		md->packet_pbs.start[iv_offset] = ~(md->packet_pbs.start[iv_offset]);
+		md->packet_pbs.start[(*iv_offset)] = ~(md->packet_pbs.start[(*iv_offset)]);
 	}
 
-	chunk_t message = chunk2(md->packet_pbs.start, sk_pbs->roof - md->packet_pbs.start);
-	shunk_t plain = null_shunk; /*to be sure*/
-	bool ok = verify_and_decrypt_v2_message(ike, message, &plain, iv_offset);
+	return chunk2(md->packet_pbs.start, sk_pbs->roof - md->packet_pbs.start);
+}
+
+static bool finish_v2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md,
+				  bool ok, shunk_t plain)
+{
 	md->chain[ISAKMP_NEXT_v2SK]->pbs = pbs_in_from_shunk(plain, "decrypted SK payload");
 
 	name_buf xb;
@@ -1071,6 +1134,280 @@ bool ikev2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md)
 	return ok;
 }
 
+bool ikev2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md)
+{
+	size_t iv_offset;
+	chunk_t message = prepare_v2_decrypt_msg(ike, md, &iv_offset);
+	shunk_t plain = null_shunk; /*to be sure*/
+	bool ok = verify_and_decrypt_v2_message(ike, message, &plain, iv_offset);
+	return finish_v2_decrypt_msg(ike, md, ok, plain);
+}
+
+/*
+ * Offload the verification and decryption of a large message (or
+ * the saved fragments of one) to a helper thread.
+ *
+ * The helper gets its own references to the keys and creates its own
+ * cipher context; the IKE SA's may be replaced (for instance by
+ * IKE_INTERMEDIATE) while the helper is running.
+ *
+ * While the helper is busy, .st_v2_offloaded_decrypt is set and
+ * further protected messages for the IKE SA are held; once the
+ * helper is done they are replayed.  That way messages are processed
+ * in order.
+ */
+
+struct task {
+	const struct encrypt_desc *encrypt;
+	const struct integ_desc *integ;
+	PK11SymKey *enckey;
+	PK11SymKey *authkey;
+	chunk_t salt;
+	/* either the SK message (in MD) ... */
+	chunk_t text;
+	size_t iv_offset;
+	shunk_t plain;
+	bool ok;
+	/* ... or saved fragments */
+	struct v2_incoming_fragments *frags;
+};
+
+static task_computer_fn v2_decrypt_computer; /* type check */
+static task_completed_cb v2_decrypt_completed; /* type check */
+static task_cleanup_cb v2_decrypt_cleanup; /* type check */
+
+static const struct task_handler v2_decrypt_handler = {
+	.name = "decrypt",
+	.computer_fn = v2_decrypt_computer,
+	.completed_cb = v2_decrypt_completed,
+	.cleanup_cb = v2_decrypt_cleanup,
+};
+
+static void v2_decrypt_computer(struct logger *logger,
+				struct task *task,
+				int my_thread UNUSED)
+{
+	struct cipher_context *cipher_context =
+		cipher_context_create(task->encrypt, DECRYPT, USE_WIRE_IV,
+				      task->enckey, HUNK_AS_SHUNK(task->salt),
+				      logger);
+	struct v2_decrypter d = {
+		.encrypt = task->encrypt,
+		.integ = task->integ,
+		.cipher_context = cipher_context,
+		.authkey = task->authkey,
+		.salt = HUNK_AS_SHUNK(task->salt),
+	};
+
+	if (task->frags == NULL) {
+		task->ok = verify_and_decrypt_v2_text(&d, task->text, &task->plain,
+						      task->iv_offset, logger);
+	} else {
+		for (unsigned i = 1; i <= task->frags->total; i++) {
+			struct v2_incoming_fragment *frag = &task->frags->frags[i];
+			if (frag->text.ptr == NULL) {
+				continue;
+			}
+			/* on failure .plain is left NULL */
+			frag->plain = null_shunk;
+			verify_and_decrypt_v2_text(&d, frag->text, &frag->plain,
+						   frag->iv_offset, logger);
+		}
+	}
+
+	cipher_context_destroy(&cipher_context, logger);
+}
+
+static stf_status v2_decrypt_completed(struct state *st,
+				       struct msg_digest *md,
+				       struct task *task)
+{
+	struct ike_sa *ike = pexpect_ike_sa(st);
+	if (ike == NULL) {
+		return STF_INTERNAL_ERROR;
+	}
+	ike->sa.st_v2_offloaded_decrypt = false;
+
+	/*
+	 * Replay held messages after this one; scheduled now since
+	 * processing this message may delete the IKE SA.
+	 */
+	release_v2_held_messages(&ike->sa, /*replay*/true);
+
+	if (task->frags == NULL) {
+		if (!finish_v2_decrypt_msg(ike, md, task->ok, task->plain)) {
+			llog_sa(RC_LOG, ike,
+				"encrypted payload seems to be corrupt; dropping packet");
+			/* Secure exchange: NEVER EVER RESPOND */
+			return STF_SKIP_COMPLETE_STATE_TRANSITION;
+		}
+		process_protected_v2_message(ike, md);
+		return STF_SKIP_COMPLETE_STATE_TRANSITION;
+	}
+
+	if (!settle_v2_incoming_fragments(ike, &task->frags)) {
+		if (task->frags != NULL) {
+			/* keep collecting; put them back */
+			struct v2_incoming_fragments **frags =
+				&ike->sa.st_v2_msgid_windows.responder.incoming_fragments;
+			PEXPECT(ike->sa.logger, (*frags) == NULL);
+			free_v2_incoming_fragments(frags);
+			(*frags) = task->frags;
+			task->frags = NULL;
+		}
+		return STF_SKIP_COMPLETE_STATE_TRANSITION;
+	}
+
+	struct msg_digest *protected_md = reassemble_v2_incoming_fragments(&task->frags);
+	process_protected_v2_message(ike, protected_md);
+	md_delref(&protected_md);
+	return STF_SKIP_COMPLETE_STATE_TRANSITION;
+}
+
+static void v2_decrypt_cleanup(struct task **task)
+{
+	symkey_delref(&global_logger, "enckey", &(*task)->enckey);
+	symkey_delref(&global_logger, "authkey", &(*task)->authkey);
+	free_chunk_content(&(*task)->salt);
+	if ((*task)->frags != NULL) {
+		free_v2_incoming_fragments(&(*task)->frags);
+	}
+	pfreeany(*task);
+}
+
+static struct task *alloc_v2_decrypt_task(struct ike_sa *ike, size_t size)
+{
+	uintmax_t threshold = config_setup_option(config_setup_singleton(),
+						  KBF_OFFLOAD_DECRYPT_THRESHOLD);
+	if (threshold == 0 || size < threshold ||
+	    server_nhelpers() == 0 ||
+	    ike->sa.st_offloaded_task != NULL) {
+		return NULL;
+	}
+
+	PK11SymKey *enckey;
+	switch (ike->sa.st_sa_role) {
+	case SA_INITIATOR:
+		/* decrypt inbound uses R */
+		enckey = ike->sa.st_skey_er_nss;
+		break;
+	case SA_RESPONDER:
+		/* decrypt inbound uses I */
+		enckey = ike->sa.st_skey_ei_nss;
+		break;
+	default:
+		bad_case(ike->sa.st_sa_role);
+	}
+
+	struct v2_decrypter d = v2_decrypter_from_ike(ike);
+	struct task task = {
+		.encrypt = d.encrypt,
+		.integ = d.integ,
+		.enckey = symkey_addref(ike->sa.logger, "enckey", enckey),
+		.authkey = symkey_addref(ike->sa.logger, "authkey", d.authkey),
+		.salt = clone_hunk(d.salt, "decrypt salt"),
+	};
+	return clone_thing(task, "decrypt task");
+}
+
+bool offload_v2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md)
+{
+	size_t iv_offset;
+	struct pbs_in *sk_pbs = &md->chain[ISAKMP_NEXT_v2SK]->pbs;
+	size_t size = sk_pbs->roof - md->packet_pbs.start;
+	struct task *task = alloc_v2_decrypt_task(ike, size);
+	if (task == NULL) {
+		return false;
+	}
+
+	task->text = prepare_v2_decrypt_msg(ike, md, &iv_offset);
+	task->iv_offset = iv_offset;
+	ldbg(ike->sa.logger, "offloading decryption of %zu byte message", task->text.len);
+	ike->sa.st_v2_offloaded_decrypt = true;
+	submit_task(&ike->sa, &ike->sa, md, /*detach_whack*/false,
+		    task, &v2_decrypt_handler, HERE);
+	return true;
+}
+
+bool offload_v2_decrypt_fragments(struct ike_sa *ike,
+				  struct v2_incoming_fragments **frags)
+{
+	size_t size = 0;
+	for (unsigned i = 1; i <= (*frags)->total; i++) {
+		size += (*frags)->frags[i].text.len;
+	}
+
+	struct task *task = alloc_v2_decrypt_task(ike, size);
+	if (task == NULL) {
+		return false;
+	}
+
+	/* the task owns the fragments until it completes */
+	task->frags = (*frags);
+	(*frags) = NULL;
+	ldbg(ike->sa.logger, "offloading decryption of %u fragments, %zu bytes",
+	     task->frags->count, size);
+	ike->sa.st_v2_offloaded_decrypt = true;
+	submit_task(&ike->sa, &ike->sa, /*md*/NULL, /*detach_whack*/false,
+		    task, &v2_decrypt_handler, HERE);
+	return true;
+}
+
+void hold_v2_message_during_decrypt(struct ike_sa *ike, struct msg_digest *md)
+{
+	struct msg_digest **held = ike->sa.st_v2_held_messages.md;
+	unsigned *nr = &ike->sa.st_v2_held_messages.nr;
+
+	if ((*nr) == MAX_V2_HELD_MESSAGES) {
+		/*
+		 * Full.  A request can be dropped, the peer will
+		 * retransmit it; but a response is only sent once so
+		 * make room by dropping the newest held request.
+		 */
+		unsigned victim = (*nr);
+		if (v2_msg_role(md) == MESSAGE_RESPONSE) {
+			for (unsigned i = (*nr); i > 0; i--) {
+				if (v2_msg_role(held[i - 1]) == MESSAGE_REQUEST) {
+					victim = i - 1;
+					break;
+				}
+			}
+		}
+		if (victim == (*nr)) {
+			llog_sa(RC_LOG, ike,
+				"discarding packet received during asynchronous work (decrypt) in %s",
+				ike->sa.st_state->name);
+			return;
+		}
+		llog_sa(RC_LOG, ike,
+			"discarding held request to make room for response received during asynchronous work (decrypt) in %s",
+			ike->sa.st_state->name);
+		md_delref(&held[victim]);
+		memmove(&held[victim], &held[victim + 1],
+			((*nr) - victim - 1) * sizeof(held[0]));
+		(*nr)--;
+	}
+
+	ldbg(ike->sa.logger, "holding message received during asynchronous work (decrypt), %u held",
+	     (*nr) + 1);
+	/* the original has been parsed; replay a copy (not a fake clone) */
+	held[(*nr)++] = copy_raw_md(md, HERE);
+}
+
+void release_v2_held_messages(struct state *st, bool replay)
+{
+	for (unsigned i = 0; i < st->st_v2_held_messages.nr; i++) {
+		struct msg_digest **md = &st->st_v2_held_messages.md[i];
+		if (replay) {
+			schedule_md_event("replay message held during decrypt", *md);
+			(*md) = NULL;
+		} else {
+			md_delref(md);
+		}
+	}
+	st->st_v2_held_messages.nr = 0;
+}
+
 /*
  * IKEv2 fragments:
  *
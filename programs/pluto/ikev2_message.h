@@ -101,6 +101,22 @@ struct msg_digest *reassemble_v2_incoming_fragments(struct v2_incoming_fragments
 
 bool ikev2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md);
 
+/*
+ * When the message (or the fragments) is at least
+ * offload-decrypt-threshold bytes, hand it to a helper thread and
+ * return true; processing resumes in the helper's callback.
+ */
+bool offload_v2_decrypt_msg(struct ike_sa *ike, struct msg_digest *md);
+bool offload_v2_decrypt_fragments(struct ike_sa *ike,
+				  struct v2_incoming_fragments **frags);
+
+/*
+ * While a decrypt is offloaded, hold further protected messages;
+ * they are replayed once the helper is done.
+ */
+void hold_v2_message_during_decrypt(struct ike_sa *ike, struct msg_digest *md);
+void release_v2_held_messages(struct state *st, bool replay);
+
 struct ikev2_id build_v2_id_payload(const struct host_end *end, shunk_t *body,
 				    const char *what, struct logger *logger);
 
@@ -494,6 +494,11 @@ static stf_status process_v2_request_no_skeyseed_continue(struct state *ike_st,
 
 	struct msg_digest *md;
 	if ((*frags)->total == 0) {
+		if (offload_v2_decrypt_msg(ike, (*frags)->md)) {
+			/* task holds a reference to MD */
+			free_v2_incoming_fragments(frags);
+			return STF_SKIP_COMPLETE_STATE_TRANSITION;
+		}
 		if (!ikev2_decrypt_msg(ike, (*frags)->md)) {
 			free_v2_incoming_fragments(frags);
 			return STF_SKIP_COMPLETE_STATE_TRANSITION;
@@ -501,6 +506,10 @@ static stf_status process_v2_request_no_skeyseed_continue(struct state *ike_st,
 		md = md_addref((*frags)->md);
 		free_v2_incoming_fragments(frags);
 	} else {
+		if (offload_v2_decrypt_fragments(ike, frags)) {
+			/* task took FRAGS */
+			return STF_SKIP_COMPLETE_STATE_TRANSITION;
+		}
 		if (!decrypt_v2_incoming_fragments(ike, frags)) {
 			/* could free FRAGS */
 			return STF_SKIP_COMPLETE_STATE_TRANSITION;
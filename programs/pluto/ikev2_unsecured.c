@@ -251,7 +251,9 @@ static void process_v2_UNSECURED_request(struct msg_digest *md)
 	 * verifying it should be relatively quick and cheap.  Right?
 	 *
 	 * No.  The equation uses v2Ni forcing the entire payload to
-	 * be parsed.
+	 * be parsed.  (When DDOS cookies are required, the cookie has
+	 * already been checked using the raw packet, see
+	 * v2_rejected_initiator_cookie_from_packet().)
 	 *
 	 * The error notification is probably INVALID_SYNTAX, but
 	 * could be v2N_UNSUPPORTED_CRITICAL_PAYLOAD.
@@ -378,6 +378,7 @@ static void drip_outbound(const struct message *m, struct logger *logger)
 	ssize_t wlen = interface->io->write_packet(interface,
 						   HUNK_AS_SHUNK(m->body),
 						   &m->outbound.endpoint,
+						   /*just_a_keepalive*/false,
 						   logger);
 	if (wlen != (ssize_t)m->body.len) {
 		endpoint_buf lb;
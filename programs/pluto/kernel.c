@@ -86,8 +86,10 @@
 #include "updown.h"
 #include "pending.h"
 #include "terminate.h"
+#include "hash_bytes.h"
 
 static deltatime_t pluto_expire_shunt_interval; /* see plutomain.c & config_setup.[hc] */
+static deltatime_t pluto_traffic_cache_time; /* see config_setup.[hc] */
 static deltatime_t pluto_shunt_lifetime; /* see plutomain.c and config_setup.[hc] */
 static deltatime_t pluto_shunt_patience; /* see kernel_init() */
 
@@ -1275,6 +1277,13 @@ static bool setup_half_kernel_state(struct child_sa *child, enum direction direc
 	     pri_shunk(said_boilerplate.sec_label),
 	     (c->child.sec_label.len > 0 ? " (IKEv2 this)" : ""));
 
+	/*
+	 * The IPCOMP, ESP and AH SAs are sent to the kernel as one
+	 * batch; errors are reported when it is committed.
+	 */
+	kernel_ops_begin_batch(child->sa.logger);
+	bool batched = true;
+
 	/* set up IPCOMP SA, if any */
 
 	if (child->sa.st_ipcomp.protocol == &ip_protocol_ipcomp) {
@@ -1582,6 +1591,11 @@ static bool setup_half_kernel_state(struct child_sa *child, enum direction direc
 		said_next++;
 	}
 
+	batched = false;
+	if (!kernel_ops_commit_batch(child->sa.logger)) {
+		goto fail;
+	}
+
 	switch (direction) {
 	case DIRECTION_OUTBOUND:
 		if (impair.install_ipsec_sa_outbound_state) {
@@ -1606,7 +1620,12 @@ fail:
 	 * Undo the done SPIs; should have been logged above.
 	 *
 	 * Deleting the SPI also deletes any SAs attached to them.
+	 * Any adds still batched must reach the kernel before the
+	 * deletes.
 	 */
+	if (batched && !kernel_ops_commit_batch(child->sa.logger)) {
+		ldbg_sa(child, "%s() batched adds also failed", __func__);
+	}
 	ldbg_sa(child, "%s() cleaning up after a fail", __func__);
 	while (said_next-- != said) {
 		if (said_next->proto != NULL) {
@@ -1693,9 +1712,13 @@ static unsigned append_teardown(struct dead_sa *dead, enum direction direction,
  * Delete any AH, ESP, and IPCOMP kernel states.
  *
  * Deleting only requires the addresses, protocol, and IPsec SPIs.
+ *
+ * The kernel may only answer once the current event is over, so
+ * there's no result; a failed delete is logged against the Child SA
+ * and counted when the kernel's answer arrives.
  */
 
-static bool uninstall_kernel_state(struct child_sa *child, enum direction direction)
+static void uninstall_kernel_state(struct child_sa *child, enum direction direction)
 {
 	struct connection *const c = child->sa.st_connection;
 	name_buf db;
@@ -1737,16 +1760,13 @@ static bool uninstall_kernel_state(struct child_sa *child, enum direction direct
 	 *
 	 * Deleting the SPI also deletes any corresponding SA.
 	 */
-	bool result = true;
 	for (unsigned i = 0; i < nr; i++) {
 		const struct dead_sa *tbd = &dead[i];
-		result &= kernel_ops_del_ipsec_spi(tbd->spi,
-						   tbd->protocol,
-						   &tbd->src, &tbd->dst,
-						   child->sa.logger);
+		kernel_ops_del_ipsec_spi(tbd->spi,
+					 tbd->protocol,
+					 &tbd->src, &tbd->dst,
+					 child->sa.logger);
 	}
-
-	return result;
 }
 
 static bool connection_has_policy_conflicts(const struct connection *c,
@@ -2000,6 +2020,248 @@ static void set_sa_info(struct ipsec_proto_info *p2, uint64_t bytes,
 	}
 }
 
+/*
+ * Cache of the kernel's traffic counters, filled using a single
+ * .dump_kernel_states() request.
+ *
+ * The table is open addressed (linear probing) and keyed by
+ * SPI+protocol+destination; it is rebuilt, from scratch, by each
+ * dump.  Entries are used while a sweep is in progress, or for
+ * traffic-cache-time after the dump.
+ */
+
+struct traffic_cache_entry {
+	bool used;
+	struct kernel_state_counters counters;
+};
+
+struct traffic_cache {
+	bool valid;
+	monotime_t when;
+	unsigned sweeps;	/* nesting */
+	unsigned nr;
+	unsigned size;		/* power of 2, or 0 */
+	struct traffic_cache_entry *entry;
+};
+
+static struct traffic_cache traffic_cache;
+
+static unsigned traffic_cache_slot(const ip_address *dst, unsigned ipproto, ipsec_spi_t spi)
+{
+	hash_t hash = zero_hash;
+	hash = hash_thing(spi, hash);
+	hash = hash_thing(ipproto, hash);
+	hash = hash_hunk(address_as_shunk(dst), hash);
+	return hash.hash & (traffic_cache.size - 1);
+}
+
+static struct traffic_cache_entry *traffic_cache_entry(const ip_address *dst,
+						       unsigned ipproto,
+						       ipsec_spi_t spi)
+{
+	if (traffic_cache.size == 0) {
+		return NULL;
+	}
+	unsigned mask = traffic_cache.size - 1;
+	for (unsigned i = traffic_cache_slot(dst, ipproto, spi); ; i = (i + 1) & mask) {
+		struct traffic_cache_entry *e = &traffic_cache.entry[i];
+		if (!e->used ||
+		    (e->counters.spi == spi &&
+		     e->counters.ipproto == ipproto &&
+		     address_eq_address(e->counters.dst, *dst))) {
+			return e;
+		}
+	}
+}
+
+static void grow_traffic_cache(void)
+{
+	unsigned old_size = traffic_cache.size;
+	struct traffic_cache_entry *old_entry = traffic_cache.entry;
+
+	traffic_cache.size = (old_size == 0 ? 1024 : old_size * 2);
+	traffic_cache.entry = alloc_things(struct traffic_cache_entry,
+					   traffic_cache.size, "traffic cache");
+	for (unsigned i = 0; i < old_size; i++) {
+		const struct traffic_cache_entry *o = &old_entry[i];
+		if (o->used) {
+			*traffic_cache_entry(&o->counters.dst, o->counters.ipproto,
+					     o->counters.spi) = *o;
+		}
+	}
+	pfreeany(old_entry);
+}
+
+static void add_traffic_cache_entry(const struct kernel_state_counters *counters,
+				    void *context UNUSED)
+{
+	/* keep the load below 1/2 */
+	if (2 * (traffic_cache.nr + 1) > traffic_cache.size) {
+		grow_traffic_cache();
+	}
+	struct traffic_cache_entry *e =
+		traffic_cache_entry(&counters->dst, counters->ipproto, counters->spi);
+	if (!e->used) {
+		traffic_cache.nr++;
+	}
+	e->used = true;
+	e->counters = *counters;
+}
+
+static void fill_traffic_cache(struct logger *logger)
+{
+	if (kernel_ops->dump_kernel_states == NULL) {
+		return;
+	}
+
+	if (traffic_cache.size > 0) {
+		memset(traffic_cache.entry, 0,
+		       traffic_cache.size * sizeof(traffic_cache.entry[0]));
+	}
+	traffic_cache.nr = 0;
+	traffic_cache.when = mononow();
+	traffic_cache.valid = kernel_ops->dump_kernel_states(add_traffic_cache_entry,
+							     NULL, logger);
+	ldbg(logger, "kernel: %s() cached traffic for %u states (%s)",
+	     __func__, traffic_cache.nr,
+	     (traffic_cache.valid ? "ok" : "failed"));
+}
+
+static bool traffic_cache_is_recent(void)
+{
+	if (!traffic_cache.valid ||
+	    deltatime_cmp(pluto_traffic_cache_time, ==, deltatime(0))) {
+		return false;
+	}
+	deltatime_t age = monotime_diff(mononow(), traffic_cache.when);
+	return deltatime_cmp(age, <=, pluto_traffic_cache_time);
+}
+
+void begin_ipsec_traffic_sweep(struct logger *logger)
+{
+	if (traffic_cache.sweeps++ == 0 &&
+	    !traffic_cache_is_recent()) {
+		fill_traffic_cache(logger);
+	}
+}
+
+void end_ipsec_traffic_sweep(void)
+{
+	PASSERT(&global_logger, traffic_cache.sweeps > 0);
+	traffic_cache.sweeps--;
+}
+
+/*
+ * A snapshot is a traffic cache of its own; sweeping it swaps it in
+ * place of the global cache, which is swapped back when the sweep
+ * ends.  Neither the global cache, nor any sweep open on it, is
+ * touched.
+ */
+
+struct traffic_cache *snapshot_ipsec_traffic(struct logger *logger)
+{
+	struct traffic_cache saved = traffic_cache;
+	zero(&traffic_cache);
+	fill_traffic_cache(logger);
+	struct traffic_cache *snapshot = clone_thing(traffic_cache, "traffic snapshot");
+	traffic_cache = saved;
+	return snapshot;
+}
+
+void begin_ipsec_traffic_snapshot_sweep(struct traffic_cache *snapshot)
+{
+	struct traffic_cache saved = traffic_cache;
+	traffic_cache = *snapshot;
+	*snapshot = saved;
+	traffic_cache.sweeps++;
+}
+
+void end_ipsec_traffic_snapshot_sweep(struct traffic_cache *snapshot)
+{
+	PASSERT(&global_logger, traffic_cache.sweeps == 1);
+	traffic_cache.sweeps--;
+	struct traffic_cache saved = *snapshot;
+	*snapshot = traffic_cache;
+	traffic_cache = saved;
+}
+
+void free_ipsec_traffic_snapshot(struct traffic_cache **snapshot)
+{
+	if (*snapshot != NULL) {
+		pfreeany((*snapshot)->entry);
+		pfree(*snapshot);
+		*snapshot = NULL;
+	}
+}
+
+/*
+ * Probes that expire in the same timer slot run back-to-back.  The
+ * first few look up their SA directly; after that a dump is cheaper
+ * so a sweep is started and left open until the event loop gets
+ * around to EVENT_TRAFFIC_PROBE_SWEEP.
+ */
+
+#define TRAFFIC_PROBE_SWEEP_MIN 8
+
+static struct {
+	unsigned probes;
+	bool sweeping;
+} traffic_probe;
+
+static void end_traffic_probe_sweep(struct logger *logger)
+{
+	ldbg(logger, "kernel: %s() %u probes (%s)", __func__,
+	     traffic_probe.probes,
+	     (traffic_probe.sweeping ? "swept" : "direct"));
+	if (traffic_probe.sweeping) {
+		end_ipsec_traffic_sweep();
+	}
+	traffic_probe.probes = 0;
+	traffic_probe.sweeping = false;
+}
+
+void begin_ipsec_traffic_probe(struct logger *logger)
+{
+	if (traffic_probe.probes++ == 0) {
+		schedule_oneshot_timer(EVENT_TRAFFIC_PROBE_SWEEP, deltatime(0));
+	}
+	if (traffic_probe.probes == TRAFFIC_PROBE_SWEEP_MIN &&
+	    kernel_ops->dump_kernel_states != NULL) {
+		begin_ipsec_traffic_sweep(logger);
+		traffic_probe.sweeping = true;
+	}
+}
+
+static bool get_cached_kernel_state(const struct kernel_state *sa,
+				    uint64_t *bytes, uint64_t *add_time,
+				    uint64_t *lastused, struct logger *logger)
+{
+	bool fresh = ((traffic_cache.valid && traffic_cache.sweeps > 0) ||
+		      traffic_cache_is_recent());
+	if (!fresh) {
+		if (deltatime_cmp(pluto_traffic_cache_time, ==, deltatime(0))) {
+			/* caching disabled */
+			return false;
+		}
+		fill_traffic_cache(logger);
+		if (!traffic_cache.valid) {
+			return false;
+		}
+	}
+
+	const struct traffic_cache_entry *e =
+		traffic_cache_entry(&sa->dst.address, sa->proto->ipproto, sa->spi);
+	if (e == NULL || !e->used) {
+		/* perhaps added since the dump */
+		return false;
+	}
+
+	*bytes = e->counters.bytes;
+	*add_time = e->counters.add_time;
+	*lastused = e->counters.lastused;
+	return true;
+}
+
 /*
  * get information about a given SA bundle
  *
@@ -2073,7 +2335,9 @@ bool get_ipsec_traffic(struct child_sa *child,
 	uint64_t bytes = 0;
 	uint64_t add_time = 0;
 	uint64_t lastused = 0;
-	if (!kernel_ops->get_kernel_state(&sa, &bytes, &add_time, &lastused,
+	if (!get_cached_kernel_state(&sa, &bytes, &add_time, &lastused,
+				     child->sa.logger) &&
+	    !kernel_ops->get_kernel_state(&sa, &bytes, &add_time, &lastused,
 					  child->sa.logger))
 		return false;
 	ldbg_sa(child, "kernel: %s() bytes=%"PRIu64" add_time=%"PRIu64" lastused=%"PRIu64,
@@ -2425,6 +2689,12 @@ void init_kernel(const struct config_setup *oco, struct logger *logger)
 	 */
 	pluto_shunt_lifetime = config_setup_deltatime(oco, KBF_SHUNTLIFETIME);
 
+	/*
+	 * How long traffic counters, dumped from the kernel, can be
+	 * re-used by get_ipsec_traffic().
+	 */
+	pluto_traffic_cache_time = config_setup_deltatime(oco, KBF_TRAFFIC_CACHE_TIME);
+
 	/*
 	 * Expiration to put on bare (orphan) shunt (kernel policy).
 	 *
@@ -2459,6 +2729,7 @@ void init_kernel(const struct config_setup *oco, struct logger *logger)
 
 	enable_periodic_timer(EVENT_SHUNT_SCAN, kernel_scan_shunts,
 			      pluto_expire_shunt_interval);
+	init_oneshot_timer(EVENT_TRAFFIC_PROBE_SWEEP, end_traffic_probe_sweep);
 }
 
 void show_kernel_interface(struct show *s)
@@ -2477,4 +2748,6 @@ void shutdown_kernel(struct logger *logger)
 		kernel_ops->flush(logger);
 		kernel_ops->shutdown(logger);
 	}
+	pfreeany(traffic_cache.entry);
+	zero(&traffic_cache);
 }
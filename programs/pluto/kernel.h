@@ -203,6 +203,23 @@ struct kernel_state {
 	const struct config_iptfs *iptfs;	/* non-NULL when enabled */
 };
 
+/*
+ * The traffic counters of one kernel state, as returned by
+ * .dump_kernel_states().
+ */
+
+struct kernel_state_counters {
+	ip_address dst;
+	unsigned ipproto;
+	ipsec_spi_t spi;
+	uint64_t bytes;
+	uint64_t add_time;
+	uint64_t lastused;
+};
+
+typedef void (kernel_state_counters_cb)(const struct kernel_state_counters *counters,
+					void *context);
+
 struct kernel_ops {
 	/*
 	 * The names used to identify the interface.
@@ -237,6 +254,18 @@ struct kernel_ops {
 	void (*plug_holes)(struct logger *logger);
 	void (*shutdown)(struct logger *logger);
 
+	/*
+	 * Optional; when present, SA and policy adds made between
+	 * begin_batch() and commit_batch() may be sent to the kernel
+	 * as a single request; commit_batch() sends them and returns
+	 * false if any made within that (possibly nested) batch
+	 * failed.  sync_batch() does the same without closing the
+	 * batch.
+	 */
+	void (*begin_batch)(struct logger *logger);
+	bool (*sync_batch)(struct logger *logger);
+	bool (*commit_batch)(struct logger *logger);
+
 	bool (*policy_add)(enum kernel_policy_op op,
 			   enum direction dir,
 			   const ip_selector *src_client,
@@ -267,6 +296,13 @@ struct kernel_ops {
 				 uint64_t *add_time,
 				 uint64_t *lastused,
 				 struct logger *logger);
+	/*
+	 * Optional; pass the counters of every kernel state to CB
+	 * using a single request.
+	 */
+	bool (*dump_kernel_states)(kernel_state_counters_cb *cb,
+				   void *context,
+				   struct logger *logger);
 
 	/*
 	 * Allocate and delete IPsec ESP/AH (IPCOMP) SPIs. (creating a
@@ -376,6 +412,34 @@ void uninstall_kernel_states(struct child_sa *child);
 
 extern bool was_eroute_idle(struct child_sa *child, deltatime_t idle_max);
 extern bool get_ipsec_traffic(struct child_sa *child, struct ipsec_proto_info *sa, enum direction direction);
+
+/*
+ * Between begin_ipsec_traffic_sweep() and end_ipsec_traffic_sweep(),
+ * get_ipsec_traffic() is answered from one dump of all the kernel's
+ * states.  Use this when looping over many Child SAs.
+ */
+void begin_ipsec_traffic_sweep(struct logger *logger);
+void end_ipsec_traffic_sweep(void);
+
+/*
+ * A listing that yields to the event-loop between slices takes one
+ * snapshot of the kernel's states up front and then sweeps that for
+ * each slice; no sweep is left open across the yield.
+ */
+struct traffic_cache;
+struct traffic_cache *snapshot_ipsec_traffic(struct logger *logger);
+void begin_ipsec_traffic_snapshot_sweep(struct traffic_cache *snapshot);
+void end_ipsec_traffic_snapshot_sweep(struct traffic_cache *snapshot);
+void free_ipsec_traffic_snapshot(struct traffic_cache **snapshot);
+
+/*
+ * Timer driven probes (NAT keep-alive, liveness) that expire together
+ * call this before get_ipsec_traffic(); once enough have, the rest
+ * are answered from one dump that is dropped when the timer callbacks
+ * finish.
+ */
+void begin_ipsec_traffic_probe(struct logger *logger);
+
 bool kernel_ops_migrate_ipsec_sa(struct child_sa *child);
 
 extern void show_kernel_interface(struct show *s);
@@ -496,6 +496,29 @@ bool kernel_ops_del_ipsec_spi(ipsec_spi_t spi, const struct ip_protocol *proto,
 	return ok;
 }
 
+void kernel_ops_begin_batch(struct logger *logger)
+{
+	if (kernel_ops->begin_batch != NULL) {
+		kernel_ops->begin_batch(logger);
+	}
+}
+
+bool kernel_ops_sync_batch(struct logger *logger)
+{
+	if (kernel_ops->sync_batch == NULL) {
+		return true;
+	}
+	return kernel_ops->sync_batch(logger);
+}
+
+bool kernel_ops_commit_batch(struct logger *logger)
+{
+	if (kernel_ops->commit_batch == NULL) {
+		return true;
+	}
+	return kernel_ops->commit_batch(logger);
+}
+
 bool kernel_ops_detect_nic_offload(const char *name, struct logger *logger)
 {
 	static bool no_offload;
@@ -54,6 +54,10 @@ bool kernel_ops_del_ipsec_spi(ipsec_spi_t spi, const struct ip_protocol *proto,
 			      const ip_address *src, const ip_address *dst,
 			      struct logger *logger);
 
+void kernel_ops_begin_batch(struct logger *logger);
+bool kernel_ops_sync_batch(struct logger *logger);
+bool kernel_ops_commit_batch(struct logger *logger);
+
 bool kernel_reqid();
 
 #endif
@@ -875,6 +875,9 @@ bool install_inbound_ipsec_kernel_policies(struct child_sa *child)
 		return true;
 	}
 
+	/* all the SPDs go to the kernel as one batch */
+	kernel_ops_begin_batch(logger);
+
 	FOR_EACH_ITEM(spd, &c->child.spds) {
 		selector_buf sb, db;
 		name_buf eb;
@@ -886,11 +889,17 @@ bool install_inbound_ipsec_kernel_policies(struct child_sa *child)
 		     str_enum_short(&routing_names, c->routing.state, &eb));
 
 		if (!install_inbound_ipsec_kernel_policy(child, spd, HERE)) {
+			kernel_ops_commit_batch(logger);
 		    log_state(RC_LOG, &child->sa, "Installing IPsec SA failed - check logs or dmesg");
 			return false;
 		}
 	}
 
+	if (!kernel_ops_commit_batch(logger)) {
+		log_state(RC_LOG, &child->sa, "Installing IPsec SA failed - check logs or dmesg");
+		return false;
+	}
+
 	if (impair.install_ipsec_sa_inbound_policy) {
 		llog(RC_LOG, logger, "IMPAIR: kernel: install_ipsec_sa_inbound_policy in %s()", __func__);
 		return false;
@@ -964,6 +973,15 @@ bool install_outbound_ipsec_kernel_policies(struct child_sa *child,
 			break;
 		}
 
+		/*
+		 * The kernel needs everything batched so far (this
+		 * Child SA's SAs and policies) before updown runs.
+		 */
+		if (!kernel_ops_sync_batch(logger)) {
+			ok = false;
+			break;
+		}
+
 		/*
 		 * Do we have to make a mess of the routing?
 		 *
@@ -37,6 +37,8 @@
 
 /* system headers */
 
+#define _GNU_SOURCE		/* for recvmmsg() */
+
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
@@ -44,6 +46,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <stdint.h>
 
 /*
@@ -115,6 +118,8 @@
 #include "sparse_names.h"
 #include "kernel_iface.h"
 #include "rnd.h" /* for get_rnd_bytes() */
+#include "linux_netlink.h"
+#include "pluto_stats.h"	/* for pstats_kernel_xfrm_async_* */
 
 static void netlink_process_xfrm_messages(int fd, void *arg, struct logger *logger);
 static void netlink_process_rtm_messages(int fd, void *arg, struct logger *logger);
@@ -124,6 +129,15 @@ static bool sendrecv_xfrm_msg(struct nlmsghdr *hdr,
 			      int *recv_errno,
 			      struct logger *logger);
 static err_t xfrm_iptfs_ipsec_sa_is_enabled(struct logger *logger);
+static void flush_xfrm_requests(struct logger *logger);
+static void init_xfrm_requests(struct logger *logger);
+static void drain_xfrm_requests(struct logger *logger);
+static void flush_xfrm_batch(struct logger *logger);
+static bool xfrm_policy_response(unsigned type, int error,
+				 enum expect_kernel_policy what_about_inbound,
+				 const char *story, const char *adstory,
+				 struct logger *logger, const char *func);
+static void llog_add_sa_error(unsigned type, int error, struct logger *logger);
 static err_t xfrm_directional_ipsec_sa_is_enabled(struct logger *logger);
 
 static struct {
@@ -400,6 +414,7 @@ static void kernel_xfrm_init(struct logger *logger)
 
 	init_netlink_rtm_fd(logger);
 	init_netlink_xfrm_fd(logger);
+	init_xfrm_requests(logger);
 
 	/*
 	 * Just assume any algorithm with a NETLINK_XFRM name works.
@@ -484,6 +499,21 @@ static void llog_ext_ack(lset_t rc_flags, struct logger *logger,
 #endif
 }
 
+static void llog_xfrm_error(int error, const struct nlmsghdr *ack,
+			    const char *description, const char *story,
+			    struct logger *logger)
+{
+	/* Probe failures are not real ERRORs */
+	if (streq(story, "Probe Test")) {
+		if (DBGP(DBG_BASE))
+			LDBG_log(logger, "netlink response for %s %s", description, story);
+	} else {
+		llog_error(logger, error,
+			   "netlink response for %s %s", description, story);
+		llog_ext_ack(RC_LOG, logger, ack);
+	}
+}
+
 /*
  * sendrecv_xfrm_msg()
  *
@@ -515,6 +545,10 @@ static bool sendrecv_xfrm_msg(struct nlmsghdr *hdr,
 
 	*recv_errno = 0;
 
+	/* the kernel must see queued requests first */
+	flush_xfrm_requests(logger);
+	flush_xfrm_batch(logger);
+
 	hdr->nlmsg_seq = ++seq;
 	do {
 		r = write(nl_send_fd, hdr, len);
@@ -626,15 +660,8 @@ static bool sendrecv_xfrm_msg(struct nlmsghdr *hdr,
 			}
 			/* ignore */
 		} else {
-			/* Probe failures are not real ERRORs */
-			if (streq(story, "Probe Test")) {
-				if (DBGP(DBG_BASE))
-					LDBG_log(logger, "netlink response for %s %s", description, story);
-			} else {
-				llog_error(logger, -rsp.u.e.error,
-				   "netlink response for %s %s", description, story);
-				llog_ext_ack(RC_LOG, logger, &rsp.n);
-			}
+			llog_xfrm_error(-rsp.u.e.error, &rsp.n,
+					description, story, logger);
 			return false;
 		}
 	}
@@ -664,34 +691,633 @@ static bool sendrecv_xfrm_msg(struct nlmsghdr *hdr,
 }
 
 /*
- * sendrecv_xfrm_policy -
+ * Asynchronous NETLINK_XFRM requests.
  *
- * @param hdr - Data to check
- * @param enoent_ok - Boolean - OK or not OK.
- * @param story - String
- * @return boolean
+ * Requests whose caller doesn't need the answer there and then are
+ * queued and later written, as one datagram, to a separate
+ * NETLINK_XFRM socket; the kernel processes each message in turn and
+ * queues an ACK for each.  Those ACKs are read by the event loop,
+ * matched back to the request using .nlmsg_seq, and any error
+ * (including the NLMSG_ERROR ext-ack) is logged against the
+ * request's logger before calling the request's callback.
+ *
+ * Up to XFRM_REQUEST_WINDOW requests can be in flight; the slot for
+ * sequence number N is .request[N % XFRM_REQUEST_WINDOW].  Should
+ * the slot still be busy, the request isn't queued and the caller
+ * falls back to sendrecv_xfrm_msg(); the event loop never waits for
+ * an ACK.  Only shutdown does, so that nothing is left in flight.
+ *
+ * Failures are logged and counted (total.kernel.xfrm.async.failed).
+ *
+ * Synchronous requests (sendrecv_xfrm_msg()) flush the queue first,
+ * so the kernel sees everything in the order it was submitted.
  */
-static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
-				 enum expect_kernel_policy what_about_inbound,
-				 const char *story, const char *adstory,
-				 struct logger *logger, const char *func)
+
+#define XFRM_REQUEST_WINDOW 64
+#define XFRM_REQUEST_BUFFER_SIZE (32 * 1024)
+#define XFRM_REQUEST_TIMEOUT_MS 1000
+
+typedef void xfrm_request_cb(void *context, int error, struct logger *logger);
+
+struct xfrm_request {
+	uint32_t seq;			/* 0 when free */
+	uint16_t type;
+	const char *description;
+	char *story;
+	xfrm_request_cb *cb;
+	void *context;
+	struct logger *logger;
+};
+
+static struct {
+	int fd;
+	uint32_t seq;
+	uint32_t written_seq;		/* requests up to here were written */
+	unsigned in_flight;
+	bool flush_scheduled;
+	struct xfrm_request request[XFRM_REQUEST_WINDOW];
+	/* queued, but not yet written */
+	unsigned nr_queued;
+	size_t len;
+	uint8_t buffer[XFRM_REQUEST_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+} xfrm_requests = {
+	.fd = NULL_FD,
+};
+
+static callback_cb flush_xfrm_requests_callback;	/* type assertion */
+static void process_xfrm_request_acks(int fd, void *arg, struct logger *logger);
+
+static void complete_xfrm_request(struct xfrm_request *req, int error)
+{
+	if (error != 0) {
+		pstats_kernel_xfrm_async_failed++;
+	}
+	if (req->cb != NULL) {
+		req->cb(req->context, error, req->logger);
+	}
+	pfreeany(req->story);
+	free_logger(&req->logger, HERE);
+	zero(req);
+	xfrm_requests.in_flight--;
+}
+
+static void process_xfrm_request_ack(const struct nlmsghdr *n, struct logger *logger)
+{
+	struct xfrm_request *req = &xfrm_requests.request[n->nlmsg_seq % XFRM_REQUEST_WINDOW];
+	if (req->seq == 0 || req->seq != n->nlmsg_seq) {
+		name_buf sb;
+		ldbg(logger, "%s() ignoring unexpected %s message with sequence %u",
+		     __func__, str_sparse_long(&xfrm_type_names, n->nlmsg_type, &sb),
+		     n->nlmsg_seq);
+		return;
+	}
+
+	int error = 0;
+	if (n->nlmsg_type == NLMSG_ERROR) {
+		const struct nlmsgerr *e = NLMSG_DATA(n);
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*e))) {
+			llog(RC_LOG, req->logger,
+			     "netlink response for %s %s was truncated",
+			     req->description, req->story);
+			error = EINVAL;
+		} else if (e->error != 0) {
+			error = -e->error;
+			llog_xfrm_error(error, n, req->description, req->story,
+					req->logger);
+		}
+	}
+
+	complete_xfrm_request(req, error);
+}
+
+static bool read_xfrm_request_acks(struct logger *logger)
 {
 	struct nlm_resp rsp;
+	struct sockaddr_nl addr;
+	socklen_t alen = sizeof(addr);
+	ssize_t r = recvfrom(xfrm_requests.fd, &rsp, sizeof(rsp), MSG_DONTWAIT,
+			     (struct sockaddr *)&addr, &alen);
+	if (r < 0) {
+		if (errno == EINTR) {
+			return true;
+		}
+		if (errno == ENOBUFS) {
+			/*
+			 * The socket's receive buffer overflowed and
+			 * ACKs were dropped; there's no telling which
+			 * so fail everything written.  Requests still
+			 * queued will get their ACK.
+			 */
+			llog_error(logger, errno, "kernel: xfrm request ACKs were lost");
+			FOR_EACH_ELEMENT(req, xfrm_requests.request) {
+				if (req->seq != 0 &&
+				    (int32_t)(req->seq - xfrm_requests.written_seq) <= 0) {
+					complete_xfrm_request(req, ENOBUFS);
+				}
+			}
+			return true;
+		}
+		if (errno != EAGAIN) {
+			llog_error(logger, errno, "kernel: recvfrom() of xfrm request ACKs failed");
+		}
+		return false;
+	}
 
-	int recv_errno;
-	if (!sendrecv_xfrm_msg(hdr, NLMSG_ERROR, &rsp,
-			       "policy", story,
-			       &recv_errno, logger)) {
+	ldbg(logger, "%s() recvfrom() returned %zd bytes", __func__, r);
+	if (DBGP(DBG_TMI)) {
+		LDBG_dump(logger, &rsp, r);
+	}
+
+	if (addr.nl_pid != 0) {
+		/* not for us: ignore */
+		return true;
+	}
+
+	size_t len = r;
+	for (const struct nlmsghdr *n = &rsp.n; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+		process_xfrm_request_ack(n, logger);
+	}
+	return true;
+}
+
+static void process_xfrm_request_acks(int fd UNUSED, void *arg UNUSED, struct logger *logger)
+{
+	do {} while (read_xfrm_request_acks(logger));
+}
+
+/*
+ * Block until an ACK arrives; on timeout assume the oldest
+ * request's ACK was lost.  Only used during shutdown.
+ */
+
+static void wait_for_xfrm_request_ack(struct logger *logger)
+{
+	struct pollfd pfd = {
+		.fd = xfrm_requests.fd,
+		.events = POLLIN,
+	};
+	int r;
+	do {
+		r = poll(&pfd, 1, XFRM_REQUEST_TIMEOUT_MS);
+	} while (r < 0 && errno == EINTR);
+
+	if (r > 0) {
+		process_xfrm_request_acks(xfrm_requests.fd, NULL, logger);
+		return;
+	}
+
+	/* find the oldest */
+	struct xfrm_request *oldest = NULL;
+	FOR_EACH_ELEMENT(req, xfrm_requests.request) {
+		if (req->seq != 0 &&
+		    (oldest == NULL || (int32_t)(req->seq - oldest->seq) < 0)) {
+			oldest = req;
+		}
+	}
+	if (oldest != NULL) {
+		llog(RC_LOG, oldest->logger,
+		     "netlink response for %s %s was lost",
+		     oldest->description, oldest->story);
+		complete_xfrm_request(oldest, ETIMEDOUT);
+	}
+}
+
+static void flush_xfrm_requests(struct logger *logger)
+{
+	if (xfrm_requests.nr_queued == 0) {
+		return;
+	}
+
+	ldbg(logger, "%s() writing %u queued requests, %zu bytes",
+	     __func__, xfrm_requests.nr_queued, xfrm_requests.len);
+
+	ssize_t r;
+	do {
+		r = write(xfrm_requests.fd, xfrm_requests.buffer, xfrm_requests.len);
+	} while (r < 0 && errno == EINTR);
+
+	int error = (r < 0 ? errno :
+		     (size_t)r != xfrm_requests.len ? EMSGSIZE :
+		     0);
+	if (error != 0) {
+		llog_error(logger, error,
+			   "netlink write() of %u queued requests failed",
+			   xfrm_requests.nr_queued);
+		/* fail everything that was queued */
+		size_t len = xfrm_requests.len;
+		for (const struct nlmsghdr *n = (const void *)xfrm_requests.buffer;
+		     NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+			struct xfrm_request *req =
+				&xfrm_requests.request[n->nlmsg_seq % XFRM_REQUEST_WINDOW];
+			if (req->seq == n->nlmsg_seq) {
+				complete_xfrm_request(req, error);
+			}
+		}
+	} else {
+		/* the last queued request has the latest sequence number */
+		xfrm_requests.written_seq = xfrm_requests.seq;
+	}
+
+	xfrm_requests.nr_queued = 0;
+	xfrm_requests.len = 0;
+}
+
+static void flush_xfrm_requests_callback(const char *story UNUSED,
+					 struct state *st UNUSED,
+					 void *context UNUSED)
+{
+	xfrm_requests.flush_scheduled = false;
+	flush_xfrm_requests(&global_logger);
+}
+
+/*
+ * Queue HDR; it is written when the current event finishes (or
+ * sooner).  CB, when non-NULL, is called with the result once the
+ * kernel's ACK arrives.  Errors are logged regardless.
+ *
+ * Returns false, without queueing HDR, when the window is full.
+ */
+
+static bool queue_xfrm_request(struct nlmsghdr *hdr,
+			       const char *description, const char *story,
+			       xfrm_request_cb *cb, void *context,
+			       struct logger *logger)
+{
+	PASSERT(logger, hdr->nlmsg_flags & NLM_F_ACK);
+
+	if (xfrm_requests.len + NLMSG_ALIGN(hdr->nlmsg_len) > sizeof(xfrm_requests.buffer)) {
+		flush_xfrm_requests(logger);
+	}
+
+	/* never use 0, it marks a free slot */
+	if (++xfrm_requests.seq == 0) {
+		++xfrm_requests.seq;
+	}
+	struct xfrm_request *req =
+		&xfrm_requests.request[xfrm_requests.seq % XFRM_REQUEST_WINDOW];
+	if (req->seq != 0) {
+		/* window full; try the slot again next time */
+		xfrm_requests.seq--;
+		pstats_kernel_xfrm_async_window_full++;
+		ldbg(logger, "%s() window full, not queueing %s %s",
+		     __func__, description, story);
 		return false;
 	}
 
-	/*
-	 * Kind of surprising: we get here by success which implies an
-	 * error structure!
-	 */
+	hdr->nlmsg_seq = xfrm_requests.seq;
+	name_buf sb;
+	ldbg(logger, "%s() queueing %s %s %s seq %u",
+	     __func__, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+	     description, story, hdr->nlmsg_seq);
+	if (DBGP(DBG_TMI)) {
+		LDBG_dump(logger, hdr, hdr->nlmsg_len);
+	}
+
+	*req = (struct xfrm_request) {
+		.seq = hdr->nlmsg_seq,
+		.type = hdr->nlmsg_type,
+		.description = description,
+		.story = clone_str(story, "xfrm request story"),
+		.cb = cb,
+		.context = context,
+		.logger = clone_logger(logger, HERE),
+	};
+	xfrm_requests.in_flight++;
+
+	memcpy(xfrm_requests.buffer + xfrm_requests.len, hdr, hdr->nlmsg_len);
+	xfrm_requests.len += NLMSG_ALIGN(hdr->nlmsg_len);
+	xfrm_requests.nr_queued++;
+
+	if (!xfrm_requests.flush_scheduled) {
+		xfrm_requests.flush_scheduled = true;
+		schedule_callback("flush xfrm requests", deltatime(0), SOS_NOBODY,
+				  flush_xfrm_requests_callback, NULL);
+	}
+	pstats_kernel_xfrm_async_queued++;
+	return true;
+}
+
+static void init_xfrm_requests(struct logger *logger)
+{
+	xfrm_requests.fd = cloexec_socket(AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK, NETLINK_XFRM);
+	if (xfrm_requests.fd < 0) {
+		fatal(PLUTO_EXIT_FAIL, logger, errno, "socket() for xfrm requests");
+	}
+
+#ifdef SOL_NETLINK
+	const int on = true;
+	if (setsockopt(xfrm_requests.fd, SOL_NETLINK, NETLINK_CAP_ACK,
+		       (const void *)&on, sizeof(on)) < 0) {
+		llog_errno(RC_LOG, logger, errno, "xfrm: setsockopt(NETLINK_CAP_ACK) failed: ");
+	}
+	if (setsockopt(xfrm_requests.fd, SOL_NETLINK, NETLINK_EXT_ACK,
+		       (const void *)&on, sizeof(on)) < 0) {
+		llog_errno(RC_LOG, logger, errno, "xfrm: setsockopt(NETLINK_EXT_ACK) failed: ");
+	}
+#endif
+
+	/* server.c will clean this up */
+	add_fd_read_listener(xfrm_requests.fd, "xfrm request acks",
+			     process_xfrm_request_acks, NULL);
+}
 
-	int error = -rsp.u.e.error;
+/*
+ * Called during shutdown: write anything queued and then wait for
+ * the ACKs.
+ */
+
+static void drain_xfrm_requests(struct logger *logger)
+{
+	flush_xfrm_requests(logger);
+	while (xfrm_requests.in_flight > 0) {
+		wait_for_xfrm_request_ack(logger);
+	}
+}
 
+/*
+ * Batched NETLINK_XFRM requests (kernel transactions).
+ *
+ * Between kernel_xfrm_begin_batch() and kernel_xfrm_commit_batch(),
+ * SA and policy adds are appended to a buffer instead of being sent.
+ * The buffer is then written with one sendmsg() and the ACKs read
+ * back with recvmmsg(); each ACK is checked (and logged) exactly as
+ * the synchronous code would.
+ *
+ * Batches nest.  Each commit writes the buffer and returns the
+ * result of the requests made within its own scope (including any
+ * nested scopes); callers undoing a failed add need to know before
+ * they start deleting.  kernel_xfrm_sync_batch() does the same
+ * without closing the batch.
+ *
+ * Anything that needs to talk to the kernel synchronously while the
+ * batch is open first flushes it so that requests stay in order; the
+ * result is folded into what the scopes' commits return.
+ */
+
+#define XFRM_BATCH_MAX 32
+#define XFRM_BATCH_DEPTH 4
+#define XFRM_BATCH_BUFFER_SIZE (64 * 1024)
+#define XFRM_BATCH_ACK_SIZE 1024
+
+struct xfrm_batch_entry {
+	uint32_t seq;
+	uint16_t type;
+	unsigned depth;			/* scopes open when batched */
+	bool policy;
+	/* policy */
+	enum expect_kernel_policy what_about_inbound;
+	const char *adstory;
+	const char *func;
+	/* both */
+	const char *description;
+	char *story;
+};
+
+static struct {
+	unsigned depth;			/* 0 when closed */
+	bool ok[XFRM_BATCH_DEPTH];	/* per scope, sticky */
+	unsigned nr;
+	size_t len;
+	struct xfrm_batch_entry entry[XFRM_BATCH_MAX];
+	uint8_t buffer[XFRM_BATCH_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	uint8_t ack[XFRM_BATCH_MAX][XFRM_BATCH_ACK_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+} xfrm_batch;
+
+static uint32_t xfrm_batch_seq = 0x80000000;	/* well clear of sendrecv_xfrm_msg() */
+
+static bool check_xfrm_batch_ack(const struct xfrm_batch_entry *e,
+				 const struct nlmsghdr *n,
+				 struct logger *logger)
+{
+	if (n->nlmsg_type != NLMSG_ERROR ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+		name_buf sb1, sb2;
+		llog(RC_LOG, logger,
+		     "netlink response to our %s message for %s %s was of wrong type (%s)",
+		     str_sparse_long(&xfrm_type_names, e->type, &sb1),
+		     e->description, e->story,
+		     str_sparse_long(&xfrm_type_names, n->nlmsg_type, &sb2));
+		return false;
+	}
+
+	const struct nlmsgerr *err = NLMSG_DATA(n);
+	int error = -err->error;
+
+	if (e->policy) {
+		if (error != 0 && DBGP(DBG_BASE)) {
+			llog_ext_ack(DEBUG_STREAM, logger, n);
+		}
+		return xfrm_policy_response(e->type, error, e->what_about_inbound,
+					    e->story, e->adstory, logger, e->func);
+	}
+
+	if (error != 0) {
+		llog_xfrm_error(error, n, e->description, e->story, logger);
+		llog_add_sa_error(e->type, error, logger);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * A failed request fails the scope that made it, and the scopes
+ * enclosing that.  Since each commit flushes, those scopes are all
+ * still open.
+ */
+
+static void fail_xfrm_batch_entry(const struct xfrm_batch_entry *e)
+{
+	for (unsigned d = 0; d < e->depth; d++) {
+		xfrm_batch.ok[d] = false;
+	}
+}
+
+static void flush_xfrm_batch(struct logger *logger)
+{
+	if (xfrm_batch.nr == 0) {
+		return;
+	}
+
+	/* the kernel must see queued requests first */
+	flush_xfrm_requests(logger);
+
+	ldbg(logger, "%s() writing %u requests, %zu bytes",
+	     __func__, xfrm_batch.nr, xfrm_batch.len);
+
+	unsigned nr_acks = 0;
+	bool acked[XFRM_BATCH_MAX] = {0};
+
+	ssize_t r;
+	do {
+		r = write(nl_send_fd, xfrm_batch.buffer, xfrm_batch.len);
+	} while (r < 0 && errno == EINTR);
+	/* scrub keys from memory */
+	memset(xfrm_batch.buffer, 0, xfrm_batch.len);
+
+	if (r < 0 || (size_t)r != xfrm_batch.len) {
+		llog_error(logger, (r < 0 ? errno : EMSGSIZE),
+			   "netlink write() of %u batched requests failed",
+			   xfrm_batch.nr);
+		for (unsigned i = 0; i < xfrm_batch.nr; i++) {
+			fail_xfrm_batch_entry(&xfrm_batch.entry[i]);
+		}
+		nr_acks = xfrm_batch.nr; /* nothing to wait for */
+	}
+
+	uint32_t first_seq = xfrm_batch.entry[0].seq;
+	while (nr_acks < xfrm_batch.nr) {
+		struct mmsghdr msgs[XFRM_BATCH_MAX];
+		struct iovec iov[XFRM_BATCH_MAX];
+		struct sockaddr_nl addr[XFRM_BATCH_MAX];
+		unsigned want = xfrm_batch.nr - nr_acks;
+		for (unsigned i = 0; i < want; i++) {
+			iov[i] = (struct iovec) {
+				.iov_base = xfrm_batch.ack[i],
+				.iov_len = sizeof(xfrm_batch.ack[i]),
+			};
+			msgs[i] = (struct mmsghdr) {
+				.msg_hdr = {
+					.msg_name = &addr[i],
+					.msg_namelen = sizeof(addr[i]),
+					.msg_iov = &iov[i],
+					.msg_iovlen = 1,
+				},
+			};
+		}
+
+		int n = recvmmsg(nl_send_fd, msgs, want, MSG_WAITFORONE, NULL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			llog_error(logger, errno,
+				   "netlink recvmmsg() of responses to %u batched requests failed",
+				   xfrm_batch.nr);
+			for (unsigned i = 0; i < xfrm_batch.nr; i++) {
+				if (!acked[i]) {
+					fail_xfrm_batch_entry(&xfrm_batch.entry[i]);
+				}
+			}
+			break;
+		}
+
+		for (int m = 0; m < n; m++) {
+			size_t len = msgs[m].msg_len;
+			if (addr[m].nl_pid != 0) {
+				/* not for us: ignore */
+				continue;
+			}
+			for (const struct nlmsghdr *h = (const void *)xfrm_batch.ack[m];
+			     NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+				unsigned i = h->nlmsg_seq - first_seq;
+				if (i >= xfrm_batch.nr || acked[i]) {
+					ldbg(logger, "%s() ignoring out of sequence (%u) message",
+					     __func__, h->nlmsg_seq);
+					continue;
+				}
+				acked[i] = true;
+				nr_acks++;
+				if (!check_xfrm_batch_ack(&xfrm_batch.entry[i], h, logger)) {
+					fail_xfrm_batch_entry(&xfrm_batch.entry[i]);
+				}
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < xfrm_batch.nr; i++) {
+		pfreeany(xfrm_batch.entry[i].story);
+	}
+	xfrm_batch.nr = 0;
+	xfrm_batch.len = 0;
+}
+
+static struct xfrm_batch_entry *batch_xfrm_msg(struct nlmsghdr *hdr,
+					       const char *description,
+					       const char *story,
+					       struct logger *logger)
+{
+	if (xfrm_batch.depth == 0) {
+		return NULL;
+	}
+
+	if (xfrm_batch.nr >= elemsof(xfrm_batch.entry) ||
+	    xfrm_batch.len + NLMSG_ALIGN(hdr->nlmsg_len) > sizeof(xfrm_batch.buffer)) {
+		flush_xfrm_batch(logger);
+	}
+
+	hdr->nlmsg_flags |= NLM_F_ACK;
+	hdr->nlmsg_seq = ++xfrm_batch_seq;
+
+	name_buf sb;
+	ldbg(logger, "%s() batching %s %s %s seq %u",
+	     __func__, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+	     description, story, hdr->nlmsg_seq);
+
+	struct xfrm_batch_entry *e = &xfrm_batch.entry[xfrm_batch.nr++];
+	*e = (struct xfrm_batch_entry) {
+		.seq = hdr->nlmsg_seq,
+		.type = hdr->nlmsg_type,
+		.depth = xfrm_batch.depth,
+		.description = description,
+		.story = clone_str(story, "xfrm batch story"),
+	};
+	memcpy(xfrm_batch.buffer + xfrm_batch.len, hdr, hdr->nlmsg_len);
+	xfrm_batch.len += NLMSG_ALIGN(hdr->nlmsg_len);
+	return e;
+}
+
+static bool batch_xfrm_sa(struct nlmsghdr *hdr,
+			  const char *description, const char *story,
+			  struct logger *logger)
+{
+	return (batch_xfrm_msg(hdr, description, story, logger) != NULL);
+}
+
+static bool batch_xfrm_policy(struct nlmsghdr *hdr,
+			      enum expect_kernel_policy what_about_inbound,
+			      const char *story, const char *adstory,
+			      const char *func, struct logger *logger)
+{
+	struct xfrm_batch_entry *e = batch_xfrm_msg(hdr, "policy", story, logger);
+	if (e == NULL) {
+		return false;
+	}
+	e->policy = true;
+	e->what_about_inbound = what_about_inbound;
+	e->adstory = adstory;
+	e->func = func;
+	return true;
+}
+
+static void kernel_xfrm_begin_batch(struct logger *logger)
+{
+	PASSERT(logger, xfrm_batch.depth < elemsof(xfrm_batch.ok));
+	if (xfrm_batch.depth == 0) {
+		PEXPECT(logger, xfrm_batch.nr == 0);
+	}
+	xfrm_batch.ok[xfrm_batch.depth++] = true;
+}
+
+static bool kernel_xfrm_sync_batch(struct logger *logger)
+{
+	flush_xfrm_batch(logger);
+	return (xfrm_batch.depth == 0 || xfrm_batch.ok[xfrm_batch.depth - 1]);
+}
+
+static bool kernel_xfrm_commit_batch(struct logger *logger)
+{
+	if (!PEXPECT(logger, xfrm_batch.depth > 0)) {
+		return true;
+	}
+	flush_xfrm_batch(logger);
+	return xfrm_batch.ok[--xfrm_batch.depth];
+}
+
+static bool xfrm_policy_response(unsigned type, int error,
+				 enum expect_kernel_policy what_about_inbound,
+				 const char *story, const char *adstory,
+				 struct logger *logger, const char *func)
+{
 	switch (what_about_inbound) {
 	case KERNEL_POLICY_PRESENT_OR_MISSING:
 		if (error == 0) {
@@ -699,7 +1325,7 @@ static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
 			name_buf sb;
 			ldbg(logger,
 			     "%s()   %s for flow %s %s had A policy",
-			     func, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+			     func, str_sparse_long(&xfrm_type_names, type, &sb),
 			     story, adstory);
 			return true;
 		}
@@ -708,7 +1334,7 @@ static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
 			name_buf sb;
 			ldbg(logger,
 			     "%s()   %s for flow %s %s had NO policy",
-			     func, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+			     func, str_sparse_long(&xfrm_type_names, type, &sb),
 			     story, adstory);
 			return true;
 		}
@@ -719,7 +1345,7 @@ static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
 			name_buf sb;
 			ldbg(logger,
 			     "%s()   %s for flow %s %s had A policy",
-			     func, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+			     func, str_sparse_long(&xfrm_type_names, type, &sb),
 			     story, adstory);
 			return true;
 		}
@@ -730,7 +1356,7 @@ static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
 			name_buf sb;
 			ldbg(logger,
 			     "%s()   %s for flow %s %s had NO policy",
-			     func, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+			     func, str_sparse_long(&xfrm_type_names, type, &sb),
 			     story, adstory);
 			return true;
 		}
@@ -740,7 +1366,7 @@ static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
 			name_buf sb;
 			llog(RC_LOG, logger,
 			     "%s()   %s for flow %s %s encountered unexpected policy",
-			     func, str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+			     func, str_sparse_long(&xfrm_type_names, type, &sb),
 			     story, adstory);
 			return true;
 		}
@@ -751,11 +1377,47 @@ static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
 	name_buf sb;
 	llog_error(logger, error,
 		   "kernel: xfrm %s %s response for flow %s",
-		   str_sparse_long(&xfrm_type_names, hdr->nlmsg_type, &sb),
+		   str_sparse_long(&xfrm_type_names, type, &sb),
 		   story, adstory);
 	return false;
 }
 
+/*
+ * sendrecv_xfrm_policy -
+ *
+ * @param hdr - Data to check
+ * @param enoent_ok - Boolean - OK or not OK.
+ * @param story - String
+ * @return boolean
+ */
+static bool sendrecv_xfrm_policy(struct nlmsghdr *hdr,
+				 enum expect_kernel_policy what_about_inbound,
+				 const char *story, const char *adstory,
+				 struct logger *logger, const char *func)
+{
+	if (batch_xfrm_policy(hdr, what_about_inbound, story, adstory, func, logger)) {
+		return true;
+	}
+
+	struct nlm_resp rsp;
+
+	int recv_errno;
+	if (!sendrecv_xfrm_msg(hdr, NLMSG_ERROR, &rsp,
+			       "policy", story,
+			       &recv_errno, logger)) {
+		return false;
+	}
+
+	/*
+	 * Kind of surprising: we get here by success which implies an
+	 * error structure!
+	 */
+
+	return xfrm_policy_response(hdr->nlmsg_type, -rsp.u.e.error,
+				    what_about_inbound, story, adstory,
+				    logger, func);
+}
+
 static void set_xfrm_selectors(struct xfrm_selector *sel,
 			       const ip_selector *src_client,
 			       const ip_selector *dst_client,
@@ -2058,16 +2720,27 @@ static bool netlink_add_sa(const struct kernel_state *sa, bool replace,
 		}
 	}
 
+	if (batch_xfrm_sa(&req.n, "Add SA", sa->story, logger)) {
+		/* keys are scrubbed once the batch is sent */
+		return true;
+	}
+
 	int recv_errno;
 	bool ret = sendrecv_xfrm_msg(&req.n, NLMSG_NOOP, NULL,
 				     "Add SA", sa->story,
 				     &recv_errno, logger);
-	if (!ret && recv_errno == ESRCH &&
-	    req.n.nlmsg_type == XFRM_MSG_UPDSA) {
+	if (!ret) {
+		llog_add_sa_error(req.n.nlmsg_type, recv_errno, logger);
+	}
+	return ret;
+}
+
+static void llog_add_sa_error(unsigned type, int error, struct logger *logger)
+{
+	if (error == ESRCH && type == XFRM_MSG_UPDSA) {
 		llog(RC_LOG, logger,
 			    "Warning: kernel expired our reserved IPsec SA SPI - negotiation took too long? Try increasing /proc/sys/net/core/xfrm_acq_expires");
 	}
-	return ret;
 }
 
 /*
@@ -2076,12 +2749,13 @@ static bool netlink_add_sa(const struct kernel_state *sa, bool replace,
  * @param sa Kernel SA to be deleted
  * @return bool True if successful
  */
-static bool xfrm_del_ipsec_spi(ipsec_spi_t spi,
-			       const struct ip_protocol *proto,
-			       const ip_address *src_address,
-			       const ip_address *dst_address,
-			       const char *story,
-			       struct logger *logger)
+static bool del_ipsec_spi(ipsec_spi_t spi,
+			  const struct ip_protocol *proto,
+			  const ip_address *src_address,
+			  const ip_address *dst_address,
+			  const char *story,
+			  bool queue,
+			  struct logger *logger)
 {
 	struct {
 		struct nlmsghdr n;
@@ -2101,12 +2775,38 @@ static bool xfrm_del_ipsec_spi(ipsec_spi_t spi,
 
 	req.n.nlmsg_len = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(req.id)));
 
+	if (queue && queue_xfrm_request(&req.n, "Del SA", story,
+					NULL, NULL, logger)) {
+		return true;
+	}
+
 	int recv_errno;
 	return sendrecv_xfrm_msg(&req.n, NLMSG_NOOP, NULL,
 				 "Del SA", story,
 				 &recv_errno, logger);
 }
 
+/*
+ * Nothing waits on the result of deleting an SA, so queue the
+ * request; true means the delete was issued, failures are logged and
+ * counted when the ACK arrives.
+ *
+ * Except while a batch is open: the delete is likely undoing a
+ * batched add, and queued requests are written before the batch.
+ * Going synchronous writes the batch first.
+ */
+
+static bool xfrm_del_ipsec_spi(ipsec_spi_t spi,
+			       const struct ip_protocol *proto,
+			       const ip_address *src_address,
+			       const ip_address *dst_address,
+			       const char *story,
+			       struct logger *logger)
+{
+	return del_ipsec_spi(spi, proto, src_address, dst_address,
+			     story, /*queue*/(xfrm_batch.depth == 0), logger);
+}
+
 /*
  * Create ip_address out of xfrm_address_t.
  *
@@ -2853,6 +3553,91 @@ static bool xfrm_get_kernel_state(const struct kernel_state *sa, uint64_t *bytes
 	return true;
 }
 
+/*
+ * Dump all the SAs (NLM_F_DUMP) passing each one's traffic counters
+ * to the callback.
+ */
+
+struct linux_netlink_context {
+	kernel_state_counters_cb *cb;
+	void *context;
+	unsigned nr;
+};
+
+static bool parse_xfrm_newsa_response(struct nlmsghdr *n,
+				      struct linux_netlink_context *dump,
+				      struct verbose verbose)
+{
+	if (n->nlmsg_type != XFRM_MSG_NEWSA ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(struct xfrm_usersa_info))) {
+		vdbg("ignoring message type %u length %u",
+		     n->nlmsg_type, n->nlmsg_len);
+		return true;
+	}
+
+	const struct xfrm_usersa_info *info = NLMSG_DATA(n);
+	const struct ip_info *afi = aftoinfo(info->family);
+	if (afi == NULL) {
+		vdbg("ignoring SA with unknown family %u", info->family);
+		return true;
+	}
+
+	struct kernel_state_counters counters = {
+		.dst = address_from_xfrm(afi, &info->id.daddr),
+		.ipproto = info->id.proto,
+		.spi = info->id.spi,
+		.bytes = info->curlft.bytes,
+		.add_time = info->curlft.add_time,
+	};
+
+	/* Run through rtattributes looking for XFRMA_LASTUSED */
+	const struct rtattr *attr =
+		(const void *)((const uint8_t *)info + NLMSG_ALIGN(sizeof(*info)));
+	int remaining = n->nlmsg_len - NLMSG_SPACE(sizeof(*info));
+	for (; RTA_OK(attr, remaining); attr = RTA_NEXT(attr, remaining)) {
+		if (attr->rta_type == XFRMA_LASTUSED &&
+		    RTA_PAYLOAD(attr) >= sizeof(uint64_t)) {
+			memcpy(&counters.lastused, RTA_DATA(attr), sizeof(uint64_t));
+		}
+	}
+
+	dump->cb(&counters, dump->context);
+	dump->nr++;
+	return true;
+}
+
+static bool xfrm_dump_kernel_states(kernel_state_counters_cb *cb, void *context,
+				    struct logger *logger)
+{
+	struct verbose verbose = VERBOSE(DEBUG_STREAM, logger, NULL);
+
+	struct {
+		struct nlmsghdr n;
+	} req = {
+		.n = {
+			.nlmsg_len = NLMSG_LENGTH(0),
+			.nlmsg_type = XFRM_MSG_GETSA,
+			/* ACK forces a blocking read of the entire dump */
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP | NLM_F_ACK,
+		},
+	};
+
+	struct linux_netlink_context dump = {
+		.cb = cb,
+		.context = context,
+	};
+
+	if (!linux_netlink_query(&req.n, NETLINK_XFRM,
+				 parse_xfrm_newsa_response,
+				 &dump, verbose)) {
+		llog(RC_LOG, logger, "kernel: dumping IPsec SAs failed");
+		return false;
+	}
+
+	vdbg("%s() dumped %u SAs", __func__, dump.nr);
+	return true;
+}
+
 static struct xfrm_selector icmpv6_selector(int port)
 {
 	/* icmp is packed into [sd]port */
@@ -3053,9 +3838,9 @@ static bool qry_xfrm_base_support(struct logger *logger, bool check_iptfs, bool
 		ldbg(logger, "kernel: directional SAs supported");
 		if (check_iptfs)
 			ldbg(logger, "kernel: IPTFS supported");
-		if (!xfrm_del_ipsec_spi(sa.spi, sa.proto,
-			&sa.src.address, &sa.dst.address,
-			"del probe", logger)) {
+		if (!del_ipsec_spi(sa.spi, sa.proto,
+				   &sa.src.address, &sa.dst.address,
+				   "del probe", /*queue*/false, logger)) {
 			llog(RC_LOG, logger, "kernel: probe SA deletion failed - ignored");
 		}
 		return true;
@@ -3338,7 +4123,7 @@ static bool netlink_poke_ipsec_policy_hole(int fd, const struct ip_info *afi, st
 
 static void kernel_xfrm_shutdown(struct logger *logger)
 {
-	ldbg(logger, "%s() no-op", __func__);
+	drain_xfrm_requests(logger);
 }
 
 static const char *xfrm_protostack_names[] = { "xfrm", "netkey", NULL, };
@@ -3356,11 +4141,15 @@ const struct kernel_ops xfrm_kernel_ops = {
 	.poke_holes = kernel_xfrm_poke_holes,
 	.plug_holes = kernel_xfrm_plug_holes,
 	.shutdown = kernel_xfrm_shutdown,
+	.begin_batch = kernel_xfrm_begin_batch,
+	.sync_batch = kernel_xfrm_sync_batch,
+	.commit_batch = kernel_xfrm_commit_batch,
 
 	.policy_del = kernel_xfrm_policy_del,
 	.policy_add = kernel_xfrm_policy_add,
 	.add_sa = netlink_add_sa,
 	.get_kernel_state = xfrm_get_kernel_state,
+	.dump_kernel_states = xfrm_dump_kernel_states,
 	.get_ipsec_spi = xfrm_get_ipsec_spi,
 	.del_ipsec_spi = xfrm_del_ipsec_spi,
 	.migrate_ipsec_sa_is_enabled = xfrm_migrate_ipsec_sa_is_enabled,
@@ -43,6 +43,7 @@
 #include "pending.h"
 #include "show.h"
 #include "config_setup.h"
+#include "server.h"		/* for attach_fd_write_listener() */
 
 static struct fd *logger_fd(const struct logger *logger);
 static void log_raw(int severity, const char *prefix, struct jambuf *buf);
@@ -132,51 +133,302 @@ void switch_log(const struct config_setup *oco, struct logger **logger)
 }
 
 /*
- * Wrap up the logic to decide if a particular output should occur.
- * The compiler will likely inline these.
+ * Output to whack.
  *
- * MESSAGE does not include trailing '\0'.
+ * Rather than a blocking sendmsg() per line, output is appended to a
+ * per-whack buffer and written, without blocking, by an event-loop
+ * writer as the socket drains.  A large status dump costs a handful
+ * of syscalls and a slow (or stopped) whack no longer stalls pluto.
+ *
+ * Each buffer holds a reference to the whack FD so the socket is
+ * only closed (and whack only sees EOF) once everything has been
+ * written.
+ *
+ * The buffer is per-socket, not per-struct show, so that show()
+ * output and llog() output to the same whack stay in order.
+ *
+ * Whack output can come from any thread, hence the lock; buffers are
+ * only freed by the event-loop writer (or at exit) so that the
+ * writer's event is never deleted while it is running.
+ *
+ * The lock is never held across a blocking write: when a buffer has
+ * to be flushed its contents are taken, the lock dropped, and the
+ * write done; other threads keep appending behind it.  Only one
+ * thread writes a buffer at a time, else output would be re-ordered.
+ */
+
+#define WHACK_OUTPUT_CHUNK (64 * 1024)		/* try to write at this */
+#define WHACK_OUTPUT_LIMIT (16 * 1024 * 1024)	/* then block */
+
+struct whack_output {
+	struct fd *fd;
+	struct fd_write_listener *writer;
+	uint8_t *ptr;
+	size_t start;	/* written up to here */
+	size_t end;	/* buffered up to here */
+	size_t size;
+	bool broken;	/* write failed, discard everything */
+	bool writing;	/* a thread is blocked writing, unlocked */
+	unsigned users;	/* threads in flush_whack_output() */
+	struct whack_output *next;
+};
+
+static pthread_mutex_t whack_output_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t whack_output_cond = PTHREAD_COND_INITIALIZER;
+static struct whack_output *whack_outputs;
+static bool whack_output_closed;
+
+/*
+ * Write out what can be written; when BLOCKING, everything.  On
+ * error (probably the other end hit ctrl-c) everything is dropped.
+ */
+
+static void write_whack_output(struct whack_output *wo, bool blocking)
+{
+	while (wo->start < wo->end) {
+		struct iovec iov = {
+			.iov_base = wo->ptr + wo->start,
+			.iov_len = wo->end - wo->start,
+		};
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+		/* write to whack socket, but suppress possible SIGPIPE */
+		ssize_t s = fd_sendmsg(wo->fd, &msg,
+				       MSG_NOSIGNAL | (blocking ? 0 : MSG_DONTWAIT));
+		if (s == -EINTR) {
+			continue;
+		}
+		if (s == -EAGAIN || s == -EWOULDBLOCK) {
+			break;
+		}
+		if (s < 0) {
+			/* probably the other end hit cntrl-c */
+			JAMBUF(buf) {
+				jam(buf, "whack error: ");
+				jam_errno(buf, (-(int)s));
+				/* not whack */
+				log_raw(LOG_WARNING, "", buf);
+			}
+			wo->broken = true;
+			wo->start = wo->end;
+			break;
+		}
+		wo->start += s;
+	}
+	if (wo->start == wo->end) {
+		wo->start = wo->end = 0;
+	}
+}
+
+/*
+ * Block until everything buffered in WO has been written.  Called,
+ * and returns, with the lock held; the lock is dropped around the
+ * write.
  */
 
-static void shunk_to_whack(shunk_t message, const struct fd *whackfd, enum rc_type rc)
+static void flush_whack_output(struct whack_output *wo)
+{
+	wo->users++;
+	while (wo->writing) {
+		pthread_cond_wait(&whack_output_cond, &whack_output_mutex);
+	}
+	wo->writing = true;
+	while (wo->start < wo->end) {
+		/* take the buffer; appends go to a new one */
+		struct whack_output out = {
+			.fd = wo->fd,
+			.ptr = wo->ptr,
+			.start = wo->start,
+			.end = wo->end,
+			.size = wo->size,
+		};
+		wo->ptr = NULL;
+		wo->start = wo->end = wo->size = 0;
+
+		pthread_mutex_unlock(&whack_output_mutex);
+		write_whack_output(&out, /*blocking*/true);
+		pthread_mutex_lock(&whack_output_mutex);
+
+		if (wo->ptr == NULL) {
+			/* nothing appended, re-use the buffer */
+			wo->ptr = out.ptr;
+			wo->size = out.size;
+		} else {
+			pfree(out.ptr);
+		}
+		if (out.broken) {
+			wo->broken = true;
+			wo->start = wo->end = 0;
+		}
+	}
+	wo->writing = false;
+	wo->users--;
+	pthread_cond_broadcast(&whack_output_cond);
+}
+
+static void free_whack_output(struct whack_output **wop)
 {
-	/*
-	 * XXX: use iovec as it's easier than trying to deal with
-	 * truncation while still ensuring that the message is
-	 * terminated with a '\n' (this isn't a performance thing, it
-	 * just replaces local memory moves with kernel equivalent).
-	 */
+	struct whack_output *wo = *wop;
+	passert(wo->users == 0 && !wo->writing);
+	*wop = wo->next;
+	detach_fd_write_listener(&wo->writer);
+	fd_delref(&wo->fd);
+	pfreeany(wo->ptr);
+	pfree(wo);
+}
+
+static void whack_output_writer(int fd UNUSED, void *arg, struct logger *logger UNUSED)
+{
+	pthread_mutex_lock(&whack_output_mutex);
+	{
+		for (struct whack_output **wop = &whack_outputs; *wop != NULL; wop = &(*wop)->next) {
+			if (*wop == arg) {
+				if ((*wop)->writing) {
+					/* flush_whack_output() has it */
+					break;
+				}
+				write_whack_output(*wop, /*blocking*/false);
+				if ((*wop)->end == 0 && (*wop)->users == 0) {
+					free_whack_output(wop);
+				}
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&whack_output_mutex);
+}
 
+static void append_whack_output(struct whack_output *wo, const void *ptr, size_t len)
+{
+	if (wo->end + len > wo->size) {
+		/* discard what has been written, then grow */
+		if (wo->start > 0) {
+			memmove(wo->ptr, wo->ptr + wo->start, wo->end - wo->start);
+			wo->end -= wo->start;
+			wo->start = 0;
+		}
+		if (wo->end + len > wo->size) {
+			size_t size = max(max(wo->size * 2, wo->end + len),
+					  (size_t)4096);
+			realloc_bytes((void**)&wo->ptr, wo->size, size, "whack output");
+			wo->size = size;
+		}
+	}
+	memcpy(wo->ptr + wo->end, ptr, len);
+	wo->end += len;
+}
+
+/*
+ * MESSAGE does not include trailing '\0'.  When FLUSH, block until
+ * everything, including MESSAGE, has been written.
+ */
+
+static void shunk_to_whack(shunk_t message, struct fd *whackfd, enum rc_type rc,
+			   bool flush)
+{
 	/* 'NNN ' */
 	char prefix[10];/*65535+200*/
 	int prefix_len = snprintf(prefix, sizeof(prefix), "%03u ", rc);
 	passert(prefix_len >= 0 && (unsigned) prefix_len < sizeof(prefix));
 
-	/* NL */
-	char nl = '\n';
+	pthread_mutex_lock(&whack_output_mutex);
+	{
+		struct whack_output *wo = whack_outputs;
+		while (wo != NULL && wo->fd != whackfd) {
+			wo = wo->next;
+		}
+		if (wo == NULL) {
+			wo = alloc_thing(struct whack_output, "whack output");
+			wo->fd = fd_addref(whackfd);
+			if (!whack_output_closed) {
+				/* also frees WO once it is empty */
+				attach_fd_write_listener(&wo->writer, fd_fileno(whackfd),
+							 "whack output", whack_output_writer, wo);
+			}
+			wo->next = whack_outputs;
+			whack_outputs = wo;
+		}
+
+		if (!wo->broken) {
+			append_whack_output(wo, prefix, prefix_len);
+			append_whack_output(wo, message.ptr, message.len);
+			append_whack_output(wo, "\n", 1);
+		}
 
-	struct iovec iov[] = {
-		{ .iov_base = prefix, .iov_len = prefix_len, },
-		/* need to cast away const :-( */
-		{ .iov_base = (void*)message.ptr, .iov_len = message.len, },
-		{ .iov_base = &nl, .iov_len = sizeof(nl), },
-	};
-	struct msghdr msg = {
-		.msg_iov = iov,
-		.msg_iovlen = elemsof(iov),
-	};
+		size_t buffered = wo->end - wo->start;
+		if (flush || whack_output_closed || buffered >= WHACK_OUTPUT_LIMIT) {
+			/* drops the lock while writing */
+			flush_whack_output(wo);
+		} else if (buffered >= WHACK_OUTPUT_CHUNK && !wo->writing) {
+			write_whack_output(wo, /*blocking*/false);
+		}
 
-	/* write to whack socket, but suppress possible SIGPIPE */
-	ssize_t s = fd_sendmsg(whackfd, &msg, MSG_NOSIGNAL);
-	if (s < 0) {
-		/* probably the other end hit cntrl-c */
-		JAMBUF(buf) {
-			jam(buf, "whack error: ");
-			jam_errno(buf, (-(int)s));
-			/* not whack */
-			log_raw(LOG_WARNING, "", buf);
+		if (whack_output_closed && wo->users == 0 && !wo->writing) {
+			struct whack_output **wop = &whack_outputs;
+			while (*wop != wo) {
+				wop = &(*wop)->next;
+			}
+			free_whack_output(wop);
+		}
+	}
+	pthread_mutex_unlock(&whack_output_mutex);
+}
+
+/*
+ * Called with the event-loop about to go away; from here on whack
+ * output is written immediately.
+ */
+
+void free_whack_outputs(struct logger *logger)
+{
+	pthread_mutex_lock(&whack_output_mutex);
+	{
+		whack_output_closed = true;
+		struct whack_output **wop = &whack_outputs;
+		while (*wop != NULL) {
+			struct whack_output *wo = *wop;
+			ldbg(logger, "whack output: flushing %zu bytes",
+			     wo->end - wo->start);
+			/* drops the lock, the list can change */
+			flush_whack_output(wo);
+			if (wo->users > 0) {
+				/* the other user frees it */
+				wop = &wo->next;
+				continue;
+			}
+			wop = &whack_outputs;
+			while (*wop != wo) {
+				wop = &(*wop)->next;
+			}
+			free_whack_output(wop);
+			wop = &whack_outputs;
+		}
+	}
+	pthread_mutex_unlock(&whack_output_mutex);
+}
+
+/*
+ * How much output is waiting for LOGGER's whacks; long dumps back
+ * off when it gets large.
+ */
+
+size_t whack_output_backlog(const struct logger *logger)
+{
+	size_t backlog = 0;
+	pthread_mutex_lock(&whack_output_mutex);
+	{
+		for (struct whack_output *wo = whack_outputs; wo != NULL; wo = wo->next) {
+			for (unsigned i = 0; i < elemsof(logger->whackfd); i++) {
+				if (logger->whackfd[i] == wo->fd) {
+					backlog += wo->end - wo->start;
+				}
+			}
 		}
 	}
+	pthread_mutex_unlock(&whack_output_mutex);
+	return backlog;
 }
 
 /*
@@ -203,8 +455,10 @@ bool whack_prompt_for(struct ike_sa *ike,
 		jam(buf, "prompt for %s:", prompt);
 		/* message, not including trailing '\0' */
 		shunk_t message = jambuf_as_shunk(buf);
+		/* whack must see the prompt before pluto blocks reading */
 		shunk_to_whack(message, whack_fd,
-			       echo ? RC_USERPROMPT : RC_ENTERSECRET);
+			       echo ? RC_USERPROMPT : RC_ENTERSECRET,
+			       /*flush*/true);
 	}
 
 	ssize_t n = fd_read(whack_fd, ansbuf, ansbuf_len);
@@ -239,7 +493,7 @@ void whack_rc(enum rc_type rc, const struct logger *logger)
 		if (logger->whackfd[i] == NULL) {
 			continue;
 		}
-		shunk_to_whack(empty_shunk, logger->whackfd[i], rc);
+		shunk_to_whack(empty_shunk, logger->whackfd[i], rc, /*flush*/false);
 	}
 }
 
@@ -310,7 +564,7 @@ static void log_whacks(enum rc_type rc, const struct logger *logger, struct jamb
 		if (logger->whackfd[i] == NULL) {
 			continue;
 		}
-		shunk_to_whack(message, logger->whackfd[i], rc);
+		shunk_to_whack(message, logger->whackfd[i], rc, /*flush*/false);
 	}
 }
 
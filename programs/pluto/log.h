@@ -44,6 +44,8 @@ struct config_setup;
 struct logger *init_log(const char *progname);
 void switch_log(const struct config_setup *oco, struct logger **logger);
 void close_log(void);	/* call after report_leaks() */
+void free_whack_outputs(struct logger *logger); /* before free_server() */
+size_t whack_output_backlog(const struct logger *logger);
 void show_log(struct show *s);
 
 extern bool whack_prompt_for(struct ike_sa *ike,
@@ -15,21 +15,165 @@
  *
  */
 
+#include <pthread.h>
+
 #include "defs.h"
 #include "log.h"
 #include "demux.h"      /* needs packet.h */
 #include "iface.h"
+#include "show.h"
+
+/*
+ * Pool of msg_digests.
+ *
+ * Every received packet needs a msg_digest (which is large) plus
+ * space for the packet; and most are released moments later.
+ * Instead of going back to malloc() each time, released digests are
+ * kept on a per-size-class free list and re-used.
+ *
+ * A packet too big for the largest class gets a one-off allocation.
+ */
+
+static const struct md_pool_class {
+	size_t size;		/* packet bytes */
+	unsigned max;		/* free digests kept */
+	const char *name;
+} md_pool_classes[] = {
+	{ 1024, 64, "1k", },
+	{ 2048, 64, "2k", },
+	{ 8192, 16, "8k", },
+	{ MAX_INPUT_UDP_SIZE, 4, "64k", },
+};
+
+#define MD_POOL_ROOF elemsof(md_pool_classes)
+
+static struct {
+	struct msg_digest *free;
+	unsigned nr_free;
+	uintmax_t hits;
+	uintmax_t misses;
+} md_pool[MD_POOL_ROOF + 1/*oversize*/];
+
+static pthread_mutex_t md_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool md_pool_closed;	/* after free_md_pool() */
+
+static const struct refcnt_base md_refcnt_base = {
+	.what = "struct msg_digest",
+};
+
+static struct msg_digest *get_md(size_t packet_len, where_t where)
+{
+	unsigned p = 0;
+	while (p < MD_POOL_ROOF && packet_len > md_pool_classes[p].size) {
+		p++;
+	}
+
+	struct msg_digest *md = NULL;
+	pthread_mutex_lock(&md_pool_mutex);
+	{
+		if (md_pool[p].free != NULL) {
+			md = md_pool[p].free;
+			md_pool[p].free = md->md_pool_next;
+			md_pool[p].nr_free--;
+			md_pool[p].hits++;
+		} else {
+			md_pool[p].misses++;
+		}
+	}
+	pthread_mutex_unlock(&md_pool_mutex);
+
+	if (md != NULL) {
+		/* the buffer doesn't need zeroing */
+		zero(md);
+	} else {
+		size_t size = (p < MD_POOL_ROOF ? md_pool_classes[p].size : packet_len);
+		md = overalloc_thing(struct msg_digest, size);
+	}
+	md->md_pool = p;
+	refcnt_init(md, &md->refcnt, &md_refcnt_base, where);
+	return md;
+}
+
+static void put_md(struct msg_digest *md)
+{
+	unsigned p = md->md_pool;
+	pthread_mutex_lock(&md_pool_mutex);
+	{
+		if (p < MD_POOL_ROOF && !md_pool_closed &&
+		    md_pool[p].nr_free < md_pool_classes[p].max) {
+			md->md_pool_next = md_pool[p].free;
+			md_pool[p].free = md;
+			md_pool[p].nr_free++;
+			md = NULL;
+		}
+	}
+	pthread_mutex_unlock(&md_pool_mutex);
+	if (md != NULL) {
+		pfree(md);
+	}
+}
+
+void show_md_pool(struct show *s)
+{
+	pthread_mutex_lock(&md_pool_mutex);
+	{
+		for (unsigned p = 0; p < MD_POOL_ROOF; p++) {
+			const char *name = md_pool_classes[p].name;
+			show(s, "current.md.pool.%s.free=%u", name, md_pool[p].nr_free);
+			show(s, "total.md.pool.%s.hits=%ju", name, md_pool[p].hits);
+			show(s, "total.md.pool.%s.misses=%ju", name, md_pool[p].misses);
+		}
+		show(s, "total.md.pool.oversize=%ju", md_pool[MD_POOL_ROOF].misses);
+	}
+	pthread_mutex_unlock(&md_pool_mutex);
+}
+
+void clear_md_pool_stats(void)
+{
+	pthread_mutex_lock(&md_pool_mutex);
+	{
+		for (unsigned p = 0; p <= MD_POOL_ROOF; p++) {
+			md_pool[p].hits = 0;
+			md_pool[p].misses = 0;
+		}
+	}
+	pthread_mutex_unlock(&md_pool_mutex);
+}
+
+void free_md_pool(struct logger *logger)
+{
+	unsigned nr = 0;
+	pthread_mutex_lock(&md_pool_mutex);
+	{
+		md_pool_closed = true;
+		for (unsigned p = 0; p < MD_POOL_ROOF; p++) {
+			while (md_pool[p].free != NULL) {
+				struct msg_digest *md = md_pool[p].free;
+				md_pool[p].free = md->md_pool_next;
+				md_pool[p].nr_free--;
+				pfree(md);
+				nr++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&md_pool_mutex);
+	ldbg(logger, "freed %u pooled message digests", nr);
+}
 
 struct msg_digest *alloc_md(struct iface_endpoint *ifp,
 			    const ip_endpoint *sender,
 			    const uint8_t *packet, size_t packet_len,
 			    where_t where)
 {
-	struct msg_digest *md = refcnt_overalloc(struct msg_digest, packet_len, where);
+	struct msg_digest *md = get_md(packet_len, where);
 	md->iface = iface_endpoint_addref_where(ifp, where);
 	md->sender = *sender;
-	md->logger = alloc_logger(md, &logger_message_vec,
-				     /*debugging*/LEMPTY, where);
+	md->md_logger = (struct logger) {
+		.object = md,
+		.object_vec = &logger_message_vec,
+		.where = where,
+	};
+	md->logger = &md->md_logger;
 	void *buffer = md + 1;
 	md->packet_pbs = pbs_in_from_shunk(shunk2(buffer, packet_len), "packet");
 	if (packet != NULL) {
@@ -38,14 +182,20 @@ struct msg_digest *alloc_md(struct iface_endpoint *ifp,
 	return md;
 }
 
-struct msg_digest *clone_raw_md(struct msg_digest *md, where_t where)
+struct msg_digest *copy_raw_md(struct msg_digest *md, where_t where)
 {
 	shunk_t packet = pbs_in_all(&md->packet_pbs);
-	struct msg_digest *clone = alloc_md(md->iface, &md->sender,
-					    packet.ptr, packet.len,
-					    where);
+	struct msg_digest *copy = alloc_md(md->iface, &md->sender,
+					   packet.ptr, packet.len,
+					   where);
+	copy->md_inception = threadtime_start();
+	return copy;
+}
+
+struct msg_digest *clone_raw_md(struct msg_digest *md, where_t where)
+{
+	struct msg_digest *clone = copy_raw_md(md, where);
 	clone->fake_clone = true;
-	clone->md_inception = threadtime_start();
 	return clone;
 }
 
@@ -61,8 +211,8 @@ void md_delref_where(struct msg_digest **mdp, where_t where)
 	struct msg_digest *md = delref_where(mdp, logger, where);
 	if (md != NULL) {
 		free_chunk_content(&md->raw_packet);
-		free_logger(&md->logger, where);
+		release_whack(md->logger, where);
 		iface_endpoint_delref_where(&md->iface, where);
-		pfree(md);
+		put_md(md);
 	}
 }
@@ -41,6 +41,9 @@
 #include "iface.h"
 #include "state_db.h"		/* for state_by_ike_spis() */
 #include "show.h"
+#include "timer.h"			/* for slotted_event_delay() */
+#include "kernel.h"			/* for get_ipsec_traffic() */
+#include "pluto_stats.h"
 
 /* As per https://tools.ietf.org/html/rfc3948#section-4 */
 #define DEFAULT_KEEP_ALIVE_SECS  20
@@ -184,7 +187,60 @@ static void nat_traversal_send_ka(struct state *st)
 
 	/* send keep alive */
 	dbg("sending NAT-T Keep Alive");
-	send_keepalive_using_state(st, "NAT-T Keep Alive");
+	if (send_keepalive_using_state(st, "NAT-T Keep Alive")) {
+		pstats_nat_keepalive_sent++;
+	}
+}
+
+/*
+ * Rather than each SA picking its own moment, the keep-alive period
+ * is divided into NAT_KEEPALIVE_SLOTS slots and each SA is assigned
+ * one.  Keep-alives sharing a slot expire in the same timer wheel
+ * tick and so are queued, per interface, on the UDP send queue and
+ * flushed as one sendmmsg() batch (see udp_write_packet()).
+ */
+
+#define NAT_KEEPALIVE_SLOTS 16
+
+static void schedule_nat_keepalive_slot(enum event_type type, struct state *st)
+{
+	unsigned slot = st->st_serialno % NAT_KEEPALIVE_SLOTS;
+	deltatime_t phase = deltatime_scale(nat_keepalive_period, slot, NAT_KEEPALIVE_SLOTS);
+	deltatime_t delay = slotted_event_delay(nat_keepalive_period,
+						nat_keepalive_period, phase);
+	deltatime_buf db;
+	pdbg(st->logger, "NAT-keep-alive: scheduled in slot %u, period %jds, delay %s",
+	     slot, deltasecs(nat_keepalive_period), str_deltatime(delay, &db));
+	event_schedule(type, delay, st);
+}
+
+/*
+ * Inbound ESP-in-UDP traffic also keeps the NAT mapping alive; when
+ * the kernel says the Child SA has seen some within the keep-alive
+ * period the keep-alive is redundant.
+ */
+
+static bool recent_inbound_ipsec_traffic(struct child_sa *child)
+{
+	if (child == NULL || !IS_IPSEC_SA_ESTABLISHED(&child->sa)) {
+		return false;
+	}
+
+	struct ipsec_proto_info *proto_info =
+		(child->sa.st_esp.protocol == &ip_protocol_esp ? &child->sa.st_esp :
+		 child->sa.st_ah.protocol == &ip_protocol_ah ? &child->sa.st_ah :
+		 NULL);
+	if (proto_info == NULL) {
+		return false;
+	}
+
+	begin_ipsec_traffic_probe(child->sa.logger);
+	if (!get_ipsec_traffic(child, proto_info, DIRECTION_INBOUND)) {
+		return false;
+	}
+
+	deltatime_t since = realtime_diff(realnow(), proto_info->inbound.last_used);
+	return deltatime_cmp(since, <, nat_keepalive_period);
 }
 
 /*
@@ -221,9 +277,7 @@ void schedule_v1_nat_keepalive(struct state *st)
 		return;
 	}
 
-	pdbg(st->logger, "NAT-keep-alive: scheduled, period %jds",
-	     deltasecs(nat_keepalive_period));
-	event_schedule(EVENT_v1_NAT_KEEPALIVE, nat_keepalive_period, st);
+	schedule_nat_keepalive_slot(EVENT_v1_NAT_KEEPALIVE, st);
 }
 
 
@@ -259,9 +313,7 @@ void schedule_v2_nat_keepalive(struct ike_sa *ike, where_t where)
 		     pri_where(where));
 	}
 
-	pdbg(ike->sa.logger, "NAT-keep-alive: scheduled, period %jds",
-	     deltasecs(nat_keepalive_period));
-	event_schedule(EVENT_v2_NAT_KEEPALIVE, nat_keepalive_period, &ike->sa);
+	schedule_nat_keepalive_slot(EVENT_v2_NAT_KEEPALIVE, &ike->sa);
 }
 
 #ifdef USE_IKEv1
@@ -281,6 +333,9 @@ void event_v1_nat_keepalive(struct state *st)
 	 * If we were to check IPsec SA, we could then also update the
 	 * ISAKMP SA, but we think this is too expensive (call
 	 * get_sa_bundle_info() to kernel _and_ find ISAKMP SA.
+	 *
+	 * Unlike IKEv2, this is left as a one-shot; only its slot
+	 * changed.
 	 */
 	if (!IS_IPSEC_SA_ESTABLISHED(st)) {
 		pdbg(st->logger, "NAT-keep-alive: IPsec SA is not established");
@@ -302,6 +357,9 @@ void event_v2_nat_keepalive(struct ike_sa *ike)
 {
 	const struct connection *c = ike->sa.st_connection;
 
+	/* next one; the SA keeps its slot */
+	schedule_nat_keepalive_slot(EVENT_v2_NAT_KEEPALIVE, &ike->sa);
+
 	/*
 	 * In IKEv2 all messages go through the IKE SA.  Hence check
 	 * its timers.
@@ -324,23 +382,27 @@ void event_v2_nat_keepalive(struct ike_sa *ike)
 	if (!is_monotime_epoch(ike->sa.st_v2_msgid_windows.last_sent) &&
 	    deltasecs(monotime_diff(mononow(), ike->sa.st_v2_msgid_windows.last_sent)) < DEFAULT_KEEP_ALIVE_SECS) {
 		pdbg(ike->sa.logger, "NAT-keep-alive: skipping send, IKE SA recently sent a request");
+		pstats_nat_keepalive_skipped++;
 		return;
 	}
 
 	/*
-	 * TODO or not?
-	 *
-	 * We could also check If there is IPsec SA encapsulation
-	 * traffic, since then we also do not need to send keepalives,
-	 * but that check is a little expensive as we have to find
-	 * some/all IPsec states and ask the kernel, every 20s.
+	 * If there is recent IPsec SA encapsulation traffic coming
+	 * in, the NAT mapping is being kept open anyway.
 	 *
-	 * XXX:
-	 *
-	 * But that call is being made every minute or so for
-	 * LIVENESS, and it's NAT so probably not that many SAs, and
-	 * finding the IKE SA is cheap.
+	 * Finding the Child SA is cheap and, since keep-alives in the
+	 * same slot run together, the kernel lookups are shared (see
+	 * begin_ipsec_traffic_probe()).
 	 */
+	struct child_sa *child = child_sa_by_serialno(c->established_child_sa);
+	if (child != NULL &&
+	    child->sa.st_clonedfrom == ike->sa.st_serialno &&
+	    recent_inbound_ipsec_traffic(child)) {
+		pdbg(ike->sa.logger, "NAT-keep-alive: skipping send, Child SA "PRI_SO" recently received traffic",
+		     pri_so(child->sa.st_serialno));
+		pstats_nat_keepalive_skipped++;
+		return;
+	}
 
 	pdbg(ike->sa.logger, "NAT-keep-alive: sending keep-alive");
 	nat_traversal_send_ka(&ike->sa);
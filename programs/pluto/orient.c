@@ -73,6 +73,7 @@ void disorient(struct connection *c)
 		 * Move to a special disoriented hash.
 		 */
 		connection_db_rehash_host_pair(c);
+		connection_db_rehash_responder(c);
 		/*
 		 * Scrub any address pools
 		 */
@@ -397,6 +398,7 @@ bool orient(struct connection *c, struct logger *logger)
 
 	connection_db_rehash_that_id(c);
 	connection_db_rehash_host_pair(c);
+	connection_db_rehash_responder(c);
 
 	/*
 	 * Add a listen for any missing interface endpoints.
@@ -35,6 +35,29 @@
 #include "defs.h"
 #include "log.h"
 
+/*
+ * SPECIALISED_FIELDS(NAME, FIELDS) expands the X-macro FIELDS(F),
+ * where each F(TYPE, SIZE, NAME, DESC) is a field_desc, into the
+ * field_desc NAME[] plus declarations for NAME_pbs_in() and
+ * NAME_pbs_out().
+ *
+ * The functions, defined further down by SPECIALISE_FIELDS(), use
+ * the same FIELDS(F) to unroll the loop over NAME[]; with each
+ * field_desc a constant the per-field switch is folded away.
+ * Point the struct_desc's .pbs_in_fields and .pbs_out_fields at
+ * them.
+ */
+
+#define FIELD_DESC(TYPE, SIZE, NAME, DESC) { TYPE, SIZE, NAME, DESC, },
+
+#define SPECIALISED_FIELDS(NAME, FIELDS)				\
+	static field_desc NAME[] = {					\
+		FIELDS(FIELD_DESC)					\
+		{ ft_end, 0, NULL, NULL, },				\
+	};								\
+	static diag_t NAME##_pbs_in(struct pbs_in_fields *f);		\
+	static bool NAME##_pbs_out(struct pbs_out_fields *f)
+
 /*
  * IKEv1/IKEv2 Header: for all messages
  *
@@ -75,23 +98,25 @@
  * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  */
 
-static field_desc isa_fields[] = {
-	{ ft_raw, IKE_SA_SPI_SIZE, "initiator SPI", NULL },
-	{ ft_raw, IKE_SA_SPI_SIZE, "responder SPI", NULL },
-	{ ft_mnpc, 8 / BITS_IN_BYTE, "next payload type", &payload_names_ikev1orv2 },
-	{ ft_loose_enum, 8 / BITS_IN_BYTE, "ISAKMP version", &version_names },
-	{ ft_enum, 8 / BITS_IN_BYTE, "exchange type", &isakmp_xchg_type_names },
-	{ ft_lset, 8 / BITS_IN_BYTE, "flags", &isakmp_flag_names },
-	{ ft_nat, 32 / BITS_IN_BYTE, "Message ID", NULL },
-	{ ft_len, 32 / BITS_IN_BYTE, "length", NULL },
-	{ ft_end, 0, NULL, NULL }
-};
+#define ISA_FIELDS(F)									\
+	F(ft_raw, IKE_SA_SPI_SIZE, "initiator SPI", NULL)				\
+	F(ft_raw, IKE_SA_SPI_SIZE, "responder SPI", NULL)				\
+	F(ft_mnpc, 8 / BITS_IN_BYTE, "next payload type", &payload_names_ikev1orv2)	\
+	F(ft_loose_enum, 8 / BITS_IN_BYTE, "ISAKMP version", &version_names)		\
+	F(ft_enum, 8 / BITS_IN_BYTE, "exchange type", &isakmp_xchg_type_names)		\
+	F(ft_lset, 8 / BITS_IN_BYTE, "flags", &isakmp_flag_names)			\
+	F(ft_nat, 32 / BITS_IN_BYTE, "Message ID", NULL)				\
+	F(ft_len, 32 / BITS_IN_BYTE, "length", NULL)
+
+SPECIALISED_FIELDS(isa_fields, ISA_FIELDS);
 
 struct_desc isakmp_hdr_desc = {
 	.name = "ISAKMP Message",
 	.fields = isa_fields,
 	.size = sizeof(struct isakmp_hdr),
 	.pt = ISAKMP_NEXT_NONE,
+	.pbs_in_fields = isa_fields_pbs_in,
+	.pbs_out_fields = isa_fields_pbs_out,
 };
 
 static field_desc raw_isa_fields[] = {
@@ -847,12 +872,12 @@ struct_desc isakmp_ikefrag_desc = {
  * GENERIC IKEv2 header.
  * Note differs from IKEv1, in that it has flags with one bit a critical bit
  */
-static field_desc ikev2generic_fields[] = {
-	{ ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names },
-	{ ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names },
-	{ ft_len, 16 / BITS_IN_BYTE, "length", NULL },
-	{ ft_end,  0, NULL, NULL }
-};
+#define IKEV2GENERIC_FIELDS(F)							\
+	F(ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names)	\
+	F(ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names)		\
+	F(ft_len, 16 / BITS_IN_BYTE, "length", NULL)
+
+SPECIALISED_FIELDS(ikev2generic_fields, IKEV2GENERIC_FIELDS);
 /* only for reading an unknown-to-us payload */
 struct_desc ikev2_generic_desc = {
 	.name = "IKEv2 Generic Payload",
@@ -892,6 +917,8 @@ struct_desc ikev2_sa_desc = {
 	.size = sizeof(struct ikev2_sa),
 	.pt = ISAKMP_NEXT_v2SA,
 	.nsst = v2_PROPOSAL_NON_LAST,
+	.pbs_in_fields = ikev2generic_fields_pbs_in,
+	.pbs_out_fields = ikev2generic_fields_pbs_out,
 };
 
 /* IKEv2 - Proposal sub-structure
@@ -915,22 +942,24 @@ struct_desc ikev2_sa_desc = {
  *
  *             Figure 7:  Proposal Substructure
  */
-static field_desc ikev2prop_fields[] = {
-	{ ft_lss, 8 / BITS_IN_BYTE, "last proposal", &ikev2_last_proposal_desc },
-	{ ft_zig,  8 / BITS_IN_BYTE, "reserved", NULL },
-	{ ft_len, 16 / BITS_IN_BYTE, "length", NULL },
-	{ ft_nat,  8 / BITS_IN_BYTE, "prop #", NULL },
-	{ ft_enum, 8 / BITS_IN_BYTE, "proto ID", &ikev2_proposal_protocol_id_names },
-	{ ft_nat,  8 / BITS_IN_BYTE, "spi size", NULL },
-	{ ft_nat,  8 / BITS_IN_BYTE, "# transforms", NULL },
-	{ ft_end,  0, NULL, NULL }
-};
+#define IKEV2PROP_FIELDS(F)								\
+	F(ft_lss, 8 / BITS_IN_BYTE, "last proposal", &ikev2_last_proposal_desc)		\
+	F(ft_zig, 8 / BITS_IN_BYTE, "reserved", NULL)					\
+	F(ft_len, 16 / BITS_IN_BYTE, "length", NULL)					\
+	F(ft_nat, 8 / BITS_IN_BYTE, "prop #", NULL)					\
+	F(ft_enum, 8 / BITS_IN_BYTE, "proto ID", &ikev2_proposal_protocol_id_names)	\
+	F(ft_nat, 8 / BITS_IN_BYTE, "spi size", NULL)					\
+	F(ft_nat, 8 / BITS_IN_BYTE, "# transforms", NULL)
+
+SPECIALISED_FIELDS(ikev2prop_fields, IKEV2PROP_FIELDS);
 
 struct_desc ikev2_prop_desc = {
 	.name = "IKEv2 Proposal Substructure Payload",
 	.fields = ikev2prop_fields,
 	.size = sizeof(struct ikev2_prop),
 	.nsst = v2_TRANSFORM_NON_LAST,
+	.pbs_in_fields = ikev2prop_fields_pbs_in,
+	.pbs_out_fields = ikev2prop_fields_pbs_out,
 };
 
 /*
@@ -950,20 +979,23 @@ struct_desc ikev2_prop_desc = {
  *
  */
 
-static field_desc ikev2trans_fields[] = {
-	{ ft_lss, 8 / BITS_IN_BYTE, "last transform", &ikev2_last_transform_desc },
-	{ ft_zig,  8 / BITS_IN_BYTE, "reserved", NULL },
-	{ ft_len, 16 / BITS_IN_BYTE, "length", NULL },
-	{ ft_loose_enum, 8 / BITS_IN_BYTE, "IKEv2 transform type", &ikev2_trans_type_names },
-	{ ft_zig,  8 / BITS_IN_BYTE, "reserved", NULL },
-	{ ft_loose_enum_enum, 16 / BITS_IN_BYTE, "IKEv2 transform ID", &v2_transform_ID_enums }, /* select enum based on transform type */
-	{ ft_end,  0, NULL, NULL }
-};
+#define IKEV2TRANS_FIELDS(F)									\
+	F(ft_lss, 8 / BITS_IN_BYTE, "last transform", &ikev2_last_transform_desc)		\
+	F(ft_zig, 8 / BITS_IN_BYTE, "reserved", NULL)						\
+	F(ft_len, 16 / BITS_IN_BYTE, "length", NULL)						\
+	F(ft_loose_enum, 8 / BITS_IN_BYTE, "IKEv2 transform type", &ikev2_trans_type_names)	\
+	F(ft_zig, 8 / BITS_IN_BYTE, "reserved", NULL)						\
+	/* select enum based on transform type */						\
+	F(ft_loose_enum_enum, 16 / BITS_IN_BYTE, "IKEv2 transform ID", &v2_transform_ID_enums)
+
+SPECIALISED_FIELDS(ikev2trans_fields, IKEV2TRANS_FIELDS);
 
 struct_desc ikev2_trans_desc = {
 	.name = "IKEv2 Transform Substructure Payload",
 	.fields = ikev2trans_fields,
 	.size = sizeof(struct ikev2_trans),
+	.pbs_in_fields = ikev2trans_fields_pbs_in,
+	.pbs_out_fields = ikev2trans_fields_pbs_out,
 };
 
 /*
@@ -980,16 +1012,18 @@ struct_desc ikev2_trans_desc = {
  *     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  *
  */
-static field_desc ikev2_trans_attr_fields[] = {
-	{ ft_af_enum, 16 / BITS_IN_BYTE, "af+type", &ikev2_trans_attr_descs },
-	{ ft_lv,      16 / BITS_IN_BYTE, "length/value", NULL },
-	{ ft_end,     0, NULL, NULL }
-};
+#define IKEV2_TRANS_ATTR_FIELDS(F)						\
+	F(ft_af_enum, 16 / BITS_IN_BYTE, "af+type", &ikev2_trans_attr_descs)	\
+	F(ft_lv, 16 / BITS_IN_BYTE, "length/value", NULL)
+
+SPECIALISED_FIELDS(ikev2_trans_attr_fields, IKEV2_TRANS_ATTR_FIELDS);
 
 struct_desc ikev2_trans_attr_desc = {
 	.name = "IKEv2 Attribute Substructure Payload",
 	.fields = ikev2_trans_attr_fields,
 	.size = sizeof(struct ikev2_trans_attr),
+	.pbs_in_fields = ikev2_trans_attr_fields_pbs_in,
+	.pbs_out_fields = ikev2_trans_attr_fields_pbs_out,
 };
 
 /* 3.4.  Key Exchange Payload
@@ -1014,20 +1048,22 @@ struct_desc ikev2_trans_attr_desc = {
  *              Figure 10:  Key Exchange Payload Format
  *
  */
-static field_desc ikev2ke_fields[] = {
-	{ ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names },
-	{ ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names },
-	{ ft_len, 16 / BITS_IN_BYTE, "length", NULL },
-	{ ft_enum, 16 / BITS_IN_BYTE, "DH group", &oakley_group_names },
-	{ ft_zig, 16 / BITS_IN_BYTE, "reserved", NULL },
-	{ ft_end,  0, NULL, NULL },
-};
+#define IKEV2KE_FIELDS(F)							\
+	F(ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names)	\
+	F(ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names)		\
+	F(ft_len, 16 / BITS_IN_BYTE, "length", NULL)				\
+	F(ft_enum, 16 / BITS_IN_BYTE, "DH group", &oakley_group_names)		\
+	F(ft_zig, 16 / BITS_IN_BYTE, "reserved", NULL)
+
+SPECIALISED_FIELDS(ikev2ke_fields, IKEV2KE_FIELDS);
 
 struct_desc ikev2_ke_desc = {
 	.name = "IKEv2 Key Exchange Payload",
 	.fields = ikev2ke_fields,
 	.size = sizeof(struct ikev2_ke),
 	.pt = ISAKMP_NEXT_v2KE,
+	.pbs_in_fields = ikev2ke_fields_pbs_in,
+	.pbs_out_fields = ikev2ke_fields_pbs_out,
 };
 
 /*
@@ -1272,6 +1308,8 @@ struct_desc ikev2_nonce_desc = {
 	.fields = ikev2generic_fields,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2Ni, /*==ISAKMP_NEXT_v2Nr*/
+	.pbs_in_fields = ikev2generic_fields_pbs_in,
+	.pbs_out_fields = ikev2generic_fields_pbs_out,
 };
 
 /*    3.10 Notify Payload
@@ -1292,23 +1330,24 @@ struct_desc ikev2_nonce_desc = {
  *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
  *
  */
-static field_desc ikev2_notify_fields[] = {
-	{ ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names },
-	{ ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names },
-	{ ft_len, 16 / BITS_IN_BYTE, "length", NULL },
-	{ ft_enum, 8 / BITS_IN_BYTE, "Protocol ID", &ikev2_notify_protocol_id_names },
-	/* names used are v1 names may be we should use 4306 3.3.1 names */
-	{ ft_nat,  8 / BITS_IN_BYTE, "SPI size", NULL },
-	{ ft_loose_enum, 16 / BITS_IN_BYTE, "Notify Message Type",
-	  &v2_notification_names },
-	{ ft_end,  0, NULL, NULL }
-};
+#define IKEV2_NOTIFY_FIELDS(F)									\
+	F(ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names)			\
+	F(ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names)				\
+	F(ft_len, 16 / BITS_IN_BYTE, "length", NULL)						\
+	F(ft_enum, 8 / BITS_IN_BYTE, "Protocol ID", &ikev2_notify_protocol_id_names)		\
+	/* names used are v1 names may be we should use 4306 3.3.1 names */			\
+	F(ft_nat, 8 / BITS_IN_BYTE, "SPI size", NULL)						\
+	F(ft_loose_enum, 16 / BITS_IN_BYTE, "Notify Message Type", &v2_notification_names)
+
+SPECIALISED_FIELDS(ikev2_notify_fields, IKEV2_NOTIFY_FIELDS);
 
 struct_desc ikev2_notify_desc = {
 	.name = "IKEv2 Notify Payload",
 	.fields = ikev2_notify_fields,
 	.size = sizeof(struct ikev2_notify),
 	.pt = ISAKMP_NEXT_v2N,
+	.pbs_in_fields = ikev2_notify_fields_pbs_in,
+	.pbs_out_fields = ikev2_notify_fields_pbs_out,
 };
 
 /* IKEv2 Delete Payload
@@ -1504,6 +1543,8 @@ struct_desc ikev2_sk_desc = {
 	.fields = ikev2generic_fields,
 	.size = sizeof(struct ikev2_generic),
 	.pt = ISAKMP_NEXT_v2SK,
+	.pbs_in_fields = ikev2generic_fields_pbs_in,
+	.pbs_out_fields = ikev2generic_fields_pbs_out,
 };
 
 /* 3.16.  EAP
@@ -1611,19 +1652,21 @@ struct_desc eap_tls_desc = {
  *
  *                         Encrypted Fragment Payload
  */
-static field_desc ikev2skf_fields[] = {
-	{ ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names },
-	{ ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names },
-	{ ft_len, 16 / BITS_IN_BYTE, "length", NULL },
-	{ ft_nat, 16 / BITS_IN_BYTE, "fragment number", NULL },
-	{ ft_nat, 16 / BITS_IN_BYTE, "total fragments", NULL },
-	{ ft_end,  0, NULL, NULL }
-};
+#define IKEV2SKF_FIELDS(F)							\
+	F(ft_pnpc, 8 / BITS_IN_BYTE, "next payload type", &ikev2_payload_names)	\
+	F(ft_lset, 8 / BITS_IN_BYTE, "flags", &payload_flag_names)		\
+	F(ft_len, 16 / BITS_IN_BYTE, "length", NULL)				\
+	F(ft_nat, 16 / BITS_IN_BYTE, "fragment number", NULL)			\
+	F(ft_nat, 16 / BITS_IN_BYTE, "total fragments", NULL)
+
+SPECIALISED_FIELDS(ikev2skf_fields, IKEV2SKF_FIELDS);
 struct_desc ikev2_skf_desc = {
 	.name = "IKEv2 Encrypted Fragment",
 	.fields = ikev2skf_fields,
 	.size = sizeof(struct ikev2_skf),
 	.pt = ISAKMP_NEXT_v2SKF,
+	.pbs_in_fields = ikev2skf_fields_pbs_in,
+	.pbs_out_fields = ikev2skf_fields_pbs_out,
 };
 
 /*
@@ -2098,222 +2141,272 @@ static void DBG_prefix_print_pbs_in_struct(const struct pbs_in *pbs,
 	DBG_print_struct(label, level, struct_ptr, sd, len_meaningful);
 }
 
-/* "parse" a network struct into a host struct.
- *
- * This code assumes that the network and host structure
- * members have the same alignment and size!  This requires
- * that all padding be explicit.
- *
- * If obj_pbs is supplied, a new struct pbs_in is created for the
- * variable part of the structure (this depends on their
- * being one length field in the structure).  The cursor of this
- * new PBS is set to after the parsed part of the struct.
- *
- * This routine returns TRUE iff it succeeds.
+/*
+ * State shared by the field-by-field parser and emitter.
+ *
+ * The loop in pbs_in_struct() (pbs_out_struct()) interprets .fields[]
+ * one field at a time calling pbs_in_field() (pbs_out_field()).  For
+ * the hot payloads, SPECIALISED_FIELDS() also expands the same field
+ * list into a straight-line function, stored in .pbs_in_fields
+ * (.pbs_out_fields), making the same calls but with each field_desc a
+ * compile-time constant (so the switch folds away).
  */
 
-diag_t pbs_in_struct(struct pbs_in *ins, struct_desc *sd,
-		     void *dest_start, size_t dest_size,
-		     struct pbs_in *obj_pbs)
-{
-	const uint8_t *cur = ins->cur;
-	if (cur + sd->size > ins->roof) {
-		return diag("not enough room in input packet for %s (remain=%li, sd->size=%zu)",
-			    sd->name, (long int)(ins->roof - cur),
-			    sd->size);
-	}
-
-	passert(dest_size >= sd->size);
-	const uint8_t *roof = cur + sd->size; /* may be changed by a length field */
-	bool length_field_found = false;
-	uint8_t *dest = dest_start;
-	uint8_t *dest_end = dest + dest_size;
-	bool immediate = false;
+struct pbs_in_fields {
+	struct pbs_in *ins;
+	struct_desc *sd;
+	struct pbs_in *obj_pbs;
+	const uint8_t *cur;
+	const uint8_t *roof;	/* may be changed by a length field */
+	uint8_t *dest;
+	bool length_field_found;
+	bool immediate;
+};
 
-	for (field_desc *fp = sd->fields; fp->field_type != ft_end; fp++) {
+struct pbs_out_fields {
+	struct pbs_out *outs;
+	struct_desc *sd;
+	const uint8_t *inp;
+	uint8_t *cur;
+	bool immediate;
+	struct pbs_out obj;
+};
 
-		/* field ends within PBS? */
-		passert(cur + fp->size <= ins->roof);
-		/* field ends within struct? */
-		passert(cur + fp->size <= ins->cur + sd->size);
-		/* field ends within dest */
-		passert(dest + fp->size <= dest_end);
+/* see packet.h */
+bool pbs_specialised_fields = true;
 
-#if 0
-		dbg("%td (%td) '%s'.'%s' %d bytes ",
-		    (cur - ins->cur), (cur - ins->start),
-		    sd->name, fp->name,
-		    fp->size);
-#endif
+static ALWAYS_INLINE diag_t pbs_in_field(struct pbs_in_fields *f, field_desc *fp)
+{
+	struct_desc *sd = f->sd;
+	struct pbs_in *ins = f->ins;
 
-		switch (fp->field_type) {
-		case ft_zig: /* should be zero, ignore if not - liberal in what to receive, strict to send */
-			for (size_t i = fp->size; i != 0; i--) {
-				uint8_t byte = *cur;
-				if (byte != 0) {
-					/*
-					 * We cannot zeroize it, it
-					 * would break our hash
-					 * calculation.
-					 *
-					 * XXX: bytes used for hashing
-					 * can't be zero/ignore.
-					 */
-					dbg("byte at offset %td (%td) of '%s'.'%s' is 0x%02"PRIx8" but should have been zero (ignored)",
-					    (cur - ins->cur),
-					    (cur - ins->start),
-					    sd->name, fp->name,
-					    byte);
-				}
-				cur++;
-				*dest++ = '\0';
+	switch (fp->field_type) {
+	case ft_zig: /* should be zero, ignore if not - liberal in what to receive, strict to send */
+		for (size_t i = fp->size; i != 0; i--) {
+			uint8_t byte = *f->cur;
+			if (byte != 0) {
+				/*
+				 * We cannot zeroize it, it would
+				 * break our hash calculation.
+				 *
+				 * XXX: bytes used for hashing can't
+				 * be zero/ignore.
+				 */
+				dbg("byte at offset %td (%td) of '%s'.'%s' is 0x%02"PRIx8" but should have been zero (ignored)",
+				    (f->cur - ins->cur),
+				    (f->cur - ins->start),
+				    sd->name, fp->name,
+				    byte);
 			}
-			break;
-
-		case ft_nat:            /* natural number (may be 0) */
-		case ft_len:            /* length of this struct and any following crud */
-		case ft_lv:             /* length/value field of attribute */
-		case ft_enum:           /* value from an enumeration */
-		case ft_loose_enum:     /* value from an enumeration with only some names known */
-		case ft_mnpc:
-		case ft_pnpc:
-		case ft_lss:
-		case ft_loose_enum_enum:	/* value from an enumeration with partial name table based on previous enum */
-		case ft_af_enum:        /* Attribute Format + value from an enumeration */
-		case ft_af_loose_enum:  /* Attribute Format + value from an enumeration */
-		case ft_lset:           /* bits representing set */
-		{
-			uintmax_t n = 0;
-
-			/* Reportedly fails on arm, see bug #775 */
-			for (size_t i = fp->size; i != 0; i--)
-				n = (n << BITS_IN_BYTE) | *cur++;
+			f->cur++;
+			*f->dest++ = '\0';
+		}
+		return NULL;
 
-			switch (fp->field_type) {
-			case ft_len:    /* length of this struct and any following crud */
-			case ft_lv:     /* length/value field of attribute */
-			{
-				passert(!length_field_found && obj_pbs != NULL);
-				length_field_found = true;
-				size_t len = fp->field_type ==
-					ft_len ? n :
-					immediate ? sd->size :
-					n + sd->size;
-
-				if (len < sd->size) {
-					return diag("%zd-byte %s of %s is smaller than minimum",
-						    len, fp->name, sd->name);
-				}
+	case ft_nat:            /* natural number (may be 0) */
+	case ft_len:            /* length of this struct and any following crud */
+	case ft_lv:             /* length/value field of attribute */
+	case ft_enum:           /* value from an enumeration */
+	case ft_loose_enum:     /* value from an enumeration with only some names known */
+	case ft_mnpc:
+	case ft_pnpc:
+	case ft_lss:
+	case ft_loose_enum_enum:	/* value from an enumeration with partial name table based on previous enum */
+	case ft_af_enum:        /* Attribute Format + value from an enumeration */
+	case ft_af_loose_enum:  /* Attribute Format + value from an enumeration */
+	case ft_lset:           /* bits representing set */
+	{
+		uintmax_t n = 0;
 
-				if (pbs_left(ins) < len) {
-					return diag("%zd-byte %s of %s is larger than can fit",
-						    len, fp->name, sd->name);
-				}
+		/* Reportedly fails on arm, see bug #775 */
+		for (size_t i = fp->size; i != 0; i--)
+			n = (n << BITS_IN_BYTE) | *f->cur++;
 
-				roof = ins->cur + len;
-				break;
+		switch (fp->field_type) {
+		case ft_len:    /* length of this struct and any following crud */
+		case ft_lv:     /* length/value field of attribute */
+		{
+			passert(!f->length_field_found && f->obj_pbs != NULL);
+			f->length_field_found = true;
+			size_t len = fp->field_type ==
+				ft_len ? n :
+				f->immediate ? sd->size :
+				n + sd->size;
+
+			if (len < sd->size) {
+				return diag("%zd-byte %s of %s is smaller than minimum",
+					    len, fp->name, sd->name);
 			}
 
-			case ft_af_loose_enum: /* Attribute Format + value from an enumeration */
-			case ft_af_enum: /* Attribute Format + value from an enumeration */
-			{
-				immediate = ((n & ISAKMP_ATTR_AF_MASK) ==
-					     ISAKMP_ATTR_AF_TV);
-				/*
-				 * Lookup fp->desc using N and
-				 * not LAST_ENUM.  Only when N
-				 * (value or AF+value) is
-				 * found is it acceptable.
-				 */
-				name_buf b;
-				if (fp->field_type == ft_af_enum &&
-				    !enum_long(fp->desc, n, &b)) {
-					return diag("%s of %s has an unknown value: %s%ju (0x%jx)",
-						    fp->name, sd->name,
-						    immediate ? "AF+" : "",
-						    n & ~ISAKMP_ATTR_AF_MASK, n);
-				}
-				break;
+			if (pbs_left(ins) < len) {
+				return diag("%zd-byte %s of %s is larger than can fit",
+					    len, fp->name, sd->name);
 			}
 
-			case ft_enum:   /* value from an enumeration */
-			{
-				name_buf b;
-				if (!enum_long(fp->desc, n, &b)) {
-					return diag("%s of %s has an unknown value: %ju (0x%jx)",
-						    fp->name, sd->name,
-						    n, n);
-				}
-				break;
+			f->roof = ins->cur + len;
+			break;
+		}
+
+		case ft_af_loose_enum: /* Attribute Format + value from an enumeration */
+		case ft_af_enum: /* Attribute Format + value from an enumeration */
+		{
+			f->immediate = ((n & ISAKMP_ATTR_AF_MASK) ==
+					ISAKMP_ATTR_AF_TV);
+			/*
+			 * Lookup fp->desc using N and not LAST_ENUM.
+			 * Only when N (value or AF+value) is found is
+			 * it acceptable.
+			 */
+			name_buf b;
+			if (fp->field_type == ft_af_enum &&
+			    !enum_long(fp->desc, n, &b)) {
+				return diag("%s of %s has an unknown value: %s%ju (0x%jx)",
+					    fp->name, sd->name,
+					    f->immediate ? "AF+" : "",
+					    n & ~ISAKMP_ATTR_AF_MASK, n);
 			}
+			break;
+		}
 
-			case ft_loose_enum:     /* value from an enumeration with only some names known */
-			case ft_mnpc:
-			case ft_pnpc:
-			case ft_lss:
-				break;
+		case ft_enum:   /* value from an enumeration */
+		{
+			name_buf b;
+			if (!enum_long(fp->desc, n, &b)) {
+				return diag("%s of %s has an unknown value: %ju (0x%jx)",
+					    fp->name, sd->name,
+					    n, n);
+			}
+			break;
+		}
 
-			case ft_loose_enum_enum:	/* value from an enumeration with partial name table based on previous enum */
-				break;
+		case ft_loose_enum:     /* value from an enumeration with only some names known */
+		case ft_mnpc:
+		case ft_pnpc:
+		case ft_lss:
+			break;
 
-			case ft_lset:            /* bits representing set */
-				if (!test_lset(fp->desc, n)) {
-					lset_buf lb;
-					return diag("bitset %s of %s has unknown member(s): %s (0x%ju)",
-						    fp->name, sd->name,
-						    str_lset(fp->desc, n, &lb),
-						    n);
-				}
-				break;
+		case ft_loose_enum_enum:	/* value from an enumeration with partial name table based on previous enum */
+			break;
 
-			default:
-				break;
+		case ft_lset:            /* bits representing set */
+			if (!test_lset(fp->desc, n)) {
+				lset_buf lb;
+				return diag("bitset %s of %s has unknown member(s): %s (0x%ju)",
+					    fp->name, sd->name,
+					    str_lset(fp->desc, n, &lb),
+					    n);
 			}
+			break;
 
-			/* deposit the value in the struct */
-			switch (fp->size) {
-			case 8 / BITS_IN_BYTE:
-				*(uint8_t *)dest = n;
-				break;
-			case 16 / BITS_IN_BYTE:
-				*(uint16_t *)dest = n;
-				break;
-			case 32 / BITS_IN_BYTE:
-				*(uint32_t *)dest = n;
-				break;
-			default:
-				bad_case(fp->size);
-			}
-			dest += fp->size;
+		default:
 			break;
 		}
 
-		case ft_raw: /* bytes to be left in network-order */
-			for (size_t i = fp->size; i != 0; i--)
-				*dest++ = *cur++;
+		/* deposit the value in the struct */
+		switch (fp->size) {
+		case 8 / BITS_IN_BYTE:
+			*(uint8_t *)f->dest = n;
+			break;
+		case 16 / BITS_IN_BYTE:
+			*(uint16_t *)f->dest = n;
+			break;
+		case 32 / BITS_IN_BYTE:
+			*(uint32_t *)f->dest = n;
 			break;
-
-		case ft_end: /* end of field list */
-			llog_passert(&global_logger, HERE, "should not be here");
 		default:
-			bad_case(fp->field_type);
+			bad_case(fp->size);
 		}
+		f->dest += fp->size;
+		return NULL;
 	}
 
-	passert(cur == ins->cur + sd->size);
+	case ft_raw: /* bytes to be left in network-order */
+		memcpy(f->dest, f->cur, fp->size);
+		f->dest += fp->size;
+		f->cur += fp->size;
+		return NULL;
+
+	case ft_end: /* end of field list */
+		llog_passert(&global_logger, HERE, "should not be here");
+	default:
+		bad_case(fp->field_type);
+	}
+}
+
+/* "parse" a network struct into a host struct.
+ *
+ * This code assumes that the network and host structure
+ * members have the same alignment and size!  This requires
+ * that all padding be explicit.
+ *
+ * If obj_pbs is supplied, a new struct pbs_in is created for the
+ * variable part of the structure (this depends on their
+ * being one length field in the structure).  The cursor of this
+ * new PBS is set to after the parsed part of the struct.
+ *
+ * This routine returns TRUE iff it succeeds.
+ */
+
+diag_t pbs_in_struct(struct pbs_in *ins, struct_desc *sd,
+		     void *dest_start, size_t dest_size,
+		     struct pbs_in *obj_pbs)
+{
+	if (ins->cur + sd->size > ins->roof) {
+		return diag("not enough room in input packet for %s (remain=%li, sd->size=%zu)",
+			    sd->name, (long int)(ins->roof - ins->cur),
+			    sd->size);
+	}
+
+	passert(dest_size >= sd->size);
+	struct pbs_in_fields f = {
+		.ins = ins,
+		.sd = sd,
+		.obj_pbs = obj_pbs,
+		.cur = ins->cur,
+		.roof = ins->cur + sd->size,
+		.dest = dest_start,
+	};
+
+	if (sd->pbs_in_fields != NULL && pbs_specialised_fields) {
+		/*
+		 * The fields are fixed so, provided they add up to
+		 * .size (checked below), each is within the PBS,
+		 * struct and DEST.
+		 */
+		diag_t d = sd->pbs_in_fields(&f);
+		if (d != NULL) {
+			return d;
+		}
+	} else {
+		const uint8_t *dest_end = f.dest + dest_size;
+		for (field_desc *fp = sd->fields; fp->field_type != ft_end; fp++) {
+			/* field ends within PBS? */
+			passert(f.cur + fp->size <= ins->roof);
+			/* field ends within struct? */
+			passert(f.cur + fp->size <= ins->cur + sd->size);
+			/* field ends within dest */
+			passert(f.dest + fp->size <= dest_end);
+			diag_t d = pbs_in_field(&f, fp);
+			if (d != NULL) {
+				return d;
+			}
+		}
+	}
+
+	passert(f.cur == ins->cur + sd->size);
 	if (obj_pbs != NULL) {
-		passert(length_field_found);
+		passert(f.length_field_found);
 		/*
 		 * It starts at the same origin; but is truncated and
 		 * cursor skips header
 		 */
-		*obj_pbs = pbs_in_from_shunk(shunk2(ins->cur/*not CUR*/, roof - ins->cur), sd->name);
-		obj_pbs->cur = cur; /* skip header */
+		*obj_pbs = pbs_in_from_shunk(shunk2(ins->cur/*not CUR*/, f.roof - ins->cur), sd->name);
+		obj_pbs->cur = f.cur; /* skip header */
 		/* back link */
 		obj_pbs->container = ins;
 		obj_pbs->desc = sd;
 	}
-	ins->cur = roof;
+	ins->cur = f.roof;
 	if (DBGP(DBG_BASE)) {
 		DBG_prefix_print_pbs_in_struct(ins, "parse ",
 					       dest_start, sd,
@@ -2662,172 +2755,225 @@ static bool pbs_out_number(struct pbs_out *outs, struct_desc *sd,
 	return true;
 }
 
-bool pbs_out_struct(struct pbs_out *outs, struct_desc *sd,
-		    const void *struct_ptr, size_t struct_size,
-		    struct pbs_out *obj_pbs)
+static ALWAYS_INLINE bool pbs_out_field(struct pbs_out_fields *f, field_desc *fp)
 {
-	const u_int8_t *inp = struct_ptr;
-	u_int8_t *cur = outs->cur;
+	struct pbs_out *outs = f->outs;
+	struct_desc *sd = f->sd;
+	size_t i = fp->size;
 
-	passert(struct_size == 0 || struct_size >= sd->size);
-
-	if (DBGP(DBG_BASE)) {
-		DBG_prefix_print_pbs_out_struct(outs, "emit ", struct_ptr, sd, obj_pbs == NULL);
+	switch (fp->field_type) {
+	case ft_zig: /* zero */
+	{
+		uint8_t byte;
+		if (impair.send_nonzero_reserved) {
+			byte = ISAKMP_PAYLOAD_FLAG_LIBRESWAN_BOGUS;
+			llog(RC_LOG, outs->logger,
+			     "IMPAIR: setting zero/ignore field to 0x%02x", byte);
+		} else {
+			byte = 0;
+		}
+		memset(f->cur, byte, i);
+		f->inp += i;
+		f->cur += i;
+		return true;
 	}
 
-	if (outs->roof - cur < (ptrdiff_t)sd->size) {
-		llog_pexpect(outs->logger, HERE,
-			     "not enough room left in output packet to place %s", sd->name);
-		return false;
-	}
+	case ft_mnpc:
+		start_next_payload_chain(outs, sd, fp,
+					 f->inp, f->cur);
+		f->inp += i;
+		f->cur += i;
+		return true;
 
+	case ft_pnpc:
+		update_next_payload_chain(outs, sd, fp,
+					  f->inp, f->cur);
+		f->inp += i;
+		f->cur += i;
+		return true;
 
-	bool immediate = false;
+	case ft_lss:
+		update_last_substructure(outs, sd, fp,
+					 f->inp, f->cur);
+		f->inp += i;
+		f->cur += i;
+		return true;
+
+	case ft_len:            /* length of this struct and any following crud */
+	case ft_lv:             /* length/value field of attribute */
+		if (!f->immediate) {
+			/* We can't check the length because it must
+			 * be filled in after variable part is supplied.
+			 * We do record where this is so that it can be
+			 * filled in by a subsequent close_pbs_out().
+			 */
+			passert(f->obj.lenfld == NULL);    /* only one ft_len allowed */
+			f->obj.lenfld = f->cur;
+			f->obj.lenfld_desc = fp;
+
+			/* fill with crap so failure to overwrite will be noticed */
+			memset(f->cur, 0xFA, i);
+
+			f->inp += i;
+			f->cur += i;
+			return true;
+		}
 
-	/* new child stream for portion of payload after this struct */
-	struct pbs_out obj = {
-		.container = outs,
-		.desc = sd,
-		.name = sd->name,
-		.logger = outs->logger,
+		/* immediate form is just like a number */
+		return pbs_out_number(outs, sd, &f->inp, &f->cur, fp, &f->immediate);
 
-		/* until a length field is discovered */
-		/* .lenfld = NULL, */
-		/* .lenfld_desc = NULL, */
+	case ft_nat:            /* natural number (may be 0) */
+	case ft_enum:           /* value from an enumeration */
+	case ft_loose_enum:     /* value from an enumeration with only some names known */
+	case ft_loose_enum_enum:	/* value from an enumeration with partial name table based on previous enum */
+	case ft_af_enum:        /* Attribute Format + value from an enumeration */
+	case ft_af_loose_enum:  /* Attribute Format + value from an enumeration */
+	case ft_lset:           /* bits representing set */
+		return pbs_out_number(outs, sd, &f->inp, &f->cur, fp, &f->immediate);
 
-		/* until an ft_mnpc field is discovered */
-		/* message.previous_np = {0}, */
+	case ft_raw: /* bytes to be left in network-order */
+		memcpy(f->cur, f->inp, i);
+		f->inp += i;
+		f->cur += i;
+		return true;
 
-		/* until an ft_lss is discovered */
-		/* .last_substructure = {0}, */
-	};
+	case ft_end: /* end of field list */
+		llog_passert(outs->logger, HERE, "should not be here");
+	default:
+		bad_case(fp->field_type);
+	}
+}
 
-	for (field_desc *fp = sd->fields; ; fp++) {
-		size_t i = fp->size;
+/*
+ * Define the functions declared by SPECIALISED_FIELDS().
+ */
 
-		/* make sure that there is space for the next structure element */
-		passert(outs->roof - cur >= (ptrdiff_t)i);
+#define PBS_IN_FIELD(TYPE, SIZE, NAME, DESC)				\
+	{								\
+		diag_t d = pbs_in_field(f, fp++);			\
+		if (d != NULL) {					\
+			return d;					\
+		}							\
+	}
 
-		/* verify that the spot is correct in the offset */
-		passert(cur - outs->cur <= (ptrdiff_t)(sd->size - i));
+#define PBS_OUT_FIELD(TYPE, SIZE, NAME, DESC)				\
+	if (!pbs_out_field(f, fp++)) {					\
+		return false;						\
+	}
 
-		/* verify that we are at the right place in the input structure */
-		passert(inp - (cur - outs->cur) == struct_ptr);
+#define SPECIALISE_FIELDS(NAME, FIELDS)					\
+	static diag_t NAME##_pbs_in(struct pbs_in_fields *f)		\
+	{								\
+		field_desc *fp = NAME;					\
+		FIELDS(PBS_IN_FIELD);					\
+		passert(fp->field_type == ft_end);			\
+		return NULL;						\
+	}								\
+	static bool NAME##_pbs_out(struct pbs_out_fields *f)		\
+	{								\
+		field_desc *fp = NAME;					\
+		FIELDS(PBS_OUT_FIELD);					\
+		passert(fp->field_type == ft_end);			\
+		return true;						\
+	}
 
-		ldbgf(DBG_TMI, outs->logger, "out_struct: %d %s",
-		      (int) (cur - outs->cur),
-		      fp->name == NULL ? "<end>" : fp->name);
+SPECIALISE_FIELDS(isa_fields, ISA_FIELDS)
+SPECIALISE_FIELDS(ikev2generic_fields, IKEV2GENERIC_FIELDS)
+SPECIALISE_FIELDS(ikev2prop_fields, IKEV2PROP_FIELDS)
+SPECIALISE_FIELDS(ikev2trans_fields, IKEV2TRANS_FIELDS)
+SPECIALISE_FIELDS(ikev2_trans_attr_fields, IKEV2_TRANS_ATTR_FIELDS)
+SPECIALISE_FIELDS(ikev2ke_fields, IKEV2KE_FIELDS)
+SPECIALISE_FIELDS(ikev2_notify_fields, IKEV2_NOTIFY_FIELDS)
+SPECIALISE_FIELDS(ikev2skf_fields, IKEV2SKF_FIELDS)
 
-		switch (fp->field_type) {
-		case ft_zig: /* zero */
-		{
-			uint8_t byte;
-			if (impair.send_nonzero_reserved) {
-				byte = ISAKMP_PAYLOAD_FLAG_LIBRESWAN_BOGUS;
-				llog(RC_LOG, outs->logger,
-				     "IMPAIR: setting zero/ignore field to 0x%02x", byte);
-			} else {
-				byte = 0;
-			}
-			memset(cur, byte, i);
-			inp += i;
-			cur += i;
-			break;
-		}
+bool pbs_out_struct(struct pbs_out *outs, struct_desc *sd,
+		    const void *struct_ptr, size_t struct_size,
+		    struct pbs_out *obj_pbs)
+{
+	passert(struct_size == 0 || struct_size >= sd->size);
 
-		case ft_mnpc:
-			start_next_payload_chain(outs, sd, fp,
-						 inp, cur);
-			inp += fp->size;
-			cur += fp->size;
-			break;
+	if (DBGP(DBG_BASE)) {
+		DBG_prefix_print_pbs_out_struct(outs, "emit ", struct_ptr, sd, obj_pbs == NULL);
+	}
 
-		case ft_pnpc:
-			update_next_payload_chain(outs, sd, fp,
-						  inp, cur);
-			inp += fp->size;
-			cur += fp->size;
-			break;
+	if (outs->roof - outs->cur < (ptrdiff_t)sd->size) {
+		llog_pexpect(outs->logger, HERE,
+			     "not enough room left in output packet to place %s", sd->name);
+		return false;
+	}
 
-		case ft_lss:
-			update_last_substructure(outs, sd, fp,
-						 inp, cur);
-			inp += fp->size;
-			cur += fp->size;
-			break;
+	struct pbs_out_fields f = {
+		.outs = outs,
+		.sd = sd,
+		.inp = struct_ptr,
+		.cur = outs->cur,
+		/* new child stream for portion of payload after this struct */
+		.obj = {
+			.container = outs,
+			.desc = sd,
+			.name = sd->name,
+			.logger = outs->logger,
+
+			/* until a length field is discovered */
+			/* .lenfld = NULL, */
+			/* .lenfld_desc = NULL, */
+
+			/* until an ft_mnpc field is discovered */
+			/* message.previous_np = {0}, */
+
+			/* until an ft_lss is discovered */
+			/* .last_substructure = {0}, */
+		},
+	};
 
-		case ft_len:            /* length of this struct and any following crud */
-		case ft_lv:             /* length/value field of attribute */
-			if (!immediate) {
-				/* We can't check the length because it must
-				 * be filled in after variable part is supplied.
-				 * We do record where this is so that it can be
-				 * filled in by a subsequent close_pbs_out().
-				 */
-				passert(obj.lenfld == NULL);    /* only one ft_len allowed */
-				obj.lenfld = cur;
-				obj.lenfld_desc = fp;
+	if (sd->pbs_out_fields != NULL && pbs_specialised_fields) {
+		/* see pbs_in_struct() */
+		if (!sd->pbs_out_fields(&f)) {
+			/* already logged */
+			return false;
+		}
+	} else {
+		for (field_desc *fp = sd->fields; fp->field_type != ft_end; fp++) {
+			size_t i = fp->size;
 
-				/* fill with crap so failure to overwrite will be noticed */
-				memset(cur, 0xFA, i);
+			/* make sure that there is space for the next structure element */
+			passert(outs->roof - f.cur >= (ptrdiff_t)i);
 
-				inp += i;
-				cur += i;
-				break;
-			}
+			/* verify that the spot is correct in the offset */
+			passert(f.cur - outs->cur <= (ptrdiff_t)(sd->size - i));
 
-			/* immediate form is just like a number */
-			if (!pbs_out_number(outs, sd, &inp, &cur, fp, &immediate)) {
-				/* already logged */
-				return false;
-			}
-			break;
+			/* verify that we are at the right place in the input structure */
+			passert(f.inp - (f.cur - outs->cur) == struct_ptr);
 
-		case ft_nat:            /* natural number (may be 0) */
-		case ft_enum:           /* value from an enumeration */
-		case ft_loose_enum:     /* value from an enumeration with only some names known */
-		case ft_loose_enum_enum:	/* value from an enumeration with partial name table based on previous enum */
-		case ft_af_enum:        /* Attribute Format + value from an enumeration */
-		case ft_af_loose_enum:  /* Attribute Format + value from an enumeration */
-		case ft_lset:           /* bits representing set */
-			if (!pbs_out_number(outs, sd, &inp, &cur, fp, &immediate)) {
+			ldbgf(DBG_TMI, outs->logger, "out_struct: %d %s",
+			      (int) (f.cur - outs->cur), fp->name);
+
+			if (!pbs_out_field(&f, fp)) {
 				/* already logged */
 				return false;
 			}
-			break;
-
-		case ft_raw: /* bytes to be left in network-order */
-			for (; i != 0; i--)
-				*cur++ = *inp++;
-			break;
-
-		case ft_end: /* end of field list */
-			passert(cur == outs->cur + sd->size);
+		}
+	}
 
-			obj.start = outs->cur;
-			obj.cur = cur;
-			obj.roof = outs->roof; /* limit of possible */
-			/* obj.lenfld* and obj.previous_np* already set */
+	passert(f.cur == outs->cur + sd->size);
 
-			if (obj_pbs == NULL) {
-				close_pbs_out(&obj); /* fill in length field, if any */
-			} else {
-				/* We set outs->cur to outs->roof so that
-				 * any attempt to output something into outs
-				 * before obj is closed will trigger an error.
-				 */
-				outs->cur = outs->roof;
+	f.obj.start = outs->cur;
+	f.obj.cur = f.cur;
+	f.obj.roof = outs->roof; /* limit of possible */
+	/* obj.lenfld* and obj.previous_np* already set */
 
-				*obj_pbs = obj;
-			}
-			return true;
+	if (obj_pbs == NULL) {
+		close_pbs_out(&f.obj); /* fill in length field, if any */
+	} else {
+		/* We set outs->cur to outs->roof so that
+		 * any attempt to output something into outs
+		 * before obj is closed will trigger an error.
+		 */
+		outs->cur = outs->roof;
 
-		default:
-			bad_case(fp->field_type);
-		}
+		*obj_pbs = f.obj;
 	}
-
-	/* never reached!?! */
+	return true;
 }
 
 bool out_struct(const void *struct_ptr, struct_desc *sd,
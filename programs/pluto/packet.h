@@ -33,6 +33,8 @@
 
 struct ip_info;
 struct logger;
+struct pbs_in_fields;
+struct pbs_out_fields;
 
 /* a struct_desc describes a structure for the struct I/O routines.
  * This requires arrays of field_desc values to describe struct fields.
@@ -81,8 +83,17 @@ typedef const struct {
 	size_t size;
 	int pt;	/* this payload type */
 	unsigned nsst; /* Nested Substructure Type */
+	/*
+	 * Optional, FIELDS[] compiled into straight-line code; see
+	 * SPECIALISED_FIELDS() in packet.c.
+	 */
+	diag_t (*pbs_in_fields)(struct pbs_in_fields *);
+	bool (*pbs_out_fields)(struct pbs_out_fields *);
 } struct_desc;
 
+/* for testing; when false .pbs_{in,out}_fields are ignored */
+extern bool pbs_specialised_fields;
+
 /*
  * Something to fixup later.
  */
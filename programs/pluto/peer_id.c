@@ -46,6 +46,7 @@
 #include "instantiate.h"
 #include "orient.h"		/* for oriented()! */
 #include "ip_info.h"
+#include "pluto_stats.h"
 
 /*
  * This is to support certificates with SAN using wildcard, eg SAN
@@ -542,6 +543,113 @@ static bool better_score(struct score best, struct score score, struct logger *l
 	return false;
 }
 
+static int connection_serialno_cmp(const void *l, const void *r)
+{
+	const struct connection *const *lc = l;
+	const struct connection *const *rc = r;
+	return ((*lc)->serialno < (*rc)->serialno ? -1 :
+		(*lc)->serialno > (*rc)->serialno ? 1 : 0);
+}
+
+/*
+ * Return the NULL terminated list of connections matching
+ * LOCAL->REMOTE that refine_host_connection_on_responder() should
+ * score.
+ *
+ * Normally that is everything in the host-pair bucket.  However,
+ * when looking for an IKEv2 template (REMOTE is %any) the bucket can
+ * contain thousands of road-warrior templates that differ only by
+ * remote ID, so instead the responder index is probed for each
+ * proposed authby: once for templates with an ID that could match
+ * INITIATOR_ID and once for templates that accept any ID.  Since
+ * score_host_connection() would reject everything else it makes no
+ * difference to the outcome.  The probes are merged oldest first so
+ * that, as with the host-pair search, ties go to the connection
+ * added first.
+ */
+
+static struct connection **refine_candidates(const struct ike_sa *ike,
+					     lset_t proposed_authbys,
+					     const struct id *initiator_id,
+					     const ip_address *local,
+					     const ip_address *remote,
+					     unsigned *visited,
+					     struct verbose verbose)
+{
+	struct connection *c = ike->sa.st_connection;
+	struct connection **candidates = NULL;
+	unsigned nr = 0;
+	unsigned size = 0;
+
+	if (address_is_specified(*remote) || c->config->ike_version != IKEv2) {
+		struct connection_filter hpf = {
+			.host_pair = {
+				.local = local,
+				.remote = remote,
+			},
+			.ike_version = c->config->ike_version,
+			.search = {
+				.order = OLD2NEW,
+				.verbose.logger = ike->sa.logger,
+				.where = HERE,
+			},
+		};
+		while (next_connection(&hpf)) {
+			if (nr + 1 >= size) {
+				size = (size == 0 ? 8 : size * 2);
+				realloc_things(candidates, nr, size, "candidates");
+			}
+			candidates[nr++] = hpf.c;
+		}
+		(*visited) += hpf.visited;
+	} else {
+		static const struct id any_id = { .kind = ID_NONE, };
+		for (enum keyword_auth auth = AUTH_NEVER + 1; auth <= AUTH_EAPONLY; auth++) {
+			if (!LHAS(proposed_authbys, auth)) {
+				continue;
+			}
+			FOR_EACH_THING(remote_id, initiator_id, &any_id) {
+				if (remote_id == initiator_id &&
+				    (initiator_id->kind == ID_NONE ||
+				     initiator_id->kind == ID_FROMCERT)) {
+					/* same bucket as &any_id */
+					continue;
+				}
+				struct connection_filter rf = {
+					.responder = {
+						.local = local,
+						.auth = auth,
+						.remote_id = remote_id,
+					},
+					.ike_version = IKEv2,
+					.search = {
+						.order = OLD2NEW,
+						.verbose.logger = ike->sa.logger,
+						.where = HERE,
+					},
+				};
+				while (next_connection(&rf)) {
+					if (nr + 1 >= size) {
+						size = (size == 0 ? 8 : size * 2);
+						realloc_things(candidates, nr, size, "candidates");
+					}
+					candidates[nr++] = rf.c;
+				}
+				(*visited) += rf.visited;
+			}
+		}
+		if (nr > 0) {
+			qsort(candidates, nr, sizeof(candidates[0]), connection_serialno_cmp);
+		}
+	}
+
+	vdbg("%u candidate connections", nr);
+	if (candidates != NULL) {
+		candidates[nr] = NULL;
+	}
+	return candidates;
+}
+
 static struct connection *refine_host_connection_on_responder(const struct ike_sa *ike,
 							      lset_t proposed_authbys,
 							      const struct id *initiator_id,
@@ -628,6 +736,7 @@ static struct connection *refine_host_connection_on_responder(const struct ike_s
 	 */
 
 	ip_address local = c->iface->local_address;
+	unsigned visited = 0;
 	FOR_EACH_THING(remote, endpoint_address(ike->sa.st_remote_endpoint), unset_address) {
 
 		verbose.level = 1;
@@ -635,21 +744,12 @@ static struct connection *refine_host_connection_on_responder(const struct ike_s
 		vdbg("trying connections matching %s->%s",
 		     str_address(&local, &lb), str_address(&remote, &rb));
 
-		struct connection_filter hpf = {
-			.host_pair = {
-				.local = &local,
-				.remote = &remote,
-			},
-			.ike_version = c->config->ike_version,
-			.search = {
-				.order = OLD2NEW,
-				.verbose.logger = ike->sa.logger,
-				.where = HERE,
-			},
-		};
+		struct connection **candidates =
+			refine_candidates(ike, proposed_authbys, initiator_id,
+					  &local, &remote, &visited, verbose);
 
-		while (next_connection(&hpf)) {
-			struct connection *d = hpf.c;
+		for (struct connection **dp = candidates; dp != NULL && *dp != NULL; dp++) {
+			struct connection *d = *dp;
 			if (c == d) {
 				/* already scored above */
 				continue;
@@ -679,6 +779,9 @@ static struct connection *refine_host_connection_on_responder(const struct ike_s
 			if (exact_id_match(score)) {
 				vdbg("returning %s because exact (peer) ID match",
 				     d->name);
+				pfreeany(candidates);
+				pstats_ike_responder_lookups++;
+				pstats_ike_responder_visited += visited;
 				return d;
 			}
 
@@ -700,7 +803,10 @@ static struct connection *refine_host_connection_on_responder(const struct ike_s
 				best = score;
 			}
 		}
+		pfreeany(candidates);
 	}
+	pstats_ike_responder_lookups++;
+	pstats_ike_responder_visited += visited;
 	return best.connection;
 }
 
@@ -35,6 +35,10 @@
 #include "whack.h"              /* for RC_LOG */
 #include "ike_alg.h"
 #include "pluto_stats.h"
+#include "iface.h"		/* for pluto_ike_socket_batch */
+#include "ddos.h"		/* for enum ddos_verdict */
+#include "server_pool.h"		/* for clear_server_helper_stats() */
+#include "updown.h"		/* for clear_updown_queue_stats() */
 #include "nat_traversal.h"
 #include "show.h"
 
@@ -81,9 +85,32 @@ unsigned long pstats_ipsec_tfc;
 unsigned long pstats_ike_dpd_recv;
 unsigned long pstats_ike_dpd_sent;
 unsigned long pstats_ike_dpd_replied;
+unsigned long pstats_ike_dpd_skipped;
+unsigned long pstats_nat_keepalive_sent;
+unsigned long pstats_nat_keepalive_skipped;
+unsigned long pstats_ike_udp_recv_wakeups;
+unsigned long pstats_ike_udp_recv_datagrams;
+unsigned long pstats_ike_udp_recv_full;
+unsigned long pstats_ike_udp_recv_errqueue;
+unsigned long pstats_ike_udp_send_queued;
+unsigned long pstats_ike_cookie_fast_path;
+unsigned long pstats_ddos_prefix[DDOS_VERDICT_ROOF];
+unsigned long pstats_ddos_prefix_evictions;
+unsigned long pstats_ike_udp_send_flushes;
+unsigned long pstats_ike_udp_send_calls;
+unsigned long pstats_ike_udp_send_gso;
+unsigned long pstats_kernel_xfrm_async_queued;
+unsigned long pstats_kernel_xfrm_async_failed;
+unsigned long pstats_kernel_xfrm_async_window_full;
+
 unsigned long pstats_iketcp_started[2];
 unsigned long pstats_iketcp_stopped[2];
 unsigned long pstats_iketcp_aborted[2];
+unsigned long pstats_ike_parent_lookups;
+unsigned long pstats_ike_parent_visited;
+unsigned long pstats_ike_responder_lookups;
+unsigned long pstats_ike_responder_visited;
+
 unsigned long pstats_pamauth_started;
 unsigned long pstats_pamauth_stopped;
 unsigned long pstats_pamauth_aborted;
@@ -445,13 +472,42 @@ void whack_showstats(const struct whack_message *wm UNUSED, struct show *s)
 	show(s, "total.ike.dpd.sent=%lu", pstats_ike_dpd_sent);
 	show(s, "total.ike.dpd.recv=%lu", pstats_ike_dpd_recv);
 	show(s, "total.ike.dpd.replied=%lu", pstats_ike_dpd_replied);
+	show(s, "total.ike.dpd.skipped=%lu", pstats_ike_dpd_skipped);
+	show(s, "total.nat.keepalive.sent=%lu", pstats_nat_keepalive_sent);
+	show(s, "total.nat.keepalive.skipped=%lu", pstats_nat_keepalive_skipped);
 
 	show_bytes(s, "total.ike.traffic", &pstats_ike_bytes);
 
+	show(s, "total.ike.parent.lookups=%lu", pstats_ike_parent_lookups);
+	show(s, "total.ike.parent.visited=%lu", pstats_ike_parent_visited);
+	show(s, "total.ike.responder.lookups=%lu", pstats_ike_responder_lookups);
+	show(s, "total.ike.responder.visited=%lu", pstats_ike_responder_visited);
+
+	show(s, "total.ike.cookie.fast_path=%lu", pstats_ike_cookie_fast_path);
+	show(s, "total.ddos.prefix.accepted=%lu", pstats_ddos_prefix[DDOS_ACCEPT]);
+	show(s, "total.ddos.prefix.cookies=%lu", pstats_ddos_prefix[DDOS_COOKIE]);
+	show(s, "total.ddos.prefix.dropped=%lu", pstats_ddos_prefix[DDOS_DROP]);
+	show(s, "total.ddos.prefix.evictions=%lu", pstats_ddos_prefix_evictions);
+
 	show(s, "total.pamauth.started=%lu", pstats_pamauth_started);
 	show(s, "total.pamauth.stopped=%lu", pstats_pamauth_stopped);
 	show(s, "total.pamauth.aborted=%lu", pstats_pamauth_aborted);
 
+	show(s, "current.ike.udp.recv.batch=%u", pluto_ike_socket_batch);
+	show(s, "total.ike.udp.recv.wakeups=%lu", pstats_ike_udp_recv_wakeups);
+	show(s, "total.ike.udp.recv.datagrams=%lu", pstats_ike_udp_recv_datagrams);
+	show(s, "total.ike.udp.recv.full=%lu", pstats_ike_udp_recv_full);
+	show(s, "total.ike.udp.recv.errqueue=%lu", pstats_ike_udp_recv_errqueue);
+	show(s, "current.ike.udp.send.batch=%s", (pluto_ike_socket_send_batch ? "yes" : "no"));
+	show(s, "total.ike.udp.send.queued=%lu", pstats_ike_udp_send_queued);
+	show(s, "total.ike.udp.send.flushes=%lu", pstats_ike_udp_send_flushes);
+	show(s, "total.ike.udp.send.calls=%lu", pstats_ike_udp_send_calls);
+	show(s, "total.ike.udp.send.gso=%lu", pstats_ike_udp_send_gso);
+
+	show(s, "total.kernel.xfrm.async.queued=%lu", pstats_kernel_xfrm_async_queued);
+	show(s, "total.kernel.xfrm.async.failed=%lu", pstats_kernel_xfrm_async_failed);
+	show(s, "total.kernel.xfrm.async.window_full=%lu", pstats_kernel_xfrm_async_window_full);
+
 	show(s, "total.iketcp.client.started=%lu", pstats_iketcp_started[false]);
 	show(s, "total.iketcp.client.stopped=%lu", pstats_iketcp_stopped[false]);
 	show(s, "total.iketcp.client.aborted=%lu", pstats_iketcp_aborted[false]);
@@ -492,6 +548,10 @@ void whack_clearstats(const struct whack_message *wm UNUSED, struct show *s UNUS
 {
 	dbg("clearing pluto stats");
 
+	clear_server_helper_stats();
+	clear_updown_queue_stats();
+	clear_md_pool_stats();
+
 	pstats_ipsec_sa = pstats_ikev1_sa = pstats_ikev2_sa = 0;
 	pstats_ikev1_fail = pstats_ikev2_fail = 0;
 	pstats_ikev1_completed = pstats_ikev2_completed = 0;
@@ -511,7 +571,20 @@ void whack_clearstats(const struct whack_message *wm UNUSED, struct show *s UNUS
 	pstats_ipsec_encap_yes = pstats_ipsec_encap_no = 0;
 	pstats_ipsec_esn = pstats_ipsec_tfc = 0;
 	pstats_ike_dpd_recv = pstats_ike_dpd_sent = pstats_ike_dpd_replied = 0;
+	pstats_ike_dpd_skipped = 0;
+	pstats_nat_keepalive_sent = pstats_nat_keepalive_skipped = 0;
 	pstats_pamauth_started = pstats_pamauth_stopped = pstats_pamauth_aborted = 0;
+	pstats_ike_parent_lookups = pstats_ike_parent_visited = 0;
+	pstats_ike_responder_lookups = pstats_ike_responder_visited = 0;
+	pstats_ike_cookie_fast_path = 0;
+	memset(pstats_ddos_prefix, 0, sizeof(pstats_ddos_prefix));
+	pstats_ddos_prefix_evictions = 0;
+	pstats_ike_udp_recv_wakeups = pstats_ike_udp_recv_datagrams = 0;
+	pstats_ike_udp_recv_full = pstats_ike_udp_recv_errqueue = 0;
+	pstats_ike_udp_send_queued = pstats_ike_udp_send_flushes = 0;
+	pstats_ike_udp_send_calls = pstats_ike_udp_send_gso = 0;
+	pstats_kernel_xfrm_async_queued = pstats_kernel_xfrm_async_failed = 0;
+	pstats_kernel_xfrm_async_window_full = 0;
 
 	memset(pstats_iketcp_started, 0, sizeof(pstats_iketcp_started));
 	memset(pstats_iketcp_stopped, 0, sizeof(pstats_iketcp_stopped));
@@ -61,6 +61,24 @@ extern const struct pluto_stat pstats_stf_status;	     /* count state transition
 extern unsigned long pstats_ike_dpd_recv;
 extern unsigned long pstats_ike_dpd_sent;
 extern unsigned long pstats_ike_dpd_replied;
+extern unsigned long pstats_ike_dpd_skipped;
+extern unsigned long pstats_nat_keepalive_sent;
+extern unsigned long pstats_nat_keepalive_skipped;
+
+extern unsigned long pstats_ike_udp_recv_wakeups;	/* socket reads */
+extern unsigned long pstats_ike_udp_recv_datagrams;
+extern unsigned long pstats_ike_udp_recv_full;		/* reads that filled the batch */
+extern unsigned long pstats_ike_udp_recv_errqueue;	/* MSG_ERRQUEUE checks */
+extern unsigned long pstats_ddos_prefix[];		/* indexed by enum ddos_verdict */
+extern unsigned long pstats_ddos_prefix_evictions;
+extern unsigned long pstats_ike_cookie_fast_path;	/* IKE_SA_INIT requests checked before parsing */
+extern unsigned long pstats_ike_udp_send_queued;	/* datagrams queued for sending */
+extern unsigned long pstats_ike_udp_send_flushes;	/* send queues flushed */
+extern unsigned long pstats_ike_udp_send_calls;		/* sendmmsg() calls */
+extern unsigned long pstats_ike_udp_send_gso;		/* datagrams sent as GSO segments */
+extern unsigned long pstats_kernel_xfrm_async_queued;	/* NETLINK_XFRM requests queued */
+extern unsigned long pstats_kernel_xfrm_async_failed;	/* ... that the kernel rejected */
+extern unsigned long pstats_kernel_xfrm_async_window_full; /* ... sent synchronously instead */
 
 extern unsigned long pstats_iketcp_started[2];
 extern unsigned long pstats_iketcp_aborted[2];
@@ -73,6 +91,11 @@ extern unsigned long pstats_pamauth_aborted;
 extern unsigned long pstats_ikev2_redirect_failed;
 extern unsigned long pstats_ikev2_redirect_completed;
 
+extern unsigned long pstats_ike_parent_lookups;	/* searches for a connection's IKE SA */
+extern unsigned long pstats_ike_parent_visited;	/* states examined by those searches */
+extern unsigned long pstats_ike_responder_lookups;	/* searches for a responder's connection */
+extern unsigned long pstats_ike_responder_visited;	/* connections examined by those searches */
+
 extern void whack_showstats(const struct whack_message *wm, struct show *s);
 extern void whack_clearstats(const struct whack_message *wm, struct show *s);
 
@@ -61,6 +61,8 @@
 #include "enum_names.h"
 #include "virtual_ip.h"
 #include "state_db.h"		/* for init_state_db() */
+#include "hash_table.h"		/* for init_hash_table_timer() init_hash_table_key() */
+#include "timer.h"			/* for init_state_event_wheel() */
 #include "connection_db.h"	/* for init_connection_db() */
 #include "spd_db.h"	/* for init_spd_route_db() */
 #include "nat_traversal.h"
@@ -72,7 +74,7 @@
 #include "crypt_symkey.h"	/* for init_crypt_symkey() */
 #include "ddns.h"		/* for init_ddns() */
 #include "x509_crl.h"		/* for free_crl_queue() */
-#include "iface.h"		/* for pluto_listen; */
+#include "iface.h"		/* for pluto_listen; init_udp_send_queue() */
 #include "kernel_info.h"	/* for init_kernel_interface() */
 #include "server_pool.h"
 #include "show.h"
@@ -371,6 +373,9 @@ enum opt {
 	OPT_KEEP_ALIVE,
 	OPT_VIRTUAL_PRIVATE,
 	OPT_NHELPERS,
+	OPT_OFFLOAD_DECRYPT_THRESHOLD,
+	OPT_UPDOWN_CONCURRENCY,
+	OPT_UPDOWN_COPROCESS,
 	OPT_EXPIRE_SHUNT_INTERVAL,
 	OPT_SEEDBITS,
 	OPT_IKEV1_SECCTX_ATTR_TYPE,
@@ -405,6 +410,9 @@ const struct option optarg_options[] = {
 	{ REPLACE_OPT("foodgroupsdir", "ipsecdir", "3.9"), required_argument, NULL, OPT_IPSECDIR },	/* redundant spelling */
 	{ OPT("nssdir", "<dirname>"), required_argument, NULL, OPT_NSSDIR },	/* nss-tools use -d */
 	{ OPT("nhelpers", "<number>"), required_argument, NULL, OPT_NHELPERS },
+	{ OPT("offload-decrypt-threshold", "<bytes>"), required_argument, NULL, OPT_OFFLOAD_DECRYPT_THRESHOLD },
+	{ OPT("updown-concurrency", "<number>"), required_argument, NULL, OPT_UPDOWN_CONCURRENCY },
+	{ OPT("updown-coprocess", "<filename>"), required_argument, NULL, OPT_UPDOWN_COPROCESS },
 	{ OPT("leak-detective"), no_argument, NULL, OPT_LEAK_DETECTIVE },
 	{ OPT("efence-protect"), no_argument, NULL, OPT_EFENCE_PROTECT, },
 
@@ -687,6 +695,17 @@ int main(int argc, char **argv)
 		case OPT_NHELPERS:	/* --nhelpers */
 			update_setup_option(KBF_NHELPERS, optarg_uintmax(logger));
 			continue;
+		case OPT_OFFLOAD_DECRYPT_THRESHOLD:	/* --offload-decrypt-threshold */
+			update_setup_option(KBF_OFFLOAD_DECRYPT_THRESHOLD,
+					    optarg_uintmax(logger));
+			continue;
+		case OPT_UPDOWN_CONCURRENCY:	/* --updown-concurrency */
+			update_setup_option(KBF_UPDOWN_CONCURRENCY,
+					    optarg_uintmax(logger));
+			continue;
+		case OPT_UPDOWN_COPROCESS:	/* --updown-coprocess */
+			update_setup_string(KSF_UPDOWN_COPROCESS, optarg_empty(logger));
+			continue;
 
 		case OPT_SEEDBITS:	/* --seedbits */
 		{
@@ -1294,9 +1313,11 @@ int main(int argc, char **argv)
 	init_states();
 	state_db_init(logger);
 	connection_db_init(logger);
+	connection_alias_db_init(logger);
 	spd_db_init(logger);
 
 	pluto_init_nss(config_setup_nssdir(), logger);
+	init_hash_table_key(logger);	/* needs NSS */
 	init_seedbits(oco, logger);
 	init_demux(oco, logger);
 
@@ -1462,6 +1483,9 @@ int main(int argc, char **argv)
 	init_server(logger);
 
 	/* server initialized; timers can follow */
+	init_hash_table_timer(logger);
+	init_state_event_wheel(logger);
+	init_udp_send_queue(logger);
 	init_log_limiter(logger);
 	deltatime_t keep_alive = config_setup_deltatime(oco, KBF_KEEP_ALIVE);
 	init_nat_traversal_timer(keep_alive, logger);
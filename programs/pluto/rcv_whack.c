@@ -127,7 +127,7 @@ static void whack_fipsstatus(const struct whack_message *wm UNUSED, struct show
 
 static void whack_showstates(const struct whack_message *wm UNUSED, struct show *s)
 {
-	show_states(s, mononow());
+	whack_dump_states(s);
 }
 
 static void jam_whack_name(struct jambuf *buf, const struct whack_message *wm)
@@ -184,6 +184,13 @@ static void whack_listen(const struct whack_message *wm, struct show *s)
 	const struct config_setup *oco = config_setup_singleton();
 	pluto_ike_socket_errqueue = config_setup_yn(oco, KYN_IKE_SOCKET_ERRQUEUE);
 	pluto_ike_socket_bufsize = config_setup_option(oco, KBF_IKE_SOCKET_BUFSIZE);
+	pluto_ike_socket_batch = config_setup_option(oco, KBF_IKE_SOCKET_BATCH);
+	if (pluto_ike_socket_batch > MAX_IKE_SOCKET_BATCH) {
+		llog(RC_LOG, logger, "ike-socket-batch=%u is too big, using %u",
+		     pluto_ike_socket_batch, MAX_IKE_SOCKET_BATCH);
+		pluto_ike_socket_batch = MAX_IKE_SOCKET_BATCH;
+	}
+	pluto_ike_socket_send_batch = config_setup_yn(oco, KYN_IKE_SOCKET_SEND_BATCH);
 
 	/* Update MSG_ERRQUEUE settings before listen. */
 
@@ -489,6 +496,10 @@ static void dispatch_command(const struct whack_message *const wm, struct show *
 			.name = "ddos",
 			.op = whack_ddos,
 		},
+		[WHACK_DDOSSTATUS] = {
+			.name = "ddos-status",
+			.op = whack_ddosstatus,
+		},
 		[WHACK_CHECKPUBKEYS] = {
 			.name = "checkpubkeys",
 			.op = whack_checkpubkeys,
@@ -711,12 +722,23 @@ static void whack_handle(struct fd *whackfd, struct logger *whack_logger)
 
 	if (msg.basic.whack_status) {
 		struct show *s = alloc_show(whack_logger);
-		whack_status(s, mononow());
+		whack_status(s);
 		free_show(&s);
 		/* bail early, but without complaint */
 		return; /* don't shutdown */
 	}
 
+	/*
+	 * Bulk add reads further records from WHACKFD.
+	 */
+
+	if (msg.whack_command == WHACK_BULK_ADD) {
+		struct show *s = alloc_show(whack_logger);
+		whack_add_bulk(&msg, n, whackfd, s);
+		free_show(&s);
+		return;
+	}
+
 	struct show *s = alloc_show(whack_logger);
 	whack_process(&msg, s);
 	free_show(&s);
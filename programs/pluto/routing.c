@@ -22,6 +22,7 @@
 #include "log.h"
 #include "kernel.h"
 #include "kernel_policy.h"
+#include "kernel_ops.h"		/* for kernel_ops_begin_batch() */
 #include "revival.h"
 #include "ikev2_ike_sa_init.h"		/* for initiate_v2_IKE_SA_INIT_request() */
 #include "pluto_stats.h"
@@ -379,9 +380,18 @@ bool connection_establish_child(struct ike_sa *ike, struct child_sa *child, wher
 	 * down into two transactions.  That way, hopefully, the
 	 * outbound code doesn't need to revert changes made by the
 	 * inbound code.
+	 *
+	 * Each direction's SAs, and the inbound policies, are
+	 * written when their own (nested) batch commits, so that a
+	 * failure can be undone; the outbound policies go when the
+	 * outbound code syncs this batch before running updown.
 	 */
-	return (dispatch(CONNECTION_ESTABLISH_INBOUND, cc, logger, &annex) &&
-		dispatch(CONNECTION_ESTABLISH_OUTBOUND, cc, logger, &annex));
+	kernel_ops_begin_batch(logger);
+	bool ok = (dispatch(CONNECTION_ESTABLISH_INBOUND, cc, logger, &annex) &&
+		   dispatch(CONNECTION_ESTABLISH_OUTBOUND, cc, logger, &annex));
+	/* always commit; a failed dispatch can leave adds batched */
+	bool committed = kernel_ops_commit_batch(logger);
+	return ok && committed;
 }
 
 enum shunt_kind routing_shunt_kind(enum routing routing)
@@ -174,7 +174,8 @@ static bool send_shunks(const char *where, bool just_a_keepalive,
 
 	if (!impair_outbound(interface, packet, &remote_endpoint, logger)) {
 		ssize_t wlen = interface->io->write_packet(interface, packet,
-							   &remote_endpoint, logger);
+							   &remote_endpoint,
+							   just_a_keepalive, logger);
 		if (wlen != (ssize_t)len) {
 			if (!just_a_keepalive) {
 				endpoint_buf lb;
@@ -234,6 +235,15 @@ bool send_pbs_out_using_md(struct msg_digest *md, const char *where, struct pbs_
 			   md->logger);
 }
 
+bool send_shunk_using_iface(const struct iface_endpoint *iface, ip_endpoint remote,
+			    const char *where, shunk_t packet, struct logger *logger)
+{
+	return send_shunks(where, false, SOS_NOBODY,
+			   iface, remote,
+			   packet, null_shunk,
+			   logger);
+}
+
 bool send_shunks_using_state(struct state *st, const char *where,
 			     shunk_t shunk_a, shunk_t shunk_b)
 {
@@ -19,15 +19,21 @@
 
 #include "shunk.h"
 #include "ip_address.h"
+#include "ip_endpoint.h"
 
 struct iface_endpoint;
 struct state;
 struct msg_digest;
 struct pbs_out;
+struct logger;
 
 bool send_pbs_out_using_md(struct msg_digest *md, const char *where, struct pbs_out *packet);
 bool send_pbs_out_using_state(struct state *st, const char *where, struct pbs_out *packet);
 
+/* no state, no message digest; for instance the cookie fast path */
+bool send_shunk_using_iface(const struct iface_endpoint *iface, ip_endpoint remote,
+			    const char *where, shunk_t packet, struct logger *logger);
+
 bool send_shunks_using_state(struct state *st, const char *where, shunk_t a, shunk_t b);
 bool send_shunk_using_state(struct state *st, const char *where, shunk_t packet);
 
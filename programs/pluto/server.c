@@ -263,6 +263,10 @@ static struct global_timer_desc global_timers[] = {
 	E(EVENT_CHECK_CRLS),
 	E(EVENT_FREE_ROOT_CERTS),
 	E(EVENT_RESET_LOG_LIMITER),
+	E(EVENT_REHASH_HASH_TABLES),
+	E(EVENT_FLUSH_UDP_SEND_QUEUES),
+	E(EVENT_STATE_EVENT_WHEEL),
+	E(EVENT_TRAFFIC_PROBE_SWEEP),
 #undef E
 };
 
@@ -618,52 +622,46 @@ void complete_state_transition(struct state *st, struct msg_digest *md, stf_stat
 	}
 }
 
-static void resume_handler(void *arg, const struct timer_event *event)
+static void run_resume(const char *name, so_serial_t serialno,
+		       struct msg_digest *md,
+		       resume_cb *callback, void *context,
+		       struct logger *logger)
 {
-	struct resume_event *e = (struct resume_event *)arg;
-	/*
-	 * At one point, .ne_event was was being set after the event
-	 * was enabled.  With multiple threads this resulted in a race
-	 * where the event ran before .ne_event was set.  The
-	 * pexpect() followed by the passert() demonstrated this - the
-	 * pexpect() failed yet the passert() passed.
-	 */
-	pexpect(e->timer != NULL);
-	ldbg(event->logger, "processing resume %s for #%lu", e->name, e->serialno);
+	ldbg(logger, "processing resume %s for #%lu", name, serialno);
 	/*
 	 * XXX: Don't confuse this and the "callback") code path.
 	 * This unsuspends MD, "callback" does not.
 	 */
-	struct state *st = state_by_serialno(e->serialno);
+	struct state *st = state_by_serialno(serialno);
 	if (st == NULL) {
 		threadtime_t start = threadtime_start();
-		stf_status status = e->callback(NULL, NULL, e->context);
+		stf_status status = callback(NULL, NULL, context);
 		pexpect(status == STF_SKIP_COMPLETE_STATE_TRANSITION);
-		threadtime_stop(&start, e->serialno, "resume %s", e->name);
+		threadtime_stop(&start, serialno, "resume %s", name);
 	} else {
 		/* no previous state */
 		statetime_t start = statetime_start(st);
 
 		/* trust nothing; so save everything */
 		so_serial_t old_st = st->st_serialno;
-		so_serial_t old_md_st = (e->md == NULL ? SOS_NOBODY :
-					 e->md->v1_st == NULL ? SOS_NOBODY :
-					 e->md->v1_st->st_serialno);
+		so_serial_t old_md_st = (md == NULL ? SOS_NOBODY :
+					 md->v1_st == NULL ? SOS_NOBODY :
+					 md->v1_st->st_serialno);
 		const enum ike_version ike_version = st->st_ike_version;
 		/* when MD.ST it matches ST */
 		pexpect(old_md_st == SOS_NOBODY || old_md_st == old_st);
 
 		/* run the callback */
-		stf_status status = e->callback(st, e->md, e->context);
+		stf_status status = callback(st, md, context);
 		/* this may trash ST and/or MD.ST */
 
 		if (status == STF_SKIP_COMPLETE_STATE_TRANSITION) {
 			/* MD.ST may have been freed! */
-			ldbg(event->logger,
+			ldbg(logger,
 			     "resume %s for #%lu suppressed complete_v%d_state_transition()%s",
-			     e->name, e->serialno, ike_version,
-			     (old_md_st != SOS_NOBODY && e->md->v1_st == NULL ? "; MD.ST disappeared" :
-			      old_md_st != SOS_NOBODY && e->md->v1_st != st ? "; MD.ST was switched" :
+			     name, serialno, ike_version,
+			     (old_md_st != SOS_NOBODY && md->v1_st == NULL ? "; MD.ST disappeared" :
+			      old_md_st != SOS_NOBODY && md->v1_st != st ? "; MD.ST was switched" :
 			      ""));
 		} else {
 			/* XXX: mumble something about struct ike_version */
@@ -673,12 +671,12 @@ static void resume_handler(void *arg, const struct timer_event *event)
 				/* no switching MD.ST */
 				if (old_md_st == SOS_NOBODY) {
 					/* (old)md->v1_st == (new)md->v1_st == NULL */
-					pexpect(e->md == NULL || e->md->v1_st == NULL);
+					pexpect(md == NULL || md->v1_st == NULL);
 				} else {
 					/* md->v1_st didn't change */
-					pexpect(e->md != NULL &&
-						e->md->v1_st != NULL &&
-						e->md->v1_st->st_serialno == old_md_st);
+					pexpect(md != NULL &&
+						md->v1_st != NULL &&
+						md->v1_st->st_serialno == old_md_st);
 				}
 				pexpect(st != NULL); /* see above */
 				break;
@@ -688,16 +686,48 @@ static void resume_handler(void *arg, const struct timer_event *event)
 			default:
 				bad_case(ike_version);
 			}
-			complete_state_transition(st, e->md, status);
+			complete_state_transition(st, md, status);
 		}
-		statetime_stop(&start, "resume %s", e->name);
+		statetime_stop(&start, "resume %s", name);
 	}
+}
+
+static void resume_handler(void *arg, const struct timer_event *event)
+{
+	struct resume_event *e = (struct resume_event *)arg;
+	/*
+	 * At one point, .ne_event was was being set after the event
+	 * was enabled.  With multiple threads this resulted in a race
+	 * where the event ran before .ne_event was set.  The
+	 * pexpect() followed by the passert() demonstrated this - the
+	 * pexpect() failed yet the passert() passed.
+	 */
+	pexpect(e->timer != NULL);
+	run_resume(e->name, e->serialno, e->md,
+		   e->callback, e->context, event->logger);
 	passert(e->timer != NULL);
 	destroy_timeout(&e->timer);
 	md_delref(&e->md);
 	pfree(e);
 }
 
+void resume_now(const char *name, so_serial_t serialno,
+		struct msg_digest **mdp,
+		resume_cb *callback, void *context,
+		struct logger *logger)
+{
+	passert(in_main_thread());
+	pexpect(serialno != SOS_NOBODY);
+	/* steal reference */
+	struct msg_digest *md = NULL;
+	if (mdp != NULL) {
+		md = (*mdp);
+		(*mdp) = NULL;
+	}
+	run_resume(name, serialno, md, callback, context, logger);
+	md_delref(&md);
+}
+
 void schedule_resume(const char *name, so_serial_t serialno,
 		     struct msg_digest **mdp,
 		     resume_cb *callback, void *context)
@@ -851,6 +881,50 @@ void add_fd_read_listener(int fd, const char *name,
 	link_pluto_event_list(fdl);
 }
 
+struct fd_write_listener {
+	fd_write_listener_cb *cb;
+	void *arg;
+	const char *name;
+	struct event ev;		/* libevent data structure */
+};
+
+static void fd_write_listener_event_handler(evutil_socket_t fd,
+					    short events UNUSED,
+					    void *arg)
+{
+	struct logger logger[1] = { global_logger, }; /* event-handler */
+	struct fd_write_listener *fdl = arg;
+	fdl->cb(fd, fdl->arg, logger);
+}
+
+void attach_fd_write_listener(struct fd_write_listener **fdl,
+			      int fd, const char *name,
+			      fd_write_listener_cb *cb, void *arg)
+{
+	passert(*fdl == NULL);
+	passert(fd >= 0);
+	/* create the listener */
+	*fdl = alloc_thing(struct fd_write_listener, name);
+	ldbg_alloc(&global_logger, "fdl", *fdl, HERE);
+	(*fdl)->name = name;
+	(*fdl)->arg = arg;
+	(*fdl)->cb = cb;
+	EVENT_ADD(*fdl, EV_WRITE|EV_PERSIST,
+		  (evutil_socket_t)fd,
+		  (struct timeval*)NULL,
+		  fd_write_listener_event_handler);
+}
+
+void detach_fd_write_listener(struct fd_write_listener **fdl)
+{
+	if (*fdl != NULL) {
+		EVENT_DEL(*fdl);
+		ldbg_free(&global_logger, "fdl", *fdl, HERE);
+		pfree(*fdl);
+		*fdl = NULL;
+	}
+}
+
 struct fd_accept_listener {
 	fd_accept_listener_cb *cb;
 	void *arg;
@@ -909,6 +983,7 @@ void list_timers(struct show *s, const monotime_t now)
 		     monosecs(now));
 
 	list_global_timers(s, now);
+	list_state_event_wheel(s, now);
 	list_signal_handlers(s);
 
 	for (struct fd_read_listener *ev = pluto_events_head;
@@ -39,6 +39,7 @@ struct iface_endpoint;
 struct iface_device;
 struct show;
 struct fd_read_listener;
+struct fd_write_listener;
 struct fd_accept_listener;
 struct timeout;
 struct config_setup;
@@ -88,6 +89,14 @@ void detach_fd_read_listener(struct fd_read_listener **fdl);
 void add_fd_read_listener(int fd, const char *name,
 			  fd_read_listener_cb *cb, void *arg);
 
+/* called while FD is writable; detach once there's nothing to write */
+typedef void (fd_write_listener_cb)(int fd, void *arg, struct logger *logger);
+
+void attach_fd_write_listener(struct fd_write_listener **fdl,
+			      int fd, const char *name,
+			      fd_write_listener_cb *cb, void *arg);
+void detach_fd_write_listener(struct fd_write_listener **fdl);
+
 extern void init_server(struct logger *logger);
 extern void free_server(void);
 
@@ -125,6 +134,18 @@ void schedule_resume(const char *name,
 		     struct msg_digest **mdp,
 		     resume_cb *callback, void *context);
 
+/*
+ * Same as schedule_resume(), but run CALLBACK immediately.  Only
+ * callable from the main thread, for instance when draining a batch
+ * of completed jobs.
+ */
+
+void resume_now(const char *name,
+		so_serial_t serialno,
+		struct msg_digest **mdp,
+		resume_cb *callback, void *context,
+		struct logger *logger);
+
 /*
  * Schedule a callback on the main event loop now.
  *
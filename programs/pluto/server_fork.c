@@ -31,9 +31,11 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>		/* for kill() */
 
 #include "monotime.h"
 
@@ -86,7 +88,7 @@ static size_t jam_pid_entry(struct jambuf *buf, const struct pid_entry *entry)
 
 static hash_t hash_pid_entry_pid(const pid_t *pid)
 {
-	return hash_thing(*pid, zero_hash);
+	return hash_unkeyed_thing(*pid, zero_hash);
 }
 
 HASH_TABLE(pid_entry, pid, .pid, 23);
@@ -365,7 +367,11 @@ pid_t server_fork_exec(const char *path, char *argv[], char *envp[],
 				   logger);
 	if (pid == 0) {
 		/* child */
-		execve(path, argv, envp);
+		if (envp == NULL) {
+			execv(path, argv);
+		} else {
+			execve(path, argv, envp);
+		}
 		/* really can't printf() */
 		_exit(42);
 	}
@@ -373,6 +379,76 @@ pid_t server_fork_exec(const char *path, char *argv[], char *envp[],
 	return pid;
 }
 
+pid_t server_fork_coprocess(const char *path, char *argv[], char *envp[],
+			    int *fd, int *reply_fd,
+			    server_fork_cb *callback, void *callback_context,
+			    struct logger *logger)
+{
+	/*
+	 * A socket, rather than a pipe, so that the parent can use
+	 * send(MSG_NOSIGNAL) and not die when the child does.
+	 */
+	int fds[2]; /*0=parent,1=child*/
+	if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) < 0) {
+		llog_error(logger, errno, "socketpair() failed");
+		return -1;
+	}
+	int reply_fds[2]; /*0=parent,1=child*/
+	if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, reply_fds) < 0) {
+		llog_error(logger, errno, "socketpair() failed");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	pid_t pid = fork();
+	switch (pid) {
+
+	case -1:
+		llog_error(logger, errno, "fork failed");
+		close(fds[0]);
+		close(fds[1]);
+		close(reply_fds[0]);
+		close(reply_fds[1]);
+		return -1;
+
+	case 0:
+		/*
+		 * CHILD
+		 *
+		 * Redirect STDIN, STDOUT and STDERR to the socket, and
+		 * fd 3 to the reply socket; dup2() strips O_CLOEXEC
+		 * (except when the descriptor is already 3).
+		 */
+		dup2(fds[1], STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		if (reply_fds[1] == 3) {
+			fcntl(3, F_SETFD, 0);
+		} else {
+			dup2(reply_fds[1], 3);
+		}
+		if (envp == NULL) {
+			execv(path, argv);
+		} else {
+			execve(path, argv, envp);
+		}
+		/* really can't printf() */
+		_exit(42);
+
+	default:
+		/* PARENT */
+		close(fds[1]);
+		close(reply_fds[1]);
+		ldbg(logger, "created %s co-process (pid:%d) using fork()", argv[0], pid);
+		add_pid(argv[0], SOS_NOBODY, NULL, pid,
+			callback, callback_context, logger);
+		*fd = fds[0];
+		*reply_fd = reply_fds[0];
+		return pid;
+	}
+}
+
 static void jam_status(struct jambuf *buf, int status)
 {
 	jam(buf, " (");
@@ -401,6 +477,73 @@ static void jam_status(struct jambuf *buf, int status)
 	jam_string(buf, ")");
 }
 
+static void reap_child(pid_t child, int status, struct logger *logger)
+{
+	LDBGP_JAMBUF(DBG_BASE, logger, buf) {
+		jam(buf, "waitpid returned pid %d",
+			child);
+		jam_status(buf, status);
+	}
+	struct pid_entry *pid_entry = pid_entry_by_pid(child);
+	if (pid_entry == NULL) {
+		LLOG_JAMBUF(RC_LOG, logger, buf) {
+			jam(buf, "waitpid return unknown child pid %d",
+				child);
+			jam_status(buf, status);
+		}
+		return;
+	}
+	/* drain output using blocking read */
+	if (pid_entry->fdl != NULL) {
+		int flags = fcntl(pid_entry->fd, F_GETFL);
+		fcntl(pid_entry->fd, F_SETFL, flags & ~O_NONBLOCK);
+		while (drain_fd(pid_entry));
+	}
+	/* log against pid_entry->logger; must cleanup */
+	struct state *st = state_by_serialno(pid_entry->serialno);
+	if (pid_entry->serialno == SOS_NOBODY) {
+		pid_entry->callback(NULL, NULL, status,
+				    HUNK_AS_SHUNK(pid_entry->output),
+				    pid_entry->context,
+				    pid_entry->logger);
+	} else if (st == NULL) {
+		LDBGP_JAMBUF(DBG_BASE, logger, buf) {
+			jam_pid_entry(buf, pid_entry);
+			jam_string(buf, " disappeared");
+		}
+		pid_entry->callback(NULL, NULL, status,
+				    HUNK_AS_SHUNK(pid_entry->output),
+				    pid_entry->context,
+				    pid_entry->logger);
+	} else {
+		if (LDBGP(DBG_CPU_USAGE, pid_entry->logger)) {
+			deltatime_t took = monotime_diff(mononow(), pid_entry->start_time);
+			deltatime_buf dtb;
+			LDBG_log(pid_entry->logger, "#%lu waited %s for '%s' fork()",
+				 st->st_serialno, str_deltatime(took, &dtb),
+				 pid_entry->name);
+		}
+		statetime_t start = statetime_start(st);
+		const enum ike_version ike_version = st->st_ike_version;
+		stf_status ret = pid_entry->callback(st, pid_entry->md, status,
+						     HUNK_AS_SHUNK(pid_entry->output),
+						     pid_entry->context,
+						     pid_entry->logger);
+		if (ret == STF_SKIP_COMPLETE_STATE_TRANSITION) {
+			/* MD.ST may have been freed! */
+			dbg("resume %s for #%lu skipped complete_v%d_state_transition()",
+			    pid_entry->name, pid_entry->serialno, ike_version);
+		} else {
+			complete_state_transition(st, pid_entry->md, ret);
+		}
+		statetime_stop(&start, "callback for %s",
+			       pid_entry->name);
+	}
+	/* clean it up */
+	pid_entry_db_del(pid_entry);
+	free_pid_entry(&pid_entry);
+}
+
 void server_fork_sigchld_handler(struct logger *logger)
 {
 	while (true) {
@@ -419,74 +562,47 @@ void server_fork_sigchld_handler(struct logger *logger)
 			dbg("waitpid returned nothing left to do (all child processes are busy)");
 			return;
 		default:
-			LDBGP_JAMBUF(DBG_BASE, logger, buf) {
-				jam(buf, "waitpid returned pid %d",
-					child);
-				jam_status(buf, status);
-			}
-			struct pid_entry *pid_entry = pid_entry_by_pid(child);
-			if (pid_entry == NULL) {
-				LLOG_JAMBUF(RC_LOG, logger, buf) {
-					jam(buf, "waitpid return unknown child pid %d",
-						child);
-					jam_status(buf, status);
-				}
-				continue;
-			}
-			/* drain output using blocking read */
-			if (pid_entry->fdl != NULL) {
-				int flags = fcntl(pid_entry->fd, F_GETFL);
-				fcntl(pid_entry->fd, F_SETFL, flags & ~O_NONBLOCK);
-				while (drain_fd(pid_entry));
-			}
-			/* log against pid_entry->logger; must cleanup */
-			struct state *st = state_by_serialno(pid_entry->serialno);
-			if (pid_entry->serialno == SOS_NOBODY) {
-				pid_entry->callback(NULL, NULL, status,
-						    HUNK_AS_SHUNK(pid_entry->output),
-						    pid_entry->context,
-						    pid_entry->logger);
-			} else if (st == NULL) {
-				LDBGP_JAMBUF(DBG_BASE, logger, buf) {
-					jam_pid_entry(buf, pid_entry);
-					jam_string(buf, " disappeared");
-				}
-				pid_entry->callback(NULL, NULL, status,
-						    HUNK_AS_SHUNK(pid_entry->output),
-						    pid_entry->context,
-						    pid_entry->logger);
-			} else {
-				if (LDBGP(DBG_CPU_USAGE, pid_entry->logger)) {
-					deltatime_t took = monotime_diff(mononow(), pid_entry->start_time);
-					deltatime_buf dtb;
-					LDBG_log(pid_entry->logger, "#%lu waited %s for '%s' fork()",
-						 st->st_serialno, str_deltatime(took, &dtb),
-						 pid_entry->name);
-				}
-				statetime_t start = statetime_start(st);
-				const enum ike_version ike_version = st->st_ike_version;
-				stf_status ret = pid_entry->callback(st, pid_entry->md, status,
-								     HUNK_AS_SHUNK(pid_entry->output),
-								     pid_entry->context,
-								     pid_entry->logger);
-				if (ret == STF_SKIP_COMPLETE_STATE_TRANSITION) {
-					/* MD.ST may have been freed! */
-					dbg("resume %s for #%lu skipped complete_v%d_state_transition()",
-					    pid_entry->name, pid_entry->serialno, ike_version);
-				} else {
-					complete_state_transition(st, pid_entry->md, ret);
-				}
-				statetime_stop(&start, "callback for %s",
-					       pid_entry->name);
-			}
-			/* clean it up */
-			pid_entry_db_del(pid_entry);
-			free_pid_entry(&pid_entry);
+			reap_child(child, status, logger);
 			continue;
 		}
 	}
 }
 
+/*
+ * Wait, for at most TIMEOUT, for PID to exit and then run its
+ * callback; if it is still running after that it is killed.  For
+ * when there's no event-loop to deliver SIGCHLD.  Returns false
+ * (logged) when PID can't be waited for.
+ */
+
+bool server_fork_wait(pid_t pid, deltatime_t timeout, struct logger *logger)
+{
+	const monotime_t deadline = monotime_add(mononow(), timeout);
+	int status;
+	pid_t child;
+	while (true) {
+		child = waitpid(pid, &status, WNOHANG);
+		if (child != 0 && !(child < 0 && errno == EINTR)) {
+			break;
+		}
+		if (monotime_cmp(mononow(), >=, deadline)) {
+			llog(RC_LOG, logger, "killing pid %d, still running after waiting", pid);
+			kill(pid, SIGKILL);
+			do {
+				child = waitpid(pid, &status, 0);
+			} while (child < 0 && errno == EINTR);
+			break;
+		}
+		usleep(10 * 1000);
+	}
+	if (child < 0) {
+		llog_error(logger, errno, "waitpid(%d) unexpectedly failed", pid);
+		return false;
+	}
+	reap_child(child, status, logger);
+	return true;
+}
+
 void init_server_fork(struct logger *logger)
 {
 	pid_entry_db_init(logger);
@@ -17,6 +17,7 @@
 #define SERVER_FORK_H
 
 #include "chunk.h"
+#include "deltatime.h"
 
 struct logger;
 struct msg_digest;
@@ -32,7 +33,8 @@ struct whack_message;
  * process (the value returned is passed to exit()).  This is used to
  * perform a thread unfriendly operation, such as calling PAM.
  *
- * SERVER_FORK_EXEC(): runs PROGRAM passing ARGV[].
+ * SERVER_FORK_EXEC(): runs PROGRAM passing ARGV[] and ENVP[] (NULL
+ * ENVP inherits pluto's environment).
 
  * On exit CALLBACK(ST, MD, WSTATUS, OUTPUT, CALLBACK_CONTEXT, ...) is
  * called where WSTATUS was returned by waitpid() and OUTPUT contains
@@ -74,7 +76,23 @@ pid_t server_fork_exec(const char *path,
 		       void *callback_context,
 		       struct logger *logger);
 
+/*
+ * SERVER_FORK_COPROCESS(): runs PATH as a long-lived co-process.
+ *
+ * *FD is a socket connected to the process's STDIN, STDOUT and
+ * STDERR, and *REPLY_FD a socket connected to its fd 3; the caller
+ * reads and writes (and closes) them.  CALLBACK is called when the
+ * process exits (OUTPUT is empty).
+ */
+
+pid_t server_fork_coprocess(const char *path,
+			    char *argv[], char *envp[], int *fd, int *reply_fd,
+			    server_fork_cb *callback,
+			    void *callback_context,
+			    struct logger *logger);
+
 void server_fork_sigchld_handler(struct logger *logger);
+bool server_fork_wait(pid_t pid, deltatime_t timeout, struct logger *logger);
 void init_server_fork(struct logger *logger);
 void check_server_fork(struct logger *logger);
 void whack_processstatus(const struct whack_message *wm, struct show *s);
@@ -44,6 +44,8 @@
 #include "pluto_timing.h"
 #include "connections.h"
 #include "demux.h"			/* for md_addref() md_delref() */
+#include "show.h"
+#include "monotime.h"
 
 #ifdef USE_SECCOMP
 # include "pluto_seccomp.h"
@@ -53,6 +55,7 @@ static callback_cb helper_thread_stopped_callback;	/* type assertion */
 static resume_cb handle_helper_answer;			/* type assertion */
 static callback_cb inline_worker;			/* type assertion */
 static callback_cb call_server_helpers_stopped_callback; /* type assertion */
+static callback_cb helper_answers_callback;		/* type assertion */
 /*
  * The job structure
  *
@@ -81,6 +84,9 @@ struct job {
 	struct task *task;
 	const struct task_handler *handler;
 	struct list_entry backlog;
+	struct job *next_answer;		/* see helper_answers */
+	enum task_priority priority;
+	monotime_t submitted;
 	so_serial_t callback_so;		/* sponsoring state-object's serial number */
 	so_serial_t task_so;			/* sponsoring state-object's serial number */
 	struct msg_digest *md;
@@ -103,8 +109,17 @@ struct job {
 		JOB->where->func,					\
 		JOB->handler->name
 
+static const char *const task_priority_name[TASK_PRIORITY_ROOF] = {
+	[TASK_PRIORITY_REKEY] = "rekey",
+	[TASK_PRIORITY_AUTHENTICATED] = "authenticated",
+	[TASK_PRIORITY_HALF_OPEN] = "halfopen",
+};
+
 /*
- * The work queue.  Accesses must be locked.
+ * The overflow queue.  Only accessed by the main thread.
+ *
+ * Jobs wait here when all the per-helper queues are full.  They are
+ * fed to the helpers as answers come back.
  */
 
 static size_t jam_backlog(struct jambuf *buf, const void *data)
@@ -125,6 +140,7 @@ static size_t jam_backlog(struct jambuf *buf, const void *data)
 	if (job->helper_id != 0) {
 		s += jam(buf, " helper %u", job->helper_id);
 	}
+	s += jam(buf, " %s", task_priority_name[job->priority]);
 	if (job->cancelled) {
 		s += jam(buf, " cancelled");
 	}
@@ -139,37 +155,139 @@ static size_t jam_backlog(struct jambuf *buf, const void *data)
 
 LIST_INFO(job, backlog, backlog_info, jam_backlog);
 
-static pthread_mutex_t backlog_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t backlog_cond = PTHREAD_COND_INITIALIZER;
+static struct list_head backlog[TASK_PRIORITY_ROOF] = {
+	[TASK_PRIORITY_REKEY] = INIT_LIST_HEAD(&backlog[TASK_PRIORITY_REKEY], &backlog_info),
+	[TASK_PRIORITY_AUTHENTICATED] = INIT_LIST_HEAD(&backlog[TASK_PRIORITY_AUTHENTICATED], &backlog_info),
+	[TASK_PRIORITY_HALF_OPEN] = INIT_LIST_HEAD(&backlog[TASK_PRIORITY_HALF_OPEN], &backlog_info),
+};
+static unsigned backlog_len[TASK_PRIORITY_ROOF];
+static uintmax_t backlog_overflows = 0;
 
-struct list_head backlog = INIT_LIST_HEAD(&backlog, &backlog_info);
-static int backlog_queue_len = 0;
+/*
+ * Per-helper job queue.
+ *
+ * A bounded lock-free queue (D. Vyukov's MPMC array queue).  The
+ * main thread is the only producer; the owning helper and any idle
+ * helper looking to steal work are the consumers.
+ *
+ * Each cell's SEQUENCE says who owns it: when it equals the enqueue
+ * position the cell is free for the producer; when it equals the
+ * dequeue position + 1 the cell holds a job for a consumer.
+ */
 
-static void message_helpers(struct job *job)
+#define HELPER_QUEUE_SIZE 256	/* power of two */
+
+struct helper_queue {
+	size_t enqueue_pos;
+	size_t dequeue_pos;
+	struct {
+		size_t sequence;
+		struct job *job;
+	} cell[HELPER_QUEUE_SIZE];
+};
+
+static void init_helper_queue(struct helper_queue *q)
 {
-	pthread_mutex_lock(&backlog_mutex);
-	if (job != NULL) {
-		insert_list_entry(&backlog, &job->backlog);
-		backlog_queue_len++;
+	for (size_t i = 0; i < HELPER_QUEUE_SIZE; i++) {
+		q->cell[i].sequence = i;
+		q->cell[i].job = NULL;
 	}
-	/* wake up threads waiting for work */
-	pthread_cond_signal(&backlog_cond);
-	pthread_mutex_unlock(&backlog_mutex);
+	q->enqueue_pos = 0;
+	q->dequeue_pos = 0;
+}
+
+static bool helper_queue_push(struct helper_queue *q, struct job *job)
+{
+	size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	while (true) {
+		typeof(q->cell[0]) *cell = &q->cell[pos % HELPER_QUEUE_SIZE];
+		size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1,
+							/*weak*/true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				cell->job = job;
+				__atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+			/* POS was updated */
+		} else if (diff < 0) {
+			/* full */
+			return false;
+		} else {
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static struct job *helper_queue_pop(struct helper_queue *q)
+{
+	size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	while (true) {
+		typeof(q->cell[0]) *cell = &q->cell[pos % HELPER_QUEUE_SIZE];
+		size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1,
+							/*weak*/true,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				struct job *job = cell->job;
+				__atomic_store_n(&cell->sequence, pos + HELPER_QUEUE_SIZE,
+						 __ATOMIC_RELEASE);
+				return job;
+			}
+			/* POS was updated */
+		} else if (diff < 0) {
+			/* empty */
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static size_t helper_queue_depth(struct helper_queue *q)
+{
+	/* racy; good enough for status */
+	size_t tail = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	size_t head = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	return (head > tail ? head - tail : 0);
 }
 
 /*
- * Note: this per-helper struct is never modified in a helper thread
+ * Per-helper state.
+ *
+ * Apart from .queue, .sleeping and the counters, this struct is
+ * never modified in a helper thread.
+ *
+ * A helper with nothing to do sets .sleeping, checks all the queues
+ * one last time, and then waits on .cond.  The main thread, after
+ * pushing a job, checks .sleeping and only then takes .mutex to wake
+ * the helper.  The full barriers on both sides ensure that either
+ * the helper sees the job or the main thread sees .sleeping.
  */
 
 struct helper_thread {
 	struct logger *logger;
 	helper_id_t helper_id;
 	pthread_t pid;
+	bool running;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool sleeping;
+	uintmax_t jobs;
+	uintmax_t steals;
+	unsigned picks;		/* only used by the helper */
+	struct helper_queue queue[TASK_PRIORITY_ROOF];
 };
 
 /* may be NULL if we are to do all the work ourselves */
 
 static struct helper_thread *helper_threads = NULL;
+static unsigned nr_helper_threads = 0;	/* size of helper_threads[] */
 static unsigned helper_threads_started = 0;
 static unsigned helper_threads_stopped = 0;
 
@@ -178,6 +296,235 @@ unsigned server_nhelpers(void)
 	return (helper_threads_started - helper_threads_stopped);
 }
 
+static void wake_helper(struct helper_thread *w)
+{
+	/* pairs with the barrier in helper_thread() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&w->mutex);
+		__atomic_store_n(&w->sleeping, false, __ATOMIC_RELAXED);
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+	}
+}
+
+static void wake_all_helpers(void)
+{
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
+		struct helper_thread *w = &helper_threads[h];
+		pthread_mutex_lock(&w->mutex);
+		__atomic_store_n(&w->sleeping, false, __ATOMIC_RELAXED);
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+	}
+}
+
+/*
+ * Hand JOB to a helper, preferring one that is asleep, and otherwise
+ * round-robin.  Busy helpers steal from each other so the choice
+ * isn't critical.
+ */
+
+static bool push_job(struct job *job)
+{
+	passert(in_main_thread());
+	static unsigned next = 0;
+	unsigned first = next;
+	for (unsigned i = 0; i < nr_helper_threads; i++) {
+		unsigned h = (next + i) % nr_helper_threads;
+		struct helper_thread *w = &helper_threads[h];
+		if (w->running &&
+		    __atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
+			first = h;
+			break;
+		}
+	}
+	for (unsigned i = 0; i < nr_helper_threads; i++) {
+		unsigned h = (first + i) % nr_helper_threads;
+		struct helper_thread *w = &helper_threads[h];
+		if (w->running && helper_queue_push(&w->queue[job->priority], job)) {
+			next = (h + 1) % nr_helper_threads;
+			wake_helper(w);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void feed_helpers(void)
+{
+	for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+		struct job *job = NULL;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(job, &backlog[p]) {
+			if (!push_job(job)) {
+				break;
+			}
+			remove_list_entry(&job->backlog);
+			backlog_len[p]--;
+		}
+	}
+}
+
+static void message_helpers(struct job *job)
+{
+	/* keep each class FIFO */
+	if (backlog_len[job->priority] == 0 && push_job(job)) {
+		return;
+	}
+	insert_list_entry(&backlog[job->priority], &job->backlog);
+	backlog_len[job->priority]++;
+	backlog_overflows++;
+	feed_helpers();
+}
+
+/*
+ * Completed jobs are pushed onto this stack by the helpers.  The
+ * helper that finds the stack empty schedules helper_answers_callback()
+ * which, on the main thread, takes everything in one go.  Hence a
+ * burst of answers costs one trip through the event loop, not one
+ * per job.
+ */
+
+static struct job *helper_answers = NULL;
+static uintmax_t helper_answer_batches = 0;
+static uintmax_t helper_answer_jobs = 0;
+
+static void send_answer(struct job *job)
+{
+	struct job *head = __atomic_load_n(&helper_answers, __ATOMIC_RELAXED);
+	do {
+		job->next_answer = head;
+	} while (!__atomic_compare_exchange_n(&helper_answers, &head, job,
+					      /*weak*/true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+	if (head == NULL) {
+		schedule_callback("helper answers", deltatime(0), SOS_NOBODY,
+				  helper_answers_callback, NULL);
+	}
+}
+
+static struct job *take_answers(void)
+{
+	struct job *stack = __atomic_exchange_n(&helper_answers, NULL, __ATOMIC_ACQUIRE);
+	/* reverse, so oldest first */
+	struct job *answers = NULL;
+	while (stack != NULL) {
+		struct job *job = stack;
+		stack = job->next_answer;
+		job->next_answer = answers;
+		answers = job;
+	}
+	return answers;
+}
+
+static void helper_answers_callback(const char *story UNUSED,
+				    struct state *st UNUSED,
+				    void *context UNUSED)
+{
+	struct logger *logger = &global_logger;
+	struct job *answers = take_answers();
+	if (answers == NULL) {
+		return;
+	}
+	helper_answer_batches++;
+	while (answers != NULL) {
+		struct job *job = answers;
+		answers = job->next_answer;
+		job->next_answer = NULL;
+		helper_answer_jobs++;
+		resume_now("sending job back to main thread",
+			   job->callback_so, &job->md/*stolen*/,
+			   handle_helper_answer, job, logger);
+	}
+	/* answers free up queue space */
+	feed_helpers();
+}
+
+/*
+ * Per-class latency, from submit_task() through to the answer being
+ * processed by the main thread.  Main thread only.
+ */
+
+static const struct {
+	intmax_t below_ms;
+	const char *name;
+} task_latency_buckets[] = {
+	{ 1, "0", },
+	{ 10, "1-9", },
+	{ 100, "10-99", },
+	{ 1000, "100-999", },
+	{ INTMAX_MAX, "1000+", },
+};
+
+#define TASK_LATENCY_ROOF elemsof(task_latency_buckets)
+
+static struct {
+	uintmax_t jobs;
+	uintmax_t latency[TASK_LATENCY_ROOF];
+} task_stats[TASK_PRIORITY_ROOF];
+
+static void count_task_latency(const struct job *job)
+{
+	intmax_t ms = milliseconds_from_deltatime(monotime_diff(mononow(), job->submitted));
+	for (unsigned b = 0; b < TASK_LATENCY_ROOF; b++) {
+		if (ms < task_latency_buckets[b].below_ms) {
+			task_stats[job->priority].latency[b]++;
+			break;
+		}
+	}
+}
+
+void show_server_helpers(struct show *s)
+{
+	unsigned backlog_total = 0;
+	for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+		backlog_total += backlog_len[p];
+	}
+	show(s, "current.helpers.threads=%u", server_nhelpers());
+	show(s, "current.helpers.backlog=%u", backlog_total);
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
+		struct helper_thread *w = &helper_threads[h];
+		size_t depth = 0;
+		for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+			depth += helper_queue_depth(&w->queue[p]);
+		}
+		show(s, "current.helper.%u.queue=%zu", w->helper_id, depth);
+	}
+	show(s, "total.helpers.backlog=%ju", backlog_overflows);
+	show(s, "total.helpers.answers.batches=%ju", helper_answer_batches);
+	show(s, "total.helpers.answers.jobs=%ju", helper_answer_jobs);
+	for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+		show(s, "total.helpers.%s.jobs=%ju",
+		     task_priority_name[p], task_stats[p].jobs);
+		for (unsigned b = 0; b < TASK_LATENCY_ROOF; b++) {
+			show(s, "total.helpers.%s.latency.ms.%s=%ju",
+			     task_priority_name[p], task_latency_buckets[b].name,
+			     task_stats[p].latency[b]);
+		}
+	}
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
+		struct helper_thread *w = &helper_threads[h];
+		show(s, "total.helper.%u.jobs=%ju",
+		     w->helper_id, __atomic_load_n(&w->jobs, __ATOMIC_RELAXED));
+		show(s, "total.helper.%u.steals=%ju",
+		     w->helper_id, __atomic_load_n(&w->steals, __ATOMIC_RELAXED));
+	}
+}
+
+void clear_server_helper_stats(void)
+{
+	backlog_overflows = 0;
+	helper_answer_batches = 0;
+	helper_answer_jobs = 0;
+	zero(&task_stats);
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
+		struct helper_thread *w = &helper_threads[h];
+		__atomic_store_n(&w->jobs, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&w->steals, 0, __ATOMIC_RELAXED);
+	}
+}
+
 /*
  * If there are any helper threads, this code is always executed IN A HELPER
  * THREAD. Otherwise it is executed in the main (only) thread.
@@ -196,15 +543,65 @@ static void do_job(struct job *job, helper_id_t helper_id)
 	}
 
 	job->time_used = logtime_stop(&start, PRI_JOB, pri_job(job));
-	schedule_resume("sending job back to main thread",
-			job->callback_so, &job->md/*stolen*/,
-			handle_helper_answer, job);
+}
+
+/*
+ * Find the next job: first from this helper's queue, and then by
+ * stealing from the other helpers.
+ */
+
+static struct job *next_job_by_priority(struct helper_thread *w,
+					enum task_priority p)
+{
+	struct job *job = helper_queue_pop(&w->queue[p]);
+	if (job != NULL) {
+		return job;
+	}
+	unsigned me = w - helper_threads;
+	for (unsigned i = 1; i < nr_helper_threads; i++) {
+		struct helper_thread *victim = &helper_threads[(me + i) % nr_helper_threads];
+		job = helper_queue_pop(&victim->queue[p]);
+		if (job != NULL) {
+			__atomic_fetch_add(&w->steals, 1, __ATOMIC_RELAXED);
+			return job;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Highest priority first, except that, to stop a flood of (say) new
+ * IKE_SA_INIT requests starving everything else or vice versa, every
+ * 4th pick starts with the authenticated class and every 16th with
+ * the half-open class.
+ */
+
+static struct job *next_job(struct helper_thread *w)
+{
+	unsigned pick = w->picks++;
+	enum task_priority first = (pick % 16 == 15 ? TASK_PRIORITY_HALF_OPEN :
+				    pick % 4 == 3 ? TASK_PRIORITY_AUTHENTICATED :
+				    TASK_PRIORITY_REKEY);
+	struct job *job = next_job_by_priority(w, first);
+	if (job != NULL) {
+		return job;
+	}
+	for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+		if (p == first) {
+			continue;
+		}
+		job = next_job_by_priority(w, p);
+		if (job != NULL) {
+			return job;
+		}
+	}
+	return NULL;
 }
 
 /* IN A HELPER THREAD */
 static void *helper_thread(void *arg)
 {
-	const struct helper_thread *w = arg;
+	struct helper_thread *w = arg;
 	ldbg(w->logger, "starting thread");
 
 #ifdef USE_SECCOMP
@@ -219,49 +616,36 @@ static void *helper_thread(void *arg)
 	ldbg(w->logger, "status value returned by setting the priority of this thread: %d", status);
 #endif
 
-	while (true) {
-		struct job *job = NULL;
-		pthread_mutex_lock(&backlog_mutex);
-		{
+	while (!exiting_pluto) {
+		struct job *job = next_job(w);
+		if (job == NULL) {
 			/*
-			 * Search the backlog[] for something to do.
-			 * If needed wait.
+			 * Nothing to do; announce that this thread
+			 * is going to sleep, check once more, and
+			 * then wait.  See wake_helper().
 			 */
-			pexpect(job == NULL);
-			while (!exiting_pluto) {
-				/* grab the next entry, if there is one */
-				pexpect(job == NULL);
-				FOR_EACH_LIST_ENTRY_OLD2NEW(job, &backlog) { break; }
-				if (job != NULL) {
-					/*
-					 * Assign the entry to this
-					 * thread, removing it from
-					 * the backlog.
-					 *
-					 * XXX: logged when job
-					 * started.
-					 */
-					remove_list_entry(&job->backlog);
-					job->helper_id = w->helper_id;
-					break;
-				}
+			pthread_mutex_lock(&w->mutex);
+			__atomic_store_n(&w->sleeping, true, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			job = next_job(w);
+			while (job == NULL && !exiting_pluto &&
+			       __atomic_load_n(&w->sleeping, __ATOMIC_RELAXED)) {
 				dbg("helper %u: waiting for work", w->helper_id);
-				pthread_cond_wait(&backlog_cond, &backlog_mutex);
+				pthread_cond_wait(&w->cond, &w->mutex);
 			}
+			__atomic_store_n(&w->sleeping, false, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&w->mutex);
 			if (job == NULL) {
-				/*
-				 * No JOB implies pluto is exiting but
-				 * not reverse - could grab a JOB in
-				 * parallel to pluto starting to exit.
-				 */
-				pexpect(exiting_pluto);
+				/* woken; try again (or exit) */
+				continue;
 			}
 		}
-		pthread_mutex_unlock(&backlog_mutex);
-		if (job == NULL) {
-			/* per above, must be shutting down */
-			break;
-		}
+		/*
+		 * Assign the entry to this thread.
+		 *
+		 * XXX: logged when job started.
+		 */
+		job->helper_id = w->helper_id;
 		/* might be cancelled */
 		if (impair.helper_thread_delay.enabled) {
 			llog(RC_LOG, job->logger,
@@ -270,6 +654,8 @@ static void *helper_thread(void *arg)
 			sleep(impair.helper_thread_delay.value);
 		}
 		do_job(job, w->helper_id);
+		__atomic_fetch_add(&w->jobs, 1, __ATOMIC_RELAXED);
+		send_answer(job);
 	}
 
 	dbg("helper %u: telling main thread that it is exiting", w->helper_id);
@@ -291,6 +677,9 @@ static void inline_worker(const char *story UNUSED, struct state *unused_st UNUS
 	struct job *job = arg;
 	/* might be cancelled */
 	do_job(job, -1);
+	schedule_resume("sending job back to main thread",
+			job->callback_so, &job->md/*stolen*/,
+			handle_helper_answer, job);
 }
 
 /*
@@ -329,6 +718,29 @@ static void inline_worker(const char *story UNUSED, struct state *unused_st UNUS
  *
  */
 
+/*
+ * Work out the task's class from the state it is for.  A state
+ * cloned from an established IKE SA and replacing something is a
+ * rekey; anything else under an established IKE SA is for an
+ * authenticated peer; and the rest is a new negotiation.
+ */
+
+static enum task_priority task_priority(struct state *callback_sa,
+					struct state *task_sa)
+{
+	struct state *parent = (IS_PARENT_SA(callback_sa) ? callback_sa :
+				state_by_serialno(callback_sa->st_clonedfrom));
+	if (parent == NULL || !IS_PARENT_SA_ESTABLISHED(parent)) {
+		return TASK_PRIORITY_HALF_OPEN;
+	}
+	if (task_sa->st_v2_rekey_pred != SOS_NOBODY ||
+	    task_sa->st_v2_ike_pred != SOS_NOBODY ||
+	    task_sa->st_v1_ipsec_pred != SOS_NOBODY) {
+		return TASK_PRIORITY_REKEY;
+	}
+	return TASK_PRIORITY_AUTHENTICATED;
+}
+
 void submit_task(struct state *callback_sa,
 		 struct state *task_sa,
 		 struct msg_digest *md,
@@ -363,6 +775,9 @@ void submit_task(struct state *callback_sa,
 
 	job->handler = handler;
 	job->task = task;
+	job->priority = task_priority(callback_sa, task_sa);
+	job->submitted = mononow();
+	task_stats[job->priority].jobs++;
 
 	/*
 	 * Save in case it needs to be cancelled.
@@ -473,6 +888,7 @@ static stf_status handle_helper_answer(struct state *callback_sa,
 	struct job *job = arg;
 	passert(job->handler != NULL);
 	struct state *task_sa = state_by_serialno(job->task_so);
+	count_task_latency(job);
 
 	/*
 	 * call the continuation (skip if suppressed)
@@ -521,6 +937,7 @@ void start_server_helpers(uintmax_t nhelpers, struct logger *logger)
 {
 	/* redundant */
 	helper_threads = NULL;
+	nr_helper_threads = 0;
 	helper_threads_started = 0;
 	helper_threads_stopped = 0;
 
@@ -570,9 +987,22 @@ void start_server_helpers(uintmax_t nhelpers, struct logger *logger)
 			struct helper_thread *w = &helper_threads[n];
 			w->helper_id = n + 1; /* i.e., not 0 */
 			w->logger = string_logger(HERE, "helper(%d)", w->helper_id);
+			pthread_mutex_init(&w->mutex, NULL);
+			pthread_cond_init(&w->cond, NULL);
+			for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+				init_helper_queue(&w->queue[p]);
+			}
+		}
+		/* before any thread starts looking for work to steal */
+		nr_helper_threads = nhelpers;
+		for (unsigned n = 0; n < nhelpers; n++) {
+			struct helper_thread *w = &helper_threads[n];
+			/* set before the thread can see it */
+			w->running = true;
 			int thread_status = pthread_create(&w->pid, NULL,
 							   helper_thread, (void *)w);
 			if (thread_status != 0) {
+				w->running = false;
 				llog(RC_LOG, logger,
 					    "failed to start child thread for helper %d, error = %d",
 					    n, thread_status);
@@ -608,18 +1038,29 @@ static void helper_thread_stopped_callback(const char *story UNUSED,
 	/* wait for more? */
 	if (helper_threads_started > helper_threads_stopped) {
 		/* poke threads waiting for work */
-		message_helpers(NULL);
+		wake_all_helpers();
 		return;
 	}
 
 	/* all done; cleanup */
-	for (unsigned h = 0; h < helper_threads_started; h++) {
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
 		struct helper_thread *w = &helper_threads[h];
+		/* return unclaimed jobs to the backlog */
+		for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+			struct job *job;
+			while ((job = helper_queue_pop(&w->queue[p])) != NULL) {
+				insert_list_entry(&backlog[p], &job->backlog);
+				backlog_len[p]++;
+			}
+		}
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->mutex);
 		free_logger(&w->logger, HERE);
 	}
 
 	pfreeany(helper_threads);
 	helper_threads = NULL;
+	nr_helper_threads = 0;
 	server_helpers_stopped_callback();
 }
 
@@ -635,7 +1076,7 @@ void stop_server_helpers(void (*server_helpers_stopped_cb)(void))
 	server_helpers_stopped_callback = server_helpers_stopped_cb;
 	if (helper_threads_started > 0) {
 		/* poke threads waiting for work */
-		message_helpers(NULL);
+		wake_all_helpers();
 	} else {
 		/*
 		 * Always finish things using a callback so this call stack
@@ -653,8 +1094,18 @@ void free_server_helper_jobs(struct logger *logger)
 	if (helper_threads_started == helper_threads_stopped) {
 		passert(helper_threads == NULL);
 		struct job *job = NULL;
-		FOR_EACH_LIST_ENTRY_OLD2NEW(job, &backlog) {
-			remove_list_entry(&job->backlog);
+		for (enum task_priority p = 0; p < TASK_PRIORITY_ROOF; p++) {
+			FOR_EACH_LIST_ENTRY_OLD2NEW(job, &backlog[p]) {
+				remove_list_entry(&job->backlog);
+				backlog_len[p]--;
+				free_job(&job);
+			}
+		}
+		/* answers that never made it back */
+		struct job *answers = take_answers();
+		while (answers != NULL) {
+			job = answers;
+			answers = job->next_answer;
 			free_job(&job);
 		}
 	} else {
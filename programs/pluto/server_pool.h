@@ -40,6 +40,7 @@
 struct state;
 struct msg_digest;
 struct logger;
+struct show;
 
 struct task; /*struct job*/
 
@@ -53,6 +54,24 @@ typedef stf_status task_completed_cb(struct state *st,
 /* always called */
 typedef void task_cleanup_cb(struct task **task);
 
+/*
+ * Helper tasks are queued by priority class.  Helpers normally take
+ * the highest class with work; starvation protection ensures the
+ * lower classes still get a share of the helpers when the higher
+ * classes are flooded.
+ *
+ * The class is derived from the sponsoring state when the task is
+ * submitted (the same handler, for instance "dh", is used by both
+ * new and rekey exchanges).
+ */
+
+enum task_priority {
+	TASK_PRIORITY_REKEY,		/* replacing an established SA */
+	TASK_PRIORITY_AUTHENTICATED,	/* for an established IKE SA */
+	TASK_PRIORITY_HALF_OPEN,	/* new negotiation */
+#define TASK_PRIORITY_ROOF (TASK_PRIORITY_HALF_OPEN+1)
+};
+
 struct task_handler {
 	const char *name;
 	task_computer_fn *computer_fn;
@@ -72,5 +91,7 @@ void start_server_helpers(uintmax_t nhelpers, struct logger *logger);
 void stop_server_helpers(void (*all_server_helpers_stopped)(void));
 void free_server_helper_jobs(struct logger *logger);
 unsigned server_nhelpers(void);
+void show_server_helpers(struct show *s);
+void clear_server_helper_stats(void);
 
 #endif
@@ -30,6 +30,13 @@ struct logger;
 
 struct show *alloc_show(struct logger *logger);
 void free_show(struct show **s);
+
+/*
+ * Long listings (every connection, every state) are shown this many
+ * items at a time, yielding to the event-loop in between; see
+ * whack_status.c.
+ */
+#define SHOW_SLICE 100
 /* underlying global logger formed by alloc_show() */
 struct logger *show_logger(struct show *s);
 
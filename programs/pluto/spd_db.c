@@ -17,6 +17,7 @@
 #include "log.h"
 #include "hash_table.h"
 #include "connections.h"
+#include "ip_info.h"
 
 /*
  * SPD_ROUTE database.
@@ -38,9 +39,140 @@ static hash_t hash_spd_remote_client(const ip_selector *sr)
 
 HASH_TABLE(spd, remote_client, .remote->client, STATE_TABLE_SIZE);
 
-HASH_DB(spd, &spd_remote_client_hash_table);
+/*
+ * Remote client prefix table.
+ *
+ * Each SPD is hashed by the longest prefix covering its remote
+ * client (for a CIDR selector that is the subnet itself).  A longest
+ * prefix match then probes one bucket per prefix length, host first,
+ * instead of walking every SPD.
+ */
+
+static unsigned covering_prefix_len(const struct ip_info *afi,
+				    const struct ip_bytes lo,
+				    const struct ip_bytes hi)
+{
+	unsigned prefix_len = 0;
+	for (unsigned i = 0; i < afi->ip_size; i++) {
+		uint8_t diff = lo.byte[i] ^ hi.byte[i];
+		if (diff != 0) {
+			while ((diff & 0x80) == 0) {
+				diff <<= 1;
+				prefix_len++;
+			}
+			return prefix_len;
+		}
+		prefix_len += 8;
+	}
+	return prefix_len;
+}
+
+static hash_t hash_prefix(const struct ip_info *afi, struct ip_bytes bytes,
+			  unsigned prefix_len)
+{
+	struct ip_bytes prefix = ip_bytes_blit(afi, bytes,
+					       &keep_routing_prefix,
+					       &clear_host_identifier,
+					       prefix_len);
+	hash_t hash = hash_thing(afi->ip.version, zero_hash);
+	hash = hash_thing(prefix_len, hash);
+	return hash_hunk(shunk2(prefix.byte, afi->ip_size), hash);
+}
+
+static hash_t hash_spd_remote_prefix(const ip_selector *client)
+{
+	const struct ip_info *afi = selector_info(*client);
+	if (afi == NULL) {
+		return zero_hash;
+	}
+	return hash_prefix(afi, client->lo,
+			   covering_prefix_len(afi, client->lo, client->hi));
+}
+
+HASH_TABLE(spd, remote_prefix, .remote->client, STATE_TABLE_SIZE);
 
-REHASH_DB_ENTRY(spd, remote_client, .remote->client);
+HASH_DB(spd,
+	&spd_remote_client_hash_table,
+	&spd_remote_prefix_hash_table);
+
+/*
+ * Both tables are keyed by the remote client.  An SPD that has yet
+ * to be added is left alone.
+ */
+
+void spd_db_rehash_remote_client(struct spd *sr)
+{
+	if (detached_list_entry(&sr->spd_db_entries.list)) {
+		return;
+	}
+	FOR_EACH_THING(table, &spd_remote_client_hash_table, &spd_remote_prefix_hash_table) {
+		del_hash_table_entry(table, sr);
+		add_hash_table_entry(table, sr);
+	}
+}
+
+static int connection_candidate_cmp(const void *l, const void *r)
+{
+	const struct connection *lc = *(const struct connection *const *)l;
+	const struct connection *rc = *(const struct connection *const *)r;
+	connection_priority_t lp = connection_priority(lc);
+	connection_priority_t rp = connection_priority(rc);
+	/* highest priority, then newest, first */
+	return (lp > rp ? -1 : lp < rp ? 1 :
+		lc->serialno > rc->serialno ? -1 :
+		lc->serialno < rc->serialno ? 1 : 0);
+}
+
+struct connection **connections_by_remote_endpoint(const ip_endpoint dst,
+						   struct verbose verbose)
+{
+	const struct ip_info *afi = endpoint_info(dst);
+	if (afi == NULL) {
+		return NULL;
+	}
+	const ip_address address = endpoint_address(dst);
+
+	unsigned nr = 0;
+	unsigned size = 0;
+	struct connection **candidates = NULL;
+
+	for (int prefix_len = afi->mask_cnt; prefix_len >= 0; prefix_len--) {
+		hash_t hash = hash_prefix(afi, address.bytes, prefix_len);
+		struct list_head *bucket = hash_table_bucket(&spd_remote_prefix_hash_table, hash);
+		struct spd *spd;
+		FOR_EACH_LIST_ENTRY_NEW2OLD(spd, bucket) {
+			const ip_selector *client = &spd->remote->client;
+			/* buckets are shared; skip other prefixes */
+			if (selector_info(*client) != afi ||
+			    covering_prefix_len(afi, client->lo, client->hi) != (unsigned)prefix_len ||
+			    !endpoint_in_selector(dst, *client)) {
+				continue;
+			}
+			if (nr + 1 >= size) {
+				size = (size == 0 ? 8 : size * 2);
+				realloc_things(candidates, nr, size, "candidates");
+			}
+			candidates[nr++] = spd->connection;
+		}
+	}
+
+	if (nr == 0) {
+		vdbg("no SPD remote client contains the endpoint");
+		return NULL;
+	}
+
+	/* order, then squeeze out connections with several SPDs */
+	qsort(candidates, nr, sizeof(candidates[0]), connection_candidate_cmp);
+	unsigned n = 0;
+	for (unsigned i = 0; i < nr; i++) {
+		if (n == 0 || candidates[n - 1] != candidates[i]) {
+			candidates[n++] = candidates[i];
+		}
+	}
+	candidates[n] = NULL;
+	vdbg("%u SPDs, %u candidate connections", nr, n);
+	return candidates;
+}
 
 static struct list_head *spd_filter_head(struct spd_filter *filter)
 {
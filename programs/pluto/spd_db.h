@@ -17,9 +17,12 @@
 #define SPD_DB_H
 
 #include "where.h"
+#include "ip_endpoint.h"
+#include "verbose.h"
 
 struct spd;
 struct logger;
+struct connection;
 
 /* spd route */
 
@@ -32,6 +35,14 @@ void spd_db_check_spd(struct spd *sr, struct logger *logger, where_t where);
 void spd_db_add(struct spd *sr);
 void spd_db_del(struct spd *sr);
 
+/*
+ * Connections with an SPD whose remote client contains DST, highest
+ * connection_priority() (then newest) first; NULL terminated, or
+ * NULL when there are none.  Caller frees the array.
+ */
+struct connection **connections_by_remote_endpoint(const ip_endpoint dst,
+						   struct verbose verbose);
+
 #if 0
 void spd_db_rehash_remote_client(struct spd *sr); /* see connections.h */
 #endif
@@ -45,6 +45,7 @@
 #include "log.h"
 #include "rnd.h"
 #include "demux.h"	/* needs packet.h */
+#include "ikev2_message.h"	/* for release_v2_held_messages() */
 #include "pending.h"
 #include "ipsec_doi.h"	/* needs demux.h and state.h */
 #include "crypt_symkey.h"
@@ -966,6 +967,9 @@ void delete_state(struct state *st)
 	/* session resumption */
 	pfreeany(st->st_v2_resume_session);
 
+	/* drop any IKEv2 messages held during a decrypt */
+	release_v2_held_messages(st, /*replay*/false);
+
 	/* if there's an IKEv1 background md, release it */
 	if (st->st_v1_background_md != NULL) {
 		ldbg(st->logger, "releasing IKEv1 MD received during background task");
@@ -1377,6 +1381,7 @@ struct v2_spi_filter {
 	ipsec_spi_t outbound_spi;
 	ipsec_spi_t inbound_spi;
 	ip_address *dst;
+	const struct ike_sa *ike;	/* optional */
 };
 
 static bool v2_spi_predicate(struct state *st, void *context)
@@ -1384,6 +1389,11 @@ static bool v2_spi_predicate(struct state *st, void *context)
 	struct v2_spi_filter *filter = context;
 	bool ret = false;
 
+	if (filter->ike != NULL &&
+	    st->st_clonedfrom != filter->ike->sa.st_serialno) {
+		return false;
+	}
+
 	struct ipsec_proto_info *pr;
 	switch (filter->protoid) {
 	case PROTO_IPSEC_AH:
@@ -1445,19 +1455,18 @@ struct child_sa *find_v2_child_sa_by_spi(ipsec_spi_t spi, int8_t protoid,
 		.inbound_spi = spi,
 		.dst = &dst,
 	};
-	struct state_filter sf = {
-		.search = {
-			.order = NEW2OLD,
-			.verbose.logger = &global_logger,
-			.where = HERE,
-		},
-	};
-	while (next_state(&sf)) {
-		struct state *st = sf.st;
-		if (v2_spi_predicate(st, &filter))
-			break;
-	};
-	return pexpect_child_sa(sf.st);
+	/*
+	 * The SPI can match either direction; as with the old
+	 * NEW2OLD walk of all states, the newer state wins.
+	 */
+	struct state *out = state_by_ipsec_spi(protoid, DIRECTION_OUTBOUND, spi,
+					       v2_spi_predicate, &filter, __func__);
+	struct state *in = state_by_ipsec_spi(protoid, DIRECTION_INBOUND, spi,
+					      v2_spi_predicate, &filter, __func__);
+	struct state *st = (out == NULL ? in :
+			    in == NULL ? out :
+			    in->st_serialno > out->st_serialno ? in : out);
+	return pexpect_child_sa(st);
 }
 
 struct child_sa *find_v2_child_sa_by_outbound_spi(struct ike_sa *ike,
@@ -1467,13 +1476,11 @@ struct child_sa *find_v2_child_sa_by_outbound_spi(struct ike_sa *ike,
 	struct v2_spi_filter filter = {
 		.protoid = protoid,
 		.outbound_spi = outbound_spi,
+		.ike = ike,
 	};
-	struct state *st = state_by_ike_spis(IKEv2,
-					     &ike->sa.st_serialno,
-					     NULL /* ignore v1 msgid */,
-					     NULL /* ignore-role */,
-					     &ike->sa.st_ike_spis,
-					     v2_spi_predicate, &filter, __func__);
+	struct state *st = state_by_ipsec_spi(protoid, DIRECTION_OUTBOUND,
+					      outbound_spi,
+					      v2_spi_predicate, &filter, __func__);
 	return pexpect_child_sa(st);
 }
 
@@ -1484,6 +1491,7 @@ struct ike_sa *find_ike_sa_by_connection(const struct connection *c,
 	struct ike_sa *best = NULL;
 
 	struct state_filter sf = {
+		.ike_peer = &c->remote->host.first_addr,
 		.search = {
 			.order = NEW2OLD,
 			.verbose.logger = &global_logger,
@@ -1492,9 +1500,6 @@ struct ike_sa *find_ike_sa_by_connection(const struct connection *c,
 	};
 	while (next_state(&sf)) {
 		struct state *st = sf.st;
-		if (!IS_PARENT_SA(st)) {
-			continue;
-		}
 		if (!connections_can_share_parent(c, st->st_connection)) {
 			continue;
 		}
@@ -1522,6 +1527,8 @@ struct ike_sa *find_ike_sa_by_connection(const struct connection *c,
 		best = pexpect_ike_sa(st);
 	}
 
+	pstats_ike_parent_lookups++;
+	pstats_ike_parent_visited += sf.visited;
 	return best;
 }
 
@@ -1544,6 +1551,7 @@ struct ike_sa *find_viable_parent_for_connection(const struct connection *c)
 	struct ike_sa *best = NULL;
 
 	struct state_filter sf = {
+		.ike_peer = &c->remote->host.first_addr,
 		.search = {
 			.order = NEW2OLD,
 			.verbose.logger = &global_logger,
@@ -1552,9 +1560,6 @@ struct ike_sa *find_viable_parent_for_connection(const struct connection *c)
 	};
 	while (next_state(&sf)) {
 		struct state *st = sf.st;
-		if (!IS_PARENT_SA(st)) {
-			continue;
-		}
 		if (!connections_can_share_parent(c, st->st_connection)) {
 			continue;
 		}
@@ -1592,6 +1597,8 @@ struct ike_sa *find_viable_parent_for_connection(const struct connection *c)
 		best = pexpect_ike_sa(st);
 	}
 
+	pstats_ike_parent_lookups++;
+	pstats_ike_parent_visited += sf.visited;
 	return best;
 }
 
@@ -1628,6 +1635,12 @@ void whack_briefstatus(const struct whack_message *wm UNUSED, struct show *s)
 		  cat_count_child_sa[CAT_ANONYMOUS]);
 }
 
+static bool same_remote_address_predicate(struct state *st, void *context)
+{
+	const ip_address *remote = context;
+	return sameaddr(&st->st_connection->remote->host.addr, remote);
+}
+
 /*
  * Muck with high-order 16 bits of this SPI in order to make
  * the corresponding SAID unique.
@@ -1649,24 +1662,13 @@ ipsec_spi_t uniquify_peer_cpi(ipsec_spi_t cpi, const struct state *st, int tries
 	 * Make sure that the result is unique.
 	 * Hard work.  If there is no unique value, we'll loop forever!
 	 */
-	struct state_filter sf = {
-		.search = {
-			.order = NEW2OLD,
-			.verbose.logger = &global_logger,
-			.where = HERE,
-		},
-	};
-	while (next_state(&sf)) {
-		struct state *s = sf.st;
-		if (s->st_ipcomp.protocol == &ip_protocol_ipcomp &&
-		    sameaddr(&s->st_connection->remote->host.addr,
-			     &st->st_connection->remote->host.addr) &&
-		    cpi == s->st_ipcomp.outbound.spi)
-		{
-			if (++tries == 20)
-				return 0; /* FAILURE */
-			return uniquify_peer_cpi(cpi, st, tries);
-		}
+	ip_address remote = st->st_connection->remote->host.addr;
+	if (state_by_ipsec_spi(PROTO_IPCOMP, DIRECTION_OUTBOUND, cpi,
+			       same_remote_address_predicate, &remote,
+			       __func__) != NULL) {
+		if (++tries == 20)
+			return 0; /* FAILURE */
+		return uniquify_peer_cpi(cpi, st, tries);
 	}
 	return cpi;
 }
@@ -2005,6 +2007,7 @@ void connswitch_state_and_log(struct state *st, struct connection *new)
 	/* and switch */
 	st->st_connection = connection_addref(new, st->logger);
 	state_db_rehash_connection_serialno(st);
+	state_db_rehash_ike_peer(st);
 	connection_delref(&old, st->logger);
 }
 
@@ -63,6 +63,7 @@
 #include "packet.h"
 #include "state_category.h"
 #include "terminate_reason.h"
+#include "timer.h"			/* for struct state_event */
 
 struct whack_message;
 struct v2_transition;
@@ -526,6 +527,18 @@ struct state {
 	struct job *st_offloaded_task;
 	bool st_v1_offloaded_task_in_background;
 	struct msg_digest *st_v1_background_md;	/* arrived during background task */
+	/*
+	 * IKEv2: a protected message (or its fragments) is being
+	 * decrypted by a helper; further protected messages are held
+	 * (as raw clones) until it is done and then replayed, so that
+	 * they are processed in order.
+	 */
+	bool st_v2_offloaded_decrypt;
+#define MAX_V2_HELD_MESSAGES 8
+	struct {
+		unsigned nr;
+		struct msg_digest *md[MAX_V2_HELD_MESSAGES];
+	} st_v2_held_messages;
 
 	chunk_t st_p1isa;	/* v1 Phase 1 initiator SA (Payload) for HASH */
 
@@ -579,6 +592,13 @@ struct state {
 		struct list_entry reqid;
 		struct list_entry ike_spis;
 		struct list_entry ike_initiator_spi;
+		struct list_entry ike_peer;
+		struct list_entry ah_inbound_spi;
+		struct list_entry ah_outbound_spi;
+		struct list_entry esp_inbound_spi;
+		struct list_entry esp_outbound_spi;
+		struct list_entry ipcomp_inbound_spi;
+		struct list_entry ipcomp_outbound_spi;
 	} state_db_entries;
 
 	struct pending *st_pending;
@@ -616,6 +636,9 @@ struct state {
 
 #define st_v2_lifetime_event(ST) ((ST)->st_v2_replace_event != NULL ? (ST)->st_v2_replace_event : (ST)->st_v2_expire_event)
 
+	/* what .st_events[] point at; see state_event_storage() */
+	struct state_event st_event_storage[PMAX(EVENT_v1_ROOF, EVENT_v2_ROOF)];
+
 
 	/* RFC 3706 Dead Peer Detection */
 	monotime_t st_last_dpd;			/* Time of last DPD transmit (0 means never?) */
@@ -624,6 +647,7 @@ struct state {
 	uint32_t st_dpd_peerseqno;             /* global variables */
 	uint32_t st_dpd_rdupcount;		/* openbsd isakmpd bug workaround */
 	struct state_event *st_v1_dpd_event;	/* backpointer for IKEv1 DPD events */
+	struct state_event st_v1_dpd_event_storage;
 
 	struct isakmp_quirks st_v1_quirks;	/* work arounds for faults in other products */
 	bool st_xauth_soft;                     /* XAUTH failed but policy is to soft fail */
@@ -883,6 +907,7 @@ struct state_filter {
 	const ike_spis_t *const ike_spis;	/* hashed */
 	const so_serial_t clonedfrom;
 	const co_serial_t connection_serialno;
+	const ip_address *const ike_peer;	/* hashed; IKE SAs only */
 
 	/*
 	 * Current result (can be safely deleted).
@@ -894,6 +919,7 @@ struct state_filter {
 	 */
 	struct list_entry *internal;	/* handle on next entry */
 	unsigned count;			/* total matches so far */
+	unsigned visited;		/* total entries examined so far */
 
 	/*
 	 * Required fields.
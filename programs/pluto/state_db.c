@@ -20,6 +20,7 @@
 #include "state.h"
 #include "connections.h"
 #include "hash_table.h"
+#include "kernel.h"		/* for enum direction */
 
 /*
  * Legacy search functions.
@@ -57,7 +58,7 @@ static bool state_plausable(struct state *st,
 
 static hash_t hash_state_serialno(const so_serial_t *serialno)
 {
-	return hash_thing(*serialno, zero_hash);
+	return hash_unkeyed_thing(*serialno, zero_hash);
 }
 
 HASH_TABLE(state, serialno, .st_serialno, STATE_TABLE_SIZE);
@@ -102,7 +103,7 @@ struct child_sa *child_sa_by_serialno(so_serial_t serialno)
 
 static hash_t hash_state_connection_serialno(const co_serial_t *connection_serial)
 {
-	return hash_thing(*connection_serial, zero_hash);
+	return hash_unkeyed_thing(*connection_serial, zero_hash);
 }
 
 HASH_TABLE(state, connection_serialno, .st_connection->serialno, STATE_TABLE_SIZE);
@@ -115,7 +116,7 @@ REHASH_DB_ENTRY(state, connection_serialno, .st_connection->serialno);
 
 static hash_t hash_state_reqid(const reqid_t *reqid)
 {
-	return hash_thing(*reqid, zero_hash);
+	return hash_unkeyed_thing(*reqid, zero_hash);
 }
 
 HASH_TABLE(state, reqid, .st_reqid, STATE_TABLE_SIZE);
@@ -262,13 +263,147 @@ struct state *state_by_ike_spis(enum ike_version ike_version,
 	return NULL;
 }
 
+/*
+ * Child SA (IPsec) SPI hash tables.
+ *
+ * A table for each of the inbound and outbound SPIs of AH, ESP and
+ * IPCOMP (an IKEv1 Child SA can have all three).  The protocol is
+ * implied by the table and the address, which lives in the
+ * connection, is checked by the caller's predicate.
+ *
+ * The SPIs start out as zero and are filled in as they are allocated
+ * (inbound) and negotiated (outbound); each time the tables need to
+ * be updated using state_db_rehash_ipsec_spis().  Since everything
+ * without an SPI ends up in the zero bucket, zero is never looked
+ * up.
+ */
+
+#define IPSEC_SPI_HASH_TABLE(PROTO, DIRECTION)				\
+									\
+	static hash_t hash_state_##PROTO##_##DIRECTION##_spi(const ipsec_spi_t *spi) \
+	{								\
+		return hash_thing(*spi, zero_hash);			\
+	}								\
+									\
+	HASH_TABLE(state, PROTO##_##DIRECTION##_spi,			\
+		   .st_##PROTO.DIRECTION.spi, STATE_TABLE_SIZE)
+
+IPSEC_SPI_HASH_TABLE(ah, inbound);
+IPSEC_SPI_HASH_TABLE(ah, outbound);
+IPSEC_SPI_HASH_TABLE(esp, inbound);
+IPSEC_SPI_HASH_TABLE(esp, outbound);
+IPSEC_SPI_HASH_TABLE(ipcomp, inbound);
+IPSEC_SPI_HASH_TABLE(ipcomp, outbound);
+
+static struct hash_table *const state_ipsec_spi_hash_tables[] = {
+	&state_ah_inbound_spi_hash_table,
+	&state_ah_outbound_spi_hash_table,
+	&state_esp_inbound_spi_hash_table,
+	&state_esp_outbound_spi_hash_table,
+	&state_ipcomp_inbound_spi_hash_table,
+	&state_ipcomp_outbound_spi_hash_table,
+};
+
+void state_db_rehash_ipsec_spis(struct state *st)
+{
+	FOR_EACH_ELEMENT(h, state_ipsec_spi_hash_tables) {
+		del_hash_table_entry(*h, st);
+		add_hash_table_entry(*h, st);
+	}
+}
+
+struct state *state_by_ipsec_spi(uint8_t protoid,
+				 enum direction direction,
+				 ipsec_spi_t spi,
+				 state_by_predicate *predicate /*optional*/,
+				 void *predicate_context,
+				 const char *reason)
+{
+	if (spi == 0) {
+		return NULL;
+	}
+
+	const bool inbound = (direction == DIRECTION_INBOUND);
+	struct hash_table *table;
+	size_t offset;
+	switch (protoid) {
+	case PROTO_IPSEC_AH:
+		table = (inbound ? &state_ah_inbound_spi_hash_table :
+			 &state_ah_outbound_spi_hash_table);
+		offset = offsetof(struct state, st_ah);
+		break;
+	case PROTO_IPSEC_ESP:
+		table = (inbound ? &state_esp_inbound_spi_hash_table :
+			 &state_esp_outbound_spi_hash_table);
+		offset = offsetof(struct state, st_esp);
+		break;
+	case PROTO_IPCOMP:
+		table = (inbound ? &state_ipcomp_inbound_spi_hash_table :
+			 &state_ipcomp_outbound_spi_hash_table);
+		offset = offsetof(struct state, st_ipcomp);
+		break;
+	default:
+		bad_case(protoid);
+	}
+
+	struct state *st;
+	struct list_head *bucket = hash_table_bucket(table, hash_thing(spi, zero_hash));
+	FOR_EACH_LIST_ENTRY_NEW2OLD(st, bucket) {
+		const struct ipsec_proto_info *pr =
+			(const struct ipsec_proto_info *)((const char *)st + offset);
+		if (pr->protocol == NULL) {
+			continue;
+		}
+		if ((inbound ? pr->inbound.spi : pr->outbound.spi) != spi) {
+			continue;
+		}
+		if (predicate != NULL &&
+		    !predicate(st, predicate_context)) {
+			continue;
+		}
+		dbg("State DB: found state #%lu in %s using %s SPI "PRI_IPSEC_SPI" (%s)",
+		    st->st_serialno, st->st_state->short_name,
+		    table->name, pri_ipsec_spi(spi), reason);
+		return st;
+	}
+	dbg("State DB: state not found using %s SPI "PRI_IPSEC_SPI" (%s)",
+	    table->name, pri_ipsec_spi(spi), reason);
+	return NULL;
+}
+
+/*
+ * IKE SA hash table, indexed by the peer's initial address.
+ *
+ * connections_can_share_parent() requires the same initial remote
+ * address (.first_addr which, unlike .addr, isn't changed by MOBIKE
+ * or a redirect) so a connection's candidate parents are all in the
+ * one bucket.  Child SAs are scattered using their serial number so
+ * they don't pile up in their parent's bucket.
+ */
+
+static hash_t hash_ike_peer(const ip_address *first_addr)
+{
+	return hash_hunk(address_as_shunk(first_addr), zero_hash);
+}
+
+static hash_t hash_state_ike_peer(const struct state *st)
+{
+	if (IS_CHILD_SA(st)) {
+		return hash_unkeyed_thing(st->st_serialno, zero_hash);
+	}
+	return hash_ike_peer(&st->st_connection->remote->host.first_addr);
+}
+
+HASH_TABLE(state, ike_peer, , STATE_TABLE_SIZE);
+REHASH_DB_ENTRY(state, ike_peer, );
+
 /*
  * Child hash table.
  */
 
 static hash_t hash_state_clonedfrom(const so_serial_t *clonedfrom)
 {
-	return hash_thing(*clonedfrom, zero_hash);
+	return hash_unkeyed_thing(*clonedfrom, zero_hash);
 }
 
 HASH_TABLE(state, clonedfrom, .st_clonedfrom, STATE_TABLE_SIZE);
@@ -286,12 +421,15 @@ void update_st_clonedfrom(struct state *st, so_serial_t clonedfrom)
 {
 	st->st_clonedfrom = clonedfrom;
 	state_db_rehash_clonedfrom(st);
+	/* IKE SA <-> Child SA */
+	state_db_rehash_ike_peer(st);
 }
 
 /*
  * Maintain the contents of the hash tables.
  *
- * Unlike serialno, the IKE SPI[ir] keys can change over time.
+ * Unlike serialno, the IKE SPI[ir] and IPsec SPI keys can change
+ * over time.
  */
 
 HASH_DB(state,
@@ -300,7 +438,14 @@ HASH_DB(state,
 	&state_connection_serialno_hash_table,
 	&state_reqid_hash_table,
 	&state_ike_initiator_spi_hash_table,
-	&state_ike_spis_hash_table);
+	&state_ike_spis_hash_table,
+	&state_ike_peer_hash_table,
+	&state_ah_inbound_spi_hash_table,
+	&state_ah_outbound_spi_hash_table,
+	&state_esp_inbound_spi_hash_table,
+	&state_esp_outbound_spi_hash_table,
+	&state_ipcomp_inbound_spi_hash_table,
+	&state_ipcomp_outbound_spi_hash_table);
 
 /*
  * The IKE SA has received the responder's SPI.  Update it and then
@@ -371,6 +516,12 @@ static struct list_head *state_filter_head(struct state_filter *filter)
 		     pri_co(filter->connection_serialno), pri_where(filter->search.where));
 		hash_t hash = hash_state_connection_serialno(&filter->connection_serialno);
 		bucket = hash_table_bucket(&state_connection_serialno_hash_table, hash);
+	} else if (filter->ike_peer != NULL) {
+		address_buf ab;
+		vdbg("FOR_EACH_STATE[ike_peer=%s]... in "PRI_WHERE,
+		     str_address(filter->ike_peer, &ab), pri_where(filter->search.where));
+		hash_t hash = hash_ike_peer(filter->ike_peer);
+		bucket = hash_table_bucket(&state_ike_peer_hash_table, hash);
 	} else {
 		/* else other queries? */
 		vdbg("FOR_EACH_STATE_... in "PRI_WHERE, pri_where(filter->search.where));
@@ -397,6 +548,12 @@ static bool matches_filter(struct state *st, struct state_filter *filter)
 	    filter->connection_serialno != st->st_connection->serialno) {
 		return false;
 	}
+	if (filter->ike_peer != NULL &&
+	    (!IS_PARENT_SA(st) ||
+	     !address_eq_address(st->st_connection->remote->host.first_addr,
+				 *filter->ike_peer))) {
+		return false;
+	}
 	return true;
 }
 
@@ -427,6 +584,7 @@ bool next_state(struct state_filter *filter)
 	     entry->data != NULL /* head has DATA == NULL */;
 	     entry = entry->next[filter->search.order]) {
 		struct state *st = (struct state *) entry->data;
+		filter->visited++;
 		if (matches_filter(st, filter)) {
 			/* save state; but step off current entry */
 			filter->internal = entry->next[filter->search.order];
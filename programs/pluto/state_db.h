@@ -18,11 +18,13 @@
 
 #include "ike_spi.h"
 #include "reqid.h"
+#include "ipsec_spi.h"
 
 struct state;
 struct connection;
 struct list_entry;
 enum sa_role;
+enum direction;
 
 void state_db_init(struct logger *logger);
 void state_db_check(struct logger *logger);
@@ -56,6 +58,7 @@ struct state *state_by_ike_spis(enum ike_version ike_version,
 				const char *reason);
 
 void state_db_rehash_connection_serialno(struct state *st);
+void state_db_rehash_ike_peer(struct state *st);
 
 struct state *state_by_reqid(reqid_t reqid,
 			     state_by_predicate *predicate /*optional*/,
@@ -63,4 +66,18 @@ struct state *state_by_reqid(reqid_t reqid,
 			     const char *reason);
 void state_db_rehash_reqid(struct state *st);
 
+/*
+ * PROTOID is the IKE protocol ID (PROTO_IPSEC_AH, PROTO_IPSEC_ESP or
+ * PROTO_IPCOMP); the address isn't part of the key so should be
+ * checked using PREDICATE.
+ */
+
+struct state *state_by_ipsec_spi(uint8_t protoid,
+				 enum direction direction,
+				 ipsec_spi_t spi,
+				 state_by_predicate *predicate /*optional*/,
+				 void *predicate_context,
+				 const char *reason);
+void state_db_rehash_ipsec_spis(struct state *st);
+
 #endif
@@ -72,6 +72,7 @@
 #include "terminate.h"
 #include "ikev1_nat.h"
 #include "ikev2_nat.h"
+#include "show.h"
 
 static void dispatch_event(struct state *st, enum event_type event_type,
 			   deltatime_t event_delay, struct logger *logger,
@@ -162,7 +163,337 @@ struct state_event **state_event_slot(struct state *st, enum event_type type)
 	bad_case(type);
 }
 
-void delete_state_event(struct state_event **evp, where_t where)
+/*
+ * The state event wheel.
+ *
+ * Rather than give each state event its own libevent timer, events
+ * are embedded in the state and threaded onto a hierarchical timer
+ * wheel driven by a single one-shot global timer.
+ *
+ * Time is measured in WHEEL_TICK_MS ticks from .epoch.  Level L has
+ * WHEEL_SLOTS slots each spanning WHEEL_SLOTS^L ticks.  An event is
+ * put on the lowest level where its tick and .now share all the
+ * higher bits, so level 0 holds events due in the current rotation,
+ * level 1 those due in the current rotation of level 1, and so on.
+ * When .now crosses into a new slot of level L, that slot's events
+ * are cascaded down.  Events beyond the top level go on .overflow.
+ *
+ * Events with a long delay are given some slack (1/256th of the
+ * delay, rounded down to a power of two ticks) so that they share a
+ * tick, and wakeup, with their neighbours.
+ */
+
+#define WHEEL_TICK_MS 10
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 5
+#define WHEEL_SLACK_SHIFT 8	/* 1/256th */
+
+static const struct list_info state_event_wheel_info = {
+	.name = "state event wheel",
+};
+
+static struct {
+	bool initialized;
+	monotime_t epoch;		/* tick 0 */
+	uint64_t now;			/* ticks before this have run */
+	bool armed;
+	uint64_t armed_tick;
+	struct list_head slot[WHEEL_LEVELS][WHEEL_SLOTS];
+	struct list_head overflow;
+	unsigned occupancy[WHEEL_LEVELS + 1];
+	unsigned nr;
+	/* statistics */
+	uintmax_t scheduled;
+	uintmax_t fired;
+	uintmax_t wakeups;
+	uintmax_t cascaded;
+#define WHEEL_LATENESS_BUCKETS 5
+	uintmax_t lateness[WHEEL_LATENESS_BUCKETS]; /* <1ms <10ms <100ms <1s >=1s */
+	deltatime_t max_lateness;
+} wheel;
+
+static bool wheel_list_empty(const struct list_head *list)
+{
+	return list->head.next[OLD2NEW] == &list->head;
+}
+
+static struct state_event *wheel_list_first(const struct list_head *list)
+{
+	return list->head.next[OLD2NEW]->data;
+}
+
+static struct list_head *wheel_list(unsigned level, uint64_t tick)
+{
+	if (level == WHEEL_LEVELS) {
+		return &wheel.overflow;
+	}
+	return &wheel.slot[level][(tick >> (WHEEL_LEVEL_BITS * level)) & WHEEL_MASK];
+}
+
+static uint64_t wheel_tick_floor(monotime_t t)
+{
+	intmax_t ms = milliseconds_from_deltatime(monotime_diff(t, wheel.epoch));
+	return (ms <= 0 ? 0 : (uint64_t)ms / WHEEL_TICK_MS);
+}
+
+static uint64_t wheel_tick_ceil(monotime_t t)
+{
+	intmax_t us = microseconds_from_deltatime(monotime_diff(t, wheel.epoch));
+	const intmax_t tick_us = WHEEL_TICK_MS * 1000;
+	return (us <= 0 ? 0 : (uint64_t)((us + tick_us - 1) / tick_us));
+}
+
+static void wheel_insert(struct state_event *ev)
+{
+	uint64_t tick = (ev->ev_tick < wheel.now ? wheel.now : ev->ev_tick);
+	unsigned level;
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned shift = WHEEL_LEVEL_BITS * (level + 1);
+		if ((tick >> shift) == (wheel.now >> shift)) {
+			break;
+		}
+	}
+	ev->ev_level = level;
+	insert_list_entry(wheel_list(level, tick), &ev->ev_entry);
+	wheel.occupancy[level]++;
+}
+
+static void wheel_remove(struct state_event *ev)
+{
+	remove_list_entry(&ev->ev_entry);
+	wheel.occupancy[ev->ev_level]--;
+}
+
+/*
+ * The first tick, after .now, when something needs doing (either an
+ * event is due or a slot needs cascading).
+ */
+
+static bool next_wheel_tick(uint64_t *next)
+{
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		if (wheel.occupancy[level] == 0) {
+			continue;
+		}
+		unsigned shift = WHEEL_LEVEL_BITS * level;
+		unsigned index = (wheel.now >> shift) & WHEEL_MASK;
+		for (unsigned i = index + 1; i < WHEEL_SLOTS; i++) {
+			if (!wheel_list_empty(&wheel.slot[level][i])) {
+				uint64_t base = (wheel.now >> (shift + WHEEL_LEVEL_BITS)) << (shift + WHEEL_LEVEL_BITS);
+				*next = base | ((uint64_t)i << shift);
+				return true;
+			}
+		}
+	}
+	if (wheel.occupancy[WHEEL_LEVELS] > 0) {
+		unsigned shift = WHEEL_LEVEL_BITS * WHEEL_LEVELS;
+		*next = ((wheel.now >> shift) + 1) << shift;
+		return true;
+	}
+	return false;
+}
+
+static void cascade_wheel_list(struct list_head *list)
+{
+	while (!wheel_list_empty(list)) {
+		struct state_event *ev = wheel_list_first(list);
+		wheel_remove(ev);
+		wheel_insert(ev);
+		wheel.cascaded++;
+	}
+}
+
+/*
+ * Move .now forward to NEXT, as returned by next_wheel_tick(), and
+ * cascade any slot that has just become current.  Higher levels
+ * first so that their events can trickle all the way down.
+ */
+
+static void move_wheel(uint64_t next)
+{
+	uint64_t old = wheel.now;
+	wheel.now = next;
+	if ((next >> (WHEEL_LEVEL_BITS * WHEEL_LEVELS)) !=
+	    (old >> (WHEEL_LEVEL_BITS * WHEEL_LEVELS))) {
+		cascade_wheel_list(&wheel.overflow);
+	}
+	for (unsigned level = WHEEL_LEVELS - 1; level > 0; level--) {
+		unsigned shift = WHEEL_LEVEL_BITS * level;
+		if ((next >> shift) != (old >> shift)) {
+			cascade_wheel_list(wheel_list(level, next));
+		}
+	}
+}
+
+static void arm_wheel(void)
+{
+	uint64_t due;
+	if (!wheel_list_empty(wheel_list(0, wheel.now))) {
+		due = wheel.now;
+	} else if (!next_wheel_tick(&due)) {
+		if (wheel.armed) {
+			deschedule_oneshot_timer(EVENT_STATE_EVENT_WHEEL);
+			wheel.armed = false;
+		}
+		return;
+	}
+
+	if (wheel.armed && wheel.armed_tick == due) {
+		return;
+	}
+
+	monotime_t when = monotime_add(wheel.epoch,
+				       deltatime_from_milliseconds(due * WHEEL_TICK_MS));
+	deltatime_t delay = monotime_diff(when, mononow());
+	if (deltatime_cmp(delay, <, deltatime(0))) {
+		delay = deltatime(0);
+	}
+	schedule_oneshot_timer(EVENT_STATE_EVENT_WHEEL, delay);
+	wheel.armed = true;
+	wheel.armed_tick = due;
+}
+
+static void count_state_event_lateness(const struct state_event *ev, monotime_t now)
+{
+	deltatime_t lateness = monotime_diff(now, ev->ev_time);
+	intmax_t ms = milliseconds_from_deltatime(lateness);
+	unsigned bucket = (ms < 1 ? 0 :
+			   ms < 10 ? 1 :
+			   ms < 100 ? 2 :
+			   ms < 1000 ? 3 :
+			   4);
+	wheel.lateness[bucket]++;
+	wheel.max_lateness = deltatime_max(wheel.max_lateness, lateness);
+}
+
+static void timer_event_cb(struct state_event *ev, const struct timer_event *event);
+
+/*
+ * Run the events in the current slot.
+ *
+ * The slot is first moved to a private list so that an event
+ * scheduled, with no delay, by a handler is run on the next wakeup
+ * and not this one.  Handlers can still delete events on the private
+ * list.
+ */
+
+static void run_wheel_slot(struct logger *logger)
+{
+	struct list_head *slot = wheel_list(0, wheel.now);
+	if (wheel_list_empty(slot)) {
+		return;
+	}
+
+	struct list_head due = INIT_LIST_HEAD(&due, &state_event_wheel_info);
+	while (!wheel_list_empty(slot)) {
+		struct state_event *ev = wheel_list_first(slot);
+		remove_list_entry(&ev->ev_entry);
+		insert_list_entry(&due, &ev->ev_entry);
+	}
+
+	while (!wheel_list_empty(&due)) {
+		struct state_event *ev = wheel_list_first(&due);
+		struct timer_event event = {
+			.inception = threadtime_start(),
+			.logger = logger,
+		};
+		count_state_event_lateness(ev, mononow());
+		wheel.fired++;
+		/* deletes EV */
+		timer_event_cb(ev, &event);
+		if (!wheel_list_empty(&due) && wheel_list_first(&due) == ev) {
+			/* the callback bailed; don't spin */
+			wheel_remove(ev);
+			wheel.nr--;
+		}
+	}
+}
+
+static global_timer_cb state_event_wheel_cb;
+
+static void state_event_wheel_cb(struct logger *logger)
+{
+	wheel.armed = false;
+	wheel.wakeups++;
+
+	uint64_t target = wheel_tick_floor(mononow());
+	run_wheel_slot(logger);
+	while (wheel_list_empty(wheel_list(0, wheel.now))) {
+		uint64_t next;
+		if (!next_wheel_tick(&next) || next > target) {
+			/* nothing due; safe to skip ahead */
+			if (target > wheel.now) {
+				wheel.now = target;
+			}
+			break;
+		}
+		move_wheel(next);
+		run_wheel_slot(logger);
+	}
+
+	arm_wheel();
+}
+
+void init_state_event_wheel(struct logger *logger)
+{
+	wheel.epoch = mononow();
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		for (unsigned i = 0; i < WHEEL_SLOTS; i++) {
+			wheel.slot[level][i] = (struct list_head)
+				INIT_LIST_HEAD(&wheel.slot[level][i], &state_event_wheel_info);
+		}
+	}
+	wheel.overflow = (struct list_head)
+		INIT_LIST_HEAD(&wheel.overflow, &state_event_wheel_info);
+	init_oneshot_timer(EVENT_STATE_EVENT_WHEEL, state_event_wheel_cb);
+	wheel.initialized = true;
+	ldbg(logger, "state event wheel initialized, %u levels of %u %ums slots",
+	     WHEEL_LEVELS, WHEEL_SLOTS, WHEEL_TICK_MS);
+}
+
+void list_state_event_wheel(struct show *s, const monotime_t now UNUSED)
+{
+	if (!wheel.initialized) {
+		return;
+	}
+	SHOW_JAMBUF(s, buf) {
+		jam(buf, "state event wheel: %u events", wheel.nr);
+		for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+			jam(buf, ", level %u: %u", level, wheel.occupancy[level]);
+		}
+		jam(buf, ", overflow: %u", wheel.occupancy[WHEEL_LEVELS]);
+	}
+	SHOW_JAMBUF(s, buf) {
+		jam(buf, "state event wheel: scheduled %ju, fired %ju, wakeups %ju, cascaded %ju",
+		    wheel.scheduled, wheel.fired, wheel.wakeups, wheel.cascaded);
+	}
+	SHOW_JAMBUF(s, buf) {
+		jam(buf, "state event wheel: late <1ms %ju, <10ms %ju, <100ms %ju, <1s %ju, >=1s %ju, max ",
+		    wheel.lateness[0], wheel.lateness[1], wheel.lateness[2],
+		    wheel.lateness[3], wheel.lateness[4]);
+		jam_deltatime(buf, wheel.max_lateness);
+		jam_string(buf, "s");
+	}
+}
+
+/*
+ * Return the event embedded in ST that EVP points at.
+ */
+
+static struct state_event *state_event_storage(struct state *st,
+					       struct state_event **evp)
+{
+	if (evp == &st->st_v1_dpd_event) {
+		return &st->st_v1_dpd_event_storage;
+	}
+	PASSERT(st->logger, evp >= st->st_events &&
+		evp < st->st_events + elemsof(st->st_events));
+	return &st->st_event_storage[evp - st->st_events];
+}
+
+void delete_state_event(struct state_event **evp, where_t where UNUSED)
 {
 	struct state_event *e = (*evp);
 	if (e == NULL) {
@@ -176,13 +507,10 @@ void delete_state_event(struct state_event **evp, where_t where)
 	    e->ev_state->st_serialno,
 	    str_enum_long(&event_type_names, e->ev_type, &tb));
 
-	/* first the event */
-	destroy_timeout(&e->timeout);
-	/* then the structure */
-	ldbg_free(&global_logger, "state-event", e, where);
-	pfree(e);
+	/* off the wheel; the storage is part of the state */
+	wheel_remove(e);
+	wheel.nr--;
 	*evp = NULL;
-
 }
 
 /*
@@ -192,7 +520,7 @@ void delete_state_event(struct state_event **evp, where_t where)
  * to event specific data (for example, to a state structure).
  */
 
-static void timer_event_cb(void *arg, const struct timer_event *event)
+static void timer_event_cb(struct state_event *ev, const struct timer_event *event)
 {
 	/*
 	 * Get rid of the old timer event before calling the timer
@@ -204,7 +532,6 @@ static void timer_event_cb(void *arg, const struct timer_event *event)
 	deltatime_t event_delay;
 
 	{
-		struct state_event *ev = arg;
 		passert(ev != NULL);
 		event_type = ev->ev_type;
 		PASSERT(event->logger, enum_long(&event_type_names, event_type, &event_name));
@@ -234,7 +561,7 @@ static void timer_event_cb(void *arg, const struct timer_event *event)
 
 		/* everything useful has been extracted */
 		delete_state_event(evp, HERE);
-		arg = ev = *evp = NULL; /* all gone */
+		ev = *evp = NULL; /* all gone */
 	}
 
 	statetime_t start = statetime_backdate(st, &event->inception);
@@ -589,6 +916,25 @@ void delete_v1_event(struct state *st)
 	delete_state_event(&st->st_v1_event, HERE);
 }
 
+deltatime_t slotted_event_delay(deltatime_t delay, deltatime_t period,
+				deltatime_t phase)
+{
+	intmax_t period_ms = milliseconds_from_deltatime(period);
+	if (period_ms <= 0) {
+		return delay;
+	}
+	intmax_t now_ms = milliseconds_from_deltatime(monotime_diff(mononow(), monotime(0)));
+	intmax_t due_ms = now_ms + milliseconds_from_deltatime(delay);
+	intmax_t off_ms = (due_ms - milliseconds_from_deltatime(phase)) % period_ms;
+	if (off_ms < 0) {
+		off_ms += period_ms;
+	}
+	if (due_ms - off_ms <= now_ms) {
+		return delay;
+	}
+	return deltatime_from_milliseconds(due_ms - off_ms - now_ms);
+}
+
 /*
  * This routine schedules a state event.
  */
@@ -623,12 +969,32 @@ void event_schedule_where(enum event_type type, deltatime_t delay, struct state
 		delete_state_event(evp, where);
 	}
 
-	struct state_event *ev = alloc_thing(struct state_event, __func__);
+	PASSERT(st->logger, wheel.initialized);
+	struct state_event *ev = state_event_storage(st, evp);
+	if (ev->ev_entry.info == NULL) {
+		init_list_entry(&state_event_wheel_info, ev, &ev->ev_entry);
+	}
+	PASSERT(st->logger, detached_list_entry(&ev->ev_entry));
 	ev->ev_type = type;
 	ev->ev_state = st;
 	ev->ev_epoch = mononow();
 	ev->ev_delay = delay;
 	ev->ev_time = monotime_add(ev->ev_epoch, delay);
+
+	/*
+	 * Round the tick up, adding slack to long delays so that
+	 * nearby events share a wakeup.
+	 */
+	if (wheel.nr == 0) {
+		/* nothing to disturb; catch up */
+		wheel.now = wheel_tick_floor(ev->ev_epoch);
+	}
+	ev->ev_tick = wheel_tick_ceil(ev->ev_time);
+	uint64_t slack = ((uint64_t)milliseconds_from_deltatime(delay) / WHEEL_TICK_MS) >> WHEEL_SLACK_SHIFT;
+	if (slack > 1) {
+		uint64_t granule = UINT64_C(1) << (63 - __builtin_clzll(slack));
+		ev->ev_tick = (ev->ev_tick + granule - 1) & ~(granule - 1);
+	}
 	*evp = ev;
 
 	deltatime_buf buf;
@@ -636,7 +1002,12 @@ void event_schedule_where(enum event_type type, deltatime_t delay, struct state
 	     __func__, event_name.buf, ev, str_deltatime(delay, &buf),
 	     ev->ev_state->st_serialno);
 
-	schedule_timeout(event_name.buf, &ev->timeout, delay, timer_event_cb, ev);
+	wheel_insert(ev);
+	wheel.nr++;
+	wheel.scheduled++;
+	if (!wheel.armed || ev->ev_tick < wheel.armed_tick) {
+		arm_wheel();
+	}
 }
 
 /*
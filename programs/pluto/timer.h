@@ -23,19 +23,29 @@
 #include "deltatime.h"
 #include "monotime.h"
 #include "where.h"
+#include "list_entry.h"
 
 struct state;   /* forward declaration */
 struct fd;
 struct logger;
 struct show;
 
+/*
+ * State events are embedded in the state (see .st_event_storage[])
+ * and threaded onto the state event wheel; .st_*_event points at the
+ * storage while the event is scheduled.
+ */
+
 struct state_event {
 	enum event_type ev_type;        /* Event type if time based */
 	struct state *ev_state;     	/* Pointer to relevant state (if any) */
-	struct timeout *timeout;	/* Underlying timer */
 	monotime_t ev_epoch;		/* it was scheduled ... */
 	deltatime_t ev_delay;		/* ... with the delay ... */
 	monotime_t ev_time;		/* ... so should happen after ...*/
+	/* timer wheel */
+	struct list_entry ev_entry;
+	uint64_t ev_tick;		/* rounded up ev_time */
+	unsigned ev_level;		/* level, or WHEEL_LEVELS for overflow */
 };
 
 void state_event_sort(const struct state_event **events, unsigned nr_events);
@@ -44,6 +54,15 @@ extern void event_schedule_where(enum event_type type, deltatime_t delay,
 				 struct state *st, where_t where);
 #define event_schedule(TYPE, DELAY, ST) event_schedule_where(TYPE, DELAY, ST, HERE)
 
+/*
+ * Shorten DELAY so that the event expires PHASE into a PERIOD
+ * boundary.  Events with the same PERIOD and PHASE then expire, and
+ * run, together.  DELAY is returned unchanged when no such boundary
+ * falls before it.
+ */
+deltatime_t slotted_event_delay(deltatime_t delay, deltatime_t period,
+				deltatime_t phase);
+
 void event_delete_where(enum event_type type, struct state *st, where_t where);
 #define event_delete(TYPE, ST) event_delete_where(TYPE, ST, HERE)
 void delete_state_event(struct state_event **evp, where_t where);
@@ -57,6 +76,8 @@ void whack_impair_call_state_event_handler(struct logger *logger, struct state *
 					   enum event_type type, bool detach_whack);
 
 extern void list_timers(struct show *s, const monotime_t now);
+void list_state_event_wheel(struct show *s, const monotime_t now);
+void init_state_event_wheel(struct logger *logger);
 extern char *revive_conn;
 
 /*
@@ -26,6 +26,13 @@
  * for more details.
  */
 
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+
 #include "ip_info.h"
 
 #include "defs.h"
@@ -39,6 +46,11 @@
 #include "keys.h"		/* for pluto_pubkeys */
 #include "secrets.h"		/* for struct pubkey_list */
 #include "server_run.h"
+#include "server_fork.h"
+#include "server.h"		/* for attach_fd_read_listener() */
+#include "config_setup.h"
+#include "show.h"
+#include "whack_shutdown.h"	/* for exiting_pluto */
 
 /*
  * Remove all characters but [-_.0-9a-zA-Z] from a character string.
@@ -283,6 +295,707 @@ static bool fmt_common_shell_out(char *buf,
 #	undef JDipaddr
 }
 
+/*
+ * Asynchronous updown.
+ *
+ * When updown-concurrency=N is non-zero, the command is queued and
+ * then run in the background, using server_fork_exec(), with at most
+ * N running at once.  Commands for the same connection are run one
+ * at a time, in the order they were queued (i.e., prepare, route, up,
+ * down stay in order).
+ *
+ * Since the command's exit status arrives later, the caller is told
+ * it succeeded; failures are only logged.
+ *
+ * When updown-coprocess=PATH is also set, the jobs are instead sent,
+ * one line each, to a single long-running process (see below).
+ */
+
+struct updown_job {
+	struct updown_job *next;
+	co_serial_t serialno;		/* connection */
+	char verb[32];			/* VERB+SUFFIX */
+	char *env;			/* PLUTO_VERB='...' PLUTO_...='...' */
+	char *updown;			/* the command */
+	unsigned id;			/* co-process record; 0 when forked */
+	pid_t pid;			/* forked; 0 when a co-process record */
+	monotime_t queued;
+	struct logger *logger;
+};
+
+static struct {
+	struct updown_job *pending;	/* oldest first */
+	struct updown_job **pending_tail;
+	struct updown_job *running;
+	unsigned nr_pending;
+	unsigned nr_running;
+} updown_queue = {
+	.pending_tail = &updown_queue.pending,
+};
+
+/*
+ * Latency, from the command being queued through to it exiting.
+ */
+
+static const struct {
+	intmax_t below_ms;
+	const char *name;
+} updown_latency_buckets[] = {
+	{ 10, "0-9", },
+	{ 100, "10-99", },
+	{ 1000, "100-999", },
+	{ 10000, "1000-9999", },
+	{ INTMAX_MAX, "10000+", },
+};
+
+#define UPDOWN_LATENCY_ROOF elemsof(updown_latency_buckets)
+
+static struct {
+	uintmax_t jobs;
+	uintmax_t failed;
+	unsigned max_pending;
+	uintmax_t latency[UPDOWN_LATENCY_ROOF];
+} updown_stats;
+
+/*
+ * The co-process, started on demand.
+ *
+ * Each job is written, to its STDIN, as the line "<id> <env>\n" and
+ * completes when the line "<id> <exit-status>" comes back on its fd
+ * 3.  Anything the co-process writes to STDOUT or STDERR is logged.
+ *
+ * The sockets are non-blocking; records that don't fit are buffered
+ * and written by a write listener as the co-process drains them.
+ */
+
+struct updown_coprocess_lines {
+	int fd;
+	struct fd_read_listener *fdl;
+	size_t len;
+	char line[LOG_WIDTH];		/* partial line */
+};
+
+static struct {
+	pid_t pid;			/* 0 when not running */
+	struct updown_coprocess_lines output;	/* STDIN/STDOUT/STDERR */
+	struct updown_coprocess_lines reply;	/* fd 3 */
+	struct fd_write_listener *writer;
+	chunk_t records;		/* waiting to be written */
+	unsigned generation;		/* ignore exits of earlier instances */
+	unsigned next_id;
+} updown_coprocess = {
+	.output.fd = -1,
+	.reply.fd = -1,
+};
+
+static void free_updown_job(struct updown_job **job)
+{
+	pfreeany((*job)->env);
+	pfreeany((*job)->updown);
+	free_logger(&(*job)->logger, HERE);
+	pfree(*job);
+	*job = NULL;
+}
+
+static struct updown_job *updown_connection_job(co_serial_t serialno)
+{
+	for (struct updown_job *r = updown_queue.running; r != NULL; r = r->next) {
+		if (r->serialno == serialno) {
+			return r;
+		}
+	}
+	return NULL;
+}
+
+static bool updown_connection_running(co_serial_t serialno)
+{
+	return (updown_connection_job(serialno) != NULL);
+}
+
+static bool updown_job_ok(const char *verb, int wstatus, struct logger *logger)
+{
+	if (WIFEXITED(wstatus)) {
+		if (WEXITSTATUS(wstatus) != 0) {
+			llog(RC_LOG, logger, "%s command exited with status %d",
+			     verb, WEXITSTATUS(wstatus));
+			return false;
+		}
+		return true;
+	}
+	if (WIFSIGNALED(wstatus)) {
+		llog(RC_LOG, logger, "%s command exited with signal %d",
+		     verb, WTERMSIG(wstatus));
+		return false;
+	}
+	llog(RC_LOG, logger, "%s command exited with unknown status %d",
+	     verb, wstatus);
+	return false;
+}
+
+static void schedule_updown_jobs(void);
+
+static void complete_updown_job(struct updown_job *job, bool ok)
+{
+	/* unlink from running */
+	for (struct updown_job **r = &updown_queue.running; (*r) != NULL; r = &(*r)->next) {
+		if ((*r) == job) {
+			(*r) = job->next;
+			updown_queue.nr_running--;
+			break;
+		}
+	}
+
+	intmax_t ms = milliseconds_from_deltatime(monotime_diff(mononow(), job->queued));
+	for (unsigned b = 0; b < UPDOWN_LATENCY_ROOF; b++) {
+		if (ms < updown_latency_buckets[b].below_ms) {
+			updown_stats.latency[b]++;
+			break;
+		}
+	}
+
+	if (!ok) {
+		updown_stats.failed++;
+	}
+	ldbg(job->logger, "%s command took %jdms", job->verb, ms);
+
+	free_updown_job(&job);
+}
+
+static server_fork_cb updown_job_exited; /* type assertion */
+
+static stf_status updown_job_exited(struct state *st UNUSED,
+				    struct msg_digest *md UNUSED,
+				    int wstatus, shunk_t output UNUSED,
+				    void *context,
+				    struct logger *logger)
+{
+	struct updown_job *job = context;
+	complete_updown_job(job, updown_job_ok(job->verb, wstatus, logger));
+	schedule_updown_jobs();
+	return STF_OK; /* ignored */
+}
+
+/*
+ * Shut down the co-process (if it hasn't already gone); jobs it was
+ * working on are failed.
+ */
+
+static void close_updown_coprocess_lines(struct updown_coprocess_lines *lines)
+{
+	detach_fd_read_listener(&lines->fdl);
+	if (lines->fd >= 0) {
+		close(lines->fd);
+	}
+	lines->fd = -1;
+	lines->len = 0;
+}
+
+static void stop_updown_coprocess(const char *why, struct logger *logger)
+{
+	if (updown_coprocess.pid == 0) {
+		return;
+	}
+	ldbg(logger, "stopping updown co-process (pid:%d): %s",
+	     updown_coprocess.pid, why);
+	detach_fd_write_listener(&updown_coprocess.writer);
+	free_chunk_content(&updown_coprocess.records);
+	close_updown_coprocess_lines(&updown_coprocess.output);
+	close_updown_coprocess_lines(&updown_coprocess.reply);
+	updown_coprocess.pid = 0;
+
+	struct updown_job **r = &updown_queue.running;
+	while ((*r) != NULL) {
+		struct updown_job *job = (*r);
+		if (job->id == 0) {
+			/* forked */
+			r = &job->next;
+			continue;
+		}
+		llog(RC_LOG, job->logger, "%s command abandoned, updown co-process %s",
+		     job->verb, why);
+		complete_updown_job(job, false);
+	}
+}
+
+static void updown_coprocess_output_line(shunk_t line, struct logger *logger)
+{
+	llog(RC_LOG, logger, "updown: "PRI_SHUNK, pri_shunk(line));
+}
+
+static void updown_coprocess_reply_line(shunk_t line, struct logger *logger)
+{
+	/* <id> <exit-status> */
+	shunk_t cursor = line;
+	shunk_t id_token = shunk_token(&cursor, NULL, " ");
+	uintmax_t id;
+	intmax_t status;
+	if (shunk_to_uintmax(id_token, NULL, 10, &id) == NULL &&
+	    shunk_to_intmax(cursor, NULL, 10, &status) == NULL) {
+		for (struct updown_job *job = updown_queue.running;
+		     job != NULL; job = job->next) {
+			if (job->id != 0 && job->id == id) {
+				bool ok = (status == 0);
+				if (!ok) {
+					llog(RC_LOG, job->logger, "%s command exited with status %jd",
+					     job->verb, status);
+				}
+				complete_updown_job(job, ok);
+				return;
+			}
+		}
+	}
+	llog(RC_LOG, logger, "updown: unexpected reply "PRI_SHUNK, pri_shunk(line));
+}
+
+/*
+ * Read what's available, passing each complete line to LINE_CB; an
+ * over-long line is split.  Returns false, having stopped the
+ * co-process, on EOF or error.
+ */
+
+static bool read_updown_coprocess_lines(struct updown_coprocess_lines *lines,
+					void (*line_cb)(shunk_t line, struct logger *logger),
+					struct logger *logger)
+{
+	char *buf = lines->line + lines->len;
+	size_t room = sizeof(lines->line) - lines->len;
+	ssize_t len = read(lines->fd, buf, room);
+	if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return true;
+	}
+	if (len < 0 && errno != ECONNRESET) {
+		llog_error(logger, errno, "reading updown co-process failed");
+		stop_updown_coprocess("failed", logger);
+		return false;
+	}
+	if (len <= 0) {
+		stop_updown_coprocess("closed its output", logger);
+		return false;
+	}
+	lines->len += len;
+
+	shunk_t input = shunk2(lines->line, lines->len);
+	while (input.len > 0) {
+		const char *nl = memchr(input.ptr, '\n', input.len);
+		if (nl == NULL && lines->len < sizeof(lines->line)) {
+			break;
+		}
+		shunk_t line = shunk_token(&input, NULL, "\n");
+		line_cb(line, logger);
+	}
+	memmove(lines->line, input.ptr, input.len);
+	lines->len = input.len;
+	return true;
+}
+
+static void updown_coprocess_output_listener(int fd UNUSED, void *arg UNUSED,
+					     struct logger *logger)
+{
+	if (!read_updown_coprocess_lines(&updown_coprocess.output,
+					 updown_coprocess_output_line, logger)) {
+		schedule_updown_jobs();
+	}
+}
+
+static void updown_coprocess_reply_listener(int fd UNUSED, void *arg UNUSED,
+					    struct logger *logger)
+{
+	read_updown_coprocess_lines(&updown_coprocess.reply,
+				    updown_coprocess_reply_line, logger);
+	schedule_updown_jobs();
+}
+
+static server_fork_cb updown_coprocess_exited; /* type assertion */
+
+static stf_status updown_coprocess_exited(struct state *st UNUSED,
+					  struct msg_digest *md UNUSED,
+					  int wstatus, shunk_t output UNUSED,
+					  void *context,
+					  struct logger *logger)
+{
+	unsigned generation = (uintptr_t)context;
+	updown_job_ok("updown co-process", wstatus, logger);
+	if (generation == updown_coprocess.generation) {
+		stop_updown_coprocess("exited", logger);
+		schedule_updown_jobs();
+	}
+	return STF_OK; /* ignored */
+}
+
+static bool start_updown_coprocess(const char *path, struct logger *logger)
+{
+	if (updown_coprocess.pid != 0) {
+		return true;
+	}
+	char *argv[] = {
+		DISCARD_CONST(char *, "updown-coprocess"),
+		NULL,
+	};
+	updown_coprocess.generation++;
+	pid_t pid = server_fork_coprocess(path, argv, /*inherit-env*/NULL,
+					  &updown_coprocess.output.fd,
+					  &updown_coprocess.reply.fd,
+					  updown_coprocess_exited,
+					  (void*)(uintptr_t)updown_coprocess.generation,
+					  logger);
+	if (pid < 0) {
+		/* already logged */
+		return false;
+	}
+	llog(RC_LOG, logger, "started updown co-process %s (pid:%d)", path, pid);
+	updown_coprocess.pid = pid;
+	if (fcntl(updown_coprocess.output.fd, F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(updown_coprocess.reply.fd, F_SETFL, O_NONBLOCK) < 0) {
+		llog_error(logger, errno, "making updown co-process sockets non-blocking failed");
+		stop_updown_coprocess("failed", logger);
+		return false;
+	}
+	attach_fd_read_listener(&updown_coprocess.output.fdl, updown_coprocess.output.fd,
+				"updown-coprocess", updown_coprocess_output_listener, NULL);
+	attach_fd_read_listener(&updown_coprocess.reply.fdl, updown_coprocess.reply.fd,
+				"updown-coprocess-reply", updown_coprocess_reply_listener, NULL);
+	return true;
+}
+
+/*
+ * Append the job's record to the co-process's pending records;
+ * newlines would split the record so are blanked.
+ */
+
+static void append_updown_record(struct updown_job *job)
+{
+	chunk_t *records = &updown_coprocess.records;
+	job->id = ++updown_coprocess.next_id;
+	if (job->id == 0) {
+		/* wrapped; 0 means forked */
+		job->id = ++updown_coprocess.next_id;
+	}
+	char id[sizeof("4294967295 ")];
+	snprintf(id, sizeof(id), "%u ", job->id);
+	size_t start = records->len;
+	append_chunk_bytes("updown record", records, id, strlen(id));
+	append_chunk_bytes("updown record", records, job->env, strlen(job->env));
+	for (size_t i = start; i < records->len; i++) {
+		if (records->ptr[i] == '\n' || records->ptr[i] == '\r') {
+			records->ptr[i] = ' ';
+		}
+	}
+	append_chunk_bytes("updown record", records, "\n", 1);
+}
+
+/*
+ * Write what the co-process will accept without blocking; a write
+ * listener is left waiting for it to drain the rest.  Returns false,
+ * having stopped the co-process, when the write fails.
+ */
+
+static void updown_coprocess_writer(int fd, void *arg, struct logger *logger);
+
+static bool write_updown_records(struct logger *logger)
+{
+	chunk_t *records = &updown_coprocess.records;
+	size_t written = 0;
+	while (written < records->len) {
+		ssize_t s = send(updown_coprocess.output.fd,
+				 records->ptr + written, records->len - written,
+				 MSG_NOSIGNAL);
+		if (s < 0 && errno == EINTR) {
+			continue;
+		}
+		if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (s < 0) {
+			llog_error(logger, errno, "writing to updown co-process failed");
+			stop_updown_coprocess("stopped accepting records", logger);
+			return false;
+		}
+		written += s;
+	}
+
+	if (written == records->len) {
+		free_chunk_content(records);
+		detach_fd_write_listener(&updown_coprocess.writer);
+		return true;
+	}
+
+	memmove(records->ptr, records->ptr + written, records->len - written);
+	records->len -= written;
+	if (updown_coprocess.writer == NULL) {
+		attach_fd_write_listener(&updown_coprocess.writer, updown_coprocess.output.fd,
+					 "updown-coprocess", updown_coprocess_writer, NULL);
+	}
+	return true;
+}
+
+static void updown_coprocess_writer(int fd UNUSED, void *arg UNUSED,
+				    struct logger *logger)
+{
+	if (!write_updown_records(logger)) {
+		/* try again with a fresh co-process */
+		schedule_updown_jobs();
+	}
+}
+
+/*
+ * The co-process only knows how to run the default updown script; a
+ * connection with its own leftupdown= (or arguments) is always
+ * forked.
+ */
+
+static bool start_updown_job(struct updown_job *job)
+{
+	const char *coprocess = config_setup_string(config_setup_singleton(),
+						    KSF_UPDOWN_COPROCESS);
+	if (coprocess != NULL &&
+	    streq(job->updown, DEFAULT_UPDOWN) &&
+	    start_updown_coprocess(coprocess, job->logger)) {
+		append_updown_record(job);
+	} else {
+		char *cmd = alloc_printf("2>&1 %s%s", job->env, job->updown);
+		char *argv[] = {
+			DISCARD_CONST(char *, "updown"),
+			DISCARD_CONST(char *, "-c"),
+			cmd,
+			NULL,
+		};
+		pid_t pid = server_fork_exec("/bin/sh", argv, /*inherit-env*/NULL,
+					     null_shunk, LOG_STREAM/*not-whack!*/,
+					     updown_job_exited, job, job->logger);
+		pfree(cmd);
+		if (pid < 0) {
+			/* already logged */
+			updown_stats.failed++;
+			return false;
+		}
+		ldbg(job->logger, "%s command running as pid %d", job->verb, pid);
+		job->id = 0;
+		job->pid = pid;
+	}
+	job->next = updown_queue.running;
+	updown_queue.running = job;
+	updown_queue.nr_running++;
+	return true;
+}
+
+/*
+ * Start the oldest pending jobs whose connection isn't already
+ * running something, until the pool is full.
+ */
+
+static void schedule_updown_jobs(void)
+{
+	unsigned concurrency = config_setup_option(config_setup_singleton(),
+						   KBF_UPDOWN_CONCURRENCY);
+	if (exiting_pluto) {
+		/* flush_updown_jobs() runs what's pending */
+		return;
+	}
+	struct updown_job **p = &updown_queue.pending;
+	while ((*p) != NULL && updown_queue.nr_running < concurrency) {
+		struct updown_job *job = (*p);
+		if (updown_connection_running(job->serialno)) {
+			/* wait for the earlier job */
+			p = &job->next;
+			continue;
+		}
+		/* unlink */
+		(*p) = job->next;
+		if (updown_queue.pending_tail == &job->next) {
+			updown_queue.pending_tail = p;
+		}
+		updown_queue.nr_pending--;
+		if (!start_updown_job(job)) {
+			free_updown_job(&job);
+		}
+	}
+	/* co-process records started by this pass are sent in one go */
+	if (updown_coprocess.records.len > 0 &&
+	    !write_updown_records(&global_logger)) {
+		/* try again with a fresh co-process */
+		schedule_updown_jobs();
+	}
+}
+
+/*
+ * Wait, for at most UPDOWN_WAIT_SECS, for the connection's running
+ * job, if any, so that a command run synchronously doesn't overtake
+ * it.  A forked job still running after that is killed; a co-process
+ * job is abandoned along with the co-process.
+ */
+
+#define UPDOWN_WAIT_SECS 10
+
+static void wait_for_updown_connection(co_serial_t serialno, struct logger *logger)
+{
+	const monotime_t deadline = monotime_add(mononow(), deltatime(UPDOWN_WAIT_SECS));
+	struct updown_job *job;
+	while ((job = updown_connection_job(serialno)) != NULL) {
+		ldbg(logger, "waiting for running %s command", job->verb);
+		deltatime_t timeout = monotime_diff(deadline, mononow());
+		if (job->pid != 0) {
+			/* reaping calls updown_job_exited() */
+			if (!server_fork_wait(job->pid, timeout, logger)) {
+				return;
+			}
+			continue;
+		}
+		/* a co-process record; write it and read replies until it's done */
+		intmax_t ms = milliseconds_from_deltatime(timeout);
+		if (ms <= 0) {
+			stop_updown_coprocess("timed out", logger);
+			return;
+		}
+		struct pollfd pfd[] = {
+			{
+				.fd = updown_coprocess.reply.fd,
+				.events = POLLIN,
+			},
+			{
+				.fd = updown_coprocess.output.fd,
+				.events = POLLIN | (updown_coprocess.records.len > 0 ? POLLOUT : 0),
+			},
+		};
+		int n = poll(pfd, elemsof(pfd), ms);
+		if (n < 0 && errno != EINTR) {
+			llog_error(logger, errno, "polling updown co-process failed");
+			stop_updown_coprocess("failed", logger);
+			return;
+		}
+		if (n <= 0) {
+			continue;
+		}
+		if ((pfd[1].revents & POLLOUT) &&
+		    !write_updown_records(logger)) {
+			continue;
+		}
+		if ((pfd[1].revents & ~POLLOUT) &&
+		    !read_updown_coprocess_lines(&updown_coprocess.output,
+						 updown_coprocess_output_line, logger)) {
+			continue;
+		}
+		if (pfd[0].revents) {
+			read_updown_coprocess_lines(&updown_coprocess.reply,
+						    updown_coprocess_reply_line, logger);
+		}
+	}
+}
+
+/*
+ * Run anything still queued, in order, on the main thread.  Used when
+ * switching to synchronous mode, for instance during shutdown when
+ * there's no event-loop to reap the children.
+ */
+
+static void flush_updown_jobs(void)
+{
+	while (updown_queue.pending != NULL) {
+		struct updown_job *job = updown_queue.pending;
+		updown_queue.pending = job->next;
+		updown_queue.nr_pending--;
+		wait_for_updown_connection(job->serialno, job->logger);
+		struct verbose verbose = VERBOSE(DEBUG_STREAM, job->logger, NULL);
+		char *cmd = alloc_printf("2>&1 %s%s", job->env, job->updown);
+		if (!server_run(job->verb, "", cmd, verbose)) {
+			updown_stats.failed++;
+		}
+		pfree(cmd);
+		free_updown_job(&job);
+	}
+	updown_queue.pending_tail = &updown_queue.pending;
+}
+
+static bool run_updown_command(const struct connection *c,
+			       const char *verb, const char *verb_suffix,
+			       char **env, const char *updown,
+			       struct verbose verbose)
+{
+	updown_stats.jobs++;
+	uintmax_t concurrency = config_setup_option(config_setup_singleton(),
+						    KBF_UPDOWN_CONCURRENCY);
+	if (concurrency == 0 || exiting_pluto) {
+		flush_updown_jobs();
+		wait_for_updown_connection(c->serialno, &global_logger);
+		/* must free */
+		char *cmd = alloc_printf("2>&1 "      /* capture stderr along with stdout */
+					 "%s"         /* PLUTO_VERB='...' other stuff */
+					 "%s",        /* actual script */
+					 *env, updown);
+		pfreeany(*env);
+		bool ok = server_run(verb, verb_suffix, cmd, verbose);
+		pfree(cmd);
+		if (!ok) {
+			updown_stats.failed++;
+		}
+		return ok;
+	}
+
+	struct updown_job *job = alloc_thing(struct updown_job, "updown job");
+	job->serialno = c->serialno;
+	snprintf(job->verb, sizeof(job->verb), "%s%s", verb, verb_suffix);
+	job->env = (*env);
+	(*env) = NULL;
+	job->updown = clone_str(updown, "updown command");
+	job->queued = mononow();
+	job->logger = clone_logger(verbose.logger, HERE);
+	/* don't keep whack waiting on the command */
+	release_whack(job->logger, HERE);
+
+	(*updown_queue.pending_tail) = job;
+	updown_queue.pending_tail = &job->next;
+	updown_queue.nr_pending++;
+	updown_stats.max_pending = max(updown_stats.max_pending,
+				       updown_queue.nr_pending);
+	vdbg("queued %s command; %u pending, %u running",
+	     job->verb, updown_queue.nr_pending, updown_queue.nr_running);
+
+	schedule_updown_jobs();
+	return true;
+}
+
+void show_updown_queue(struct show *s)
+{
+	show(s, "current.updown.concurrency=%ju",
+	     config_setup_option(config_setup_singleton(), KBF_UPDOWN_CONCURRENCY));
+	show(s, "current.updown.pending=%u", updown_queue.nr_pending);
+	show(s, "current.updown.running=%u", updown_queue.nr_running);
+	show(s, "total.updown.pending.max=%u", updown_stats.max_pending);
+	show(s, "total.updown.jobs=%ju", updown_stats.jobs);
+	show(s, "total.updown.failed=%ju", updown_stats.failed);
+	for (unsigned b = 0; b < UPDOWN_LATENCY_ROOF; b++) {
+		show(s, "total.updown.latency.ms.%s=%ju",
+		     updown_latency_buckets[b].name, updown_stats.latency[b]);
+	}
+}
+
+void clear_updown_queue_stats(void)
+{
+	zero(&updown_stats);
+}
+
+void free_updown_queue(struct logger *logger)
+{
+	ldbg(logger, "freeing updown queue: %u pending, %u running",
+	     updown_queue.nr_pending, updown_queue.nr_running);
+	flush_updown_jobs();
+	/*
+	 * Still running jobs are abandoned; without an event-loop
+	 * their exit can't be reaped.
+	 */
+	while (updown_queue.running != NULL) {
+		struct updown_job *job = updown_queue.running;
+		updown_queue.running = job->next;
+		updown_queue.nr_running--;
+		free_updown_job(&job);
+	}
+	/* the co-process exits when it sees EOF */
+	pid_t pid = updown_coprocess.pid;
+	if (pid != 0) {
+		stop_updown_coprocess("shutting down", logger);
+		server_fork_wait(pid, deltatime(UPDOWN_WAIT_SECS), logger);
+	}
+}
+
 static bool do_updown_verb(const char *verb,
 			   const struct connection *c,
 			   const struct spd *spd,
@@ -359,22 +1072,18 @@ static bool do_updown_verb(const char *verb,
 	}
 
 	/* must free */
-	char *cmd = alloc_printf("2>&1 "      /* capture stderr along with stdout */
-				 "PLUTO_VERB='%s%s' "
-				 "%s"         /* other stuff */
-				 "%s",        /* actual script */
+	char *env = alloc_printf("PLUTO_VERB='%s%s' "
+				 "%s",        /* other stuff */
 				 verb, verb_suffix,
-				 common_shell_out_str,
-				 c->local->config->child.updown);
-	if (cmd == NULL) {
+				 common_shell_out_str);
+	if (env == NULL) {
 		vlog("%s%s command too long!", verb,
 		     verb_suffix);
 		return false;
 	}
 
-	bool ok = server_run(verb, verb_suffix, cmd, verbose);
-	pfree(cmd);
-	return ok;
+	return run_updown_command(c, verb, verb_suffix, &env,
+				  c->local->config->child.updown, verbose);
 }
 
 static bool do_updown_1(enum updown updown_verb,
@@ -77,4 +77,10 @@ void do_updown_unroute_spd(const struct spd *spd, const struct spd_owner *owner,
 			   struct child_sa *child, struct logger *logger,
 			   struct updown_env);
 
+/* asynchronous updown (updown-concurrency=) */
+struct show;
+void show_updown_queue(struct show *s);
+void clear_updown_queue_stats(void);
+void free_updown_queue(struct logger *logger);
+
 #endif
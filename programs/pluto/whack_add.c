@@ -14,6 +14,9 @@
  *
  */
 
+#include <errno.h>
+#include <sys/socket.h>	/* for recv() */
+
 #include "lswlog.h"	/* for RC_FATAL */
 #include "whack.h"
 
@@ -21,6 +24,9 @@
 #include "show.h"
 #include "connections.h"
 #include "whack_delete.h"
+#include "fd.h"
+#include "server.h"		/* for attach_fd_read_listener() */
+#include "log.h"		/* for clone_logger() */
 
 PRINTF_LIKE(3)
 static void llog_add_connection_failed(const struct whack_message *wm,
@@ -61,7 +67,7 @@ struct subnets {
 static bool parse_subnets(struct subnets *sn,
 			  const struct whack_message *wm,
 			  const struct whack_end *end,
-			  struct logger *logger)
+			  struct logger *error_logger)
 {
 	*sn = (struct subnets) {
 		.name = wm->name,
@@ -76,13 +82,13 @@ static bool parse_subnets(struct subnets *sn,
 		err_t e = ttosubnet_num(shunk1(end->subnet), /*afi*/NULL,
 					&subnet, &nonzero_host);
 		if (e != NULL) {
-			llog_add_connection_failed(wm, logger, 
+			llog_add_connection_failed(wm, error_logger, 
 						   "%ssubnet=%s invalid, %s",
 						   end->leftright, end->subnet, e);
 			return false;
 		}
 		if (nonzero_host.ip.is_set) {
-			llog_add_connection_failed(wm, logger,
+			llog_add_connection_failed(wm, error_logger,
 						   "%ssubnet=%s contains non-zero host identifier",
 						   end->leftright, end->subnet);
 			return false;
@@ -95,7 +101,7 @@ static bool parse_subnets(struct subnets *sn,
 	if (end->subnets != NULL) {
 		diag_t d = ttosubnets_num(shunk1(end->subnets), /*afi*/NULL, &subnets);
 		if (d != NULL) {
-			llog_add_connection_failed(wm, logger,
+			llog_add_connection_failed(wm, error_logger,
 						   "%ssubnets=%s invalid, %s",
 						   end->leftright, end->subnets,
 						   str_diag(d));
@@ -167,10 +173,11 @@ static const struct ip_info *next_subnet(char **subnetstr,
  *
  */
 
-static void permutate_connection_subnets(const struct whack_message *wm,
+static bool permutate_connection_subnets(const struct whack_message *wm,
 					 const struct subnets *left,
 					 const struct subnets *right,
-					 struct logger *logger)
+					 struct logger *logger,
+					 struct logger *error_logger)
 {
 	/*
 	 * The first combination is the current leftsubnet/rightsubnet
@@ -244,12 +251,12 @@ static void permutate_connection_subnets(const struct whack_message *wm,
 			    right_afi == NULL) {
 				diag_t d = add_connection(&wam, logger);
 				if (d != NULL) {
-					llog_add_connection_failed(&wam, logger, "%s", str_diag(d));
+					llog_add_connection_failed(&wam, error_logger, "%s", str_diag(d));
 					pfree_diag(&d);
 					pfreeany(name);
 					pfreeany(left_subnet);
 					pfreeany(right_subnet);
-					return;
+					return false;
 				}
 			} else {
 				PEXPECT(logger, (wam.end[LEFT_END].subnet != NULL &&
@@ -265,9 +272,17 @@ static void permutate_connection_subnets(const struct whack_message *wm,
 		}
 	}
 
+	return true;
 }
 
-static void add_connections(const struct whack_message *wm, struct logger *logger)
+/*
+ * Add WM's connection(s).  Logging of the added connections goes to
+ * LOGGER, and failures to ERROR_LOGGER.
+ */
+
+static bool add_connections(const struct whack_message *wm,
+			    struct logger *logger,
+			    struct logger *error_logger)
 {
 	/*
 	 * Reject {left,right}subnets=... combined with
@@ -288,11 +303,11 @@ static void add_connections(const struct whack_message *wm, struct logger *logge
 				continue;
 			}
 			/* have subnets=.. and subnet=a,b... */
-			llog_add_connection_failed(wm, logger,
+			llog_add_connection_failed(wm, error_logger,
 						   "multi-selector %ssubnet=\"%s\" combined with %ssubnets=\"%s\"",
 						   subnet->leftright, subnet->subnet,
 						   subnets->leftright, subnets->subnets);
-			return;
+			return false;
 		}
 	}
 
@@ -300,28 +315,30 @@ static void add_connections(const struct whack_message *wm, struct logger *logge
 	if (!have_subnets) {
 		diag_t d = add_connection(wm, logger);
 		if (d != NULL) {
-			llog_add_connection_failed(wm, logger, "%s", str_diag(d));
+			llog_add_connection_failed(wm, error_logger, "%s", str_diag(d));
 			pfree_diag(&d);
+			return false;
 		}
-		return;
+		return true;
 	}
 
 	struct subnets left = {0};
-	if (!parse_subnets(&left, wm, &wm->end[LEFT_END], logger)) {
+	if (!parse_subnets(&left, wm, &wm->end[LEFT_END], error_logger)) {
 		pfreeany(left.subnets.list);
-		return;
+		return false;
 	}
 
 	struct subnets right = {0};
-	if (!parse_subnets(&right, wm, &wm->end[RIGHT_END], logger)) {
+	if (!parse_subnets(&right, wm, &wm->end[RIGHT_END], error_logger)) {
 		pfreeany(left.subnets.list);
 		pfreeany(right.subnets.list);
-		return;
+		return false;
 	}
 
-	permutate_connection_subnets(wm, &left, &right, logger);
+	bool ok = permutate_connection_subnets(wm, &left, &right, logger, error_logger);
 	pfreeany(left.subnets.list);
 	pfreeany(right.subnets.list);
+	return ok;
 }
 
 void whack_add(const struct whack_message *wm, struct show *s)
@@ -368,5 +385,257 @@ void whack_add(const struct whack_message *wm, struct show *s)
 		break;
 	}
 
-	add_connections(wm, show_logger(s));
+	add_connections(wm, show_logger(s), show_logger(s));
+}
+
+/*
+ * Bulk add; see whack.h.
+ *
+ * The header has already been read (and unpacked); the stream of
+ * length-prefixed records is read by an event-loop listener, and
+ * the connections added a batch at a time, so that pluto keeps
+ * processing IKE while the records trickle in.  Per-connection
+ * chatter is only logged, leaving whack with just the failures and a
+ * summary.
+ *
+ * Should the sender go quiet for WHACK_BULK_TIMEOUT_SECS the session
+ * is aborted.
+ */
+
+#define WHACK_BULK_TIMEOUT_SECS 5
+#define WHACK_BULK_INPUT (2 * (sizeof(uint32_t) + sizeof(struct whack_message)))
+
+struct bulk_add {
+	struct fd *whackfd;
+	struct logger *logger;
+	struct fd_read_listener *listener;
+	struct timeout *timeout;
+	size_t skip;			/* rest of the header */
+	unsigned nr;			/* batched */
+	unsigned received;
+	unsigned added;
+	unsigned failed;
+	struct whack_message batch[WHACK_BULK_BATCH];
+	size_t start, end;		/* unparsed input */
+	uint8_t input[WHACK_BULK_INPUT];
+	struct bulk_add *next;
+};
+
+static struct bulk_add *bulk_adds;
+
+PRINTF_LIKE(2)
+static void llog_bulk_add_failed(struct logger *logger, const char *fmt, ...)
+{
+	LLOG_JAMBUF(RC_BADWHACKMESSAGE, logger, buf) {
+		jam_string(buf, "bulk add: ");
+		va_list ap;
+		va_start(ap, fmt);
+		jam_va_list(buf, fmt, ap);
+		va_end(ap);
+	}
+}
+
+static void add_bulk_batch(struct bulk_add *b)
+{
+	struct logger quiet_logger = *b->logger;
+	quiet_logger.whackfd[0] = NULL;
+	quiet_logger.whackfd[1] = NULL;
+
+	unsigned added = 0;
+	struct show *quiet = alloc_show(&quiet_logger);
+	for (unsigned i = 0; i < b->nr; i++) {
+		const struct whack_message *wm = &b->batch[i];
+		/* "ipsec add" semantics, see whack_add() */
+		whack_addconn_delete(wm, quiet);
+		if (connection_with_name_exists(wm->name)) {
+			llog_pexpect(b->logger, HERE,
+				     "attempt to redefine connection \"%s\"", wm->name);
+			continue;
+		}
+		if (add_connections(wm, &quiet_logger, b->logger)) {
+			added++;
+		}
+	}
+	free_show(&quiet);
+
+	b->added += added;
+	b->failed += b->nr - added;
+	b->nr = 0;
+}
+
+static void free_bulk_add(struct bulk_add **bp)
+{
+	struct bulk_add *b = *bp;
+	*bp = b->next;
+	detach_fd_read_listener(&b->listener);
+	destroy_timeout(&b->timeout);
+	free_logger(&b->logger, HERE);
+	fd_delref(&b->whackfd);
+	pfree(b);
+}
+
+/*
+ * Add what was received, even when the stream was broken, and send
+ * the summary.  Releasing the whack FD lets whack exit.
+ */
+
+static void end_bulk_add(struct bulk_add *b, bool ok)
+{
+	add_bulk_batch(b);
+
+	struct show *s = alloc_show(b->logger);
+	whack_log(RC_LOG, s, "bulk add: received %u connections%s; added %u; failed %u",
+		  b->received, (ok ? "" : " (stream aborted)"), b->added, b->failed);
+	free_show(&s);
+
+	struct bulk_add **bp = &bulk_adds;
+	while (*bp != b) {
+		bp = &(*bp)->next;
+	}
+	free_bulk_add(bp);
+}
+
+static void bulk_add_timeout(void *arg, const struct timer_event *event UNUSED)
+{
+	struct bulk_add *b = arg;
+	destroy_timeout(&b->timeout);
+	llog_bulk_add_failed(b->logger, "timed out after %ds, missing %zu bytes",
+			     WHACK_BULK_TIMEOUT_SECS,
+			     (b->skip > 0 ? b->skip : sizeof(uint32_t)));
+	end_bulk_add(b, false);
+}
+
+/*
+ * Parse the complete records in the input buffer; returns false once
+ * the session has ended.
+ */
+
+static bool parse_bulk_records(struct bulk_add *b)
+{
+	while (true) {
+		if (b->skip > 0) {
+			size_t skip = min(b->skip, b->end - b->start);
+			b->start += skip;
+			b->skip -= skip;
+			if (b->skip > 0) {
+				return true;
+			}
+		}
+
+		uint32_t len;
+		if (b->end - b->start < sizeof(len)) {
+			return true;
+		}
+		memcpy(&len, b->input + b->start, sizeof(len));
+		if (len == 0) {
+			end_bulk_add(b, true);
+			return false;
+		}
+		if (len > sizeof(struct whack_message)) {
+			llog_bulk_add_failed(b->logger, "record %u has %u bytes, larger than %zu",
+					     b->received + 1, len, sizeof(struct whack_message));
+			end_bulk_add(b, false);
+			return false;
+		}
+		if (b->end - b->start < sizeof(len) + len) {
+			return true;
+		}
+
+		b->received++;
+		struct whack_message *wm = &b->batch[b->nr];
+		zero(wm);
+		memcpy(wm, b->input + b->start + sizeof(len), len);
+		b->start += sizeof(len) + len;
+
+		struct whackpacker wp = {
+			.msg = wm,
+			.n = len,
+		};
+		diag_t d = unpack_whack_msg(&wp, b->logger);
+		if (d != NULL) {
+			llog_bulk_add_failed(b->logger, "record %u: %s", b->received, str_diag(d));
+			pfree_diag(&d);
+			b->failed++;
+			continue;
+		}
+		if (wm->whack_command != WHACK_ADD || wm->name == NULL) {
+			llog_bulk_add_failed(b->logger, "record %u is not a named connection", b->received);
+			b->failed++;
+			continue;
+		}
+
+		if (++b->nr == WHACK_BULK_BATCH) {
+			add_bulk_batch(b);
+		}
+	}
+}
+
+/*
+ * Each call reads at most WHACK_BULK_INPUT bytes, bounding how long
+ * the event-loop is held up.
+ */
+
+static void bulk_add_read(int fd, void *arg, struct logger *logger UNUSED)
+{
+	struct bulk_add *b = arg;
+
+	if (b->start > 0) {
+		memmove(b->input, b->input + b->start, b->end - b->start);
+		b->end -= b->start;
+		b->start = 0;
+	}
+
+	ssize_t n = recv(fd, b->input + b->end, sizeof(b->input) - b->end, MSG_DONTWAIT);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+			return;
+		}
+		llog_error(b->logger, errno, "bulk add: read() failed");
+		end_bulk_add(b, false);
+		return;
+	}
+	if (n == 0) {
+		llog_bulk_add_failed(b->logger, "truncated stream, missing %zu bytes",
+				     (b->skip > 0 ? b->skip : sizeof(uint32_t)));
+		end_bulk_add(b, false);
+		return;
+	}
+	b->end += n;
+
+	if (parse_bulk_records(b)) {
+		destroy_timeout(&b->timeout);
+		schedule_timeout("bulk add", &b->timeout,
+				 deltatime(WHACK_BULK_TIMEOUT_SECS),
+				 bulk_add_timeout, b);
+	}
+}
+
+void whack_add_bulk(const struct whack_message *header, size_t header_len,
+		    struct fd *whackfd, struct show *s)
+{
+	struct bulk_add *b = alloc_thing(struct bulk_add, "bulk add");
+	b->whackfd = fd_addref(whackfd);
+	b->logger = clone_logger(show_logger(s), HERE);
+	/*
+	 * The header is always sent in full; discard what the
+	 * initial read didn't see.
+	 */
+	b->skip = sizeof(*header) - header_len;
+	b->next = bulk_adds;
+	bulk_adds = b;
+
+	attach_fd_read_listener(&b->listener, fd_fileno(whackfd), "bulk add",
+				bulk_add_read, b);
+	schedule_timeout("bulk add", &b->timeout,
+			 deltatime(WHACK_BULK_TIMEOUT_SECS),
+			 bulk_add_timeout, b);
+}
+
+void free_whack_bulk_adds(struct logger *logger)
+{
+	while (bulk_adds != NULL) {
+		ldbg(logger, "bulk add: abandoned after %u connections",
+		     bulk_adds->received);
+		free_bulk_add(&bulk_adds);
+	}
 }
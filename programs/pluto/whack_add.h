@@ -19,7 +19,13 @@
 
 struct whack_message;
 struct show;
+struct fd;
+struct logger;
 
 void whack_add(const struct whack_message *m, struct show *s);
+/* finishes after the call returns; S's whack stays attached until then */
+void whack_add_bulk(const struct whack_message *header, size_t header_len,
+		    struct fd *whackfd, struct show *s);
+void free_whack_bulk_adds(struct logger *logger); /* before free_whack_outputs() */
 
 #endif
@@ -159,6 +159,8 @@ static void show_brief_connection_statuses(struct show *s)
 	int count = 0;
 	int active = 0;
 
+	/* one kernel dump for all the Child SAs */
+	begin_ipsec_traffic_sweep(show_logger(s));
 	struct connections *connections = sort_connections();
 	ITEMS_FOR_EACH(cp, connections) {
 		count++;
@@ -169,6 +171,7 @@ static void show_brief_connection_statuses(struct show *s)
 		}
 	}
 	pfree(connections);
+	end_ipsec_traffic_sweep();
 
 	show(s, "# Total IPsec connections: loaded %d, active %d",
 		     count, active);
@@ -33,6 +33,7 @@
  */
 
 #include "whack_connectionstatus.h"
+#include "whack_status.h"		/* for whack_dump_connection_statuses() */
 
 #include "visit_connection.h"
 
@@ -1064,32 +1065,67 @@ static void show_connection_status(struct show *s, const struct connection *c)
 	show_kernel_alg_connection(s, c);
 }
 
-void show_connection_statuses(struct show *s)
-{
-	show_separator(s);
-	show(s, "Connection list:");
-	show_separator(s);
+/*
+ * The sorted connections are remembered by serial number as they can
+ * be deleted between slices.
+ */
+
+struct connection_statuses {
+	unsigned loaded;
+	unsigned next;
+	unsigned routed;
+	unsigned active;
+	co_serial_t serialno[];
+};
 
-	unsigned active = 0;
-	unsigned routed = 0;
+bool show_connection_statuses(struct show *s, struct connection_statuses **cursor)
+{
+	if (*cursor == NULL) {
+		show_separator(s);
+		show(s, "Connection list:");
+		show_separator(s);
+
+		struct connections *connections = sort_connections();
+		*cursor = overalloc_thing(struct connection_statuses,
+					  connections->len * sizeof(co_serial_t));
+		(*cursor)->loaded = connections->len;
+		for (unsigned i = 0; i < connections->len; i++) {
+			(*cursor)->serialno[i] = connections->item[i]->serialno;
+		}
+		pfree(connections);
+	}
 
-	struct connections *connections = sort_connections();
-	ITEMS_FOR_EACH(cp, connections) {
-		const struct connection *c = (*cp);
+	struct connection_statuses *cs = *cursor;
+	for (unsigned n = 0; n < SHOW_SLICE && cs->next < cs->loaded; n++) {
+		const struct connection *c = connection_by_serialno(cs->serialno[cs->next++]);
+		if (c == NULL) {
+			/* deleted since the listing started */
+			continue;
+		}
 		if (kernel_route_installed(c)) {
-			routed++;
+			cs->routed++;
 		}
 		if (c->routing.state == RT_ROUTED_TUNNEL) {
-			active++;
+			cs->active++;
 		}
 		show_connection_status(s, c);
 	}
 
+	if (cs->next < cs->loaded) {
+		return true;
+	}
+
 	show_separator(s);
 	show(s, "Total IPsec connections: loaded %u, routed %u, active %u",
-	     connections->len, routed, active);
+	     cs->loaded, cs->routed, cs->active);
+
+	free_connection_statuses(cursor);
+	return false;
+}
 
-	pfree(connections);
+void free_connection_statuses(struct connection_statuses **cursor)
+{
+	pfreeany(*cursor);
 }
 
 static unsigned whack_connection_status(const struct whack_message *m UNUSED,
@@ -1103,7 +1139,7 @@ static unsigned whack_connection_status(const struct whack_message *m UNUSED,
 void whack_connectionstatus(const struct whack_message *m, struct show *s)
 {
 	if (m->name == NULL) {
-		show_connection_statuses(s);
+		whack_dump_connection_statuses(s);
 		return;
 	}
 
@@ -25,9 +25,16 @@ struct jambuf;
 struct spd_end;
 struct connection;
 struct host_end;
+struct connection_statuses;
 
 void whack_connectionstatus(const struct whack_message *wm, struct show *s);
-void show_connection_statuses(struct show *s);
+
+/*
+ * Show SHOW_SLICE connections starting at *CURSOR (NULL for the
+ * first call); returns true while there are more to show.
+ */
+bool show_connection_statuses(struct show *s, struct connection_statuses **cursor);
+void free_connection_statuses(struct connection_statuses **cursor);
 
 /*
  * Format the topology of a connection end, leaving out defaults.
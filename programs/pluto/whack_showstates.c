@@ -407,28 +407,74 @@ static void show_pending_child_details(struct show *s,
 	}
 }
 
-void show_states(struct show *s, const monotime_t now)
-{
-	show_separator(s);
-	struct state **array = sort_states(HERE);
-
-	if (array != NULL) {
-		/* now print sorted results */
-		int i;
-		for (i = 0; array[i] != NULL; i++) {
-			struct state *st = array[i];
-			show_state(s, st, now);
-			if (IS_IPSEC_SA_ESTABLISHED(st)) {
-				/* print out SPIs if SAs are established */
-				struct child_sa *child = pexpect_child_sa(st);
-				show_established_child_details(s, child, now);
-			}  else if (IS_IKE_SA(st)) {
-				/* show any associated pending Phase 2s */
-				struct ike_sa *ike = pexpect_ike_sa(st);
-				show_pending_child_details(s, ike);
-			}
+/*
+ * The sorted states are remembered by serial number as they can be
+ * deleted between slices.
+ */
+
+struct show_states {
+	struct traffic_cache *traffic;	/* one kernel dump for the lot */
+	unsigned len;
+	unsigned next;
+	so_serial_t serialno[];
+};
 
+bool show_states(struct show *s, const monotime_t now, struct show_states **cursor)
+{
+	if (*cursor == NULL) {
+		show_separator(s);
+		struct state **array = sort_states(HERE);
+		if (array == NULL) {
+			return false;
+		}
+		unsigned len = 0;
+		while (array[len] != NULL) {
+			len++;
+		}
+		*cursor = overalloc_thing(struct show_states,
+					  len * sizeof(so_serial_t));
+		(*cursor)->len = len;
+		for (unsigned i = 0; i < len; i++) {
+			(*cursor)->serialno[i] = array[i]->st_serialno;
 		}
 		pfree(array);
+		(*cursor)->traffic = snapshot_ipsec_traffic(show_logger(s));
+	}
+
+	struct show_states *ss = *cursor;
+	begin_ipsec_traffic_snapshot_sweep(ss->traffic);
+	for (unsigned n = 0; n < SHOW_SLICE && ss->next < ss->len; n++) {
+		struct state *st = state_by_serialno(ss->serialno[ss->next++]);
+		if (st == NULL) {
+			/* deleted since the listing started */
+			continue;
+		}
+		show_state(s, st, now);
+		if (IS_IPSEC_SA_ESTABLISHED(st)) {
+			/* print out SPIs if SAs are established */
+			struct child_sa *child = pexpect_child_sa(st);
+			show_established_child_details(s, child, now);
+		}  else if (IS_IKE_SA(st)) {
+			/* show any associated pending Phase 2s */
+			struct ike_sa *ike = pexpect_ike_sa(st);
+			show_pending_child_details(s, ike);
+		}
+	}
+	end_ipsec_traffic_snapshot_sweep(ss->traffic);
+
+	if (ss->next < ss->len) {
+		return true;
+	}
+
+	free_show_states(cursor);
+	return false;
+}
+
+void free_show_states(struct show_states **cursor)
+{
+	if (*cursor != NULL) {
+		free_ipsec_traffic_snapshot(&(*cursor)->traffic);
+		pfree(*cursor);
+		*cursor = NULL;
 	}
 }
@@ -20,7 +20,13 @@
 
 struct show;
 struct whack_message;
+struct show_states;
 
-void show_states(struct show *s, monotime_t now);
+/*
+ * Show SHOW_SLICE states starting at *CURSOR (NULL for the first
+ * call); returns true while there are more to show.
+ */
+bool show_states(struct show *s, monotime_t now, struct show_states **cursor);
+void free_show_states(struct show_states **cursor);
 
 #endif
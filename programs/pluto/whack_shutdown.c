@@ -54,16 +54,21 @@
 #ifdef USE_DNSSEC
 #include "dnssec.h"		/* for unbound_ctx_free() */
 #endif
-#include "demux.h"		/* for free_demux() */
+#include "demux.h"		/* for free_md_pool() */
 #include "impair_message.h"	/* for free_impair_message() */
 #include "state_db.h"		/* for check_state_db() */
 #include "connection_db.h"	/* for check_connection_db() */
 #include "ikev2_ike_session_resume.h"	/* for shutdown_ike_session_resume() */
 #include "spd_db.h"	/* for check_spd_db() */
 #include "server_fork.h"	/* for check_server_fork() */
+#include "updown.h"		/* for free_updown_queue() */
 #include "pending.h"
 #include "connection_event.h"
 #include "terminate.h"
+#include "hash_table.h"		/* for free_hash_tables() */
+#include "ddos.h"		/* for free_ddos() */
+#include "whack_status.h"	/* for free_whack_dumps() */
+#include "whack_add.h"		/* for free_whack_bulk_adds() */
 
 volatile bool exiting_pluto = false;
 static enum pluto_exit_code pluto_exit_code;
@@ -152,6 +157,7 @@ void exit_epilogue(void)
 	struct logger logger[1] = { global_logger, };
 
 	if (pluto_leave_state) {
+		free_whack_outputs(logger);
 		shutdown_nss();
 		free_preshared_secrets(logger);
 		delete_lock_file();	/* delete any lock files */
@@ -167,6 +173,7 @@ void exit_epilogue(void)
 	 */
 	state_db_check(logger);
 	connection_db_check(logger);
+	connection_alias_db_check(logger);
 	spd_db_check(logger);
 	check_server_fork(logger); /*pid_entry_db_check()*/
 
@@ -175,6 +182,7 @@ void exit_epilogue(void)
 	 * revivals, ...
 	 */
 	delete_every_connection(logger);
+	free_updown_queue(logger);	/* after connections run down */
 
 	free_server_helper_jobs(logger);
 
@@ -210,13 +218,20 @@ void exit_epilogue(void)
 	unbound_ctx_free();	/* needs event-loop aka server */
 #endif
 
+	free_ddos(logger);
+	free_hash_tables(logger);	/* before the timer goes */
+	free_whack_dumps(logger);	/* before free_whack_outputs() */
+	free_whack_bulk_adds(logger);	/* before free_whack_outputs() */
+
 	/*
 	 * No libevent events beyond this point.
 	 */
+	free_whack_outputs(logger);
 	free_server();
 
 	free_virtual_ip();	/* virtual_private= */
 	free_pluto_main();	/* our static chars */
+	free_md_pool(logger);	/* after the last message */
 
 	/* report memory leaks now, after all free_* calls */
 	if (leak_detective) {
@@ -47,6 +47,10 @@
 #include "whack_status.h"
 #include "whack_connectionstatus.h"	/* for show_connection_statuses() */
 #include "whack_showstates.h"
+#include "hash_table.h"		/* for show_hash_tables() */
+#include "server_pool.h"		/* for show_server_helpers() */
+#include "updown.h"		/* for show_updown_queue() */
+#include "demux.h"		/* for show_md_pool() */
 
 static void show_system_security(struct show *s)
 {
@@ -68,10 +72,14 @@ static void show_system_security(struct show *s)
 void whack_globalstatus(const struct whack_message *wm, struct show *s)
 {
 	show_globalstate_status(s);
+	show_hash_tables(s);
+	show_server_helpers(s);
+	show_updown_queue(s);
+	show_md_pool(s);
 	whack_showstats(wm, s);
 }
 
-void whack_status(struct show *s, const monotime_t now)
+static void show_status_header(struct show *s)
 {
 	show_kernel_interface(s);
 	show_ifaces_status(s);
@@ -83,8 +91,168 @@ void whack_status(struct show *s, const monotime_t now)
 	show_kernel_alg_status(s);
 	show_ike_alg_status(s);
 	show_db_ops_status(s);
-	show_connection_statuses(s);
-	whack_briefstatus(NULL/*wm:ignored*/, s);
-	show_states(s, now);
-	whack_shuntstatus(NULL/*wm:ignored*/, s);
+}
+
+/*
+ * With thousands of connections and states, a dump is megabytes of
+ * output.  Rather than produce it all in one go, stalling the
+ * event-loop (and then everything else behind whack's socket), it is
+ * produced SHOW_SLICE connections or states at a time with a yield to
+ * the event-loop in between.  When whack isn't keeping up, the dump
+ * also backs off so that the output buffer doesn't grow without
+ * bound.
+ *
+ * The dump's logger holds references to the whack FDs, so whack only
+ * sees EOF once the last slice has been written.
+ */
+
+#define WHACK_DUMP_BACKLOG (1024 * 1024)	/* bytes */
+#define WHACK_DUMP_BACKOFF_MS 10
+
+enum whack_dump_step {
+	DUMP_DONE = 0,
+	DUMP_STATUS_HEADER,
+	DUMP_CONNECTION_STATUSES,
+	DUMP_BRIEFSTATUS,
+	DUMP_STATES,
+	DUMP_SHUNTSTATUS,
+};
+
+static const enum whack_dump_step status_steps[] = {
+	DUMP_STATUS_HEADER,
+	DUMP_CONNECTION_STATUSES,
+	DUMP_BRIEFSTATUS,
+	DUMP_STATES,
+	DUMP_SHUNTSTATUS,
+	DUMP_DONE,
+};
+
+static const enum whack_dump_step connection_statuses_steps[] = {
+	DUMP_CONNECTION_STATUSES,
+	DUMP_DONE,
+};
+
+static const enum whack_dump_step states_steps[] = {
+	DUMP_STATES,
+	DUMP_DONE,
+};
+
+struct whack_dump {
+	struct logger *logger;
+	struct show *s;
+	const enum whack_dump_step *step;
+	struct connection_statuses *connection_statuses;
+	struct show_states *show_states;
+	struct timeout *timeout;
+	struct whack_dump *next;
+};
+
+static struct whack_dump *whack_dumps;
+
+/*
+ * Returns true when there is more to do.
+ */
+
+static bool whack_dump_slice(struct whack_dump *d)
+{
+	switch (*d->step) {
+	case DUMP_STATUS_HEADER:
+		show_status_header(d->s);
+		break;
+	case DUMP_CONNECTION_STATUSES:
+		if (show_connection_statuses(d->s, &d->connection_statuses)) {
+			return true;
+		}
+		break;
+	case DUMP_BRIEFSTATUS:
+		whack_briefstatus(NULL/*wm:ignored*/, d->s);
+		break;
+	case DUMP_STATES:
+		if (show_states(d->s, mononow(), &d->show_states)) {
+			return true;
+		}
+		break;
+	case DUMP_SHUNTSTATUS:
+		whack_shuntstatus(NULL/*wm:ignored*/, d->s);
+		break;
+	case DUMP_DONE:
+		return false;
+	}
+	d->step++;
+	return (*d->step != DUMP_DONE);
+}
+
+static void free_whack_dump(struct whack_dump **dp)
+{
+	struct whack_dump *d = *dp;
+	*dp = d->next;
+	destroy_timeout(&d->timeout);
+	free_connection_statuses(&d->connection_statuses);
+	free_show_states(&d->show_states);
+	free_show(&d->s);
+	free_logger(&d->logger, HERE);
+	pfree(d);
+}
+
+static void whack_dump_timeout(void *arg, const struct timer_event *event UNUSED);
+
+static void run_whack_dump(struct whack_dump *d)
+{
+	if (whack_dump_slice(d)) {
+		deltatime_t delay =
+			(whack_output_backlog(d->logger) > WHACK_DUMP_BACKLOG
+			 ? deltatime_from_milliseconds(WHACK_DUMP_BACKOFF_MS)
+			 : deltatime(0));
+		schedule_timeout("whack dump", &d->timeout, delay,
+				 whack_dump_timeout, d);
+		return;
+	}
+
+	struct whack_dump **dp = &whack_dumps;
+	while (*dp != d) {
+		dp = &(*dp)->next;
+	}
+	free_whack_dump(dp);
+}
+
+static void whack_dump_timeout(void *arg, const struct timer_event *event UNUSED)
+{
+	struct whack_dump *d = arg;
+	destroy_timeout(&d->timeout);
+	run_whack_dump(d);
+}
+
+static void start_whack_dump(struct show *s, const enum whack_dump_step *steps)
+{
+	struct whack_dump *d = alloc_thing(struct whack_dump, "whack dump");
+	d->logger = clone_logger(show_logger(s), HERE);
+	d->s = alloc_show(d->logger);
+	d->step = steps;
+	d->next = whack_dumps;
+	whack_dumps = d;
+	/* the first slice is immediate */
+	run_whack_dump(d);
+}
+
+void whack_status(struct show *s)
+{
+	start_whack_dump(s, status_steps);
+}
+
+void whack_dump_connection_statuses(struct show *s)
+{
+	start_whack_dump(s, connection_statuses_steps);
+}
+
+void whack_dump_states(struct show *s)
+{
+	start_whack_dump(s, states_steps);
+}
+
+void free_whack_dumps(struct logger *logger)
+{
+	while (whack_dumps != NULL) {
+		ldbg(logger, "whack dump: abandoned");
+		free_whack_dump(&whack_dumps);
+	}
 }
@@ -24,8 +24,17 @@
 
 struct show;
 struct whack_message;
+struct logger;
 
-void whack_status(struct show *s, const monotime_t now);
 void whack_globalstatus(const struct whack_message *wm, struct show *s);
 
+/*
+ * These run from the event-loop, a slice at a time, and finish after
+ * the call returns; S's whack stays attached until they do.
+ */
+void whack_status(struct show *s);
+void whack_dump_connection_statuses(struct show *s);
+void whack_dump_states(struct show *s);
+void free_whack_dumps(struct logger *logger); /* before free_whack_outputs() */
+
 #endif
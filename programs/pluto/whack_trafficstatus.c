@@ -181,11 +181,14 @@ static unsigned whack_trafficstatus_connection(const struct whack_message *m UNU
 void whack_trafficstatus(const struct whack_message *m, struct show *s)
 {
 	if (m->name == NULL) {
+		/* one kernel dump for all the Child SAs */
+		begin_ipsec_traffic_sweep(show_logger(s));
 		struct connections *connections = sort_connections();
 		ITEMS_FOR_EACH(cp, connections) {
 			whack_trafficstatus_connection(m, s, (*cp));
 		}
 		pfree(connections);
+		end_ipsec_traffic_sweep();
 		return;
 	}
 
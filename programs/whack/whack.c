@@ -202,7 +202,7 @@ static void help(void)
 		"socket errqueue: whack --ike-socket-errqueue-toggle\n"
 		"\n"
 		"ddos-protection: whack (--ddos-busy | --ddos-unlimited | \\\n"
-		"	--ddos-auto)\n"
+		"	--ddos-auto) | --ddos-status\n"
 		"\n"
 		"list: whack [--utc] [--checkpubkeys] [--listpubkeys] [--listcerts] \\\n"
 		"	[--listcacerts] [--listcrls] [--listpsks] [--listevents] [--listall]\n"
@@ -409,6 +409,7 @@ enum opt {
 	OPT_DDOS_BUSY,
 	OPT_DDOS_UNLIMITED,
 	OPT_DDOS_AUTO,
+	OPT_DDOS_STATUS,
 
 	OPT_DDNS,
 
@@ -711,6 +712,7 @@ const struct option optarg_options[] = {
 	{ REPLACE_OPT("ddos-busy", "ddos-mode", "5.3"), no_argument, NULL, OPT_DDOS_BUSY },
 	{ REPLACE_OPT("ddos-unlimited", "ddos-mode", "5.3"), no_argument, NULL, OPT_DDOS_UNLIMITED },
 	{ REPLACE_OPT("ddos-auto", "ddos-mode", "5.3"), no_argument, NULL, OPT_DDOS_AUTO },
+	{ "ddos-status\0", no_argument, NULL, OPT_DDOS_STATUS },
 
 	{ "ddns\0", no_argument, NULL, OPT_DDNS },
 
@@ -1293,6 +1295,10 @@ int main(int argc, char **argv)
 			whack_command(&msg, WHACK_DDOS);
 			msg.whack.ddos.mode = DDOS_AUTO;
 			continue;
+		case OPT_DDOS_STATUS:	/* --ddos-status */
+			whack_command(&msg, WHACK_DDOSSTATUS);
+			ignore_errors = true;
+			continue;
 
 		case OPT_DDNS:	/* --ddns */
 			whack_command(&msg, WHACK_DDNS);
@@ -0,0 +1,351 @@
+/* test hash_bytes(), for libreswan
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Library General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/lgpl-2.1.txt>.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+ * License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>		/* for clock_gettime() */
+
+#include "lswcdefs.h"		/* for elemsof() */
+#include "constants.h"		/* for streq() */
+#include "hash_bytes.h"
+#include "lswalloc.h"		/* for leaks */
+#include "lswtool.h"		/* for tool_logger() */
+
+unsigned fails;
+
+#define FAIL(FMT, ...)							\
+	{								\
+		fails++;						\
+		fprintf(stderr, "%s: "FMT"\n", __func__, ##__VA_ARGS__); \
+	}
+
+static const struct hasher {
+	const char *name;
+	hash_t (*hash)(const void *ptr, size_t len, hash_t hash);
+} hashers[] = {
+	{ "unkeyed", hash_unkeyed_bytes, },
+	{ "keyed", hash_bytes, },
+};
+
+/* deterministic pseudo-random input (xorshift64) */
+
+static uint64_t next_rnd(uint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+/*
+ * Keys that look like what pluto hashes: serial numbers (8 bytes),
+ * IKE SPIs (8 or 16 bytes), and IPv6 addresses (16 bytes).
+ *
+ * NR_BUCKETS is the size the state table grows to when holding
+ * NR_KEYS entries.
+ */
+
+#define NR_KEYS 60000
+#define NR_BUCKETS 31999
+
+struct key {
+	uint8_t bytes[16];
+	size_t len;
+};
+
+static const char *const key_kinds[] = {
+	"serialno",
+	"ike-spis",
+	"ipv6-address",
+	"ike-spii-chosen",
+};
+
+/*
+ * Find an SPIi that, with the unkeyed hash, lands in bucket 0.  The
+ * hash is linear so, given the first six bytes, the last two can be
+ * solved for.
+ */
+
+static void chosen_ike_spii(struct key *k, uint64_t *seed)
+{
+	k->len = 8;
+	while (true) {
+		uint64_t rnd = next_rnd(seed);
+		memcpy(k->bytes, &rnd, 6);
+		hash_t prefix = hash_unkeyed_bytes(k->bytes, 6, zero_hash);
+		for (unsigned b6 = 0; b6 < 256; b6++) {
+			unsigned partial = (prefix.hash * 251 + b6) * 251;
+			unsigned b7 = (NR_BUCKETS - partial % NR_BUCKETS) % NR_BUCKETS;
+			if (b7 > 255) {
+				continue;
+			}
+			k->bytes[6] = b6;
+			k->bytes[7] = b7;
+			if (hash_unkeyed_bytes(k->bytes, k->len, zero_hash).hash % NR_BUCKETS == 0) {
+				return;
+			}
+		}
+	}
+}
+
+static void fill_keys(struct key *keys, unsigned kind)
+{
+	uint64_t seed = 0x123456789abcdef;
+	for (unsigned i = 0; i < NR_KEYS; i++) {
+		struct key *k = &keys[i];
+		zero(k);
+		switch (kind) {
+		case 0: /* sequential serial numbers */
+		{
+			uint64_t serialno = i + 1;
+			memcpy(k->bytes, &serialno, sizeof(serialno));
+			k->len = sizeof(serialno);
+			break;
+		}
+		case 1: /* random SPIi+SPIr */
+		{
+			uint64_t spi[2] = { next_rnd(&seed), next_rnd(&seed), };
+			memcpy(k->bytes, spi, sizeof(spi));
+			k->len = sizeof(spi);
+			break;
+		}
+		case 2: /* 2001:db8::/64 with sequential hosts */
+			k->bytes[0] = 0x20; k->bytes[1] = 0x01;
+			k->bytes[2] = 0x0d; k->bytes[3] = 0xb8;
+			k->bytes[14] = i >> 8;
+			k->bytes[15] = i & 0xff;
+			k->len = 16;
+			break;
+		case 3: /* SPIi chosen by a hostile peer */
+			chosen_ike_spii(k, &seed);
+			break;
+		}
+	}
+}
+
+static void check_hash_bytes_alignment(void)
+{
+	uint8_t buf[64 + 8];
+	for (unsigned i = 0; i < sizeof(buf); i++) {
+		buf[i] = i * 7 + 1;
+	}
+	for (size_t len = 0; len <= 64; len++) {
+		uint8_t aligned[64];
+		memcpy(aligned, buf, len);
+		hash_t expected = hash_bytes(aligned, len, zero_hash);
+		for (unsigned offset = 1; offset < 8; offset++) {
+			memmove(buf + offset, aligned, len);
+			hash_t h = hash_bytes(buf + offset, len, zero_hash);
+			if (h.hash != expected.hash) {
+				FAIL("len %zu offset %u: 0x%x != 0x%x",
+				     len, offset, h.hash, expected.hash);
+			}
+		}
+		memcpy(buf, aligned, len);
+	}
+}
+
+static void check_hash_bytes_differ(void)
+{
+	/* every single bit flip, and every length, gives a new hash */
+	uint8_t buf[24] = {0};
+	hash_t seen[elemsof(buf) * 8 + elemsof(buf) + 1];
+	unsigned nr_seen = 0;
+	for (size_t len = 0; len <= sizeof(buf); len++) {
+		seen[nr_seen++] = hash_bytes(buf, len, zero_hash);
+	}
+	for (unsigned bit = 0; bit < sizeof(buf) * 8; bit++) {
+		buf[bit / 8] ^= 1 << (bit % 8);
+		seen[nr_seen++] = hash_bytes(buf, sizeof(buf), zero_hash);
+		buf[bit / 8] ^= 1 << (bit % 8);
+	}
+	for (unsigned i = 0; i < nr_seen; i++) {
+		for (unsigned j = i + 1; j < nr_seen; j++) {
+			if (seen[i].hash == seen[j].hash) {
+				FAIL("hash %u and %u collide: 0x%x", i, j, seen[i].hash);
+			}
+		}
+	}
+}
+
+static void check_hash_bytes_chaining(void)
+{
+	const char a[] = "left";
+	const char b[] = "right";
+	hash_t ab = hash_bytes(b, sizeof(b), hash_bytes(a, sizeof(a), zero_hash));
+	hash_t ba = hash_bytes(a, sizeof(a), hash_bytes(b, sizeof(b), zero_hash));
+	if (ab.hash == ba.hash) {
+		FAIL("chaining is order independent: 0x%x", ab.hash);
+	}
+	hash_t h = hash_bytes(b, sizeof(b), zero_hash);
+	if (ab.hash == h.hash) {
+		FAIL("chaining ignores the previous hash: 0x%x", h.hash);
+	}
+}
+
+static void check_hash_bytes_key(void)
+{
+	const char a[] = "some text";
+	hash_t unkeyed = hash_bytes(a, sizeof(a), zero_hash);
+	struct hash_key key = { .bytes = { 1, 2, 3, 4, }, };
+	init_hash_key(&key);
+	hash_t keyed = hash_bytes(a, sizeof(a), zero_hash);
+	init_hash_key(&(struct hash_key) {0});
+	hash_t again = hash_bytes(a, sizeof(a), zero_hash);
+	if (unkeyed.hash == keyed.hash) {
+		FAIL("key ignored: 0x%x", keyed.hash);
+	}
+	if (unkeyed.hash != again.hash) {
+		FAIL("key not reset: 0x%x != 0x%x", unkeyed.hash, again.hash);
+	}
+}
+
+/*
+ * SipHash-2-4-128 reference vectors: key 00 01 .. 0f, message 00 01
+ * .. LEN-1.
+ */
+
+static void check_mac_bytes(void)
+{
+	static const struct {
+		size_t len;
+		const char *mac;
+	} tests[] = {
+		{ 0, "a3817f04ba25a8e66df67214c7550293", },
+		{ 1, "da87c1d86b99af44347659119b22fc45", },
+		{ 7, "a1f1ebbed8dbc153c0b84aa61ff08239", },
+		{ 8, "3b62a9ba6258f5610f83e264f31497b4", },
+		{ 15, "5493e99933b0a8117e08ec0f97cfc3d9", },
+		{ 63, "5150d1772f50834a503e069a973fbd7c", },
+	};
+
+	struct hash_key key;
+	for (unsigned i = 0; i < sizeof(key.bytes); i++) {
+		key.bytes[i] = i;
+	}
+	uint8_t message[64];
+	for (unsigned i = 0; i < sizeof(message); i++) {
+		message[i] = i;
+	}
+
+	for (unsigned t = 0; t < elemsof(tests); t++) {
+		struct mac_128 mac = mac_bytes(&key, message, tests[t].len);
+		char hex[sizeof(mac.bytes) * 2 + 1];
+		for (unsigned i = 0; i < sizeof(mac.bytes); i++) {
+			snprintf(hex + i * 2, 3, "%02x", mac.bytes[i]);
+		}
+		if (!streq(hex, tests[t].mac)) {
+			FAIL("len %zu: got %s, expecting %s", tests[t].len, hex, tests[t].mac);
+		}
+	}
+}
+
+/*
+ * Load NR_KEYS into NR_BUCKETS buckets and then look each one up,
+ * reporting the bucket distribution, the time to hash, and the time
+ * per lookup.
+ */
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void check_hash_bytes_distribution(void)
+{
+	struct key *keys = alloc_things(struct key, NR_KEYS, "keys");
+	unsigned *next = alloc_things(unsigned, NR_KEYS, "next");
+	unsigned *heads = alloc_things(unsigned, NR_BUCKETS, "heads");
+	unsigned *lengths = alloc_things(unsigned, NR_BUCKETS, "lengths");
+	for (unsigned kind = 0; kind < elemsof(key_kinds); kind++) {
+		fill_keys(keys, kind);
+		for (const struct hasher *h = hashers; h < hashers + elemsof(hashers); h++) {
+			/* chain keys into buckets; 0 is end-of-list */
+			memset(heads, 0, NR_BUCKETS * sizeof(heads[0]));
+			memset(lengths, 0, NR_BUCKETS * sizeof(lengths[0]));
+			for (unsigned i = 0; i < NR_KEYS; i++) {
+				unsigned b = h->hash(keys[i].bytes, keys[i].len, zero_hash).hash % NR_BUCKETS;
+				next[i] = heads[b];
+				heads[b] = i + 1;
+				lengths[b]++;
+			}
+			unsigned longest = 0;
+			for (unsigned b = 0; b < NR_BUCKETS; b++) {
+				longest = max(longest, lengths[b]);
+			}
+			/* just hash */
+			unsigned sink = 0;
+			double start = now_ns();
+			for (unsigned i = 0; i < NR_KEYS; i++) {
+				sink += h->hash(keys[i].bytes, keys[i].len, zero_hash).hash;
+			}
+			double hash_ns = (now_ns() - start) / NR_KEYS;
+			/* hash and walk the bucket */
+			unsigned visited = 0;
+			start = now_ns();
+			for (unsigned i = 0; i < NR_KEYS; i++) {
+				unsigned b = h->hash(keys[i].bytes, keys[i].len, zero_hash).hash % NR_BUCKETS;
+				for (unsigned e = heads[b]; e != 0; e = next[e - 1]) {
+					visited++;
+					if (memcmp(keys[e - 1].bytes, keys[i].bytes, keys[i].len) == 0) {
+						break;
+					}
+				}
+			}
+			double lookup_ns = (now_ns() - start) / NR_KEYS;
+			printf("%-16s %-8s longest bucket %5u visited/lookup %8.2f %6.1f ns/hash %8.1f ns/lookup (%x)\n",
+			       key_kinds[kind], h->name, longest,
+			       (double)visited / NR_KEYS, hash_ns, lookup_ns,
+			       sink & 0xf);
+			/*
+			 * With ~2 keys per bucket, a bucket holding more
+			 * than 16 is a badly skewed hash.
+			 */
+			if (h->hash == hash_bytes && longest > 16) {
+				FAIL("%s: longest bucket %u is too long",
+				     key_kinds[kind], longest);
+			}
+		}
+	}
+	pfree(keys);
+	pfree(next);
+	pfree(heads);
+	pfree(lengths);
+}
+
+int main(int argc, char *argv[])
+{
+	leak_detective = true;
+	struct logger *logger = tool_logger(argc, argv);
+
+	check_hash_bytes_alignment();
+	check_hash_bytes_differ();
+	check_hash_bytes_chaining();
+	check_hash_bytes_key();
+	check_mac_bytes();
+	check_hash_bytes_distribution();
+
+	if (report_leaks(logger)) {
+		fails++;
+	}
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	} else {
+		return 0;
+	}
+}
@@ -0,0 +1,557 @@
+/* test pbs_in_struct() and pbs_out_struct(), for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>		/* for clock_gettime() */
+
+#include "lswcdefs.h"		/* for elemsof() */
+#include "lswalloc.h"		/* for leaks */
+#include "lswtool.h"		/* for tool_logger() */
+#include "chunk.h"		/* for chunk_from_hex() */
+#include "diag.h"
+#include "packet.h"
+
+unsigned fails;
+static struct logger *logger;
+
+#define FAIL(FMT, ...)							\
+	{								\
+		fails++;						\
+		fprintf(stderr, "%s: "FMT"\n", __func__, ##__VA_ARGS__); \
+	}
+
+/*
+ * Messages captured from a PSK IKEv2 exchange between two plutos.
+ */
+
+static const struct message {
+	const char *name;
+	const char *hex;
+} messages[] = {
+	{
+		.name = "IKE_SA_INIT request",
+		.hex =
+		"226afd9906bc7d3300000000000000002120220800000000000002dc22000214"
+		"020000640101000b0300000c01000014800e0100030000080200000703000008"
+		"0200000503000008040000130300000804000014030000080400001503000008"
+		"0400001f0300000804000010030000080400000f030000080400000e00000008"
+		"04000012020000640201000b0300000c01000014800e00800300000802000007"
+		"0300000802000005030000080400001303000008040000140300000804000015"
+		"030000080400001f0300000804000010030000080400000f030000080400000e"
+		"0000000804000012020000600301000b030000080100001c0300000802000007"
+		"0300000802000005030000080400001303000008040000140300000804000015"
+		"030000080400001f0300000804000010030000080400000f030000080400000e"
+		"0000000804000012020000740401000d0300000c0100000c800e010003000008"
+		"020000070300000802000005030000080300000e030000080300000c03000008"
+		"0400001303000008040000140300000804000015030000080400001f03000008"
+		"04000010030000080400000f030000080400000e000000080400001200000074"
+		"0501000d0300000c0100000c800e008003000008020000070300000802000005"
+		"030000080300000e030000080300000c03000008040000130300000804000014"
+		"0300000804000015030000080400001f0300000804000010030000080400000f"
+		"030000080400000e0000000804000012280000480013000088f7074be7022b9b"
+		"4782a9c15a6b666f8c25e7c9563a9b2b6583db32290f3cce6e188dbcc1211f13"
+		"92e98666244407822ccbc5a9618b5dda9052acc2786f49fd29000024b4105de2"
+		"bc201ca4b954e52fa145f5e7dd17a7b514c3c0728eec5915153f929c29000008"
+		"0000402e2900001c00004004c2409961b426e2892f707525c5f632a2208af7b7"
+		"0000001c0000400548abc8f23ab7e1269f48758813dd6a2857ca0b2c",
+	},
+	{
+		.name = "IKE_SA_INIT response",
+		.hex =
+		"226afd9906bc7d3371bb40093191ac1821202220000000000000010622000028"
+		"00000024010100030300000c01000014800e0100030000080200000700000008"
+		"0400001328000048001300009cceb140cc4e1fcc906b3a94d174ac5027233d1b"
+		"09bd525990a05817e30182df9534b6de3e4d195932b7ef4866c0d5d1fd679a93"
+		"f08ade869818a56ea594baf829000024dac50841d9de7912fc3ec7e3814b5ade"
+		"4c2e2164cb9d4ca2e5f8d1ba9ed17758290000080000402e2900000e0000402f"
+		"0002000300042900001c00004004e080ef8d9e7894d7533d7a8466f04ac31045"
+		"99832900001c000040052b507f613c7d5f1f14757c10e2e12c9c8ed5f8680000"
+		"000800004022",
+	},
+	{
+		.name = "IKE_AUTH request",
+		.hex =
+		"226afd9906bc7d3371bb40093191ac182e20230800000001000001a523000189"
+		"4e0f6886a437457039407fa5ed335609a344beeee59e1ddf3de762123d6b0ffb"
+		"45ce869eb5ede4b806f2780b1d8a378bbedbebd4851a064ab6dd9a56303938c4"
+		"a14a3ef6694b545d9421f20d7e5ffd28501e280f9fa8b6ed092eb320a03d8f80"
+		"70621657aab6f810cda58b9aad425aaeb7daad5dc35289145d071b9af37e1811"
+		"ed416e4705480136a18068f9e13e30c8e1116cf87b2db1c51747d40bb41b2912"
+		"9bd3d804b03ceee1552267e44178047d541918df3d2b5b16118463ccc9fbc854"
+		"a071cec0f823db50e424fbb76e1a8dd3307a9b5f93b69e92c98e0c058a832ae0"
+		"04310b73062dadfad61eeec36574f041676c016858ac5426627eeb5cda42071e"
+		"1c69de0af8dea74447966c0f8b88e01d389e822c0f53282842bbc0a1b3073780"
+		"3930e18f6891cea5e847c9eedb1a8cfa55d001d0d6207b60f0318319f473250c"
+		"c0e021ea002e25eda298de61eb80e2d29a3d81d89238859cbb202d8c510f28be"
+		"d0d881f43a4cd35c4df0fc41ee346154e24844872001d8fa7749d38785fb977b"
+		"582ebb6a09",
+	},
+	{
+		.name = "IKE_AUTH response",
+		.hex =
+		"226afd9906bc7d3371bb40093191ac182e202320000000010000009524000079"
+		"57e52a2ff2dc116dc1ddcfa1a18b1173c5e5d581bff4e62e04c3fbba0fc77a8b"
+		"8ddcce3315672fbfeb5abb90d820470158dff9d6dc208f50137a1424926c895f"
+		"ce3df55857d582777b7a5e777d13ec69d23fc91d3f0e228a072a2b6a1952930f"
+		"966214b7182feafd49c77f6b046443bcdc5cd8dd7a",
+	},
+};
+
+/*
+ * The payloads with specialised parsers and emitters; and the
+ * substructures each is found within.
+ */
+
+static const struct hot {
+	struct_desc *sd;
+	struct_desc *within[3];	/* outermost first */
+} hots[] = {
+	{ .sd = &isakmp_hdr_desc, },
+	{ .sd = &ikev2_sa_desc, },
+	{ .sd = &ikev2_prop_desc, .within = { &ikev2_sa_desc, }, },
+	{ .sd = &ikev2_trans_desc, .within = { &ikev2_sa_desc, &ikev2_prop_desc, }, },
+	{ .sd = &ikev2_trans_attr_desc, .within = { &ikev2_sa_desc, &ikev2_prop_desc, &ikev2_trans_desc, }, },
+	{ .sd = &ikev2_ke_desc, },
+	{ .sd = &ikev2_nonce_desc, },
+	{ .sd = &ikev2_notify_desc, },
+	{ .sd = &ikev2_sk_desc, },
+	{ .sd = &ikev2_skf_desc, },
+};
+
+/* big enough for any payload's struct */
+union payload_buf {
+	uint8_t bytes[256];
+	uint64_t align;
+	struct ikev2_generic generic;
+	struct ikev2_prop prop;
+};
+
+static bool parsed(diag_t d, const char *what)
+{
+	if (d != NULL) {
+		FAIL("%s: %s", what, str_diag(d));
+		pfree_diag(&d);
+		return false;
+	}
+	return true;
+}
+
+static void copy_rest(struct pbs_in *in, struct pbs_out *out)
+{
+	shunk_t rest = pbs_in_left(in);
+	if (out != NULL && !pbs_out_hunk(out, rest, "rest")) {
+		FAIL("emitting %zu bytes failed", rest.len);
+	}
+}
+
+/*
+ * Parse, and when OUT is non-NULL emit, the message.  Descends into
+ * SA proposals, transforms and attributes; copies everything else.
+ */
+
+static bool transcode_substructures(struct pbs_in *in, struct pbs_out *out,
+				    struct_desc *sd)
+{
+	while (pbs_left(in) > 0) {
+		union payload_buf p;
+		struct pbs_in pin;
+		if (!parsed(pbs_in_struct(in, sd, &p, sizeof(p), &pin), sd->name)) {
+			return false;
+		}
+		struct pbs_out pout;
+		if (out != NULL && !pbs_out_struct(out, sd, &p, sizeof(p), &pout)) {
+			FAIL("emitting %s failed", sd->name);
+			return false;
+		}
+		struct pbs_out *pouts = (out != NULL ? &pout : NULL);
+		if (sd == &ikev2_prop_desc) {
+			shunk_t spi;
+			if (!parsed(pbs_in_shunk(&pin, p.prop.isap_spisize, &spi, "SPI"), "SPI")) {
+				return false;
+			}
+			if (pouts != NULL && !pbs_out_hunk(pouts, spi, "SPI")) {
+				FAIL("emitting SPI failed");
+				return false;
+			}
+			if (!transcode_substructures(&pin, pouts, &ikev2_trans_desc)) {
+				return false;
+			}
+		} else if (sd == &ikev2_trans_desc) {
+			if (!transcode_substructures(&pin, pouts, &ikev2_trans_attr_desc)) {
+				return false;
+			}
+		} else {
+			copy_rest(&pin, pouts);
+		}
+		if (pouts != NULL) {
+			close_pbs_out(pouts);
+		}
+	}
+	return true;
+}
+
+static bool transcode(shunk_t message, struct pbs_out *out)
+{
+	struct pbs_in in = pbs_in_from_shunk(message, "message");
+	struct isakmp_hdr hdr;
+	struct pbs_in body;
+	if (!parsed(pbs_in_struct(&in, &isakmp_hdr_desc, &hdr, sizeof(hdr), &body),
+		    "header")) {
+		return false;
+	}
+
+	unsigned np = hdr.isa_np;
+	struct pbs_out bodys;
+	if (out != NULL) {
+		hdr.isa_np = ISAKMP_NEXT_NONE; /* filled in by the chain */
+		if (!pbs_out_struct(out, &isakmp_hdr_desc, &hdr, sizeof(hdr), &bodys)) {
+			FAIL("emitting header failed");
+			return false;
+		}
+	}
+	struct pbs_out *bodyp = (out != NULL ? &bodys : NULL);
+
+	while (np != ISAKMP_NEXT_v2NONE) {
+		struct_desc *sd = v2_payload_desc(np);
+		if (sd == NULL) {
+			FAIL("unknown payload %u", np);
+			return false;
+		}
+		union payload_buf p;
+		struct pbs_in pin;
+		if (!parsed(pbs_in_struct(&body, sd, &p, sizeof(p), &pin), sd->name)) {
+			return false;
+		}
+		unsigned next = p.generic.isag_np;
+		struct pbs_out pout;
+		if (bodyp != NULL) {
+			if (np != ISAKMP_NEXT_v2SKF) {
+				/* filled in by the chain */
+				p.generic.isag_np = ISAKMP_NEXT_v2NONE;
+			}
+			if (!pbs_out_struct(bodyp, sd, &p, sizeof(p), &pout)) {
+				FAIL("emitting %s failed", sd->name);
+				return false;
+			}
+		}
+		struct pbs_out *pouts = (bodyp != NULL ? &pout : NULL);
+		if (np == ISAKMP_NEXT_v2SA) {
+			if (!transcode_substructures(&pin, pouts, &ikev2_prop_desc)) {
+				return false;
+			}
+		} else {
+			copy_rest(&pin, pouts);
+		}
+		if (pouts != NULL) {
+			if (np == ISAKMP_NEXT_v2SK) {
+				/* the first encrypted payload; normally set by the encryption code */
+				pout.start[0] = next;
+			}
+			close_pbs_out(pouts);
+		}
+		if (np == ISAKMP_NEXT_v2SK || np == ISAKMP_NEXT_v2SKF) {
+			/* rest is encrypted */
+			break;
+		}
+		np = next;
+	}
+
+	if (bodyp != NULL) {
+		close_pbs_out(bodyp);
+	}
+	return true;
+}
+
+/*
+ * Transcode each captured message using both the specialised and
+ * the interpreted code, the result should be the original.
+ */
+
+static void check_transcode(void)
+{
+	for (const struct message *m = messages; m < messages + elemsof(messages); m++) {
+		chunk_t message = chunk_from_hex(m->hex, m->name);
+		FOR_EACH_THING(specialised, true, false) {
+			pbs_specialised_fields = specialised;
+			uint8_t buf[1024];
+			struct pbs_out out = open_pbs_out(m->name, buf, sizeof(buf), logger);
+			if (!transcode(HUNK_AS_SHUNK(message), &out)) {
+				FAIL("%s: %s transcode failed", m->name,
+				     specialised ? "specialised" : "interpreted");
+				continue;
+			}
+			shunk_t result = pbs_out_all(&out);
+			if (!hunk_eq(result, message)) {
+				FAIL("%s: %s transcode differs; %zu bytes, expecting %zu",
+				     m->name, specialised ? "specialised" : "interpreted",
+				     result.len, message.len);
+			}
+		}
+		free_chunk_content(&message);
+	}
+	pbs_specialised_fields = true;
+}
+
+/*
+ * Differential fuzz: feed the same bytes, and then the same struct,
+ * to both the specialised and interpreted code and check that the
+ * results are identical.
+ */
+
+/* deterministic pseudo-random input (xorshift64) */
+
+static uint64_t next_rnd(uint64_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 7;
+	*seed ^= *seed << 17;
+	return *seed;
+}
+
+struct parse {
+	union payload_buf dest;
+	char diag[256];
+	bool ok;
+	ptrdiff_t cur;
+	ptrdiff_t obj_start, obj_cur, obj_roof;
+};
+
+static void parse(struct_desc *sd, const uint8_t *bytes, size_t len,
+		  bool specialised, struct parse *p)
+{
+	pbs_specialised_fields = specialised;
+	memset(p, 0xa5, sizeof(*p));
+	struct pbs_in in = pbs_in_from_shunk(shunk2(bytes, len), "fuzz");
+	struct pbs_in obj;
+	zero(&obj);
+	diag_t d = pbs_in_struct(&in, sd, &p->dest, sizeof(p->dest), &obj);
+	p->ok = (d == NULL);
+	snprintf(p->diag, sizeof(p->diag), "%s", (d == NULL ? "" : str_diag(d)));
+	pfree_diag(&d);
+	p->cur = in.cur - bytes;
+	p->obj_start = (obj.start == NULL ? -1 : obj.start - bytes);
+	p->obj_cur = (obj.cur == NULL ? -1 : obj.cur - bytes);
+	p->obj_roof = (obj.roof == NULL ? -1 : obj.roof - bytes);
+}
+
+static ptrdiff_t emit(const struct hot *h, const union payload_buf *p,
+		      bool specialised, uint8_t *buf, size_t size)
+{
+	pbs_specialised_fields = specialised;
+	struct pbs_out pbs[elemsof(h->within) + 3];
+	unsigned n = 0;
+	pbs[0] = open_pbs_out("fuzz", buf, size, logger);
+	if (h->sd != &isakmp_hdr_desc) {
+		struct isakmp_hdr hdr = {
+			.isa_xchg = ISAKMP_v2_IKE_SA_INIT,
+		};
+		if (!pbs_out_struct(&pbs[n], &isakmp_hdr_desc, &hdr, sizeof(hdr), &pbs[n + 1])) {
+			return -1;
+		}
+		n++;
+		for (unsigned w = 0; w < elemsof(h->within) && h->within[w] != NULL; w++) {
+			union payload_buf c;
+			zero(&c);
+			if (h->within[w] == &ikev2_prop_desc) {
+				c.prop.isap_protoid = IKEv2_SEC_PROTO_IKE;
+			}
+			if (!pbs_out_struct(&pbs[n], h->within[w], &c, sizeof(c), &pbs[n + 1])) {
+				return -1;
+			}
+			n++;
+		}
+	}
+	if (!pbs_out_struct(&pbs[n], h->sd, p, sizeof(*p), &pbs[n + 1])) {
+		return -1;
+	}
+	for (n++; n > 0; n--) {
+		close_pbs_out(&pbs[n]);
+	}
+	return pbs[0].cur - buf;
+}
+
+/*
+ * Make the parsed struct emittable: the chain fields are computed
+ * while emitting, and must be zero.
+ */
+
+static void sanitize(struct_desc *sd, union payload_buf *p)
+{
+	size_t offset = 0;
+	for (field_desc *fp = sd->fields; fp->field_type != ft_end; fp++) {
+		switch (fp->field_type) {
+		case ft_mnpc:
+		case ft_pnpc:
+		case ft_lss:
+			memset(p->bytes + offset, 0, fp->size);
+			break;
+		default:
+			break;
+		}
+		offset += fp->size;
+	}
+}
+
+struct fuzz_stats {
+	unsigned ok;
+	unsigned failed;
+};
+
+static void fuzz(const struct hot *h, const uint8_t *bytes, size_t len,
+		 struct fuzz_stats *stats)
+{
+	struct parse specialised, interpreted;
+	parse(h->sd, bytes, len, true, &specialised);
+	parse(h->sd, bytes, len, false, &interpreted);
+	if (memcmp(&specialised, &interpreted, sizeof(specialised)) != 0) {
+		FAIL("%s: %zu bytes parsed differently: '%s' vs '%s'",
+		     h->sd->name, len, specialised.diag, interpreted.diag);
+		return;
+	}
+	if (!specialised.ok) {
+		stats->failed++;
+		return;
+	}
+	stats->ok++;
+
+	union payload_buf p = specialised.dest;
+	sanitize(h->sd, &p);
+	uint8_t sbuf[128], ibuf[128];
+	memset(sbuf, 0xa5, sizeof(sbuf));
+	memset(ibuf, 0xa5, sizeof(ibuf));
+	ptrdiff_t slen = emit(h, &p, true, sbuf, sizeof(sbuf));
+	ptrdiff_t ilen = emit(h, &p, false, ibuf, sizeof(ibuf));
+	if (slen < 0 || slen != ilen || memcmp(sbuf, ibuf, sizeof(sbuf)) != 0) {
+		FAIL("%s: emitted differently: %td vs %td bytes",
+		     h->sd->name, slen, ilen);
+	}
+}
+
+#define NR_MUTATIONS 20000
+#define MAX_FUZZ_LEN 48
+
+static void check_fuzz(void)
+{
+	chunk_t corpus[elemsof(messages)];
+	for (unsigned m = 0; m < elemsof(messages); m++) {
+		corpus[m] = chunk_from_hex(messages[m].hex, messages[m].name);
+	}
+
+	uint64_t seed = 0x123456789abcdef;
+	for (const struct hot *h = hots; h < hots + elemsof(hots); h++) {
+		if (h->sd->pbs_in_fields == NULL || h->sd->pbs_out_fields == NULL) {
+			FAIL("%s: not specialised", h->sd->name);
+			continue;
+		}
+		struct fuzz_stats stats = {0};
+		/* every offset into every message, as is */
+		for (unsigned m = 0; m < elemsof(corpus); m++) {
+			for (size_t o = 0; o < corpus[m].len; o++) {
+				fuzz(h, corpus[m].ptr + o,
+				     min(corpus[m].len - o, (size_t)MAX_FUZZ_LEN), &stats);
+			}
+		}
+		/* and then mutated */
+		for (unsigned i = 0; i < NR_MUTATIONS; i++) {
+			uint8_t bytes[MAX_FUZZ_LEN];
+			uint64_t rnd = next_rnd(&seed);
+			size_t len = rnd % (sizeof(bytes) + 1);
+			const chunk_t *c = &corpus[(rnd >> 8) % elemsof(corpus)];
+			size_t o = (rnd >> 16) % c->len;
+			size_t n = min(len, c->len - o);
+			memcpy(bytes, c->ptr + o, n);
+			for (size_t b = n; b < len; b++) {
+				bytes[b] = next_rnd(&seed);
+			}
+			for (unsigned flips = (rnd >> 32) % 4; flips > 0 && len > 0; flips--) {
+				uint64_t r = next_rnd(&seed);
+				bytes[r % len] = r >> 32;
+			}
+			fuzz(h, bytes, len, &stats);
+		}
+		if (stats.ok == 0 || stats.failed == 0) {
+			FAIL("%s: %u parsed, %u rejected; expecting both",
+			     h->sd->name, stats.ok, stats.failed);
+		}
+	}
+	pbs_specialised_fields = true;
+
+	for (unsigned m = 0; m < elemsof(corpus); m++) {
+		free_chunk_content(&corpus[m]);
+	}
+}
+
+/*
+ * Time parsing, and then parsing and emitting, each captured
+ * message.
+ */
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define NR_LOOPS 20000
+
+static void benchmark(void)
+{
+	for (const struct message *m = messages; m < messages + elemsof(messages); m++) {
+		chunk_t message = chunk_from_hex(m->hex, m->name);
+		FOR_EACH_THING(specialised, true, false) {
+			pbs_specialised_fields = specialised;
+			double start = now_ns();
+			for (unsigned i = 0; i < NR_LOOPS; i++) {
+				transcode(HUNK_AS_SHUNK(message), NULL);
+			}
+			double parse_ns = (now_ns() - start) / NR_LOOPS;
+			start = now_ns();
+			for (unsigned i = 0; i < NR_LOOPS; i++) {
+				uint8_t buf[1024];
+				struct pbs_out out = open_pbs_out(m->name, buf, sizeof(buf), logger);
+				transcode(HUNK_AS_SHUNK(message), &out);
+			}
+			double transcode_ns = (now_ns() - start) / NR_LOOPS;
+			printf("%-20s %4zu bytes %-11s %8.1f ns/parse %8.1f ns/parse+emit\n",
+			       m->name, message.len,
+			       specialised ? "specialised" : "interpreted",
+			       parse_ns, transcode_ns);
+		}
+		free_chunk_content(&message);
+	}
+	pbs_specialised_fields = true;
+}
+
+int main(int argc, char *argv[])
+{
+	leak_detective = true;
+	logger = tool_logger(argc, argv);
+
+	check_transcode();
+	check_fuzz();
+	benchmark();
+
+	if (report_leaks(logger)) {
+		fails++;
+	}
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	} else {
+		return 0;
+	}
+}